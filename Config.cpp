@@ -3,12 +3,24 @@
 //#include "util.h"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+// 原始内容的hash(FNV-1a), 不会返回0
+static uint64_t SourceHash(const char* data, size_t len) {
+    uint64_t h = 14695981039346656037ull;
+    for(size_t i = 0; i < len; ++i) {
+        h ^= (uint8_t)data[i];
+        h *= 1099511628211ull;
+    }
+    return h ? h : 1;
+}
+
 ConfigVarBase::ptr Config::LookupBase(const std::string& name) {
     RWMutexType::ReadLock lock(GetMutex());
     auto it = GetDatas().find(name);
@@ -52,12 +64,21 @@ void Config::LoadFromYaml(const YAML::Node& root) {
         ConfigVarBase::ptr var = LookupBase(key);
 
         if(var) {
+            std::string val;
             if(i.second.IsScalar()) {
-                var->fromString(i.second.Scalar());
+                val = i.second.Scalar();
             } else {
                 std::stringstream ss;
                 ss << i.second;
-                var->fromString(ss.str());
+                val = ss.str();
+            }
+            // 和上次加载的内容一样就不再解析
+            uint64_t hash = SourceHash(val.data(), val.size());
+            if(hash == var->getSourceHash()) {
+                continue;
+            }
+            if(var->fromString(val)) {
+                var->setSourceHash(hash);
             }
         }
     }
@@ -93,6 +114,182 @@ void Config::LoadFromConfDir(const std::string& path, bool force) {
     }
 }
 
+// 快照格式(主机字节序):
+//   SnapshotHeader
+//   count个记录: SnapshotRecord name type value
+// 字节序不同的机器上magic对不上, 直接拒绝加载
+static const uint32_t SNAPSHOT_MAGIC = 0x46435953; // "SYCF"
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct SnapshotRecord {
+    uint16_t name_len;
+    uint16_t type_len;
+    uint32_t value_len;
+    // ConfigVarBase::toBinary的返回值
+    uint8_t binary;
+};
+
+bool Config::SaveSnapshot(const std::string& path) {
+    std::string data;
+    data.resize(sizeof(SnapshotHeader));
+    uint32_t count = 0;
+    std::string value;
+    Visit([&data, &count, &value](ConfigVarBase::ptr var) {
+        const std::string& name = var->getName();
+        std::string type = var->getTypeName();
+        value.clear();
+        bool binary = var->toBinary(value);
+        if(name.size() > UINT16_MAX || type.size() > UINT16_MAX
+                || value.size() > UINT32_MAX) {
+            SYLAR_LOG_ERROR(g_logger) << "SaveSnapshot skip too large name=" << name;
+            return;
+        }
+        SnapshotRecord rec;
+        rec.name_len = name.size();
+        rec.type_len = type.size();
+        rec.value_len = value.size();
+        rec.binary = binary;
+        data.append((const char*)&rec.name_len, sizeof(rec.name_len));
+        data.append((const char*)&rec.type_len, sizeof(rec.type_len));
+        data.append((const char*)&rec.value_len, sizeof(rec.value_len));
+        data.append((const char*)&rec.binary, sizeof(rec.binary));
+        data.append(name);
+        data.append(type);
+        data.append(value);
+        ++count;
+    });
+    SnapshotHeader header;
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.count = count;
+    header.reserved = 0;
+    memcpy(&data[0], &header, sizeof(header));
+
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        SYLAR_LOG_ERROR(g_logger) << "SaveSnapshot open " << tmp
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    size_t offset = 0;
+    while(offset < data.size()) {
+        ssize_t n = write(fd, data.data() + offset, data.size() - offset);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            SYLAR_LOG_ERROR(g_logger) << "SaveSnapshot write " << tmp
+                << " errno=" << errno << " errstr=" << strerror(errno);
+            close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        offset += n;
+    }
+    fsync(fd);
+    close(fd);
+    if(rename(tmp.c_str(), path.c_str())) {
+        SYLAR_LOG_ERROR(g_logger) << "SaveSnapshot rename " << tmp << " to " << path
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        unlink(tmp.c_str());
+        return false;
+    }
+    SYLAR_LOG_INFO(g_logger) << "SaveSnapshot file=" << path
+        << " count=" << count << " size=" << data.size();
+    return true;
+}
+
+bool Config::LoadSnapshot(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        SYLAR_LOG_ERROR(g_logger) << "LoadSnapshot file=" << path << " too small";
+        return false;
+    }
+    size_t size = st.st_size;
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) {
+        SYLAR_LOG_ERROR(g_logger) << "LoadSnapshot mmap " << path
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    madvise(addr, size, MADV_SEQUENTIAL);
+
+    const char* base = (const char*)addr;
+    SnapshotHeader header;
+    memcpy(&header, base, sizeof(header));
+    if(header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION) {
+        munmap(addr, size);
+        SYLAR_LOG_ERROR(g_logger) << "LoadSnapshot file=" << path << " bad header";
+        return false;
+    }
+
+    const size_t rec_size = sizeof(uint16_t) * 2 + sizeof(uint32_t) + sizeof(uint8_t);
+    size_t pos = sizeof(header);
+    uint32_t changed = 0;
+    bool ok = true;
+    for(uint32_t i = 0; i < header.count; ++i) {
+        if(size - pos < rec_size) {
+            ok = false;
+            break;
+        }
+        SnapshotRecord rec;
+        memcpy(&rec.name_len, base + pos, sizeof(rec.name_len));
+        memcpy(&rec.type_len, base + pos + 2, sizeof(rec.type_len));
+        memcpy(&rec.value_len, base + pos + 4, sizeof(rec.value_len));
+        memcpy(&rec.binary, base + pos + 8, sizeof(rec.binary));
+        pos += rec_size;
+        if(size - pos < (size_t)rec.name_len + rec.type_len + rec.value_len) {
+            ok = false;
+            break;
+        }
+        const char* name = base + pos;
+        const char* type = name + rec.name_len;
+        const char* value = type + rec.type_len;
+        pos += (size_t)rec.name_len + rec.type_len + rec.value_len;
+
+        ConfigVarBase::ptr var = LookupBase(std::string(name, rec.name_len));
+        if(!var) {
+            continue;
+        }
+        if(var->getTypeName().compare(0, std::string::npos, type, rec.type_len)) {
+            SYLAR_LOG_ERROR(g_logger) << "LoadSnapshot name=" << var->getName()
+                << " type=" << std::string(type, rec.type_len)
+                << " real_type=" << var->getTypeName();
+            continue;
+        }
+        uint64_t hash = SourceHash(value, rec.value_len);
+        if(hash == var->getSourceHash()) {
+            continue;
+        }
+        if(var->fromBinary(value, rec.value_len, rec.binary)) {
+            var->setSourceHash(hash);
+            ++changed;
+        }
+    }
+    munmap(addr, size);
+    if(!ok) {
+        SYLAR_LOG_ERROR(g_logger) << "LoadSnapshot file=" << path << " truncated";
+        return false;
+    }
+    SYLAR_LOG_INFO(g_logger) << "LoadSnapshot file=" << path
+        << " count=" << header.count << " changed=" << changed;
+    return true;
+}
+
 void Config::Visit(std::function<void(ConfigVarBase::ptr)> cb) {
     RWMutexType::ReadLock lock(GetMutex());
     ConfigVarMap& m = GetDatas();
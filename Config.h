@@ -13,12 +13,17 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <functional>
+#include <atomic>
+#include <type_traits>
+#include <string.h>
+#include <stdint.h>
 
 #include "thread.h"
 #include "log.h"
 #include "mutex.h"
 #include "fiber.h"
 #include "util.h"
+#include "macro.h"
 
 namespace sylar {
 
@@ -48,9 +53,31 @@ public:
 
     virtual bool fromString(const std::string& val) = 0;
     virtual std::string getTypeName() const = 0;
+
+    /**
+     * @brief 把当前值追加到out, 用于Config::SaveSnapshot
+     * @return 算术类型和std::string按原始字节存放, STL容器按BinaryCast编码, 这些返回true;
+     *         其它类型(自定义类型, 元素是自定义类型的容器)存放YAML String返回false
+     */
+    virtual bool toBinary(std::string& out) = 0;
+
+    /**
+     * @brief 从toBinary的结果恢复参数的值
+     * @param[in] binary toBinary的返回值, false 时data为YAML String
+     */
+    virtual bool fromBinary(const char* data, size_t len, bool binary) = 0;
+
+    /**
+     * @brief 最近一次从配置文件/快照加载的原始内容的hash, 0 表示没有或者之后被修改过
+     * @details 重新加载时内容hash没变就不再解析, 也不会触发回调
+     */
+    uint64_t getSourceHash() const { return m_sourceHash.load(std::memory_order_relaxed);}
+    void setSourceHash(uint64_t v) { m_sourceHash.store(v, std::memory_order_relaxed);}
 protected:
     std::string m_name;
     std::string m_description;
+    /// 最近一次加载的原始内容的hash
+    std::atomic<uint64_t> m_sourceHash{0};
 };
 
 /**
@@ -288,6 +315,202 @@ public:
 };
 
 
+/**
+ * @brief 快照用的二进制编码, Config::SaveSnapshot/LoadSnapshot使用
+ * @details 算术类型按原始字节存放; std::string先存uint32_t长度再存内容;
+ *          vector/list/set/unordered_set先存uint32_t元素个数再逐个存元素,
+ *          map/unordered_map<std::string, T>逐个存key和value, 元素递归使用BinaryCast
+ *          Supported为false的类型(包括元素是这类类型的容器)在快照里存YAML String
+ *          字节序和类型长度不做转换, 快照只在同一种机器上使用
+ */
+template<class T, class Enable = void>
+class BinaryCast {
+public:
+    static constexpr bool Supported = false;
+};
+
+/**
+ * @brief 长度和元素个数的编码
+ */
+class BinaryCastLen {
+public:
+    static bool EncodeLen(size_t n, std::string& out) {
+        if(n > UINT32_MAX) {
+            return false;
+        }
+        uint32_t len = n;
+        out.append((const char*)&len, sizeof(len));
+        return true;
+    }
+
+    static bool DecodeLen(const char*& p, const char* end, uint32_t& n) {
+        if((size_t)(end - p) < sizeof(n)) {
+            return false;
+        }
+        memcpy(&n, p, sizeof(n));
+        p += sizeof(n);
+        return true;
+    }
+};
+
+/**
+ * @brief 算术类型按原始字节编码
+ */
+template<class T>
+class BinaryCast<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+public:
+    static constexpr bool Supported = true;
+
+    static bool Encode(const T& v, std::string& out) {
+        out.append((const char*)&v, sizeof(T));
+        return true;
+    }
+
+    static bool Decode(const char*& p, const char* end, T& v) {
+        if((size_t)(end - p) < sizeof(T)) {
+            return false;
+        }
+        if constexpr (std::is_same<T, bool>::value) {
+            // 不是0/1的字节直接拷进bool是未定义行为
+            v = *p != 0;
+        } else {
+            memcpy(&v, p, sizeof(T));
+        }
+        p += sizeof(T);
+        return true;
+    }
+};
+
+/**
+ * @brief std::string 编码为 长度 + 内容
+ */
+template<>
+class BinaryCast<std::string> : public BinaryCastLen {
+public:
+    static constexpr bool Supported = true;
+
+    static bool Encode(const std::string& v, std::string& out) {
+        if(!EncodeLen(v.size(), out)) {
+            return false;
+        }
+        out.append(v);
+        return true;
+    }
+
+    static bool Decode(const char*& p, const char* end, std::string& v) {
+        uint32_t n = 0;
+        if(!DecodeLen(p, end, n) || (size_t)(end - p) < n) {
+            return false;
+        }
+        v.assign(p, n);
+        p += n;
+        return true;
+    }
+};
+
+/**
+ * @brief vector/list/set/unordered_set 编码为 元素个数 + 各个元素
+ */
+template<class C, class T>
+class BinaryCastSeq : public BinaryCastLen {
+public:
+    static constexpr bool Supported = BinaryCast<T>::Supported;
+
+    static bool Encode(const C& v, std::string& out) {
+        if(!EncodeLen(v.size(), out)) {
+            return false;
+        }
+        for(auto& i : v) {
+            if(!BinaryCast<T>::Encode(i, out)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool Decode(const char*& p, const char* end, C& v) {
+        uint32_t n = 0;
+        if(!DecodeLen(p, end, n)) {
+            return false;
+        }
+        v.clear();
+        // n来自文件, 不按它预分配, 数据不够时元素解码会失败
+        for(uint32_t i = 0; i < n; ++i) {
+            T e;
+            if(!BinaryCast<T>::Decode(p, end, e)) {
+                return false;
+            }
+            v.insert(v.end(), std::move(e));
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief map/unordered_map<std::string, T> 编码为 元素个数 + 各个key和value
+ */
+template<class C, class T>
+class BinaryCastMap : public BinaryCastLen {
+public:
+    static constexpr bool Supported = BinaryCast<T>::Supported;
+
+    static bool Encode(const C& v, std::string& out) {
+        if(!EncodeLen(v.size(), out)) {
+            return false;
+        }
+        for(auto& i : v) {
+            if(!BinaryCast<std::string>::Encode(i.first, out)
+                    || !BinaryCast<T>::Encode(i.second, out)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool Decode(const char*& p, const char* end, C& v) {
+        uint32_t n = 0;
+        if(!DecodeLen(p, end, n)) {
+            return false;
+        }
+        v.clear();
+        for(uint32_t i = 0; i < n; ++i) {
+            std::string key;
+            T e;
+            if(!BinaryCast<std::string>::Decode(p, end, key)
+                    || !BinaryCast<T>::Decode(p, end, e)) {
+                return false;
+            }
+            v[key] = std::move(e);
+        }
+        return true;
+    }
+};
+
+template<class T>
+class BinaryCast<std::vector<T> > : public BinaryCastSeq<std::vector<T>, T> {
+};
+
+template<class T>
+class BinaryCast<std::list<T> > : public BinaryCastSeq<std::list<T>, T> {
+};
+
+template<class T>
+class BinaryCast<std::set<T> > : public BinaryCastSeq<std::set<T>, T> {
+};
+
+template<class T>
+class BinaryCast<std::unordered_set<T> > : public BinaryCastSeq<std::unordered_set<T>, T> {
+};
+
+template<class T>
+class BinaryCast<std::map<std::string, T> > : public BinaryCastMap<std::map<std::string, T>, T> {
+};
+
+template<class T>
+class BinaryCast<std::unordered_map<std::string, T> >
+    : public BinaryCastMap<std::unordered_map<std::string, T>, T> {
+};
+
 /**
  * @brief 配置参数模板子类,保存对应类型的参数值
  * @details T 参数的具体类型
@@ -313,7 +536,8 @@ public:
             ,const T& default_value
             ,const std::string& description = "")
         :ConfigVarBase(name, description)
-        ,m_val(default_value) {
+        ,m_val(new T(default_value)) {
+        storeFast(default_value);
     }
 
     /**
@@ -323,8 +547,7 @@ public:
     std::string toString() override {
         try {
             //return boost::lexical_cast<std::string>(m_val);
-            RWMutexType::ReadLock lock(m_mutex);
-            return ToStr()(m_val);
+            return ToStr()(*getSnapshot());
         } catch (std::exception& e) {
             SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::toString exception "
                 << e.what() << " convert: " << TypeToName<T>() << " to string"
@@ -340,6 +563,7 @@ public:
     bool fromString(const std::string& val) override {
         try {
             setValue(FromStr()(val));
+            return true;
         } catch (std::exception& e) {
             SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::fromString exception "
                 << e.what() << " convert: string to " << TypeToName<T>()
@@ -351,28 +575,117 @@ public:
 
     /**
      * @brief 获取当前参数的值
+     * @details 不超过8字节的平凡类型直接读原子变量, 真正无锁; 其它类型拷贝当前快照, 见getSnapshot
      */
     const T getValue() {
-        RWMutexType::ReadLock lock(m_mutex);
-        return m_val;
+        if constexpr (IsFast) {
+            T v;
+            uint64_t bits = m_fast.load(std::memory_order_acquire);
+            memcpy(&v, &bits, sizeof(T));
+            return v;
+        } else {
+            return *getSnapshot();
+        }
+    }
+
+    /**
+     * @brief 获取当前值的只读快照
+     * @details 快照发布后不再修改, 持有期间即使有新值发布也保持不变, 适合避免拷贝大对象
+     *          注意std::atomic_load对shared_ptr不是无锁的: libstdc++按地址哈希到一组自旋锁,
+     *          只在复制指针和增加引用计数期间持有, 不和setValue的互斥量或回调竞争
+     */
+    std::shared_ptr<const T> getSnapshot() const {
+        return std::atomic_load_explicit(&m_val, std::memory_order_acquire);
     }
 
     /**
      * @brief 设置当前参数的值
-     * @details 如果参数的值有发生变化,则通知对应的注册回调函数
+     * @details 如果参数的值有发生变化, 先发布新的快照, 再通知对应的注册回调函数
+     *          写入方互斥, 每次变更(old,new)在锁内按发布顺序排进m_pending,
+     *          没有回调在执行时由本次写入方在锁外按顺序逐个通知, 否则交给正在通知的写入方,
+     *          所以各次变更的回调严格按发布顺序执行, 相邻两次的new/old首尾相接
+     *          回调里可以读写本配置或增删回调, 回调里的setValue只排队, 当前回调返回后才通知
+     *          并发写入时setValue返回不代表回调已经执行; 回调里getValue()可能已经比new_value更新
      */
     void setValue(const T& v) {
+        std::shared_ptr<const T> val(new T(v));
         {
-            RWMutexType::ReadLock lock(m_mutex);
-            if(v == m_val) {
+            MutexType::Lock wlock(m_writeMutex);
+            std::shared_ptr<const T> old = getSnapshot();
+            if(v == *old) {
                 return;
             }
-            for(auto& i : m_cbs) {
-                i.second(m_val, v);
+            storeFast(v);
+            std::atomic_store_explicit(&m_val, val, std::memory_order_release);
+            m_sourceHash.store(0, std::memory_order_relaxed);
+            m_pending.emplace_back(old, val);
+            if(m_notifying) {
+                return;
             }
+            m_notifying = true;
         }
-        RWMutexType::WriteLock lock(m_mutex);
-        m_val = v;
+        notifyPending();
+    }
+
+    bool toBinary(std::string& out) override {
+        std::shared_ptr<const T> v = getSnapshot();
+        if constexpr (std::is_arithmetic<T>::value) {
+            out.append((const char*)v.get(), sizeof(T));
+            return true;
+        } else if constexpr (std::is_same<T, std::string>::value) {
+            out.append(*v);
+            return true;
+        } else {
+            if constexpr (BinaryCast<T>::Supported) {
+                size_t pos = out.size();
+                if(BinaryCast<T>::Encode(*v, out)) {
+                    return true;
+                }
+                // 长度超过uint32_t, 退回YAML String
+                out.resize(pos);
+            }
+            try {
+                out.append(ToStr()(*v));
+            } catch (std::exception& e) {
+                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::toBinary exception "
+                    << e.what() << " convert: " << TypeToName<T>() << " to string"
+                    << " name=" << m_name;
+            }
+            return false;
+        }
+    }
+
+    bool fromBinary(const char* data, size_t len, bool binary) override {
+        if constexpr (std::is_arithmetic<T>::value) {
+            if(binary) {
+                if(len != sizeof(T)) {
+                    return false;
+                }
+                T v;
+                memcpy(&v, data, sizeof(T));
+                setValue(v);
+                return true;
+            }
+        } else if constexpr (std::is_same<T, std::string>::value) {
+            if(binary) {
+                setValue(std::string(data, len));
+                return true;
+            }
+        } else if constexpr (BinaryCast<T>::Supported) {
+            if(binary) {
+                T v;
+                const char* end = data + len;
+                if(!BinaryCast<T>::Decode(data, end, v) || data != end) {
+                    return false;
+                }
+                setValue(v);
+                return true;
+            }
+        }
+        if(binary) {
+            return false;
+        }
+        return fromString(std::string(data, len));
     }
 
     /**
@@ -420,8 +733,65 @@ public:
         m_cbs.clear();
     }
 private:
+    /// 不超过8字节的平凡类型额外存一份在原子变量里, 读的时候连快照的引用计数都不用动
+    static constexpr bool IsFast = std::is_trivially_copyable<T>::value
+                                    && sizeof(T) <= sizeof(uint64_t);
+
+    /**
+     * @brief 按顺序通知m_pending里的变更, 直到队列为空
+     * @details 同一时刻只有一个写入方在这里, 由m_notifying保证
+     */
+    void notifyPending() {
+        while(true) {
+            std::pair<std::shared_ptr<const T>, std::shared_ptr<const T> > change;
+            {
+                MutexType::Lock wlock(m_writeMutex);
+                if(m_pending.empty()) {
+                    m_notifying = false;
+                    return;
+                }
+                change = std::move(m_pending.front());
+                m_pending.pop_front();
+            }
+
+            std::map<uint64_t, on_change_cb> cbs;
+            {
+                RWMutexType::ReadLock lock(m_mutex);
+                cbs = m_cbs;
+            }
+            for(auto& i : cbs) {
+                // 回调抛出异常不能让m_notifying一直为true, 否则之后的变更再也不会通知
+                try {
+                    i.second(*change.first, *change.second);
+                } catch (std::exception& e) {
+                    SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::setValue listener exception "
+                        << e.what() << " name=" << m_name;
+                }
+            }
+        }
+    }
+
+    void storeFast(const T& v) {
+        if constexpr (IsFast) {
+            uint64_t bits = 0;
+            memcpy(&bits, &v, sizeof(T));
+            m_fast.store(bits, std::memory_order_release);
+        }
+    }
+private:
+    typedef Mutex MutexType;
+    /// 保护m_cbs
     RWMutexType m_mutex;
-    T m_val;
+    /// 串行化setValue, 同时保护m_pending和m_notifying
+    MutexType m_writeMutex;
+    /// 已发布但还没通知回调的变更(old,new), 按发布顺序
+    std::list<std::pair<std::shared_ptr<const T>, std::shared_ptr<const T> > > m_pending;
+    /// 是否有写入方正在通知m_pending里的变更
+    bool m_notifying = false;
+    /// 当前值的快照, 只整体替换不原地修改
+    std::shared_ptr<const T> m_val;
+    /// IsFast时当前值的按位拷贝
+    std::atomic<uint64_t> m_fast{0};
     //变更回调函数组, uint64_t key,要求唯一，一般可以用hash
     std::map<uint64_t, on_change_cb> m_cbs;
 };
@@ -448,6 +818,17 @@ public:
     template<class T>
     static typename ConfigVar<T>::ptr Lookup(const std::string& name,
             const T& default_value, const std::string& description = "") {
+        {
+            // 已存在的参数只需要读锁
+            RWMutexType::ReadLock lock(GetMutex());
+            auto it = GetDatas().find(name);
+            if(it != GetDatas().end()) {
+                auto tmp = std::dynamic_pointer_cast<ConfigVar<T> >(it->second);
+                if(tmp) {
+                    return tmp;
+                }
+            }
+        }
         RWMutexType::WriteLock lock(GetMutex());
         auto it = GetDatas().find(name);
         if(it != GetDatas().end()) {
@@ -499,6 +880,21 @@ public:
      */
     static void LoadFromConfDir(const std::string& path, bool force = false);
 
+    /**
+     * @brief 把所有配置参数的当前值保存成二进制快照
+     * @details 算术类型和std::string存原始字节, 其它类型存YAML String
+     *          先写临时文件再rename, 不会留下写了一半的快照
+     */
+    static bool SaveSnapshot(const std::string& path);
+
+    /**
+     * @brief mmap加载SaveSnapshot保存的快照
+     * @details 只处理已注册的参数, 类型名不一致的跳过; 内容和上次加载相同的参数
+     *          不解析也不触发回调
+     * @return 文件不存在或格式错误返回false
+     */
+    static bool LoadSnapshot(const std::string& path);
+
     /**
      * @brief 查找配置参数,返回配置参数的基类
      * @param[in] name 配置参数名称
@@ -529,6 +925,55 @@ private:
     }
 };
 
+/**
+ * @brief 按名字缓存的配置参数句柄
+ * @details 第一次读取时查找一次, 之后直接访问ConfigVar, 不再查表也不加锁
+ *          参数可以定义在别的编译单元, 不依赖静态初始化顺序; 参数注册之前读取返回默认值
+ *          ConfigVar注册后不会被删除, 缓存裸指针是安全的
+ */
+template<class T>
+class ConfigHandle {
+public:
+    /**
+     * @param[in] name 配置参数名称
+     * @param[in] default_value 参数还没有注册时返回的值
+     */
+    ConfigHandle(const std::string& name, const T& default_value = T())
+        :m_name(name)
+        ,m_default(default_value) {
+    }
+
+    /**
+     * @brief 返回配置参数, 还没有注册或者类型不匹配时返回nullptr
+     */
+    ConfigVar<T>* getVar() {
+        ConfigVar<T>* var = m_var.load(std::memory_order_acquire);
+        if(SYLAR_LIKELY(var)) {
+            return var;
+        }
+        auto v = Config::Lookup<T>(m_name);
+        if(v) {
+            m_var.store(v.get(), std::memory_order_release);
+        }
+        return v.get();
+    }
+
+    /**
+     * @brief 获取当前参数的值
+     */
+    const T getValue() {
+        ConfigVar<T>* var = getVar();
+        return var ? var->getValue() : m_default;
+    }
+private:
+    /// 配置参数名称
+    std::string m_name;
+    /// 还没有注册时的默认值
+    T m_default;
+    /// 缓存的配置参数
+    std::atomic<ConfigVar<T>*> m_var{nullptr};
+};
+
 }
 
 #endif
@@ -6,15 +6,55 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "Config.h"
+#include <algorithm>
 
 namespace sylar {
     // 系统日志器，用于调度器相关的日志输出
     static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+    // 是否启用工作窃取调度(每个线程一个本地队列 + 全局注入队列)
+    static ConfigVar<bool>::ptr g_scheduler_work_stealing =
+        Config::Lookup<bool>("scheduler.work_stealing", false, "scheduler work stealing mode");
+
+    // 工作窃取模式下线程本地队列的容量, 超出部分进入全局注入队列
+    static ConfigVar<uint32_t>::ptr g_scheduler_local_queue_size =
+        Config::Lookup<uint32_t>("scheduler.local_queue_size", 256, "scheduler local run queue size");
+
+    // 工作线程的绑定方式, none: 不绑定, core: 每个线程一个核, node: 每个线程一个NUMA节点
+    static ConfigVar<std::string>::ptr g_scheduler_affinity =
+        Config::Lookup<std::string>("scheduler.affinity", "none", "scheduler thread affinity(none|core|node)");
+
+    // 绑定可用的核, 为空时使用进程允许的全部核
+    static ConfigVar<std::vector<int> >::ptr g_scheduler_cpus =
+        Config::Lookup<std::vector<int> >("scheduler.cpus", std::vector<int>(), "scheduler cpus to bind");
+
+    // 调度器和IOManager内部AdaptiveMutex休眠之前的自旋次数
+    static ConfigVar<uint32_t>::ptr g_scheduler_mutex_spin =
+        Config::Lookup<uint32_t>("scheduler.mutex_spin", 100, "scheduler AdaptiveMutex spin count before futex wait");
+
+    // 是否记录AdaptiveMutex的获取/等待统计(MutexStats)
+    // mutex.cpp不依赖配置模块, 开关放在这里, 由调度器传给MutexStats
+    static ConfigVar<bool>::ptr g_mutex_profile =
+        Config::Lookup<bool>("mutex.profile", false, "record AdaptiveMutex acquire/wait histogram");
+
+    struct MutexProfileIniter {
+        MutexProfileIniter() {
+            MutexStats::SetEnabled(g_mutex_profile->getValue());
+            g_mutex_profile->addListener([](const bool& old_value, const bool& new_value) {
+                MutexStats::SetEnabled(new_value);
+            });
+        }
+    };
+
+    static MutexProfileIniter s_mutex_profile_initer;
+
     // 线程局部变量：当前线程的调度器指针
     static thread_local Scheduler* t_scheduler = nullptr;
     // 线程局部变量：当前线程的调度协程指针
     static thread_local Fiber* t_scheduler_fiber = nullptr;
+    // 线程局部变量：当前线程的本地运行队列(仅在run()期间有效)
+    thread_local Scheduler::LocalQueue* Scheduler::t_local_queue = nullptr;
 
     // 协程调度器构造函数
     // threads: 线程数量，必须大于0
@@ -26,6 +66,19 @@ namespace sylar {
     Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
         : m_name(name) {
         SYLAR_ASSERT(threads > 0);
+        m_workStealing = g_scheduler_work_stealing->getValue();
+        m_localQueueCapacity = g_scheduler_local_queue_size->getValue();
+        m_mutexSpin = g_scheduler_mutex_spin->getValue();
+        m_mutex.setSpin(m_mutexSpin);
+        const std::string& affinity = g_scheduler_affinity->getValue();
+        if(affinity == "core") {
+            m_affinity = AFFINITY_CORE;
+        } else if(affinity == "node") {
+            m_affinity = AFFINITY_NODE;
+        } else if(affinity != "none") {
+            SYLAR_LOG_WARN(g_logger) << "unknown scheduler.affinity=" << affinity;
+        }
+        m_cpus = g_scheduler_cpus->getValue();
 
         if (use_caller) {
             // 初始化当前线程的主协程
@@ -62,6 +115,11 @@ namespace sylar {
     Scheduler::~Scheduler() {
         // 确保调度器已经停止
         SYLAR_ASSERT(m_stopping);
+        unregisterMetrics();
+        // 工作线程都已经退出, 释放本地队列
+        for(auto& i : m_localQueues) {
+            delete i.exchange(nullptr);
+        }
         // 如果当前线程的调度器是this，则清空线程局部变量
         if (GetThis() == this) {
             t_scheduler = nullptr;
@@ -81,6 +139,13 @@ namespace sylar {
         return t_scheduler_fiber;
     }
 
+    void Scheduler::setAffinity(Affinity affinity, const std::vector<int>& cpus) {
+        MutexType::Lock lock(m_mutex);
+        SYLAR_ASSERT(m_stopping && m_threads.empty());
+        m_affinity = affinity;
+        m_cpus = cpus;
+    }
+
     // 启动协程调度器
     // 创建指定数量的工作线程，每个线程都运行run()函数
     // 如果调度器已经启动则直接返回
@@ -105,7 +170,28 @@ namespace sylar {
             // 记录线程ID
             m_threadIds.push_back(m_threads[i]->getId());
         }
+
+        // 建好本地队列的下标, 工作线程在run()中需要先拿到m_mutex才能查到自己的位置
+        // 所以这里在锁内建好, 之后只读
+        // 要绑定的工作线程在run()里绑定之后自己分配队列, 内存落在它所在的节点上; 其余的在这里分配
+        m_localQueues = std::vector<std::atomic<LocalQueue*> >(m_threadIds.size());
+        for (size_t i = 0; i < m_threadIds.size(); ++i) {
+            m_threadIndex[m_threadIds[i]] = i;
+            LocalQueue* queue = nullptr;
+            if(m_affinity == AFFINITY_NONE || m_threadIds[i] == m_rootThread) {
+                queue = new LocalQueue;
+                queue->thread = m_threadIds[i];
+            }
+            m_localQueues[i].store(queue, std::memory_order_release);
+        }
         lock.unlock();
+
+        // 在start()里注册而不是构造函数里: 构造期间虚函数collectMetrics还不是子类的版本,
+        // 子类的成员也还没初始化; 采集时会加m_mutex, 所以在锁外注册
+        if(!m_metricsId) {
+            m_metricsId = Metrics::AddCollector(std::bind(&Scheduler::collectMetrics
+                                                          ,this, std::placeholders::_1));
+        }
     }
 
     // 停止协程调度器
@@ -148,15 +234,9 @@ namespace sylar {
 
         // 设置停止标志
         m_stopping = true;
-        // 通知所有工作线程停止
-        for (size_t i = 0; i < m_threadCount; ++i) {
-            tickle();
-        }
-
-        // 如果存在根协程，也需要通知
-        if (m_rootFiber) {
-            tickle();
-        }
+        // 通知工作线程停止
+        // 唤醒只需一次, 退出的线程会接力唤醒下一个睡眠线程
+        tickle();
 
         // 如果存在根协程且调度器还没有完全停止
         // 让根协程有机会完成剩余工作
@@ -205,6 +285,32 @@ namespace sylar {
             t_scheduler_fiber = Fiber::GetThis().get();
         }
 
+        // 找到当前线程的本地队列, start()持有m_mutex直到队列数组建好
+        LocalQueue* local_queue = nullptr;
+        size_t thread_index = 0;
+        bool has_index = false;
+        {
+            MutexType::Lock lock(m_mutex);
+            local_queue = getLocalQueue(sylar::GetThreadId());
+            auto it = m_threadIndex.find(sylar::GetThreadId());
+            if(it != m_threadIndex.end()) {
+                thread_index = it->second;
+                has_index = true;
+            }
+        }
+
+        // 先绑定再分配本线程用的内存(本地队列, 协程栈, 定时器集合等), 按首次访问分配到本节点
+        // 队列发布之前投递给本线程的任务进了全局队列, 全局队列里指定本线程的任务照样会取
+        if(m_affinity != AFFINITY_NONE && sylar::GetThreadId() != m_rootThread) {
+            bindThread(thread_index);
+            if(!local_queue && has_index) {
+                local_queue = new LocalQueue;
+                local_queue->thread = sylar::GetThreadId();
+                m_localQueues[thread_index].store(local_queue, std::memory_order_release);
+            }
+        }
+        t_local_queue = local_queue;
+
         // 创建空闲协程，当没有任务时执行
         Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
         // 回调函数协程，用于复用执行函数类型的任务
@@ -212,6 +318,8 @@ namespace sylar {
 
         // 任务封装结构，用于从任务队列中取出的任务
         FiberAndThread ft;
+        // 本线程的运行时指标
+        ThreadMetrics& metrics = Metrics::Local();
         // 调度器主循环
         while(true) {
             // 重置任务结构
@@ -220,7 +328,12 @@ namespace sylar {
             bool is_active = false;  // 是否取到了有效任务
 
             // ========== 任务获取阶段 ==========
-            {
+            // 先取本地队列(指定本线程的任务, 工作窃取模式下的本地任务), 不碰全局锁
+            if(local_queue) {
+                is_active = popLocal(local_queue, ft, tickle_me);
+            }
+
+            if(!is_active) {
                 MutexType::Lock lock(m_mutex);
                 auto it = m_fibers.begin();
 
@@ -243,7 +356,7 @@ namespace sylar {
                     }
 
                     // 找到可执行任务，取出并从队列中删除
-                    ft = *it;
+                    ft = std::move(*it);
                     m_fibers.erase(it++);
                     ++m_activeThreadCount;  // 增加活跃线程计数
                     is_active = true;
@@ -253,6 +366,11 @@ namespace sylar {
                 tickle_me |= it != m_fibers.end();
             }
 
+            // 本地和全局队列都没有任务, 尝试从其他线程窃取
+            if(!is_active && local_queue && m_workStealing) {
+                is_active = steal(local_queue, ft);
+            }
+
             // 通知其他线程有任务需要处理
             if(tickle_me) {
                 tickle();
@@ -263,34 +381,40 @@ namespace sylar {
             // 情况1: 执行协程任务
             if(ft.fiber && (ft.fiber->getState() != Fiber::TERM
                             && ft.fiber->getState() != Fiber::EXCEPT)) {
+                uint64_t start = Metrics::NowNs();
+                metrics.task_wait.record(start - ft.enqueue);
                 // 切换到协程执行
                 ft.fiber->swapIn();
                 --m_activeThreadCount;
+                metrics.task_run.record(Metrics::NowNs() - start);
+                metrics.tasks.inc();
 
                 // 根据协程执行后的状态进行处理
+                // HOLD由swapIn在切回来之后设置, 这里不能再写状态:
+                // 它可能已经被唤醒(比如定时器, 不指定线程)并在别的线程上运行了
                 if(ft.fiber->getState() == Fiber::READY) {
                     // 协程让出执行权但还需要继续执行，重新调度
                     schedule(ft.fiber);
-                } else if(ft.fiber->getState() != Fiber::TERM
-                        && ft.fiber->getState() != Fiber::EXCEPT) {
-                    // 协程暂停，设置为HOLD状态
-                    ft.fiber->m_state = Fiber::HOLD;
-                        }
+                }
                 ft.reset();
-                            }
+            }
             // 情况2: 执行回调函数任务
             else if(ft.cb) {
-                // 复用cb_fiber或创建新的协程来执行回调函数
+                // 复用cb_fiber, 或者从协程池取一个来执行回调函数
                 if(cb_fiber) {
-                    cb_fiber->reset(ft.cb);
+                    cb_fiber->reset(std::move(ft.cb));
                 } else {
-                    cb_fiber.reset(new Fiber(ft.cb));
+                    cb_fiber = Fiber::Create(std::move(ft.cb));
                 }
+                uint64_t start = Metrics::NowNs();
+                metrics.task_wait.record(start - ft.enqueue);
                 ft.reset();
 
                 // 切换到回调协程执行
                 cb_fiber->swapIn();
                 --m_activeThreadCount;
+                metrics.task_run.record(Metrics::NowNs() - start);
+                metrics.tasks.inc();
 
                 // 根据回调协程执行后的状态进行处理
                 if(cb_fiber->getState() == Fiber::READY) {
@@ -301,11 +425,10 @@ namespace sylar {
                         || cb_fiber->getState() == Fiber::TERM) {
                     // 回调协程异常或结束，清理协程
                     cb_fiber->reset(nullptr);
-                        } else {//if(cb_fiber->getState() != Fiber::TERM) {
-                            // 回调协程暂停，设置为HOLD状态
-                            cb_fiber->m_state = Fiber::HOLD;
-                            cb_fiber.reset();
-                        }
+                } else {
+                    // 回调协程挂起了(HOLD), 以后由唤醒它的人重新调度, 这里不再复用
+                    cb_fiber.reset();
+                }
             }
             // 情况3: 没有任务可执行
             else {
@@ -318,6 +441,7 @@ namespace sylar {
                 // 检查空闲协程是否已结束，如果结束则退出调度循环
                 if(idle_fiber->getState() == Fiber::TERM) {
                     SYLAR_LOG_INFO(g_logger) << "idle fiber term";
+                    t_local_queue = nullptr;
                     break;
                 }
 
@@ -339,7 +463,14 @@ namespace sylar {
     // 基类实现为空，子类可以重写此方法实现具体的通知机制
     // 例如使用信号量、条件变量等同步原语唤醒阻塞的线程
     void Scheduler::tickle() {
-        SYLAR_LOG_INFO(g_logger) << "tickle";
+        SYLAR_LOG_DEBUG(g_logger) << "tickle";
+    }
+
+    // 通知指定线程
+    // 基类无法区分线程, 不使用thread, 直接退化为tickle()
+    // 子类如果每个线程有独立的唤醒通道, 可以重写此方法只唤醒目标线程
+    void Scheduler::tickleThread(int /*thread*/) {
+        tickle();
     }
 
     // 判断调度器是否应该停止
@@ -352,7 +483,227 @@ namespace sylar {
     bool Scheduler::stopping() {
         MutexType::Lock lock(m_mutex);
         return m_autoStop && m_stopping
-            && m_fibers.empty() && m_activeThreadCount == 0;
+            && m_fibers.empty() && m_localFiberCount == 0
+            && m_activeThreadCount == 0;
+    }
+
+    // 空闲线程睡眠前的二次检查
+    // 其他线程的本地队列里都是指定给它们的任务(或等它们窃取), 不算在内, 否则这里会空转
+    bool Scheduler::hasReadyTasks() {
+        LocalQueue* queue = t_local_queue;
+        if(queue) {
+            LocalQueue::MutexType::Lock lock(queue->mutex);
+            if(!queue->fibers.empty()) {
+                return true;
+            }
+        }
+        MutexType::Lock lock(m_mutex);
+        return !m_fibers.empty();
+    }
+
+    void Scheduler::bindThread(size_t index) {
+        std::vector<int> cpus = m_cpus.empty() ? Thread::GetAllowedCpus() : m_cpus;
+        if(cpus.empty()) {
+            return;
+        }
+        bool ok = false;
+        if(m_affinity == AFFINITY_CORE) {
+            int cpu = cpus[index % cpus.size()];
+            ok = Thread::SetAffinity({cpu});
+            // 进程可能被numactl设置成了交错分配, 指定优先本节点
+            ok = ok && Thread::SetPreferredNode(Thread::GetCpuNode(cpu));
+        } else if(m_affinity == AFFINITY_NODE) {
+            std::vector<int> nodes;
+            for(auto cpu : cpus) {
+                nodes.push_back(Thread::GetCpuNode(cpu));
+            }
+            std::sort(nodes.begin(), nodes.end());
+            nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+            int node = nodes[index % nodes.size()];
+
+            std::vector<int> node_cpus;
+            for(auto cpu : cpus) {
+                if(Thread::GetCpuNode(cpu) == node) {
+                    node_cpus.push_back(cpu);
+                }
+            }
+            ok = Thread::SetAffinity(node_cpus) && Thread::SetPreferredNode(node);
+        }
+        if(!ok) {
+            SYLAR_LOG_WARN(g_logger) << m_name << " bind thread index=" << index
+                                     << " affinity=" << m_affinity << " fail";
+        }
+    }
+
+    size_t Scheduler::getQueueSize() {
+        MutexType::Lock lock(m_mutex);
+        return m_fibers.size();
+    }
+
+    std::vector<std::pair<int, size_t> > Scheduler::getLocalQueueSizes() {
+        // 队列数组只在start()中创建, 先在全局锁内取出指针, 再逐个加本地队列的锁
+        // 还没有发布队列的线程跳过
+        std::vector<LocalQueue*> queues;
+        {
+            MutexType::Lock lock(m_mutex);
+            for(auto& i : m_localQueues) {
+                LocalQueue* queue = i.load(std::memory_order_acquire);
+                if(queue) {
+                    queues.push_back(queue);
+                }
+            }
+        }
+        std::vector<std::pair<int, size_t> > result;
+        for(auto queue : queues) {
+            LocalQueue::MutexType::Lock lock(queue->mutex);
+            result.push_back(std::make_pair(queue->thread, queue->fibers.size()));
+        }
+        return result;
+    }
+
+    void Scheduler::collectMetrics(MetricsWriter& writer) {
+        std::string labels = "scheduler=\"" + m_name + "\"";
+        writer.gauge("sylar_scheduler_threads", "Scheduler threads", getThreadCount(), labels);
+        writer.gauge("sylar_scheduler_active_threads", "Scheduler threads running a task"
+                     ,getActiveThreadCount(), labels);
+        writer.gauge("sylar_scheduler_idle_threads", "Scheduler threads in idle"
+                     ,getIdleThreadCount(), labels);
+        writer.gauge("sylar_scheduler_queue_depth", "Tasks waiting in a run queue"
+                     ,getQueueSize(), labels + ",queue=\"global\"");
+        for(auto& i : getLocalQueueSizes()) {
+            writer.gauge("sylar_scheduler_queue_depth", "Tasks waiting in a run queue"
+                         ,i.second, labels + ",queue=\"" + std::to_string(i.first) + "\"");
+        }
+    }
+
+    void Scheduler::unregisterMetrics() {
+        if(m_metricsId) {
+            Metrics::DelCollector(m_metricsId);
+            m_metricsId = 0;
+        }
+    }
+
+    // 返回线程id对应的本地队列, 目标线程还没有发布队列时返回nullptr
+    // m_threadIndex 只在start()中写入, 之后只读
+    Scheduler::LocalQueue* Scheduler::getLocalQueue(int thread) {
+        auto it = m_threadIndex.find(thread);
+        if(it == m_threadIndex.end()) {
+            return nullptr;
+        }
+        return m_localQueues[it->second].load(std::memory_order_acquire);
+    }
+
+    // 投递到线程本地队列
+    // 1. 指定线程的任务O(1)放入目标线程的队列, 不再让所有线程持锁反复扫描跳过
+    // 2. 工作窃取模式下, 当前线程属于本调度器时, 任意线程任务放入自己的本地队列
+    // 3. 其他情况(外部线程投递, 本地队列已满, start()之前)返回false, 由调用者放入全局队列
+    bool Scheduler::scheduleLocal(FiberAndThread& ft, int& tickle_thread, bool& need_tickle) {
+        LocalQueue* queue = nullptr;
+        if(ft.thread != -1) {
+            queue = getLocalQueue(ft.thread);
+        } else if(m_workStealing && t_scheduler == this) {
+            queue = t_local_queue;
+        }
+        if(!queue) {
+            return false;
+        }
+
+        {
+            LocalQueue::MutexType::Lock lock(queue->mutex);
+            // 指定线程的任务只能在目标线程执行, 不受容量限制
+            if(ft.thread == -1 && queue->fibers.size() >= m_localQueueCapacity) {
+                return false;
+            }
+            queue->fibers.push_back(std::move(ft));
+            ++m_localFiberCount;
+        }
+
+        if(queue->thread != sylar::GetThreadId()) {
+            // 只唤醒目标线程, 不再广播
+            tickle_thread = queue->thread;
+        } else if(m_workStealing && hasIdleThreads()) {
+            // 自己的队列有新任务, 唤醒空闲线程来窃取
+            need_tickle = true;
+        }
+        return true;
+    }
+
+    // 从本地队列头部取一个可执行任务
+    // 正在执行中的协程(刚把自己投递出来还没切出)需要跳过
+    // 只剩下还没切出的协程时设置tickle_me, 防止本线程直接睡进idle
+    bool Scheduler::popLocal(LocalQueue* queue, FiberAndThread& ft, bool& tickle_me) {
+        LocalQueue::MutexType::Lock lock(queue->mutex);
+        for(auto it = queue->fibers.begin(); it != queue->fibers.end(); ++it) {
+            if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
+                continue;
+            }
+            ft = std::move(*it);
+            queue->fibers.erase(it);
+            // 先增加活跃计数再减少队列计数, 避免stopping()误判
+            ++m_activeThreadCount;
+            --m_localFiberCount;
+            return true;
+        }
+        tickle_me |= !queue->fibers.empty();
+        return false;
+    }
+
+    // 从其他线程的本地队列尾部窃取一半任务
+    // 第一个直接执行, 其余放入自己的本地队列, 最多放到m_localQueueCapacity
+    // 指定了线程的任务不允许被窃取
+    bool Scheduler::steal(LocalQueue* self, FiberAndThread& ft) {
+        if(m_localFiberCount == 0) {
+            return false;
+        }
+
+        // 自己的本地队列还能放多少, 加上直接执行的那一个
+        size_t limit = 1;
+        {
+            LocalQueue::MutexType::Lock lock(self->mutex);
+            if(self->fibers.size() < m_localQueueCapacity) {
+                limit += m_localQueueCapacity - self->fibers.size();
+            }
+        }
+
+        size_t count = m_localQueues.size();
+        // 从不同的起点开始, 避免所有空闲线程都去抢同一个队列
+        size_t start = (size_t)sylar::GetThreadId() % count;
+        std::vector<FiberAndThread> stolen;
+        for(size_t i = 0; i < count && stolen.empty(); ++i) {
+            LocalQueue* victim = m_localQueues[(start + i) % count].load(std::memory_order_acquire);
+            if(!victim || victim == self) {
+                continue;
+            }
+
+            LocalQueue::MutexType::Lock lock(victim->mutex);
+            size_t n = std::min((victim->fibers.size() + 1) / 2, limit);
+            for(auto it = victim->fibers.end(); n > 0 && it != victim->fibers.begin();) {
+                --it;
+                if(it->thread != -1
+                        || (it->fiber && it->fiber->getState() == Fiber::EXEC)) {
+                    continue;
+                }
+                stolen.push_back(std::move(*it));
+                it = victim->fibers.erase(it);
+                --n;
+            }
+            if(!stolen.empty()) {
+                ++m_activeThreadCount;
+                --m_localFiberCount;
+            }
+        }
+
+        if(stolen.empty()) {
+            return false;
+        }
+
+        ft = std::move(stolen.front());
+        if(stolen.size() > 1) {
+            LocalQueue::MutexType::Lock lock(self->mutex);
+            self->fibers.insert(self->fibers.end(), std::make_move_iterator(stolen.begin() + 1),
+                                std::make_move_iterator(stolen.end()));
+        }
+        return true;
     }
 
     // 空闲协程执行函数
@@ -360,7 +711,7 @@ namespace sylar {
     // 在循环中让出执行权，直到调度器停止
     // 子类可以重写此方法实现自定义的空闲逻辑
     void Scheduler::idle() {
-        SYLAR_LOG_INFO(g_logger) << "idle";
+        SYLAR_LOG_DEBUG(g_logger) << "idle";
         // 循环让出执行权，直到调度器停止
         while(!stopping()) {
             sylar::Fiber::YieldToHold();
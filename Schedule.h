@@ -8,9 +8,12 @@
 #include <memory>
 #include <vector>
 #include <list>
+#include <deque>
+#include <unordered_map>
 #include <iostream>
 #include "fiber.h"
 #include "Thread.h"
+#include "metrics.h"
 #include <google/protobuf/message.h>
 
 namespace sylar {
@@ -19,7 +22,17 @@ namespace sylar {
     public:
         // 协程调度器
         typedef std::shared_ptr<Scheduler> ptr;
-        typedef Mutex MutexType;
+        typedef AdaptiveMutex MutexType;
+
+        // 工作线程的绑定方式
+        enum Affinity {
+            // 不绑定
+            AFFINITY_NONE = 0,
+            // 每个工作线程绑定一个核, 轮流使用可用的核
+            AFFINITY_CORE = 1,
+            // 每个工作线程绑定一个NUMA节点(节点上所有可用的核), 轮流分配到各个节点
+            AFFINITY_NODE = 2
+        };
 
         // use_caller 为是否调用当前线程, threads 为线程数量
         Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name = "");
@@ -47,12 +60,25 @@ namespace sylar {
         */
         template<class FiberOrCb>
         void schedule(FiberOrCb fc, int thread = -1) {
+            FiberAndThread ft(std::move(fc), thread);
+            if(!ft.fiber && !ft.cb) {
+                return;
+            }
+
+            // 快速路径: 指定线程的任务和工作窃取模式下的本地任务只需要本地队列的锁
+            // 放不进去(目标线程未知, 队列已满)再持全局锁交给scheduleNoLock
+            // 唤醒都放到锁外面做, tickle()/tickleThread()里有系统调用
+            int tickle_thread = -1;
             bool need_tickle = false;
-            {
+            if(!(ft.thread != -1 || m_workStealing)
+                    || !scheduleLocal(ft, tickle_thread, need_tickle)) {
                 MutexType::Lock lock(m_mutex);
-                need_tickle = scheduleNoLock(fc, thread);
+                need_tickle = scheduleNoLock(ft, tickle_thread);
             }
 
+            if(tickle_thread != -1) {
+                tickleThread(tickle_thread);
+            }
             if(need_tickle) {
                 tickle();
             }
@@ -66,25 +92,62 @@ namespace sylar {
         template<class InputIterator>
         void schedule(InputIterator begin, InputIterator end) {
             bool need_tickle = false;
+            // 共享栈协程会绑定到原来的线程, 要单独唤醒
+            std::vector<int> tickle_threads;
             {
                 MutexType::Lock lock(m_mutex);
                 while(begin != end) {
-                    need_tickle = scheduleNoLock(*begin, -1) || need_tickle;
+                    int tickle_thread = -1;
+                    need_tickle = scheduleNoLock(*begin, -1, tickle_thread) || need_tickle;
+                    if(tickle_thread != -1) {
+                        tickle_threads.push_back(tickle_thread);
+                    }
                     ++begin;
                 }
             }
+            for(int thread : tickle_threads) {
+                tickleThread(thread);
+            }
             if(need_tickle) {
                 tickle();
             }
         }
 
+        // 设置工作线程的绑定方式, 必须在start()之前调用, 默认取scheduler.affinity/scheduler.cpus
+        // cpus 可用的核, 为空时使用进程允许的全部核
+        // 绑定之后工作线程优先从所在节点分配内存, 协程栈/定时器集合/本地队列都在工作线程里分配
+        // use_caller的调用线程不绑定
+        void setAffinity(Affinity affinity, const std::vector<int>& cpus = {});
+
+        Affinity getAffinity() const { return m_affinity;}
+
         void switchTo(int thread = -1);
         std::ostream& dump(std::ostream& os);
 
+        // 线程总数
+        size_t getThreadCount() const { return m_threadCount + (m_rootThread != -1 ? 1 : 0);}
+
+        // 正在执行任务的线程数
+        size_t getActiveThreadCount() const { return m_activeThreadCount;}
+
+        // 空闲的线程数
+        size_t getIdleThreadCount() const { return m_idleThreadCount;}
+
+        // 全局队列中的任务数
+        size_t getQueueSize();
+
+        // 每个线程本地队列中的任务数, 返回(线程id, 任务数)
+        std::vector<std::pair<int, size_t> > getLocalQueueSizes();
+
     protected:
         // 通知协程调度器有任务了,线程空闲时会阻塞
         virtual void tickle();
 
+        // 只通知指定线程, 指定线程的任务在它自己的本地队列里, 其他线程取不到
+        // 子类必须保证目标线程睡眠时能被叫醒; 基类没有按线程的唤醒通道, 忽略thread退化为tickle()
+        // 不在持有m_mutex时调用
+        virtual void tickleThread(int thread);
+
         void run();
 
         virtual bool stopping();
@@ -95,43 +158,91 @@ namespace sylar {
 
         bool hasIdleThreads() { return m_idleThreadCount > 0; }
 
+        // 当前线程是否还有可取的任务(本线程的本地队列或全局队列)
+        // 空闲线程睡眠前用来做二次检查
+        bool hasReadyTasks();
+
+        // 向Metrics输出调度器的瞬时状态, 子类可以追加自己的指标
+        // start()时才注册, 子类在构造完成后调用start()
+        virtual void collectMetrics(MetricsWriter& writer);
+
+        // 停止向Metrics输出, 子类析构时要先调用, 避免采集时访问已析构的成员
+        void unregisterMetrics();
+
     private:
+        struct FiberAndThread;
+        struct LocalQueue;
+
         // 启动协程调度(无锁)
         template <class FiberOrCb>
-        bool scheduleNoLock(FiberOrCb fc, int thread) {
-            bool need_tickle = m_fibers.empty();
-            FiberAndThread ft(fc, thread);
-            if(ft.fiber || ft.cb) {
-                m_fibers.push_back(ft);
+        bool scheduleNoLock(FiberOrCb fc, int thread, int& tickle_thread) {
+            FiberAndThread ft(std::move(fc), thread);
+            if(!ft.fiber && !ft.cb) {
+                return m_fibers.empty();
             }
+            return scheduleNoLock(ft, tickle_thread);
+        }
+
+        // 投递任务, 需持有m_mutex, 返回是否需要tickle()
+        // 指定线程的任务O(1)放入目标线程的本地队列, 需要唤醒的目标线程放在tickle_thread(没有时不修改)
+        // 其余放入全局(注入)队列; 调用者释放m_mutex之后再唤醒
+        bool scheduleNoLock(FiberAndThread& ft, int& tickle_thread) {
+            bool need_tickle = false;
+            if(ft.thread != -1 && scheduleLocal(ft, tickle_thread, need_tickle)) {
+                return need_tickle;
+            }
+            need_tickle = m_fibers.empty();
+            m_fibers.push_back(std::move(ft));
             return need_tickle;
         }
 
+        // 放入线程本地队列, 队列已满或目标线程未知时返回false
+        // 不在这里唤醒: 需要唤醒的目标线程放在tickle_thread, 需要叫醒空闲线程来窃取时need_tickle置true
+        // 不需要持有m_mutex
+        bool scheduleLocal(FiberAndThread& ft, int& tickle_thread, bool& need_tickle);
+
+        // 返回线程id对应的本地队列, 不存在返回nullptr
+        LocalQueue* getLocalQueue(int thread);
+
+        // 从本地队列取出一个可执行任务
+        bool popLocal(LocalQueue* queue, FiberAndThread& ft, bool& tickle_me);
+
+        // 从其他线程的本地队列窃取任务
+        bool steal(LocalQueue* self, FiberAndThread& ft);
+
+        // 按m_affinity绑定第index个线程(当前线程)
+        void bindThread(size_t index);
+
     private:
+        // 只能移动, 回调用Callback存放, 小的lambda/std::function不额外分配内存
         struct FiberAndThread {
             Fiber::ptr fiber;
-            std::function<void()> cb;
+            Callback cb;
             int thread;
+            // 入队时间(纳秒), 用来统计等待时间
+            uint64_t enqueue = 0;
 
             // 构造
             FiberAndThread(Fiber::ptr f, int thr)
-                :fiber(f), thread(thr) {
+                :fiber(f), thread(thr), enqueue(Metrics::NowNs()) {
+                bindStackThread();
             }
             // 构造, 唯一的不同是指针函数
             FiberAndThread(Fiber::ptr* f, int thr)
-                :thread(thr) {
+                :thread(thr), enqueue(Metrics::NowNs()) {
                 fiber.swap(*f);
+                bindStackThread();
             }
 
-            // 构造函数, 函数版本
-            FiberAndThread(std::function<void()> f, int thr)
-                :cb(f), thread(thr) {
+            // 构造函数, 函数版本(lambda, std::bind, std::function等)
+            FiberAndThread(Callback f, int thr)
+                :cb(std::move(f)), thread(thr), enqueue(Metrics::NowNs()) {
             }
 
-            // 构造函数, 函数指针版本
+            // 构造函数, 函数指针版本, 取走*f
             FiberAndThread(std::function<void()>* f, int thr)
-                :thread(thr) {
-                cb.swap(*f);
+                :cb(std::move(*f)), thread(thr), enqueue(Metrics::NowNs()) {
+                *f = nullptr;
             }
 
             FiberAndThread()
@@ -143,17 +254,48 @@ namespace sylar {
                 fiber.reset();
                 cb = nullptr;
             }
+
+            // 共享栈协程运行过之后只能回到原来的线程
+            void bindStackThread() {
+                if(thread == -1 && fiber) {
+                    thread = fiber->getStackThread();
+                }
+            }
+        };
+
+        // 每个线程独占的运行队列
+        // 指定线程的任务总是投递到这里, 工作窃取模式下也存放任意线程的任务(有界)
+        // 按缓存行对齐, 不同线程的队列锁不会伪共享
+        struct alignas(SYLAR_CACHELINE_SIZE) LocalQueue {
+            typedef Spinlock MutexType;
+            MutexType mutex;
+            std::deque<FiberAndThread> fibers;
+            // 所属线程id
+            int thread = -1;
         };
+
+        // 当前线程的本地运行队列(仅在run()期间有效)
+        static thread_local LocalQueue* t_local_queue;
     private:
-        MutexType m_mutex;
+        // 全局队列锁, 独占缓存行
+        CacheAligned<MutexType> m_mutex;
         // 线程池
         std::vector<Thread::ptr> m_threads;
-        // 待执行任务队列
+        // 待执行任务队列(工作窃取模式下作为溢出/注入队列)
         std::list<FiberAndThread> m_fibers;
+        // 线程本地队列(按线程id分桶), 下标与m_threadIds一致, 数组在start()中建好后不再变化
+        // 绑定了核的工作线程在run()里绑定之后自己分配并发布, 在此之前为nullptr; 析构时释放
+        std::vector<std::atomic<LocalQueue*> > m_localQueues;
+        // 线程id -> 本地队列下标, start()之后只读
+        std::unordered_map<int, size_t> m_threadIndex;
+        // 本地队列中的任务总数
+        std::atomic<size_t> m_localFiberCount = {0};
         // use_caller 为 true 时调度协程
         Fiber::ptr m_rootFiber;
         // 名字
         std::string m_name;
+        // Metrics采集函数id, 0为已注销
+        uint64_t m_metricsId = 0;
     protected:
         // 协程下的线程ID数组
         std::vector<int> m_threadIds;
@@ -167,8 +309,18 @@ namespace sylar {
         bool m_stopping = true;
         // 是否自动停止
         bool m_autoStop = false;
+        // 是否启用工作窃取调度
+        bool m_workStealing = false;
+        // 本地队列容量
+        size_t m_localQueueCapacity = 256;
+        // 工作线程的绑定方式
+        Affinity m_affinity = AFFINITY_NONE;
+        // 绑定可用的核, 为空时使用进程允许的全部核
+        std::vector<int> m_cpus;
         // 主线程id
         int m_rootThread = 0;
+        // 内部AdaptiveMutex的自旋次数(scheduler.mutex_spin)
+        uint32_t m_mutexSpin = 100;
     };
 
     class SchedulerSwitcher {
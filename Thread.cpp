@@ -4,6 +4,15 @@
 
 #include "Thread.h"
 #include "log.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
 
 namespace sylar {
     static thread_local Thread* t_thread = nullptr;
@@ -51,6 +60,138 @@ namespace sylar {
         }
     }
 
+    static bool ToCpuSet(const std::vector<int>& cpus, cpu_set_t& set) {
+        CPU_ZERO(&set);
+        for(auto cpu : cpus) {
+            if(cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        return CPU_COUNT(&set) > 0;
+    }
+
+    bool Thread::setAffinity(const std::vector<int>& cpus) {
+        cpu_set_t set;
+        if(!ToCpuSet(cpus, set)) {
+            return false;
+        }
+        int rt = pthread_setaffinity_np(m_thread, sizeof(set), &set);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_logger) << "pthread_setaffinity_np fail rt=" << rt
+                                      << " name=" << m_name;
+            return false;
+        }
+        return true;
+    }
+
+    bool Thread::SetAffinity(const std::vector<int>& cpus) {
+        cpu_set_t set;
+        if(!ToCpuSet(cpus, set)) {
+            return false;
+        }
+        int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_logger) << "pthread_setaffinity_np fail rt=" << rt
+                                      << " name=" << t_thread_name;
+            return false;
+        }
+        return true;
+    }
+
+    bool Thread::SetPreferredNode(int node) {
+        // 不依赖libnuma, 直接调用set_mempolicy
+        unsigned long mask = 0;
+        int mode = MPOL_DEFAULT;
+        if(node >= 0) {
+            if(node >= (int)(sizeof(mask) * 8)) {
+                return false;
+            }
+            mask = 1ul << node;
+            mode = MPOL_PREFERRED;
+        }
+        if(syscall(SYS_set_mempolicy, mode, node >= 0 ? &mask : nullptr
+                   ,node >= 0 ? sizeof(mask) * 8 : 0)) {
+            SYLAR_LOG_ERROR(g_logger) << "set_mempolicy fail node=" << node
+                                      << " errno=" << errno << " errstr=" << strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    bool Thread::BindNode(int node) {
+        std::vector<int> cpus = GetNodeCpus(node);
+        if(cpus.empty() || !SetAffinity(cpus)) {
+            return false;
+        }
+        return SetPreferredNode(node);
+    }
+
+    // 进程启动时允许运行的核, 第一次用到时读取
+    // sched_getaffinity(0)是调用线程的掩码, 线程绑核之后只剩一个核, 所以取主线程(pid)的, 而且只取一次
+    static const std::vector<int>& ProcessCpus() {
+        static const std::vector<int> s_cpus = []() {
+            std::vector<int> cpus;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if(sched_getaffinity(getpid(), sizeof(set), &set) == 0) {
+                for(int i = 0; i < CPU_SETSIZE; ++i) {
+                    if(CPU_ISSET(i, &set)) {
+                        cpus.push_back(i);
+                    }
+                }
+            } else {
+                SYLAR_LOG_ERROR(g_logger) << "sched_getaffinity fail errno=" << errno
+                    << " errstr=" << strerror(errno);
+            }
+            return cpus;
+        }();
+        return s_cpus;
+    }
+
+    // 加载时就读一次, 这时还没有线程绑核(包括use_caller时绑核的主线程)
+    static struct ProcessCpusIniter {
+        ProcessCpusIniter() {
+            ProcessCpus();
+        }
+    } s_process_cpus_initer;
+
+    std::vector<int> Thread::GetAllowedCpus() {
+        return ProcessCpus();
+    }
+
+    int Thread::GetCpuNode(int cpu) {
+        // /sys/devices/system/cpu/cpuN/ 下面有一个nodeM的链接
+        std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        DIR* dir = opendir(path.c_str());
+        if(!dir) {
+            return 0;
+        }
+        int node = 0;
+        struct dirent* dp = nullptr;
+        while((dp = readdir(dir)) != nullptr) {
+            if(strncmp(dp->d_name, "node", 4) == 0 && isdigit(dp->d_name[4])) {
+                node = atoi(dp->d_name + 4);
+                break;
+            }
+        }
+        closedir(dir);
+        return node;
+    }
+
+    std::vector<int> Thread::GetNodeCpus(int node) {
+        std::vector<int> cpus;
+        for(auto cpu : GetAllowedCpus()) {
+            if(GetCpuNode(cpu) == node) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    int Thread::GetCurrentCpu() {
+        return sched_getcpu();
+    }
+
     void Thread::join() {
         //使用pthread_join等待线程结束
         int rt = pthread_join(m_thread, nullptr);
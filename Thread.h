@@ -10,6 +10,7 @@
 #include <functional>
 #include "singleton.h"
 #include <memory>
+#include <vector>
 #include <semaphore>
 #include <boost/noncopyable.hpp>
 #include <semaphore.h>
@@ -27,9 +28,33 @@ namespace sylar {
 
         void join();
 
+        // 把线程绑定到cpus上运行
+        bool setAffinity(const std::vector<int>& cpus);
+
         static Thread* GetThis();
         static const std::string& GetName();
         static void SetName(const std::string& name);
+
+        // 把当前线程绑定到cpus上运行
+        static bool SetAffinity(const std::vector<int>& cpus);
+
+        // 当前线程优先从node节点分配内存(新缺页的内存), node为-1时恢复默认的本地分配
+        static bool SetPreferredNode(int node);
+
+        // 把当前线程绑定到NUMA节点上: 只在节点的核上运行, 优先用节点的内存
+        static bool BindNode(int node);
+
+        // 进程启动时允许运行的核(加载时读取一次), 不受之后线程绑核的影响
+        static std::vector<int> GetAllowedCpus();
+
+        // 核所在的NUMA节点, 没有NUMA信息时返回0
+        static int GetCpuNode(int cpu);
+
+        // NUMA节点上的核
+        static std::vector<int> GetNodeCpus(int node);
+
+        // 当前线程正在运行的核
+        static int GetCurrentCpu();
     private:
         static void* run(void* arg);
     private:
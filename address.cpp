@@ -4,6 +4,7 @@
 
 #include "address.h"
 #include "log.h"
+#include "dns.h"
 #include <sstream>
 #include <netdb.h>
 #include <ifaddrs.h>
@@ -103,6 +104,12 @@ namespace sylar {
             node = host;
         }
 
+        // 在协程里走异步解析, getaddrinfo会阻塞整个线程
+        int rt = DnsResolverMgr::GetInstance().lookup(result, node, service, family);
+        if(rt >= 0) {
+            return rt > 0;
+        }
+
         int error = getaddrinfo(node.c_str(), service, &hints, &results);
         if(error) {
             SYLAR_LOG_DEBUG(g_logger) << "Address::Lookup getaddress(" << host << ", "
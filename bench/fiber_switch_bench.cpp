@@ -0,0 +1,85 @@
+//
+// Created by admin on 2025/8/5.
+//
+
+// 协程上下文切换微基准: 比较 swapcontext 和手写汇编 fcontext 每次切换的耗时
+// 两边用同样的乒乓方式: 主上下文 <-> 协程上下文 来回切换 N 次
+
+#include <ucontext.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include "../fcontext.h"
+
+static const size_t s_stack_size = 128 * 1024;
+static uint64_t s_rounds = 1000000;
+
+// ---------------- ucontext ----------------
+static ucontext_t s_uc_main;
+static ucontext_t s_uc_fiber;
+
+static void UcontextFunc() {
+    while (true) {
+        swapcontext(&s_uc_fiber, &s_uc_main);
+    }
+}
+
+static double BenchUcontext() {
+    void* stack = malloc(s_stack_size);
+    getcontext(&s_uc_fiber);
+    s_uc_fiber.uc_link = nullptr;
+    s_uc_fiber.uc_stack.ss_sp = stack;
+    s_uc_fiber.uc_stack.ss_size = s_stack_size;
+    makecontext(&s_uc_fiber, &UcontextFunc, 0);
+
+    auto begin = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < s_rounds; ++i) {
+        swapcontext(&s_uc_main, &s_uc_fiber);
+    }
+    auto end = std::chrono::steady_clock::now();
+    free(stack);
+
+    // 每轮切进去再切回来, 两次切换
+    return std::chrono::duration<double, std::nano>(end - begin).count() / (s_rounds * 2);
+}
+
+// ---------------- fcontext ----------------
+static fcontext_t s_fc_main = nullptr;
+static fcontext_t s_fc_fiber = nullptr;
+
+static void FcontextFunc(intptr_t) {
+    while (true) {
+        sylar_jump_fcontext(&s_fc_fiber, s_fc_main, 0);
+    }
+}
+
+static double BenchFcontext() {
+    void* stack = malloc(s_stack_size);
+    s_fc_fiber = sylar_make_fcontext((char*)stack + s_stack_size, s_stack_size, &FcontextFunc);
+
+    auto begin = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < s_rounds; ++i) {
+        sylar_jump_fcontext(&s_fc_main, s_fc_fiber, 0);
+    }
+    auto end = std::chrono::steady_clock::now();
+    free(stack);
+
+    return std::chrono::duration<double, std::nano>(end - begin).count() / (s_rounds * 2);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        s_rounds = strtoull(argv[1], nullptr, 10);
+    }
+    if (s_rounds == 0) {
+        s_rounds = 1;
+    }
+
+    double uc = BenchUcontext();
+    double fc = BenchFcontext();
+    printf("rounds=%llu\n", (unsigned long long)s_rounds);
+    printf("swapcontext: %.2f ns/switch\n", uc);
+    printf("fcontext:    %.2f ns/switch\n", fc);
+    return 0;
+}
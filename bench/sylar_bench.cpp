@@ -0,0 +1,566 @@
+//
+// Created by admin on 2025/9/2.
+//
+
+// 热路径基准测试: 协程, 调度器, 定时器, hook socket, TcpServer, 配置, 日志
+// 结果按Google Benchmark的JSON格式输出(context + benchmarks), 可以直接用它的compare.py对比
+// 用法: sylar_bench [--filter=子串] [--min_time=秒] [--max_threads=N] [--max_timers=N] [--out=文件]
+
+#include "../fiber.h"
+#include "../iomanager.h"
+#include "../timer.h"
+#include "../hook.h"
+#include "../Config.h"
+#include "../log.h"
+#include "../mutex.h"
+#include "../tcp_server.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+    struct Options {
+        // 只运行名字包含filter的用例
+        std::string filter;
+        // 自动放大循环次数, 直到单个用例耗时超过min_time秒
+        double min_time = 0.2;
+        size_t max_threads = 64;
+        size_t max_timers = 1000000;
+        // 为空时输出到stdout
+        std::string out;
+    };
+
+    struct Result {
+        std::string name;
+        uint64_t iterations;
+        // 每次操作的耗时(纳秒)
+        double real_time;
+        double cpu_time;
+    };
+
+    Options s_options;
+    std::vector<Result> s_results;
+
+    uint64_t NowNs(clockid_t clock = CLOCK_MONOTONIC) {
+        struct timespec ts;
+        clock_gettime(clock, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    bool Match(const std::string& name) {
+        return s_options.filter.empty() || name.find(s_options.filter) != std::string::npos;
+    }
+
+    // 记录一次测量, items 为这次处理的操作数
+    void Report(const std::string& name, uint64_t items, uint64_t real_ns, uint64_t cpu_ns) {
+        if(items == 0) {
+            items = 1;
+        }
+        Result r{name, items, (double)real_ns / items, (double)cpu_ns / items};
+        fprintf(stderr, "%-48s %12llu %12.2f ns/op\n", name.c_str()
+                , (unsigned long long)items, r.real_time);
+        s_results.push_back(r);
+    }
+
+    // 运行fn(iterations), 循环次数从1开始放大, 直到总耗时超过min_time
+    void Run(const std::string& name, const std::function<void(uint64_t)>& fn) {
+        if(!Match(name)) {
+            return;
+        }
+        uint64_t iterations = 1;
+        while(true) {
+            uint64_t cpu_begin = NowNs(CLOCK_PROCESS_CPUTIME_ID);
+            uint64_t begin = NowNs();
+            fn(iterations);
+            uint64_t real = NowNs() - begin;
+            uint64_t cpu = NowNs(CLOCK_PROCESS_CPUTIME_ID) - cpu_begin;
+            if(real >= s_options.min_time * 1e9 || iterations >= (1ull << 40)) {
+                Report(name, iterations, real, cpu);
+                return;
+            }
+            // 按这次的耗时估算, 多放大一点, 最多放大10倍
+            double scale = real ? s_options.min_time * 1e9 * 1.4 / real : 10;
+            iterations = std::max(iterations + 1, (uint64_t)(iterations * std::min(scale, 10.0)));
+        }
+    }
+
+    // 防止编译器把被测代码优化掉
+    template<class T>
+    void DoNotOptimize(const T& v) {
+        asm volatile("" : : "r,m"(v) : "memory");
+    }
+
+    std::string ToJson() {
+        char host[256] = {0};
+        gethostname(host, sizeof(host) - 1);
+        time_t now = time(0);
+        char date[64];
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+        std::stringstream ss;
+        ss << "{\n  \"context\": {\n"
+           << "    \"date\": \"" << date << "\",\n"
+           << "    \"host_name\": \"" << host << "\",\n"
+           << "    \"executable\": \"sylar_bench\",\n"
+           << "    \"num_cpus\": " << sysconf(_SC_NPROCESSORS_ONLN) << ",\n"
+#ifdef NDEBUG
+           << "    \"library_build_type\": \"release\"\n"
+#else
+           << "    \"library_build_type\": \"debug\"\n"
+#endif
+           << "  },\n  \"benchmarks\": [";
+        for(size_t i = 0; i < s_results.size(); ++i) {
+            const Result& r = s_results[i];
+            ss << (i ? "," : "") << "\n    {\n"
+               << "      \"name\": \"" << r.name << "\",\n"
+               << "      \"run_type\": \"iteration\",\n"
+               << "      \"iterations\": " << r.iterations << ",\n"
+               << "      \"real_time\": " << r.real_time << ",\n"
+               << "      \"cpu_time\": " << r.cpu_time << ",\n"
+               << "      \"time_unit\": \"ns\",\n"
+               << "      \"items_per_second\": " << (r.real_time > 0 ? 1e9 / r.real_time : 0) << "\n"
+               << "    }";
+        }
+        ss << "\n  ]\n}\n";
+        return ss.str();
+    }
+
+    // ---------------- 协程 ----------------
+    void BenchFiber() {
+        sylar::Fiber::GetThis();
+
+        // 切入再切回, 每次迭代两次切换
+        Run("fiber/switch", [](uint64_t n) {
+            sylar::Fiber* self = nullptr;
+            bool stop = false;
+            sylar::Fiber::ptr fiber(new sylar::Fiber([&self, &stop]() {
+                while(!stop) {
+                    self->back();
+                }
+            }, 0, true));
+            self = fiber.get();
+            for(uint64_t i = 0; i < n; ++i) {
+                fiber->call();
+            }
+            // 让协程正常结束再析构
+            stop = true;
+            fiber->call();
+        });
+
+        // 每次新建协程(分配栈), 执行一个空函数, 销毁
+        Run("fiber/create_destroy", [](uint64_t n) {
+            for(uint64_t i = 0; i < n; ++i) {
+                sylar::Fiber::ptr fiber(new sylar::Fiber([]() {}, 0, true));
+                fiber->call();
+            }
+        });
+
+        // 通过Fiber::Create复用协程池里结束的协程
+        Run("fiber/create_pooled", [](uint64_t n) {
+            sylar::Fiber* main_fiber = sylar::Fiber::GetThis().get();
+            for(uint64_t i = 0; i < n; ++i) {
+                sylar::Fiber::ptr fiber = sylar::Fiber::Create([]() {});
+                fiber->swapIn();
+                // 不在调度器里时, 协程结束后swapOut把当前协程设成了调度协程(nullptr)
+                sylar::Fiber::SetThis(main_fiber);
+            }
+        });
+    }
+
+    // ---------------- 调度器 ----------------
+    void BenchSchedule() {
+        for(size_t threads = 1; threads <= s_options.max_threads; threads *= 2) {
+            std::string name = "schedule/threads:" + std::to_string(threads);
+            if(!Match(name)) {
+                continue;
+            }
+            sylar::IOManager iom(threads, false, "bench");
+            Run(name, [&iom](uint64_t n) {
+                std::atomic<uint64_t> done{0};
+                sylar::Semaphore sem;
+                for(uint64_t i = 0; i < n; ++i) {
+                    iom.schedule([&done, &sem, n]() {
+                        if(done.fetch_add(1, std::memory_order_relaxed) + 1 == n) {
+                            sem.notify();
+                        }
+                    });
+                }
+                sem.wait();
+            });
+            iom.stop();
+        }
+    }
+
+    // ---------------- 定时器 ----------------
+    class BenchTimerManager : public sylar::TimerManager {
+    public:
+        BenchTimerManager(Backend backend)
+            :TimerManager(backend) {
+        }
+    protected:
+        void onTimerInsertedAtFront() override {}
+    };
+
+    void BenchTimer() {
+        std::mt19937_64 rng(12345);
+        for(size_t count = 10000; count <= s_options.max_timers; count *= 10) {
+            for(int backend = 0; backend < 2; ++backend) {
+                std::string suffix = std::string(backend ? "/wheel" : "/set")
+                                     + "/timers:" + std::to_string(count);
+                BenchTimerManager::Backend type = backend ? sylar::TimerManager::WHEEL
+                                                          : sylar::TimerManager::SET;
+                std::vector<sylar::Timer::ptr> timers;
+                timers.reserve(count);
+
+                if(Match("timer/add" + suffix) || Match("timer/cancel" + suffix)) {
+                    BenchTimerManager mgr(type);
+                    uint64_t cpu_begin = NowNs(CLOCK_PROCESS_CPUTIME_ID);
+                    uint64_t begin = NowNs();
+                    for(size_t i = 0; i < count; ++i) {
+                        timers.push_back(mgr.addTimer(1000 + rng() % 3600000, []() {}, false));
+                    }
+                    if(Match("timer/add" + suffix)) {
+                        Report("timer/add" + suffix, count, NowNs() - begin
+                               ,NowNs(CLOCK_PROCESS_CPUTIME_ID) - cpu_begin);
+                    }
+
+                    std::shuffle(timers.begin(), timers.end(), rng);
+                    cpu_begin = NowNs(CLOCK_PROCESS_CPUTIME_ID);
+                    begin = NowNs();
+                    for(auto& i : timers) {
+                        i->cancel();
+                    }
+                    if(Match("timer/cancel" + suffix)) {
+                        Report("timer/cancel" + suffix, count, NowNs() - begin
+                               ,NowNs(CLOCK_PROCESS_CPUTIME_ID) - cpu_begin);
+                    }
+                    timers.clear();
+                }
+
+                if(Match("timer/expire" + suffix)) {
+                    // 都在50毫秒内到期, 等到期后只计listExpiredCb的耗时
+                    BenchTimerManager mgr(type);
+                    for(size_t i = 0; i < count; ++i) {
+                        mgr.addTimer(1 + rng() % 50, []() {}, false);
+                    }
+                    usleep(60 * 1000);
+                    std::vector<std::function<void()> > cbs;
+                    uint64_t cpu_begin = NowNs(CLOCK_PROCESS_CPUTIME_ID);
+                    uint64_t begin = NowNs();
+                    mgr.listExpiredCb(cbs);
+                    Report("timer/expire" + suffix, cbs.size(), NowNs() - begin
+                           ,NowNs(CLOCK_PROCESS_CPUTIME_ID) - cpu_begin);
+                }
+            }
+        }
+    }
+
+    // ---------------- hook socket ----------------
+    // 同一个IOManager里的两个协程通过回环TCP连接乒乓, 每次迭代一个64字节的往返
+    void BenchEcho() {
+        const std::string name = "hook/tcp_echo_rtt";
+        if(!Match(name)) {
+            return;
+        }
+        sylar::IOManager iom(2, false, "bench_echo");
+
+        int listen_fd = -1;
+        sockaddr_in addr;
+        sylar::Semaphore ready;
+        iom.schedule([&]() {
+            listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t len = sizeof(addr);
+            if(bind(listen_fd, (sockaddr*)&addr, len) || listen(listen_fd, 16)
+                    || getsockname(listen_fd, (sockaddr*)&addr, &len)) {
+                perror("echo server");
+                exit(1);
+            }
+            ready.notify();
+
+            int fd = accept(listen_fd, nullptr, nullptr);
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            char buf[4096];
+            while(true) {
+                ssize_t rt = read(fd, buf, sizeof(buf));
+                if(rt <= 0 || write(fd, buf, rt) != rt) {
+                    break;
+                }
+            }
+            close(fd);
+            close(listen_fd);
+        });
+        ready.wait();
+
+        int client_fd = -1;
+        iom.schedule([&]() {
+            client_fd = socket(AF_INET, SOCK_STREAM, 0);
+            if(connect(client_fd, (sockaddr*)&addr, sizeof(addr))) {
+                perror("echo client");
+                exit(1);
+            }
+            int one = 1;
+            setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            ready.notify();
+        });
+        ready.wait();
+
+        Run(name, [&](uint64_t n) {
+            sylar::Semaphore done;
+            iom.schedule([&]() {
+                char buf[64] = {0};
+                for(uint64_t i = 0; i < n; ++i) {
+                    if(write(client_fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+                        break;
+                    }
+                    size_t got = 0;
+                    while(got < sizeof(buf)) {
+                        ssize_t rt = read(client_fd, buf + got, sizeof(buf) - got);
+                        if(rt <= 0) {
+                            break;
+                        }
+                        got += rt;
+                    }
+                }
+                done.notify();
+            });
+            done.wait();
+        });
+
+        iom.schedule([&]() {
+            close(client_fd);
+        });
+        iom.stop();
+    }
+
+    // ---------------- TcpServer ----------------
+    // 回环上的TcpServer: echo_rtt 同hook/tcp_echo_rtt, 回包走连接的写队列
+    // connect 每次迭代建立并关闭一个连接, 测batch accept和连接的创建销毁
+    void BenchTcpServer() {
+        if(!Match("tcp_server/")) {
+            return;
+        }
+        sylar::IOManager iom(2, false, "bench_tcp");
+        sylar::IOManager accept_iom(1, false, "bench_accept");
+
+        sylar::TcpServer::ptr server(new sylar::TcpServer(&iom, &accept_iom));
+        server->setHandler([](sylar::TcpConnection::ptr conn) {
+            int one = 1;
+            setsockopt(conn->getSocket()->getSocket(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            char buf[4096];
+            while(true) {
+                int rt = conn->recv(buf, sizeof(buf));
+                if(rt <= 0 || !conn->send(buf, rt)) {
+                    break;
+                }
+            }
+        });
+        sylar::Address::ptr addr = sylar::IPv4Address::Create("127.0.0.1", 0);
+        if(!server->bind(addr) || !server->start()) {
+            fprintf(stderr, "tcp_server bind fail\n");
+            exit(1);
+        }
+        addr = server->getSocks()[0]->getLocalAddress();
+
+        if(Match("tcp_server/echo_rtt")) {
+            sylar::Socket::ptr client;
+            sylar::Semaphore ready;
+            iom.schedule([&]() {
+                client = sylar::Socket::CreateTCP(addr);
+                if(!client->connect(addr)) {
+                    perror("tcp_server client");
+                    exit(1);
+                }
+                int one = 1;
+                client->setOption(IPPROTO_TCP, TCP_NODELAY, one);
+                ready.notify();
+            });
+            ready.wait();
+
+            Run("tcp_server/echo_rtt", [&](uint64_t n) {
+                sylar::Semaphore done;
+                iom.schedule([&]() {
+                    char buf[64] = {0};
+                    for(uint64_t i = 0; i < n; ++i) {
+                        if(client->send(buf, sizeof(buf)) != (int)sizeof(buf)) {
+                            break;
+                        }
+                        size_t got = 0;
+                        while(got < sizeof(buf)) {
+                            int rt = client->recv(buf + got, sizeof(buf) - got);
+                            if(rt <= 0) {
+                                break;
+                            }
+                            got += rt;
+                        }
+                    }
+                    done.notify();
+                });
+                done.wait();
+            });
+
+            iom.schedule([&]() {
+                client->close();
+                client.reset();
+            });
+        }
+
+        if(Match("tcp_server/connect")) {
+            Run("tcp_server/connect", [&](uint64_t n) {
+                sylar::Semaphore done;
+                iom.schedule([&]() {
+                    for(uint64_t i = 0; i < n; ++i) {
+                        sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+                        if(!sock->connect(addr)) {
+                            break;
+                        }
+                        sock->close();
+                    }
+                    done.notify();
+                });
+                done.wait();
+            });
+        }
+
+        server->stop();
+        accept_iom.stop();
+        iom.stop();
+    }
+
+    // ---------------- 配置 ----------------
+    void BenchConfig() {
+        sylar::ConfigVar<int>::ptr var = sylar::Config::Lookup<int>("bench.value", 1, "bench value");
+
+        Run("config/lookup", [](uint64_t n) {
+            for(uint64_t i = 0; i < n; ++i) {
+                auto v = sylar::Config::Lookup<int>("bench.value");
+                DoNotOptimize(v);
+            }
+        });
+
+        Run("config/get_value", [var](uint64_t n) {
+            for(uint64_t i = 0; i < n; ++i) {
+                int v = var->getValue();
+                DoNotOptimize(v);
+            }
+        });
+
+        Run("config/handle_get_value", [](uint64_t n) {
+            static sylar::ConfigHandle<int> s_handle("bench.value", 0);
+            for(uint64_t i = 0; i < n; ++i) {
+                int v = s_handle.getValue();
+                DoNotOptimize(v);
+            }
+        });
+    }
+
+    // ---------------- 日志 ----------------
+    // 格式化但丢弃输出, 只测日志本身的开销
+    class NullLogAppender : public sylar::LogAppender {
+    public:
+        void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level
+                 ,sylar::LogEvent::ptr event) override {
+            if(level >= m_level) {
+                MutexType::Lock lock(m_mutex);
+                m_bytes += m_formatter->format(logger, level, event).size();
+            }
+        }
+
+        std::string toYamlString() override {
+            return "";
+        }
+    private:
+        uint64_t m_bytes = 0;
+    };
+
+    void BenchLog() {
+        sylar::Logger::ptr logger = SYLAR_LOG_NAME("bench");
+        logger->clearAppenders();
+        logger->addAppender(sylar::LogAppender::ptr(new NullLogAppender));
+
+        Run("log/filtered", [logger](uint64_t n) {
+            logger->setLevel(sylar::LogLevel::ERROR);
+            for(uint64_t i = 0; i < n; ++i) {
+                SYLAR_LOG_INFO(logger) << "bench filtered line i=" << i;
+            }
+        });
+
+        Run("log/emitted", [logger](uint64_t n) {
+            logger->setLevel(sylar::LogLevel::DEBUG);
+            for(uint64_t i = 0; i < n; ++i) {
+                SYLAR_LOG_INFO(logger) << "bench emitted line i=" << i;
+            }
+        });
+    }
+
+    void ParseArgs(int argc, char** argv) {
+        for(int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            size_t pos = arg.find('=');
+            std::string key = arg.substr(0, pos);
+            std::string value = pos == std::string::npos ? "" : arg.substr(pos + 1);
+            if(key == "--filter") {
+                s_options.filter = value;
+            } else if(key == "--min_time") {
+                s_options.min_time = atof(value.c_str());
+            } else if(key == "--max_threads") {
+                s_options.max_threads = std::max(1, atoi(value.c_str()));
+            } else if(key == "--max_timers") {
+                s_options.max_timers = strtoull(value.c_str(), nullptr, 10);
+            } else if(key == "--out") {
+                s_options.out = value;
+            } else {
+                fprintf(stderr, "usage: %s [--filter=substr] [--min_time=seconds]"
+                        " [--max_threads=N] [--max_timers=N] [--out=file]\n", argv[0]);
+                exit(1);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    ParseArgs(argc, argv);
+
+    // 调度器和IOManager的日志会干扰计时
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+
+    BenchFiber();
+    BenchSchedule();
+    BenchTimer();
+    BenchEcho();
+    BenchTcpServer();
+    BenchConfig();
+    BenchLog();
+
+    std::string json = ToJson();
+    if(s_options.out.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream ofs(s_options.out);
+        if(!ofs) {
+            fprintf(stderr, "open %s fail\n", s_options.out.c_str());
+            return 1;
+        }
+        ofs << json;
+    }
+    return 0;
+}
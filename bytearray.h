@@ -0,0 +1,183 @@
+//
+// Created by admin on 2025/8/26.
+//
+
+#ifndef BYTEARRAY_H
+#define BYTEARRAY_H
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <vector>
+
+namespace sylar {
+
+    // 二进制数组, 由固定大小的内存块链表组成, 提供序列化和反序列化
+    // 读写共用一个位置m_position, 写完之后setPosition回去再读
+    // 可读/可写区域可以导出成iovec, 直接交给readv/writev, 不需要中间拷贝
+    class ByteArray {
+    public:
+        typedef std::shared_ptr<ByteArray> ptr;
+
+        // 内存块
+        struct Node {
+            // 分配s字节的内存块
+            Node(size_t s);
+
+            Node();
+
+            ~Node();
+
+            // 内存块地址
+            char* ptr;
+            // 下一个内存块
+            Node* next;
+            // 内存块大小
+            size_t size;
+        };
+
+        // base_size 每个内存块的大小
+        ByteArray(size_t base_size = 4096);
+
+        ~ByteArray();
+
+        // 写固定长度的有符号/无符号整数, 按m_endian的字节序
+        void writeFint8  (int8_t value);
+        void writeFuint8 (uint8_t value);
+        void writeFint16 (int16_t value);
+        void writeFuint16(uint16_t value);
+        void writeFint32 (int32_t value);
+        void writeFuint32(uint32_t value);
+        void writeFint64 (int64_t value);
+        void writeFuint64(uint64_t value);
+
+        // 写变长的有符号整数, 先zigzag编码再varint
+        void writeInt32  (int32_t value);
+        void writeInt64  (int64_t value);
+
+        // 写变长的无符号整数(varint)
+        void writeUint32 (uint32_t value);
+        void writeUint64 (uint64_t value);
+
+        // 写浮点数, 按对应长度的整数写
+        void writeFloat  (float value);
+        void writeDouble (double value);
+
+        // 写字符串, 长度分别用uint16_t/uint32_t/uint64_t/varint表示
+        void writeStringF16(const std::string& value);
+        void writeStringF32(const std::string& value);
+        void writeStringF64(const std::string& value);
+        void writeStringVint(const std::string& value);
+
+        // 写字符串, 不带长度
+        void writeStringWithoutLength(const std::string& value);
+
+        // 读固定长度的整数, getReadSize()不够时抛出std::out_of_range
+        int8_t   readFint8();
+        uint8_t  readFuint8();
+        int16_t  readFint16();
+        uint16_t readFuint16();
+        int32_t  readFint32();
+        uint32_t readFuint32();
+        int64_t  readFint64();
+        uint64_t readFuint64();
+
+        // 读变长整数
+        int32_t  readInt32();
+        uint32_t readUint32();
+        int64_t  readInt64();
+        uint64_t readUint64();
+
+        // 读浮点数
+        float    readFloat();
+        double   readDouble();
+
+        // 读带长度的字符串
+        std::string readStringF16();
+        std::string readStringF32();
+        std::string readStringF64();
+        std::string readStringVint();
+
+        // 清空数据, 只保留第一个内存块
+        void clear();
+
+        // 写入size长度的数据, m_position随之后移
+        void write(const void* buf, size_t size);
+
+        // 读取size长度的数据, m_position随之后移, 数据不够时抛出std::out_of_range
+        void read(void* buf, size_t size);
+
+        // 从position开始读取size长度的数据, 不改变m_position
+        void read(void* buf, size_t size, size_t position) const;
+
+        // 当前位置
+        size_t getPosition() const { return m_position;}
+
+        // 设置当前位置, 超过容量时抛出std::out_of_range
+        // 超过已有数据时数据长度随之增加, 用于readv写入之后提交长度
+        void setPosition(size_t v);
+
+        // 把可读数据写入文件
+        bool writeToFile(const std::string& name) const;
+
+        // 从文件读取数据
+        bool readFromFile(const std::string& name);
+
+        // 内存块大小
+        size_t getBaseSize() const { return m_baseSize;}
+
+        // 可读的数据大小
+        size_t getReadSize() const { return m_size - m_position;}
+
+        // 是否是小端
+        bool isLittleEndian() const;
+
+        // 设置是否为小端, 默认是大端(网络字节序)
+        void setIsLittleEndian(bool val);
+
+        // 可读数据转成std::string
+        std::string toString() const;
+
+        // 可读数据转成16进制的std::string(格式:FF FF FF)
+        std::string toHexString() const;
+
+        // 把从当前位置开始最多len字节的可读数据导出成iovec, 不改变m_position
+        // 返回实际的长度
+        uint64_t getReadBuffers(std::vector<iovec>& buffers, uint64_t len = ~0ull) const;
+
+        // 把从position开始最多len字节的可读数据导出成iovec
+        uint64_t getReadBuffers(std::vector<iovec>& buffers, uint64_t len, uint64_t position) const;
+
+        // 从当前位置开始准备len字节的可写空间并导出成iovec, 不改变m_position
+        // 写入之后调用setPosition(getPosition() + n)提交
+        uint64_t getWriteBuffers(std::vector<iovec>& buffers, uint64_t len);
+
+        // 数据的长度
+        size_t getSize() const { return m_size;}
+    private:
+        // 扩容到至少可以再写size字节
+        void addCapacity(size_t size);
+
+        // 当前可写入的容量
+        size_t getCapacity() const { return m_capacity - m_position;}
+    private:
+        // 内存块的大小
+        size_t m_baseSize;
+        // 当前操作位置
+        size_t m_position;
+        // 当前的总容量
+        size_t m_capacity;
+        // 当前数据的大小
+        size_t m_size;
+        // 字节序, 默认大端
+        int8_t m_endian;
+        // 第一个内存块
+        Node* m_root;
+        // 当前位置所在的内存块
+        Node* m_cur;
+    };
+}
+
+#endif //BYTEARRAY_H
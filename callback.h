@@ -0,0 +1,155 @@
+//
+// Created by admin on 2025/8/30.
+//
+
+#ifndef CALLBACK_H
+#define CALLBACK_H
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sylar {
+
+    // 无参数无返回值的可调用对象, 用来代替调度路径上的std::function<void()>
+    // 不超过INLINE_SIZE字节并且移动不抛异常的对象直接放在内部缓冲区, 不分配内存
+    // std::function<void()>本身也能放进缓冲区, 已有的std::function传进来只多一次移动
+    // 只能移动, 不能拷贝
+    class Callback {
+    public:
+        static const size_t INLINE_SIZE = 48;
+
+        Callback() noexcept {}
+
+        Callback(std::nullptr_t) noexcept {}
+
+        template<class F, class D = typename std::decay<F>::type,
+                 class = typename std::enable_if<!std::is_same<D, Callback>::value
+                                    && std::is_invocable_r<void, D&>::value>::type>
+        Callback(F&& f) {
+            if(IsEmpty(f)) {
+                return;
+            }
+            if constexpr (sizeof(D) <= INLINE_SIZE
+                    && alignof(D) <= alignof(std::max_align_t)
+                    && std::is_nothrow_move_constructible<D>::value) {
+                new (m_buf) D(std::forward<F>(f));
+                m_ops = &InlineOps<D>::s_ops;
+            } else {
+                *(D**)m_buf = new D(std::forward<F>(f));
+                m_ops = &HeapOps<D>::s_ops;
+            }
+        }
+
+        Callback(Callback&& rhs) noexcept {
+            moveFrom(rhs);
+        }
+
+        Callback& operator=(Callback&& rhs) noexcept {
+            if(this != &rhs) {
+                reset();
+                moveFrom(rhs);
+            }
+            return *this;
+        }
+
+        Callback& operator=(std::nullptr_t) noexcept {
+            reset();
+            return *this;
+        }
+
+        Callback(const Callback&) = delete;
+        Callback& operator=(const Callback&) = delete;
+
+        ~Callback() {
+            reset();
+        }
+
+        void operator()() {
+            m_ops->invoke(m_buf);
+        }
+
+        explicit operator bool() const noexcept { return m_ops != nullptr;}
+
+        // 释放持有的对象
+        void reset() noexcept {
+            if(m_ops) {
+                m_ops->destroy(m_buf);
+                m_ops = nullptr;
+            }
+        }
+
+        void swap(Callback& rhs) noexcept {
+            Callback tmp(std::move(rhs));
+            rhs = std::move(*this);
+            *this = std::move(tmp);
+        }
+
+        // 是否存放在内部缓冲区(没有额外分配)
+        bool isInline() const noexcept { return m_ops && m_ops->inline_storage;}
+    private:
+        struct Ops {
+            void (*invoke)(void* buf);
+            // 把src的对象移动到dst, 并销毁src里的对象
+            void (*move)(void* dst, void* src) noexcept;
+            void (*destroy)(void* buf) noexcept;
+            bool inline_storage;
+        };
+
+        template<class D>
+        struct InlineOps {
+            static void Invoke(void* buf) {
+                (*(D*)buf)();
+            }
+            static void Move(void* dst, void* src) noexcept {
+                new (dst) D(std::move(*(D*)src));
+                ((D*)src)->~D();
+            }
+            static void Destroy(void* buf) noexcept {
+                ((D*)buf)->~D();
+            }
+            static constexpr Ops s_ops = {&Invoke, &Move, &Destroy, true};
+        };
+
+        template<class D>
+        struct HeapOps {
+            static void Invoke(void* buf) {
+                (**(D**)buf)();
+            }
+            static void Move(void* dst, void* src) noexcept {
+                *(D**)dst = *(D**)src;
+            }
+            static void Destroy(void* buf) noexcept {
+                delete *(D**)buf;
+            }
+            static constexpr Ops s_ops = {&Invoke, &Move, &Destroy, false};
+        };
+
+        // 空的std::function和空函数指针当作空的Callback
+        template<class D>
+        static bool IsEmpty(const D& f) {
+            if constexpr (std::is_pointer<D>::value) {
+                return f == nullptr;
+            } else if constexpr (std::is_same<D, std::function<void()> >::value) {
+                return !f;
+            } else {
+                return false;
+            }
+        }
+
+        void moveFrom(Callback& rhs) noexcept {
+            if(rhs.m_ops) {
+                rhs.m_ops->move(m_buf, rhs.m_buf);
+                m_ops = rhs.m_ops;
+                rhs.m_ops = nullptr;
+            }
+        }
+    private:
+        alignas(std::max_align_t) unsigned char m_buf[INLINE_SIZE];
+        const Ops* m_ops = nullptr;
+    };
+}
+
+#endif //CALLBACK_H
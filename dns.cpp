@@ -0,0 +1,548 @@
+//
+// Created by admin on 2025/8/28.
+//
+
+#include "dns.h"
+#include "log.h"
+#include "Config.h"
+#include "fiber.h"
+#include "Schedule.h"
+#include "hook.h"
+#include "socket.h"
+#include "util.h"
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace sylar {
+
+    static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+    static sylar::ConfigVar<bool>::ptr g_dns_enable =
+        sylar::Config::Lookup("dns.enable", true, "use async dns resolver in fibers");
+
+    static sylar::ConfigVar<std::vector<std::string> >::ptr g_dns_servers =
+        sylar::Config::Lookup("dns.servers", std::vector<std::string>(),
+                              "dns servers ip[:port], empty means /etc/resolv.conf");
+
+    static sylar::ConfigVar<uint32_t>::ptr g_dns_timeout =
+        sylar::Config::Lookup("dns.timeout", (uint32_t)2000, "dns query timeout(ms) per server");
+
+    static sylar::ConfigVar<uint32_t>::ptr g_dns_retry =
+        sylar::Config::Lookup("dns.retry", (uint32_t)1, "dns query retry times over all servers");
+
+    static sylar::ConfigVar<uint32_t>::ptr g_dns_max_ttl =
+        sylar::Config::Lookup("dns.max_ttl", (uint32_t)3600, "dns cache max ttl(s)");
+
+    static sylar::ConfigVar<uint32_t>::ptr g_dns_negative_ttl =
+        sylar::Config::Lookup("dns.negative_ttl", (uint32_t)30, "dns negative cache ttl(s)");
+
+    static sylar::ConfigVar<uint32_t>::ptr g_dns_cache_size =
+        sylar::Config::Lookup("dns.cache_size", (uint32_t)10000, "dns cache max entries");
+
+    static const uint16_t DNS_TYPE_A = 1;
+    static const uint16_t DNS_TYPE_AAAA = 28;
+    static const uint16_t DNS_CLASS_IN = 1;
+    static const uint16_t DNS_PORT = 53;
+    // 不带EDNS时UDP响应最大512字节, 留些余量
+    static const size_t DNS_BUFFER_SIZE = 1232;
+
+    // 构造查询报文, 只有一个问题, 要求递归
+    static bool BuildQuery(std::string& out, uint16_t id, const std::string& name, uint16_t qtype) {
+        out.clear();
+        const uint8_t header[12] = {(uint8_t)(id >> 8), (uint8_t)id, 0x01, 0x00,
+                                    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+        out.append((const char*)header, sizeof(header));
+        size_t start = 0;
+        while(start < name.size()) {
+            size_t dot = name.find('.', start);
+            if(dot == std::string::npos) {
+                dot = name.size();
+            }
+            size_t len = dot - start;
+            if(len == 0 || len > 63) {
+                return false;
+            }
+            out.push_back((char)len);
+            out.append(name, start, len);
+            start = dot + 1;
+        }
+        out.push_back('\0');
+        if(out.size() - sizeof(header) > 255) {
+            return false;
+        }
+        out.push_back((char)(qtype >> 8));
+        out.push_back((char)qtype);
+        out.push_back((char)(DNS_CLASS_IN >> 8));
+        out.push_back((char)DNS_CLASS_IN);
+        return true;
+    }
+
+    // 跳过一个域名(可能带压缩指针), 返回之后的位置, 出错返回0
+    static size_t SkipName(const uint8_t* buf, size_t len, size_t pos) {
+        while(pos < len) {
+            uint8_t c = buf[pos];
+            if((c & 0xC0) == 0xC0) {
+                return pos + 2 <= len ? pos + 2 : 0;
+            }
+            if(c == 0) {
+                return pos + 1;
+            }
+            pos += c + 1;
+        }
+        return 0;
+    }
+
+    static uint16_t ReadU16(const uint8_t* p) {
+        return ((uint16_t)p[0] << 8) | p[1];
+    }
+
+    static uint32_t ReadU32(const uint8_t* p) {
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+            | ((uint32_t)p[2] << 8) | p[3];
+    }
+
+    enum ParseResult {
+        // 不是这次查询的响应, 继续等
+        PARSE_MISMATCH,
+        // 服务器出错或报文格式错误, 换下一个服务器
+        PARSE_FAIL,
+        // 有结果
+        PARSE_OK,
+        // 域名不存在或者没有这种记录
+        PARSE_NONE
+    };
+
+    // 解析响应, 取出所有A/AAAA记录(CNAME链的目标记录也在answer里), ttl 取最小值
+    static ParseResult ParseResponse(const uint8_t* buf, size_t len, uint16_t id, uint16_t qtype,
+                                     std::vector<IPAddress::ptr>& addrs, uint32_t& ttl) {
+        if(len < 12 || ReadU16(buf) != id) {
+            return PARSE_MISMATCH;
+        }
+        uint16_t flags = ReadU16(buf + 2);
+        if(!(flags & 0x8000)) {
+            return PARSE_MISMATCH;
+        }
+        uint16_t rcode = flags & 0x000F;
+        if(rcode == 3) {
+            return PARSE_NONE;
+        }
+        if(rcode != 0) {
+            return PARSE_FAIL;
+        }
+        uint16_t qdcount = ReadU16(buf + 4);
+        uint16_t ancount = ReadU16(buf + 6);
+        size_t pos = 12;
+        for(uint16_t i = 0; i < qdcount; ++i) {
+            pos = SkipName(buf, len, pos);
+            if(!pos || pos + 4 > len) {
+                return PARSE_FAIL;
+            }
+            pos += 4;
+        }
+        ttl = UINT32_MAX;
+        for(uint16_t i = 0; i < ancount; ++i) {
+            pos = SkipName(buf, len, pos);
+            if(!pos || pos + 10 > len) {
+                return PARSE_FAIL;
+            }
+            uint16_t type = ReadU16(buf + pos);
+            uint16_t cls = ReadU16(buf + pos + 2);
+            uint32_t rttl = ReadU32(buf + pos + 4);
+            uint16_t rdlen = ReadU16(buf + pos + 8);
+            pos += 10;
+            if(pos + rdlen > len) {
+                return PARSE_FAIL;
+            }
+            if(cls == DNS_CLASS_IN && type == qtype) {
+                if(type == DNS_TYPE_A && rdlen == 4) {
+                    sockaddr_in addr;
+                    memset(&addr, 0, sizeof(addr));
+                    addr.sin_family = AF_INET;
+                    memcpy(&addr.sin_addr, buf + pos, 4);
+                    addrs.push_back(std::make_shared<IPv4Address>(addr));
+                    ttl = std::min(ttl, rttl);
+                } else if(type == DNS_TYPE_AAAA && rdlen == 16) {
+                    addrs.push_back(std::make_shared<IPv6Address>(buf + pos));
+                    ttl = std::min(ttl, rttl);
+                }
+            }
+            pos += rdlen;
+        }
+        return addrs.empty() ? PARSE_NONE : PARSE_OK;
+    }
+
+    // 解析 ip / ip:port / [ipv6]:port
+    static IPAddress::ptr ParseServer(const std::string& str) {
+        std::string host = str;
+        uint16_t port = DNS_PORT;
+        if(!str.empty() && str[0] == '[') {
+            size_t end = str.find(']');
+            if(end == std::string::npos) {
+                return nullptr;
+            }
+            host = str.substr(1, end - 1);
+            if(end + 1 < str.size() && str[end + 1] == ':') {
+                port = atoi(str.c_str() + end + 2);
+            }
+        } else if(std::count(str.begin(), str.end(), ':') == 1) {
+            size_t end = str.find(':');
+            host = str.substr(0, end);
+            port = atoi(str.c_str() + end + 1);
+        }
+        return IPAddress::Create(host.c_str(), port);
+    }
+
+    // 浅拷贝一份地址, 缓存里的地址是共享的, 不能直接改端口
+    static IPAddress::ptr CloneAddress(const IPAddress::ptr& addr) {
+        return std::dynamic_pointer_cast<IPAddress>(
+                Address::Create(addr->getAddr(), addr->getAddrLen()));
+    }
+
+    static bool MatchFamily(const IPAddress::ptr& addr, int family) {
+        return family == AF_UNSPEC || addr->getFamily() == family;
+    }
+
+    DnsResolver::DnsResolver() {
+        reload();
+    }
+
+    void DnsResolver::reload() {
+        reload(g_dns_servers->getValue());
+    }
+
+    void DnsResolver::reload(const std::vector<std::string>& dns_servers) {
+        // search/domain/ndots总是从/etc/resolv.conf读, nameserver只在没有配置dns.servers时使用
+        std::vector<IPAddress::ptr> servers;
+        std::vector<std::string> conf = dns_servers;
+        std::vector<std::string> search;
+        uint32_t ndots = 1;
+        {
+            std::ifstream ifs("/etc/resolv.conf");
+            std::string line;
+            while(std::getline(ifs, line)) {
+                std::stringstream ss(line);
+                std::string key, value;
+                ss >> key;
+                if(key == "nameserver") {
+                    ss >> value;
+                    if(!value.empty() && dns_servers.empty()) {
+                        conf.push_back(value);
+                    }
+                } else if(key == "search" || key == "domain") {
+                    // 和glibc一样, 后出现的search/domain覆盖前面的
+                    search.clear();
+                    while(ss >> value) {
+                        if(value.back() == '.') {
+                            value.pop_back();
+                        }
+                        if(!value.empty()) {
+                            std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+                            search.push_back(value);
+                        }
+                    }
+                } else if(key == "options") {
+                    while(ss >> value) {
+                        if(value.compare(0, 6, "ndots:") == 0) {
+                            ndots = std::min<uint32_t>(15, strtoul(value.c_str() + 6, nullptr, 10));
+                        }
+                    }
+                }
+            }
+        }
+        for(auto& i : conf) {
+            IPAddress::ptr addr = ParseServer(i);
+            if(addr) {
+                servers.push_back(addr);
+            } else {
+                SYLAR_LOG_ERROR(g_logger) << "DnsResolver invalid server " << i;
+            }
+        }
+
+        std::unordered_map<std::string, std::vector<IPAddress::ptr> > hosts;
+        std::ifstream ifs("/etc/hosts");
+        std::string line;
+        while(std::getline(ifs, line)) {
+            size_t comment = line.find('#');
+            if(comment != std::string::npos) {
+                line.resize(comment);
+            }
+            std::stringstream ss(line);
+            std::string ip, name;
+            ss >> ip;
+            IPAddress::ptr addr = ip.empty() ? nullptr : IPAddress::Create(ip.c_str(), 0);
+            if(!addr) {
+                continue;
+            }
+            while(ss >> name) {
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+                hosts[name].push_back(addr);
+            }
+        }
+
+        {
+            RWMutex::WriteLock lock(m_mutex);
+            m_servers.swap(servers);
+            m_hosts.swap(hosts);
+            m_search.swap(search);
+            m_ndots = ndots;
+        }
+        clear();
+    }
+
+    void DnsResolver::clear() {
+        for(size_t i = 0; i < SHARD_COUNT; ++i) {
+            Mutex::Lock lock(m_shards[i].mutex);
+            m_shards[i].cache.clear();
+        }
+    }
+
+    std::vector<IPAddress::ptr> DnsResolver::getServers() {
+        RWMutex::ReadLock lock(m_mutex);
+        return m_servers;
+    }
+
+    std::vector<std::string> DnsResolver::getSearchNames(const std::string& name) {
+        std::vector<std::string> names;
+        // 以'.'结尾的是完整域名, 不加后缀
+        if(!name.empty() && name.back() == '.') {
+            names.push_back(name);
+            return names;
+        }
+        uint32_t dots = std::count(name.begin(), name.end(), '.');
+        RWMutex::ReadLock lock(m_mutex);
+        // 点数不少于ndots时先按原名查, 否则先试search后缀
+        if(dots >= m_ndots) {
+            names.push_back(name);
+        }
+        for(auto& i : m_search) {
+            names.push_back(name + "." + i);
+        }
+        if(dots < m_ndots) {
+            names.push_back(name);
+        }
+        return names;
+    }
+
+    bool DnsResolver::lookupHosts(std::vector<IPAddress::ptr>& result,
+                                  const std::string& name, int family) {
+        RWMutex::ReadLock lock(m_mutex);
+        auto it = m_hosts.find(name);
+        if(it == m_hosts.end()) {
+            return false;
+        }
+        size_t size = result.size();
+        for(auto& i : it->second) {
+            if(MatchFamily(i, family)) {
+                result.push_back(i);
+            }
+        }
+        return result.size() > size;
+    }
+
+    int DnsResolver::lookup(std::vector<Address::ptr>& result, const std::string& node,
+                            const char* service, int family) {
+        if(!g_dns_enable->getValue() || !sylar::is_hook_enable() || !Scheduler::GetThis()) {
+            return -1;
+        }
+        if(node.empty() || (family != AF_INET && family != AF_INET6 && family != AF_UNSPEC)) {
+            return -1;
+        }
+        // 数字地址getaddrinfo不会发网络请求
+        in6_addr tmp;
+        if(inet_pton(AF_INET, node.c_str(), &tmp) == 1
+                || inet_pton(AF_INET6, node.c_str(), &tmp) == 1) {
+            return -1;
+        }
+        uint16_t port = 0;
+        if(service && *service) {
+            char* end = nullptr;
+            unsigned long v = strtoul(service, &end, 10);
+            // 服务名(比如http)交给getaddrinfo查/etc/services
+            if(*end || v > UINT16_MAX) {
+                return -1;
+            }
+            port = v;
+        }
+
+        std::string name = node;
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        std::vector<IPAddress::ptr> addrs;
+        if(!lookupHosts(addrs, name, family)) {
+            if(getServers().empty()) {
+                return -1;
+            }
+            // 按resolv.conf的search/ndots依次尝试, 第一个有结果的为准
+            bool found = false;
+            for(auto& i : getSearchNames(name)) {
+                if(resolve(addrs, i, family)) {
+                    found = true;
+                    break;
+                }
+            }
+            if(!found) {
+                SYLAR_LOG_DEBUG(g_logger) << "DnsResolver::lookup(" << node << ", "
+                    << family << ") failed";
+                return 0;
+            }
+        }
+        for(auto& i : addrs) {
+            IPAddress::ptr addr = CloneAddress(i);
+            if(addr) {
+                addr->setPort(port);
+                result.push_back(addr);
+            }
+        }
+        return result.empty() ? 0 : 1;
+    }
+
+    bool DnsResolver::resolve(std::vector<IPAddress::ptr>& result, const std::string& name,
+                              int family) {
+        std::string key = name;
+        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+        if(!key.empty() && key.back() == '.') {
+            key.pop_back();
+        }
+        bool ok = false;
+        if(family == AF_INET || family == AF_UNSPEC) {
+            ok |= resolveOne(result, key, DNS_TYPE_A);
+        }
+        if(family == AF_INET6 || family == AF_UNSPEC) {
+            ok |= resolveOne(result, key, DNS_TYPE_AAAA);
+        }
+        return ok;
+    }
+
+    bool DnsResolver::resolveOne(std::vector<IPAddress::ptr>& result, const std::string& name,
+                                 uint16_t qtype) {
+        std::string key = name;
+        key.push_back('/');
+        key.append(std::to_string(qtype));
+        Shard& shard = m_shards[std::hash<std::string>()(key) % SHARD_COUNT];
+
+        Query::ptr query;
+        bool leader = false;
+        {
+            Mutex::Lock lock(shard.mutex);
+            auto it = shard.cache.find(key);
+            if(it != shard.cache.end()) {
+                if(it->second.expire > sylar::GetCurrentMS()) {
+                    result.insert(result.end(), it->second.addrs.begin(), it->second.addrs.end());
+                    return !it->second.addrs.empty();
+                }
+                shard.cache.erase(it);
+            }
+            auto& q = shard.inflight[key];
+            if(!q) {
+                q = std::make_shared<Query>();
+                leader = true;
+            } else {
+                q->waiters.push();
+            }
+            query = q;
+        }
+
+        if(!leader) {
+            // 发起查询的协程拿到结果之后再唤醒
+            Fiber::YieldToHold();
+            result.insert(result.end(), query->entry.addrs.begin(), query->entry.addrs.end());
+            return !query->entry.addrs.empty();
+        }
+
+        query->ok = this->query(name, qtype, query->entry);
+        {
+            Mutex::Lock lock(shard.mutex);
+            if(query->ok) {
+                size_t limit = std::max<size_t>(1, g_dns_cache_size->getValue() / SHARD_COUNT);
+                if(shard.cache.size() >= limit) {
+                    uint64_t now = sylar::GetCurrentMS();
+                    for(auto it = shard.cache.begin(); it != shard.cache.end();) {
+                        if(it->second.expire <= now) {
+                            it = shard.cache.erase(it);
+                        } else {
+                            ++it;
+                        }
+                    }
+                    if(shard.cache.size() >= limit) {
+                        shard.cache.erase(shard.cache.begin());
+                    }
+                }
+                shard.cache[key] = query->entry;
+            }
+            shard.inflight.erase(key);
+            query->waiters.wakeAll();
+        }
+        result.insert(result.end(), query->entry.addrs.begin(), query->entry.addrs.end());
+        return !query->entry.addrs.empty();
+    }
+
+    bool DnsResolver::query(const std::string& name, uint16_t qtype, Entry& entry) {
+        std::vector<IPAddress::ptr> servers = getServers();
+        if(servers.empty()) {
+            return false;
+        }
+        static thread_local std::mt19937 s_rng(std::random_device{}());
+        uint32_t timeout = g_dns_timeout->getValue();
+        uint32_t retry = g_dns_retry->getValue();
+        std::string req;
+        uint8_t buf[DNS_BUFFER_SIZE];
+
+        for(uint32_t attempt = 0; attempt <= retry; ++attempt) {
+            for(auto& server : servers) {
+                uint16_t id = (uint16_t)s_rng();
+                if(!BuildQuery(req, id, name, qtype)) {
+                    SYLAR_LOG_DEBUG(g_logger) << "DnsResolver invalid name " << name;
+                    return false;
+                }
+                Socket::ptr sock = Socket::CreateUDP(server);
+                sock->setRecvTimeout(timeout);
+                if(!sock->connect(server) || sock->send(req.data(), req.size()) <= 0) {
+                    continue;
+                }
+                while(true) {
+                    int n = sock->recv(buf, sizeof(buf));
+                    if(n <= 0) {
+                        SYLAR_LOG_DEBUG(g_logger) << "DnsResolver query " << name
+                            << " server=" << *server << " timeout";
+                        break;
+                    }
+                    std::vector<IPAddress::ptr> addrs;
+                    uint32_t ttl = 0;
+                    ParseResult rt = ParseResponse(buf, n, id, qtype, addrs, ttl);
+                    if(rt == PARSE_MISMATCH) {
+                        continue;
+                    }
+                    if(rt == PARSE_FAIL) {
+                        break;
+                    }
+                    if(rt == PARSE_OK) {
+                        ttl = std::max<uint32_t>(1, std::min(ttl, g_dns_max_ttl->getValue()));
+                    } else {
+                        ttl = g_dns_negative_ttl->getValue();
+                    }
+                    entry.addrs.swap(addrs);
+                    entry.expire = sylar::GetCurrentMS() + (uint64_t)ttl * 1000;
+                    return true;
+                }
+            }
+        }
+        SYLAR_LOG_ERROR(g_logger) << "DnsResolver query " << name << " type=" << qtype
+            << " failed, servers=" << servers.size();
+        return false;
+    }
+
+    struct DnsIniter {
+        DnsIniter() {
+            g_dns_servers->addListener([](const std::vector<std::string>& old_value,
+                                          const std::vector<std::string>& new_value) {
+                DnsResolverMgr::GetInstance().reload(new_value);
+            });
+        }
+    };
+
+    static DnsIniter __dns_init;
+}
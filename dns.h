@@ -0,0 +1,105 @@
+//
+// Created by admin on 2025/8/28.
+//
+
+#ifndef DNS_H
+#define DNS_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "address.h"
+#include "mutex.h"
+#include "singleton.h"
+#include "fiber_sync.h"
+
+namespace sylar {
+
+    // 协程里使用的异步DNS解析器
+    // getaddrinfo没有hook, 一次慢查询会卡住整个IOManager线程, 这里直接用hook之后的UDP socket发查询
+    // 结果按TTL缓存(分片加锁), 解析失败的域名也缓存一段时间(dns.negative_ttl)
+    // 同一个域名的并发查询合并成一次, 后来的协程挂起等第一个查询的结果
+    class DnsResolver {
+    public:
+        typedef std::shared_ptr<DnsResolver> ptr;
+
+        DnsResolver();
+
+        // 给Address::Lookup用, node 域名, service 端口(只支持数字), family 协议簇
+        // return 1 成功, 0 解析失败, -1 不适用(不在协程里/数字地址/没有可用的DNS服务器/未开启)
+        //        返回-1时调用方应退回到getaddrinfo
+        int lookup(std::vector<Address::ptr>& result, const std::string& node,
+                   const char* service, int family);
+
+        // 解析域名, 结果的端口为0, 只能在开启hook的协程里调用
+        // family AF_INET 查A记录, AF_INET6 查AAAA记录, AF_UNSPEC 两个都查
+        bool resolve(std::vector<IPAddress::ptr>& result, const std::string& name,
+                     int family = AF_INET);
+
+        // 清空缓存
+        void clear();
+
+        // 重新读取DNS服务器(dns.servers, 为空时读/etc/resolv.conf), search/ndots和/etc/hosts
+        void reload();
+
+        // 同上, 用servers代替dns.servers的当前值, 给配置变化回调用
+        void reload(const std::vector<std::string>& servers);
+    private:
+        // 缓存项, addrs为空表示否定缓存
+        struct Entry {
+            std::vector<IPAddress::ptr> addrs;
+            // 过期时间(毫秒)
+            uint64_t expire = 0;
+        };
+
+        // 正在进行的查询
+        struct Query {
+            typedef std::shared_ptr<Query> ptr;
+            // 查询是否成功(包括域名不存在这种确定的结果)
+            bool ok = false;
+            Entry entry;
+            // 等待结果的协程, 由所在分片的mutex保护
+            FiberWaitQueue waiters;
+        };
+
+        // 缓存分片, 减少线程之间的锁竞争
+        struct Shard {
+            Mutex mutex;
+            std::unordered_map<std::string, Entry> cache;
+            std::unordered_map<std::string, Query::ptr> inflight;
+        };
+
+        static const size_t SHARD_COUNT = 16;
+
+        // 查询一种记录, 带缓存和合并
+        bool resolveOne(std::vector<IPAddress::ptr>& result, const std::string& name,
+                        uint16_t qtype);
+
+        // 向DNS服务器发查询, return 是否得到确定的结果
+        bool query(const std::string& name, uint16_t qtype, Entry& entry);
+
+        // 当前的DNS服务器
+        std::vector<IPAddress::ptr> getServers();
+
+        // 按/etc/resolv.conf的search和ndots展开成依次尝试的完整域名
+        std::vector<std::string> getSearchNames(const std::string& name);
+
+        // 在/etc/hosts里查找
+        bool lookupHosts(std::vector<IPAddress::ptr>& result, const std::string& name, int family);
+    private:
+        Shard m_shards[SHARD_COUNT];
+        // 保护m_servers, m_hosts, m_search, m_ndots
+        RWMutex m_mutex;
+        std::vector<IPAddress::ptr> m_servers;
+        std::unordered_map<std::string, std::vector<IPAddress::ptr> > m_hosts;
+        // resolv.conf的search域名
+        std::vector<std::string> m_search;
+        // 点数少于m_ndots的域名先试search后缀
+        uint32_t m_ndots = 1;
+    };
+
+    typedef sylar::Singleton<DnsResolver> DnsResolverMgr;
+}
+
+#endif //DNS_H
@@ -10,13 +10,14 @@
 
 #include <byteswap.h>
 #include <stdint.h>
+#include <type_traits>
 
 namespace sylar {
 
     // 首先使用enablie_if检测是否是8字节数据量
     // 随后使用bswap_64来进行转换
     template <class T>
-    typename std::enable_if<sizeof(T) == sizeof(uint8_t), T>::type
+    typename std::enable_if<sizeof(T) == sizeof(uint64_t), T>::type
     byteswap(T value) {
         return (T)bswap_64((uint64_t)value);
     }
@@ -41,7 +42,14 @@ namespace sylar {
      * 統一的宏（SYLAR_BYTE_ORDER），以便在專案內部以一致的方式處理字序問題，
      * 增加程式碼的可移植性和可讀性。
      */
-#if BYTE_ORDER == BIG_ENDIAN
+    // 本文件和系统的<endian.h>同名, 引用顺序不对时BYTE_ORDER可能没有定义, 优先用编译器内置的宏
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define SYLAR_BYTE_ORDER SYLAR_BIG_ENDIAN
+#else
+#define SYLAR_BYTE_ORDER SYLAR_LITTLE_ENDIAN
+#endif
+#elif BYTE_ORDER == BIG_ENDIAN
     // 如果系統宏 BYTE_ORDER 等於 BIG_ENDIAN，表示當前系統為「大字序」（Big Endian）。
     // 在這種情況下，將專案自定義的字序宏 SYLAR_BYTE_ORDER 定義為 SYLAR_BIG_ENDIAN (其值為 2)。
 #define SYLAR_BYTE_ORDER SYLAR_BIG_ENDIAN
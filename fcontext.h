@@ -0,0 +1,35 @@
+//
+// Created by admin on 2025/8/5.
+//
+
+#ifndef FCONTEXT_H
+#define FCONTEXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * 手写汇编的协程上下文切换(参考boost.context的fcontext)
+ * swapcontext每次切换都要sigprocmask保存/恢复信号掩码, 是一次系统调用
+ * 这里只保存被调用者保存寄存器(callee-saved)和浮点控制字, 完全在用户态完成
+ *
+ * fcontext_t 就是保存了寄存器的栈顶指针
+ */
+extern "C" {
+    typedef void* fcontext_t;
+
+    /**
+     * 保存当前上下文到 *ofc, 并切换到 nfc
+     * vp 会作为 nfc 的返回值(首次进入时作为入口函数的参数)
+     */
+    intptr_t sylar_jump_fcontext(fcontext_t* ofc, fcontext_t nfc, intptr_t vp);
+
+    /**
+     * 在栈上构造一个上下文, 首次切换进去时执行 fn
+     * sp 为栈顶(高地址), size 为栈大小
+     * fn 不允许返回, 返回会直接_exit
+     */
+    fcontext_t sylar_make_fcontext(void* sp, size_t size, void (*fn)(intptr_t));
+}
+
+#endif //FCONTEXT_H
@@ -6,7 +6,15 @@
 #include "config.h"
 #include "log.h"
 #include "macro.h"
+#include "Schedule.h"
+#include "watchdog.h"
 #include <atomic>
+#include <unordered_map>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
 
 // 个人觉得还是把流程图跟要点写下来
 // 不写的话,再过三天连我自己都看不懂了
@@ -37,10 +45,57 @@ namespace sylar {
     // 线程指针(主协程智能指针)
     static thread_local Fiber::ptr t_threadFiber = nullptr;
 
+    static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
     // 配置指定协程的 栈大小
     static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
         Config::Lookup<uint32_t>("fiber.stack_size",128 * 1024, "fiber stack size");
 
+    // 配置协程栈分配器, malloc 或 pooled
+    static ConfigVar<std::string>::ptr g_fiber_stack_allocator =
+        Config::Lookup<std::string>("fiber.stack_allocator", "malloc", "fiber stack allocator(malloc|pooled)");
+
+    // 共享栈大小
+    static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+        Config::Lookup<uint32_t>("fiber.shared_stack_size", 1024 * 1024, "fiber shared stack size");
+
+    // 栈池每个线程每种栈大小最多缓存的栈数量
+    static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_size =
+        Config::Lookup<uint32_t>("fiber.stack_pool_size", 64, "fiber stack pool size per thread");
+
+    // 配置值缓存, 避免每次创建协程都去读配置
+    static std::atomic<bool> s_pooled_stack {false};
+    static std::atomic<uint32_t> s_stack_pool_size {64};
+
+    // 池中缓存的栈数量
+    static std::atomic<uint64_t> s_stack_pooled {0};
+    // 正在被协程使用的栈数量
+    static std::atomic<uint64_t> s_stack_in_use {0};
+
+    static ConfigVar<uint32_t>::ptr g_fiber_pool_size =
+        Config::Lookup<uint32_t>("fiber.pool_size", 64, "per-thread reusable fiber pool size");
+
+    // Create复用协程的次数
+    static std::atomic<uint64_t> s_fiber_reused {0};
+
+    struct _FiberIniter {
+        _FiberIniter() {
+            s_pooled_stack = g_fiber_stack_allocator->getValue() == "pooled";
+            s_stack_pool_size = g_fiber_stack_pool_size->getValue();
+
+            g_fiber_stack_allocator->addListener([](const std::string& old_value, const std::string& new_value){
+                SYLAR_LOG_INFO(g_logger) << "fiber stack allocator changed from "
+                                         << old_value << " to " << new_value;
+                s_pooled_stack = new_value == "pooled";
+            });
+            g_fiber_stack_pool_size->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+                s_stack_pool_size = new_value;
+            });
+        }
+    };
+
+    static _FiberIniter s_fiber_initer;
+
     //我们想要统一管理栈大小
     class MallocStackAllocator {
     public:
@@ -56,7 +111,153 @@ namespace sylar {
         }
     };
 
-    using StackAllocator = MallocStackAllocator;
+    /**
+     * 基于mmap的栈池
+     * 1. 每个栈的最低地址放一个PROT_NONE的保护页, 栈溢出直接SIGSEGV而不是踩坏别的内存
+     * 2. mmap只是预留地址空间, 物理页在协程真正用到时才分配(缺页时提交)
+     *    所以128K的栈实际只占用协程摸到的那几页
+     * 3. 每个线程按栈大小维护空闲链表, 释放的栈先缓存起来给下一个协程复用
+     *    协程一般在同一个调度线程上创建和销毁, 所以不需要加锁
+     */
+    class PooledStackAllocator {
+    public:
+        static void* Alloc(size_t size) {
+            size = RoundUp(size);
+            std::vector<void*>& free_list = t_pool.free_lists[size];
+            if (!free_list.empty()) {
+                void* vp = free_list.back();
+                free_list.pop_back();
+                --s_stack_pooled;
+                return vp;
+            }
+
+            size_t page = PageSize();
+            void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE
+                    , MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (base == MAP_FAILED) {
+                SYLAR_LOG_ERROR(g_logger) << "PooledStackAllocator mmap size=" << size
+                    << " errno=" << errno << " errstr=" << strerror(errno);
+                throw std::bad_alloc();
+            }
+            // 栈向低地址增长, 保护页放在最低处
+            if (mprotect(base, page, PROT_NONE)) {
+                SYLAR_LOG_ERROR(g_logger) << "PooledStackAllocator mprotect guard page errno="
+                    << errno << " errstr=" << strerror(errno);
+            }
+            return (char*)base + page;
+        }
+
+        static void Dealloc(void* vp, size_t size) {
+            size = RoundUp(size);
+            std::vector<void*>& free_list = t_pool.free_lists[size];
+            if (free_list.size() < s_stack_pool_size) {
+                free_list.push_back(vp);
+                ++s_stack_pooled;
+                return;
+            }
+            Unmap(vp, size);
+        }
+    private:
+        struct Pool {
+            ~Pool() {
+                for (auto& i : free_lists) {
+                    for (auto& vp : i.second) {
+                        Unmap(vp, i.first);
+                        --s_stack_pooled;
+                    }
+                }
+            }
+            // 栈大小 -> 空闲栈
+            std::unordered_map<size_t, std::vector<void*> > free_lists;
+        };
+
+        static size_t PageSize() {
+            static size_t s_page_size = sysconf(_SC_PAGESIZE);
+            return s_page_size;
+        }
+
+        static size_t RoundUp(size_t size) {
+            size_t page = PageSize();
+            return (size + page - 1) / page * page;
+        }
+
+        static void Unmap(void* vp, size_t size) {
+            size_t page = PageSize();
+            munmap((char*)vp - page, size + page);
+        }
+    public:
+        // 构造本线程的栈池
+        static void Touch() {
+            (void)t_pool.free_lists.size();
+        }
+    private:
+        static thread_local Pool t_pool;
+    };
+
+    thread_local PooledStackAllocator::Pool PooledStackAllocator::t_pool;
+
+    // 每个线程的协程池, 池子持有一份引用
+    // 引用计数只剩池子这一份并且已经结束的协程没有人再用了, 可以reset之后直接复用
+    // 协程可能在别的线程结束和释放引用, 读到use_count为1之后加acquire屏障, 看到它最后的状态
+    struct FiberPool {
+        FiberPool() {
+            // 保证栈池先于协程池构造, 线程退出时协程池先析构, 回收栈时栈池还在
+            PooledStackAllocator::Touch();
+        }
+        std::vector<Fiber::ptr> fibers;
+        // 下一次开始查找的位置, 协程大致按创建的顺序结束
+        size_t cursor = 0;
+    };
+
+    static thread_local FiberPool t_fiber_pool;
+
+    // 根据协程创建时的配置选择分配器, 释放时必须用同一个分配器
+    class StackAllocator {
+    public:
+        static void* Alloc(size_t size, bool pooled) {
+            void* vp = pooled ? PooledStackAllocator::Alloc(size)
+                                : MallocStackAllocator::Alloc(size);
+            ++s_stack_in_use;
+            return vp;
+        }
+
+        static void Dealloc(void* vp, size_t size, bool pooled) {
+            --s_stack_in_use;
+            if (pooled) {
+                PooledStackAllocator::Dealloc(vp, size);
+            } else {
+                MallocStackAllocator::Dealloc(vp, size);
+            }
+        }
+    };
+
+    // 线程共享栈, 同一时刻只有一个协程(occupant)的栈内容在上面
+    // 每个线程只有一个, 不走栈池
+    struct SharedStack {
+        ~SharedStack() {
+            if (stack) {
+                StackAllocator::Dealloc(stack, size, false);
+            }
+        }
+
+        char* stack = nullptr;
+        size_t size = 0;
+        Fiber* occupant = nullptr;
+    };
+
+    static thread_local SharedStack t_shared_stack;
+
+    // 切出时记录的栈顶再往下留出的余量, 覆盖SwapContext之下切换函数自身的栈帧
+    static const size_t s_shared_stack_margin = 512;
+
+    static SharedStack* GetSharedStack() {
+        SharedStack* ss = &t_shared_stack;
+        if (!ss->stack) {
+            ss->size = g_fiber_shared_stack_size->getValue();
+            ss->stack = (char*)StackAllocator::Alloc(ss->size, false);
+        }
+        return ss;
+    }
 
     uint64_t Fiber::GetFiberId() {
         if (t_fiber) {
@@ -65,57 +266,160 @@ namespace sylar {
         return 0;
     }
 
+#ifdef SYLAR_FIBER_FCONTEXT
+    // fcontext的入口函数带一个参数, 转一下
+    static void FcontextMainFunc(intptr_t) {
+        Fiber::MainFunc();
+    }
+
+    static void FcontextCallerMainFunc(intptr_t) {
+        Fiber::CallerMainFunc();
+    }
+#endif
+
+    void Fiber::makeContext(bool use_caller) {
+#ifdef SYLAR_FIBER_FCONTEXT
+        m_ctx = sylar_make_fcontext((char*)m_stack + m_stacksize, m_stacksize
+                    , use_caller ? &FcontextCallerMainFunc : &FcontextMainFunc);
+#else
+        //获取当前上下文
+        if (getcontext(&m_ctx)) {
+            SYLAR_ASSERT2(false, "getcontext");
+        }
+        //没有关联上下文(如果有关联上下文, 自身结束时会回到关联上下文执行)
+        m_ctx.uc_link = nullptr;
+        //指定栈
+        m_ctx.uc_stack.ss_sp = m_stack;
+        //指定栈大小
+        m_ctx.uc_stack.ss_size = m_stacksize;
+
+        //创建上下文
+        if (!use_caller) {
+            makecontext(&m_ctx, &Fiber::MainFunc, 0);
+        } else {
+            makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+        }
+#endif
+    }
+
+    void Fiber::SwapContext(Fiber* from, Fiber* to) {
+        // 共享栈协程之间不会直接切换, 总是经过线程主协程中转
+        SYLAR_ASSERT(!(from->m_sharedStack && to->m_sharedStack));
+        if (from->m_sharedStack) {
+            // 只记录位置, 真正拷贝推迟到别的协程要用共享栈时
+            volatile char marker = 0;
+            char* sp = (char*)&marker - s_shared_stack_margin;
+            from->m_stackSp = sp < from->m_stack ? (char*)from->m_stack : sp;
+            // 执行完了就让出共享栈, 不需要再保存
+            if (from->m_state == TERM || from->m_state == EXCEPT) {
+                t_shared_stack.occupant = nullptr;
+            }
+        }
+        if (to->m_sharedStack) {
+            to->acquireSharedStack();
+        }
+#ifdef SYLAR_FIBER_FCONTEXT
+        sylar_jump_fcontext(&from->m_ctx, to->m_ctx, 0);
+#else
+        if (swapcontext(&from->m_ctx, &to->m_ctx)) {
+            SYLAR_ASSERT2(false, "swapcontext");
+        }
+#endif
+    }
+
+    void Fiber::acquireSharedStack() {
+        SharedStack* ss = GetSharedStack();
+        if (m_stackThread == -1) {
+            m_stackThread = sylar::GetThreadId();
+            m_stack = ss->stack;
+            m_stacksize = ss->size;
+        }
+        // 栈上有指向栈内的绝对地址, 只能回到原来的共享栈上运行
+        SYLAR_ASSERT2(m_stack == ss->stack, "shared stack fiber resumed on another thread");
+
+        if (ss->occupant == this) {
+            return;
+        }
+        if (ss->occupant) {
+            ss->occupant->saveSharedStack();
+        }
+        ss->occupant = this;
+
+        if (m_ctxPending) {
+            makeContext(m_useCaller);
+            m_ctxPending = false;
+        } else if (m_saveBuf) {
+            memcpy((char*)m_stack + m_stacksize - m_saveSize, m_saveBuf, m_saveSize);
+            free(m_saveBuf);
+            m_saveBuf = nullptr;
+            m_saveSize = 0;
+        }
+    }
+
+    void Fiber::saveSharedStack() {
+        // 执行完的协程栈内容已经没用了
+        if (m_state != TERM && m_state != EXCEPT && !m_ctxPending) {
+            char* top = (char*)m_stack + m_stacksize;
+            m_saveSize = top - m_stackSp;
+            m_saveBuf = (char*)malloc(m_saveSize);
+            memcpy(m_saveBuf, m_stackSp, m_saveSize);
+        }
+    }
+
     Fiber::Fiber() {
         m_state = EXEC;
         SetThis(this);
 
+#ifndef SYLAR_FIBER_FCONTEXT
+        // fcontext下主协程的上下文在第一次切出时保存
         if (getcontext(&m_ctx)) {
-            SYLAR_ASSERT(false, "getcontext");
+            SYLAR_ASSERT2(false, "getcontext");
         }
+#endif
 
         ++s_fiber_count;
 
         SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber main";
     }
 
-    Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
+    Fiber::Fiber(Callback cb, size_t stacksize, bool use_caller, bool shared_stack)
         : m_id(++s_fiber_count)
-        , m_cb(cb) {
+        , m_sharedStack(shared_stack)
+        , m_useCaller(use_caller)
+        , m_cb(std::move(cb)) {
         ++s_fiber_count;
+        if (m_sharedStack) {
+            // 栈和上下文在第一次切入时确定
+            m_ctxPending = true;
+            SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber shared stack id=" << m_id;
+            return;
+        }
+
         //栈大小
         m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
 
         //分配栈内存
-        m_stack = StackAllocator::Alloc(m_stacksize);
-        //获取当前上下文
-        if (getcontext(&m_ctx)) {
-            SYLAR_ASSERT(false, "getcontext");
-        }
-        //没有关联上下文(如果有关联上下文, 自身结束时会回到关联上下文执行)
-
-        //指定上下文起始指针
-        m_ctx.uc_link = nullptr;
-        //指定栈大小
-        m_ctx.uc_stack.ss_sp = m_stack;
-        //创建上下文
-        m_ctx.uc_stack.ss_size = m_stacksize;
-
-        if (!use_caller) {
-            makecontext(&m_ctx, &Fiber::MainFunc, 0);
-        } else {
-            makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
-        }
+        m_pooledStack = s_pooled_stack;
+        m_stack = StackAllocator::Alloc(m_stacksize, m_pooledStack);
+        makeContext(use_caller);
 
         SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber id=" << m_id;
     }
 
     Fiber::~Fiber() {
         --s_fiber_count;
-        if (m_stack) {
+        if (m_sharedStack) {
+            SYLAR_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
+            if (m_stackThread == sylar::GetThreadId()
+                    && t_shared_stack.occupant == this) {
+                t_shared_stack.occupant = nullptr;
+            }
+            free(m_saveBuf);
+        } else if (m_stack) {
             //子线程会有独属的m_stack
             SYLAR_ASSERT(m_state == TERM || m_state == INIT);
             //回收栈
-            StackAllocator::Dealloc(m_stack,m_stacksize);
+            StackAllocator::Dealloc(m_stack, m_stacksize, m_pooledStack);
         } else {
             SYLAR_ASSERT(!m_cb);
             SYLAR_ASSERT(m_state == EXEC);
@@ -128,21 +432,22 @@ namespace sylar {
     }
 
     //重置协程函数, 并重置状态, 可以复用栈
-    void Fiber::reset(std::function<void()> cb) {
-        SYLAR_ASSERT(m_stack);
+    void Fiber::reset(Callback cb) {
+        SYLAR_ASSERT(m_stack || m_sharedStack);
         SYLAR_ASSERT(m_state == TERM
                 || m_state == INIT
                 || m_state == EXCEPT);
-        m_cb = cb;
-        if (getcontext(&m_ctx)) {
-            SYLAR_ASSERT(false, "getcontext");
+        m_cb = std::move(cb);
+        if (m_sharedStack) {
+            // 共享栈可能被别的协程占用, 等下次切入再初始化
+            free(m_saveBuf);
+            m_saveBuf = nullptr;
+            m_saveSize = 0;
+            m_useCaller = false;
+            m_ctxPending = true;
+        } else {
+            makeContext(false);
         }
-
-        m_ctx.uc_link = nullptr;
-        m_ctx.uc_stack.ss_sp = m_stack;
-        m_ctx.uc_stack.ss_size = m_stacksize;
-
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
         m_state = INIT;
     }
 
@@ -150,17 +455,18 @@ namespace sylar {
     void Fiber::call() {
         SetThis(this);
         m_state = EXEC;
-        if (swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-            SYLAR_ASSERT(false, "swapcontext");
+        Watchdog::OnSwapIn(m_id);
+        SwapContext(t_threadFiber.get(), this);
+        Watchdog::OnSwapOut();
+        if (m_state == EXEC) {
+            m_state = HOLD;
         }
     }
 
     // 切换到主协程,子协程任务退至后台
     void Fiber::back() {
         SetThis(t_threadFiber.get());
-        if(swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-            SYLAR_ASSERT(false, "swapcontext");
-        }
+        SwapContext(this, t_threadFiber.get());
     }
 
     // 切换到当前线程执行
@@ -168,17 +474,21 @@ namespace sylar {
         SetThis(this);
         SYLAR_ASSERT(m_state != EXEC);
         m_state = EXEC;
-        if (swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-            SYLAR_ASSERT(false, "swapcontext");
+        Watchdog::OnSwapIn(m_id);
+        SwapContext(t_threadFiber.get(), this);
+        // 回到调度协程, 协程让出或者结束了
+        Watchdog::OnSwapOut();
+        // 挂起的协程在上下文保存完之后才置为HOLD
+        // 在此之前状态一直是EXEC, 其他线程取任务时会跳过它, 不会在保存完之前被切入
+        if (m_state == EXEC) {
+            m_state = HOLD;
         }
     }
 
     // 切换到主协程
     void Fiber::swapOut() {
         SetThis(Scheduler::GetMainFiber());
-        if (swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-            SYLAR_ASSERT(false, "swapcontext");
-        }
+        SwapContext(this, t_threadFiber.get());
     }
 
     // 设置当前协程
@@ -197,10 +507,48 @@ namespace sylar {
         // 符合我们的懒加载设计,非常的牛逼啊兄弟
         Fiber::ptr main_fiber(new Fiber);
         SYLAR_ASSERT(t_fiber == main_fiber.get());
-        t_threadFiber == main_fiber;
+        t_threadFiber = main_fiber;
         return t_fiber -> shared_from_this();
     }
 
+    Fiber::ptr Fiber::Create(Callback cb, size_t stacksize) {
+        uint32_t stack_size = stacksize ? stacksize : g_fiber_stack_size->getValue();
+        FiberPool& pool = t_fiber_pool;
+        size_t count = pool.fibers.size();
+        for (size_t i = 0; i < count; ++i) {
+            size_t idx = (pool.cursor + i) % count;
+            Fiber::ptr& fiber = pool.fibers[idx];
+            if (fiber.use_count() != 1) {
+                continue;
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (fiber->m_stacksize != stack_size
+                    || (fiber->m_state != TERM && fiber->m_state != INIT
+                        && fiber->m_state != EXCEPT)) {
+                continue;
+            }
+            pool.cursor = idx + 1;
+            fiber->reset(std::move(cb));
+            ++s_fiber_reused;
+            return fiber;
+        }
+
+        Fiber::ptr fiber(new Fiber(std::move(cb), stack_size));
+        size_t limit = g_fiber_pool_size->getValue();
+        if (count < limit) {
+            pool.fibers.push_back(fiber);
+        } else if (limit) {
+            // 池子满了, 轮流换掉旧的, 旧协程由其它引用者释放
+            pool.cursor %= count;
+            pool.fibers[pool.cursor++] = fiber;
+        }
+        return fiber;
+    }
+
+    uint64_t Fiber::TotalReusedFibers() {
+        return s_fiber_reused;
+    }
+
     // 将协程切换到Ready状态,并放到后台
     void Fiber::YieldToReady() {
         Fiber::ptr cur = GetThis();
@@ -213,7 +561,7 @@ namespace sylar {
     void Fiber::YieldToHold() {
         Fiber::ptr cur = GetThis();
         SYLAR_ASSERT(cur->m_state == EXEC);
-        cur -> m_state = HOLD;
+        // 状态保持EXEC, 由swapIn在切回调度协程之后置为HOLD
         cur -> swapOut();
     }
 
@@ -222,6 +570,16 @@ namespace sylar {
         return s_fiber_count;
     }
 
+    // 栈池中缓存的栈数量
+    uint64_t Fiber::TotalPooledStacks() {
+        return s_stack_pooled;
+    }
+
+    // 正在使用的栈数量
+    uint64_t Fiber::TotalStacksInUse() {
+        return s_stack_in_use;
+    }
+
     void Fiber::MainFunc() {
         Fiber::ptr cur = GetThis();
         SYLAR_ASSERT(cur);
@@ -8,10 +8,15 @@
 //先导知识
 //在Cpp中,指针的大小与指向类型的大小是一样的
 
+#ifdef SYLAR_FIBER_FCONTEXT
+#include "fcontext.h"
+#else
 #include <ucontext.h>
+#endif
 #include <execinfo.h>
 #include <memory>
 #include <functional>
+#include "callback.h"
 
 namespace sylar {
     class Scheduler;
@@ -42,14 +47,22 @@ namespace sylar {
         Fiber();
 
     public:
-        //构造函数
-        Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+        /**
+         * 构造函数
+         * cb 协程执行的函数
+         * stacksize 协程栈大小, 0使用配置值
+         * use_caller 是否在调用者线程的主协程上执行
+         * shared_stack 是否使用线程共享栈: 所有共享栈协程轮流在同一块大栈上运行,
+         *              切出后实际用到的栈内容才会拷贝到按需分配的缓冲区,
+         *              适合大量长时间挂起的协程; 首次运行后绑定在该线程上
+         */
+        Fiber(Callback cb, size_t stacksize = 0, bool use_caller = false, bool shared_stack = false);
 
         // 析构
         ~Fiber();
 
         //重置协程状态为INIT
-        void reset(std::function<void()> cb);
+        void reset(Callback cb);
 
         // 切换到当前协程执行
         void swapIn();
@@ -71,6 +84,12 @@ namespace sylar {
         // 返回协程状态
         State getState() const { return m_state; }
 
+        // 是否使用共享栈
+        bool isSharedStack() const { return m_sharedStack; }
+
+        // 共享栈协程绑定的线程id, 未绑定返回-1
+        int getStackThread() const { return m_stackThread; }
+
     public:
         //设置当前协程的运行协程
         static void SetThis(Fiber* f);
@@ -78,6 +97,13 @@ namespace sylar {
         //返回当前所在协程
         static Fiber::ptr GetThis();
 
+        // 创建普通栈协程, 优先复用本线程协程池里已经结束并且没有别人引用的协程(连同栈和控制块)
+        // 池子大小为fiber.pool_size, 0 为不缓存
+        static Fiber::ptr Create(Callback cb, size_t stacksize = 0);
+
+        // 返回Create复用协程的总次数
+        static uint64_t TotalReusedFibers();
+
         //将当前协程切换为后台,并设置为Ready状态
         static void YieldToReady();
 
@@ -87,6 +113,12 @@ namespace sylar {
         // 返回当前协程的总数量
         static uint64_t TotalFibers();
 
+        // 返回栈池中缓存的栈数量
+        static uint64_t TotalPooledStacks();
+
+        // 返回正在被协程使用的栈数量
+        static uint64_t TotalStacksInUse();
+
         // 协程执行函数
         static void MainFunc();
 
@@ -95,6 +127,18 @@ namespace sylar {
 
         //获取协程ID
         static uint64_t GetFiberId();
+    private:
+        // 在m_stack上初始化上下文, 首次切换进来时执行MainFunc或CallerMainFunc
+        void makeContext(bool use_caller);
+
+        // 保存当前上下文到from, 切换到to
+        static void SwapContext(Fiber* from, Fiber* to);
+
+        // 把共享栈的当前占用者切出并把自己的栈内容拷回共享栈
+        void acquireSharedStack();
+
+        // 把自己在共享栈上用到的部分拷贝到缓冲区
+        void saveSharedStack();
     private:
         //协程id
         uint64_t m_id = 0;
@@ -103,11 +147,31 @@ namespace sylar {
         //协程状态
         State m_state = INIT;
         //协程上下文
+#ifdef SYLAR_FIBER_FCONTEXT
+        fcontext_t m_ctx = nullptr;
+#else
         ucontext_t m_ctx;
+#endif
         //当前栈指针
         void* m_stack = nullptr;
+        //栈是否来自栈池(创建时决定, 释放时用同一个分配器)
+        bool m_pooledStack = false;
+        //是否使用线程共享栈
+        bool m_sharedStack = false;
+        //创建时的use_caller, 共享栈协程需要延迟初始化上下文
+        bool m_useCaller = false;
+        //共享栈上下文还未初始化(首次切入时才初始化, 避免破坏共享栈当前占用者)
+        bool m_ctxPending = false;
+        //共享栈协程绑定的线程id
+        int m_stackThread = -1;
+        //切出时的栈顶位置(共享栈)
+        char* m_stackSp = nullptr;
+        //切出后保存的栈内容(共享栈)
+        char* m_saveBuf = nullptr;
+        //保存的栈内容大小
+        size_t m_saveSize = 0;
         //回调
-        std::function<void()> m_cb;
+        Callback m_cb;
     };
 
 }
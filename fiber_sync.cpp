@@ -0,0 +1,114 @@
+//
+// Created by admin on 2025/8/29.
+//
+
+#include "fiber_sync.h"
+#include "fiber.h"
+#include "Schedule.h"
+#include "macro.h"
+#include "util.h"
+
+namespace sylar {
+
+    // 唤醒方可能在协程真正切出去之前就把它放回调度队列,
+    // 指定回到挂起时的线程, 这个线程只有在协程切出去之后才会去取任务, 不会被别的线程提前执行
+    void FiberWaitQueue::push() {
+        Scheduler* scheduler = Scheduler::GetThis();
+        SYLAR_ASSERT2(scheduler, "fiber sync primitives must be used in a scheduler fiber");
+        m_waiters.push_back(FiberWaiter{scheduler, Fiber::GetThis(), sylar::GetThreadId()});
+    }
+
+    bool FiberWaitQueue::wakeOne() {
+        if(m_waiters.empty()) {
+            return false;
+        }
+        FiberWaiter waiter = std::move(m_waiters.front());
+        m_waiters.pop_front();
+        waiter.scheduler->schedule(waiter.fiber, waiter.thread);
+        return true;
+    }
+
+    size_t FiberWaitQueue::wakeAll() {
+        size_t count = 0;
+        while(wakeOne()) {
+            ++count;
+        }
+        return count;
+    }
+
+    void FiberMutex::lockSlow() {
+        while(true) {
+            {
+                Spinlock::Lock lock(m_mutex);
+                // 置成CONTENDED, 拿到锁的协程unlock时会检查等待队列
+                if(m_state.exchange(CONTENDED, std::memory_order_acquire) == UNLOCKED) {
+                    return;
+                }
+                m_waiters.push();
+            }
+            Fiber::YieldToHold();
+        }
+    }
+
+    void FiberMutex::unlockSlow() {
+        Spinlock::Lock lock(m_mutex);
+        m_waiters.wakeOne();
+    }
+
+    FiberSemaphore::FiberSemaphore(uint32_t count)
+        :m_count(count) {
+    }
+
+    bool FiberSemaphore::tryWait() {
+        uint32_t count = m_count.load(std::memory_order_relaxed);
+        while(count > 0) {
+            if(m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void FiberSemaphore::wait() {
+        if(tryWait()) {
+            return;
+        }
+        {
+            Spinlock::Lock lock(m_mutex);
+            // 计数只在没有等待者时增加, 且都在锁内, 这里再检查一次就不会丢通知
+            if(tryWait()) {
+                return;
+            }
+            m_waiters.push();
+        }
+        // notify直接把计数交给了我们
+        Fiber::YieldToHold();
+    }
+
+    void FiberSemaphore::notify() {
+        Spinlock::Lock lock(m_mutex);
+        if(!m_waiters.wakeOne()) {
+            m_count.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    void FiberCondVar::wait(FiberMutex& mutex) {
+        {
+            Spinlock::Lock lock(m_mutex);
+            m_waiters.push();
+        }
+        mutex.unlock();
+        Fiber::YieldToHold();
+        mutex.lock();
+    }
+
+    void FiberCondVar::notify() {
+        Spinlock::Lock lock(m_mutex);
+        m_waiters.wakeOne();
+    }
+
+    void FiberCondVar::notifyAll() {
+        Spinlock::Lock lock(m_mutex);
+        m_waiters.wakeAll();
+    }
+}
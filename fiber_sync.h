@@ -0,0 +1,228 @@
+//
+// Created by admin on 2025/8/29.
+//
+
+#ifndef FIBER_SYNC_H
+#define FIBER_SYNC_H
+
+#include <atomic>
+#include <deque>
+#include <list>
+#include <memory>
+#include <stdint.h>
+#include <boost/noncopyable.hpp>
+#include "mutex.h"
+
+namespace sylar {
+
+    class Scheduler;
+    class Fiber;
+
+    // 挂起等待的协程, 唤醒时放回它所属的Scheduler, 并指定回到挂起时的线程
+    struct FiberWaiter {
+        Scheduler* scheduler;
+        std::shared_ptr<Fiber> fiber;
+        int thread;
+    };
+
+    // 协程等待队列, 由调用方的锁保护
+    class FiberWaitQueue {
+    public:
+        // 把当前协程加入队列, 之后调用方释放锁再Fiber::YieldToHold()
+        // 必须在Scheduler的协程里调用
+        void push();
+
+        // 唤醒一个协程, 队列为空返回false
+        bool wakeOne();
+
+        // 唤醒所有协程, 返回唤醒的个数
+        size_t wakeAll();
+
+        bool empty() const { return m_waiters.empty();}
+    private:
+        std::list<FiberWaiter> m_waiters;
+    };
+
+    // 协程互斥量
+    // 没有竞争时lock/unlock各一次原子操作; 有竞争时挂起当前协程让出线程, 而不是阻塞整个线程
+    // 只能在Scheduler的协程里使用, 不可重入
+    class FiberMutex : private boost::noncopyable {
+    public:
+        typedef ScopedLockImpl<FiberMutex> Lock;
+
+        void lock() {
+            int expected = UNLOCKED;
+            if(m_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire)) {
+                return;
+            }
+            lockSlow();
+        }
+
+        bool tryLock() {
+            int expected = UNLOCKED;
+            return m_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire);
+        }
+
+        void unlock() {
+            if(m_state.exchange(UNLOCKED, std::memory_order_release) == CONTENDED) {
+                unlockSlow();
+            }
+        }
+    private:
+        void lockSlow();
+        void unlockSlow();
+    private:
+        enum State {
+            UNLOCKED = 0,
+            LOCKED = 1,
+            // 可能有协程在等待, unlock时要检查等待队列
+            CONTENDED = 2
+        };
+        std::atomic<int> m_state{UNLOCKED};
+        // 保护m_waiters
+        Spinlock m_mutex;
+        FiberWaitQueue m_waiters;
+    };
+
+    // 协程信号量, 有剩余计数时wait只有一次CAS
+    class FiberSemaphore : private boost::noncopyable {
+    public:
+        FiberSemaphore(uint32_t count = 0);
+
+        void wait();
+
+        // 有剩余计数时减一返回true, 否则返回false, 不挂起
+        bool tryWait();
+
+        // 有等待的协程时直接把计数交给它
+        void notify();
+    private:
+        std::atomic<uint32_t> m_count;
+        // 保护m_waiters
+        Spinlock m_mutex;
+        FiberWaitQueue m_waiters;
+    };
+
+    // 协程条件变量, 配合FiberMutex使用
+    class FiberCondVar : private boost::noncopyable {
+    public:
+        // 释放mutex并挂起, 被唤醒后重新加锁返回
+        // 可能虚假唤醒(别的协程先拿到了锁), 调用方要循环检查条件
+        void wait(FiberMutex& mutex);
+
+        template<class Pred>
+        void wait(FiberMutex& mutex, Pred pred) {
+            while(!pred()) {
+                wait(mutex);
+            }
+        }
+
+        void notify();
+
+        void notifyAll();
+    private:
+        // 保护m_waiters
+        Spinlock m_mutex;
+        FiberWaitQueue m_waiters;
+    };
+
+    // 有界的多生产者多消费者通道
+    // 满了push挂起, 空了pop挂起; close之后push失败, pop取完剩余数据后失败
+    template<class T>
+    class Channel : private boost::noncopyable {
+    public:
+        typedef std::shared_ptr<Channel> ptr;
+
+        Channel(size_t capacity)
+            :m_capacity(capacity ? capacity : 1) {
+        }
+
+        // 放入v, 通道关闭返回false
+        bool push(const T& v) {
+            FiberMutex::Lock lock(m_mutex);
+            m_notFull.wait(m_mutex, [this]() { return m_closed || m_queue.size() < m_capacity;});
+            if(m_closed) {
+                return false;
+            }
+            m_queue.push_back(v);
+            m_notEmpty.notify();
+            return true;
+        }
+
+        bool push(T&& v) {
+            FiberMutex::Lock lock(m_mutex);
+            m_notFull.wait(m_mutex, [this]() { return m_closed || m_queue.size() < m_capacity;});
+            if(m_closed) {
+                return false;
+            }
+            m_queue.push_back(std::move(v));
+            m_notEmpty.notify();
+            return true;
+        }
+
+        // 取出一个到v, 通道关闭并且取空返回false
+        bool pop(T& v) {
+            FiberMutex::Lock lock(m_mutex);
+            m_notEmpty.wait(m_mutex, [this]() { return m_closed || !m_queue.empty();});
+            if(m_queue.empty()) {
+                return false;
+            }
+            v = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_notFull.notify();
+            return true;
+        }
+
+        // 不挂起, 满了或者关闭返回false
+        bool tryPush(const T& v) {
+            FiberMutex::Lock lock(m_mutex);
+            if(m_closed || m_queue.size() >= m_capacity) {
+                return false;
+            }
+            m_queue.push_back(v);
+            m_notEmpty.notify();
+            return true;
+        }
+
+        // 不挂起, 空了返回false
+        bool tryPop(T& v) {
+            FiberMutex::Lock lock(m_mutex);
+            if(m_queue.empty()) {
+                return false;
+            }
+            v = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_notFull.notify();
+            return true;
+        }
+
+        // 关闭通道, 唤醒所有等待的协程
+        void close() {
+            FiberMutex::Lock lock(m_mutex);
+            m_closed = true;
+            m_notFull.notifyAll();
+            m_notEmpty.notifyAll();
+        }
+
+        bool isClosed() {
+            FiberMutex::Lock lock(m_mutex);
+            return m_closed;
+        }
+
+        size_t size() {
+            FiberMutex::Lock lock(m_mutex);
+            return m_queue.size();
+        }
+
+        size_t getCapacity() const { return m_capacity;}
+    private:
+        size_t m_capacity;
+        bool m_closed = false;
+        FiberMutex m_mutex;
+        FiberCondVar m_notFull;
+        FiberCondVar m_notEmpty;
+        std::deque<T> m_queue;
+    };
+}
+
+#endif //FIBER_SYNC_H
@@ -5,6 +5,7 @@
 #include "log.h"
 #include "fiber.h"
 #include "iomanager.h"
+#include "iouring.h"
 #include "fd_manager.h"
 #include "macro.h"
 
@@ -28,11 +29,13 @@ static thread_local bool t_hook_enable = false;
     XX(recv) \
     XX(recvfrom) \
     XX(recvmsg) \
+    XX(recvmmsg) \
     XX(write) \
     XX(writev) \
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(sendmmsg) \
     XX(close) \
     XX(fcntl) \
     XX(ioctl) \
@@ -91,7 +94,7 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    if(ctx->isClose())
+    if(ctx->isClose()) {
         errno = EBADF;
         return -1;
     }
@@ -148,6 +151,44 @@ retry:
     return n;
 }
 
+// 内核对非阻塞socket的请求不等待就绪, 直接返回EAGAIN(没有fast poll的老内核)
+// 碰到一次之后全部走就绪通知, 不再每次先提交一次再退回
+static std::atomic<bool> s_uring_nowait{false};
+
+// io_uring后端: 直接提交请求, 协程挂起到完成为止, 省掉就绪通知和重试
+// hook的socket都被设置了O_NONBLOCK, 读写只能用RECV/SEND/RECVMSG/SENDMSG这类socket请求,
+// 它们在数据没就绪时由内核挂poll等待; READ/WRITEV这类文件请求会因为O_NONBLOCK直接返回EAGAIN
+// 共享栈协程切走后栈会被别的协程覆盖, 内核异步读写栈上的缓冲区不安全, 仍走do_io
+template<typename Prep, typename OriginFun, typename... Args>
+static ssize_t do_uring_io(int fd, Prep prep, OriginFun fun, const char* hook_fun_name,
+        uint32_t event, int timeout_so, Args&&... args) {
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if(!sylar::t_hook_enable || !iom || !iom->isUring() || s_uring_nowait
+            || sylar::Fiber::GetThis()->isSharedStack()) {
+        return do_io(fd, fun, hook_fun_name, event, timeout_so, std::forward<Args>(args)...);
+    }
+
+    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    if(!ctx || ctx->isClose() || !ctx->isSocket() || ctx->getUserNonblock()) {
+        return do_io(fd, fun, hook_fun_name, event, timeout_so, std::forward<Args>(args)...);
+    }
+
+    int res = iom->submitIo(prep, ctx->getTimeout(timeout_so));
+    // 老内核对非阻塞句柄直接返回EAGAIN而不是等待, 退回就绪通知
+    if(SYLAR_UNLIKELY(res == -EAGAIN)) {
+        if(!s_uring_nowait.exchange(true)) {
+            SYLAR_LOG_WARN(g_logger) << hook_fun_name << " io_uring returned EAGAIN on a nonblocking socket"
+                                     << ", use epoll readiness from now on";
+        }
+        return do_io(fd, fun, hook_fun_name, event, timeout_so, std::forward<Args>(args)...);
+    }
+    if(res < 0) {
+        errno = -res;
+        return -1;
+    }
+    return res;
+}
+
 
 extern "C" {
 #define XX(name) name ## _fun name ## _f = nullptr;
@@ -226,14 +267,31 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
 
-    int n = connect_f(fd, addr, addrlen);
-    if(n == 0) {
-        return 0;
-    } else if(n != -1 || errno != EINPROGRESS) {
-        return n;
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if(iom && iom->isUring() && !sylar::Fiber::GetThis()->isSharedStack()) {
+        int res = iom->submitIo([fd, addr, addrlen](io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_CONNECT;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)addr;
+            sqe->off = addrlen;
+        }, timeout_ms);
+        if(res == 0) {
+            return 0;
+        }
+        // 老内核对非阻塞句柄返回EINPROGRESS, 继续走下面的等待
+        if(res != -EINPROGRESS) {
+            errno = -res;
+            return -1;
+        }
+    } else {
+        int n = connect_f(fd, addr, addrlen);
+        if(n == 0) {
+            return 0;
+        } else if(n != -1 || errno != EINPROGRESS) {
+            return n;
+        }
     }
 
-    sylar::IOManager* iom = sylar::IOManager::GetThis();
     sylar::Timer::ptr timer;
     std::shared_ptr<timer_info> tinfo(new timer_info);
     std::weak_ptr<timer_info> winfo(tinfo);
@@ -284,7 +342,12 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
-    int fd = do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    int fd = do_uring_io(s, [s, addr, addrlen](io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = s;
+            sqe->addr = (uint64_t)addr;
+            sqe->addr2 = (uint64_t)addrlen;
+        }, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
     if(fd >= 0) {
         sylar::FdMgr::GetInstance()->get(fd, true);
     }
@@ -292,7 +355,13 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
-    return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf, count);
+    // do_uring_io只处理socket, 用RECV代替READ
+    return do_uring_io(fd, [fd, buf, count](io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)buf;
+            sqe->len = count;
+        }, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
@@ -300,7 +369,13 @@ ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
-    return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+    return do_uring_io(sockfd, [sockfd, buf, len, flags](io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = sockfd;
+            sqe->addr = (uint64_t)buf;
+            sqe->len = len;
+            sqe->msg_flags = flags;
+        }, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
@@ -311,16 +386,37 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
     return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO, msg, flags);
 }
 
+// 一次取走已到达的一批数据报, 一个都没有时才挂起协程
+// timeout 沿用系统语义(每收到一个数据报后检查), 等待的超时仍由SO_RCVTIMEO控制
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout) {
+    return do_io(sockfd, recvmmsg_f, "recvmmsg", sylar::IOManager::READ, SO_RCVTIMEO, msgvec, vlen, flags, timeout);
+}
+
 ssize_t write(int fd, const void *buf, size_t count) {
     return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+    // do_uring_io只处理socket, 用SENDMSG代替WRITEV, msg在协程栈上, 请求完成前协程不会返回
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*)iov;
+    msg.msg_iovlen = iovcnt;
+    return do_uring_io(fd, [fd, &msg](io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)&msg;
+        }, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
-    return do_io(s, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+    return do_uring_io(s, [s, msg, len, flags](io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = s;
+            sqe->addr = (uint64_t)msg;
+            sqe->len = len;
+            sqe->msg_flags = flags;
+        }, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
 }
 
 ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct sockaddr *to, socklen_t tolen) {
@@ -331,8 +427,16 @@ ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
     return do_io(s, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
 }
 
+// 返回发出的数据报个数, 可能少于vlen, 剩下的由调用方续发
+int sendmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    return do_io(s, sendmmsg_f, "sendmmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msgvec, vlen, flags);
+}
+
 int close(int fd) {
+    // 没开hook的线程关闭的fd也要清掉持久注册和FdCtx, 否则fd复用后拿到的是旧的状态
+    sylar::IOManager::OnClose(fd);
     if(!sylar::t_hook_enable) {
+        sylar::FdMgr::GetInstance()->del(fd);
         return close_f(fd);
     }
 
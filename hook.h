@@ -16,8 +16,8 @@
  * 支持的系统调用类别：
  * - 睡眠函数：sleep, usleep, nanosleep
  * - 套接字操作：socket, connect, accept
- * - 读操作：read, readv, recv, recvfrom, recvmsg
- * - 写操作：write, writev, send, sendto, sendmsg
+ * - 读操作：read, readv, recv, recvfrom, recvmsg, recvmmsg
+ * - 写操作：write, writev, send, sendto, sendmsg, sendmmsg
  * - 文件控制：close, fcntl, ioctl
  * - 套接字选项：getsockopt, setsockopt
  *
@@ -134,6 +134,11 @@ extern "C" {
     /** 保存原始recvmsg函数地址的指针变量 */
     extern recvmsg_fun recvmsg_f;
 
+    /** recvmmsg函数指针类型：一次接收多个数据报 */
+    typedef int (*recvmmsg_fun)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
+    /** 保存原始recvmmsg函数地址的指针变量 */
+    extern recvmmsg_fun recvmmsg_f;
+
     /* ========== 写操作相关函数 ========== */
 
     /** write函数指针类型：向文件描述符写入数据 */
@@ -161,6 +166,11 @@ extern "C" {
     /** 保存原始sendmsg函数地址的指针变量 */
     extern sendmsg_fun sendmsg_f;
 
+    /** sendmmsg函数指针类型：一次发送多个数据报 */
+    typedef int (*sendmmsg_fun)(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+    /** 保存原始sendmmsg函数地址的指针变量 */
+    extern sendmmsg_fun sendmmsg_f;
+
     /* ========== 文件控制相关函数 ========== */
 
     /** close函数指针类型：关闭文件描述符 */
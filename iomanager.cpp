@@ -5,16 +5,69 @@
 #include "iomanager.h"
 #include "macro.h"
 #include "log.h"
+#include "Config.h"
+#include "iouring.h"
+#include "address.h"
+#include "watchdog.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <set>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <string.h>
 
 namespace sylar {
     static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+    // 是否使用分层时间轮管理定时器
+    static sylar::ConfigVar<bool>::ptr g_timer_wheel =
+        sylar::Config::Lookup("timer.wheel", false, "use hierarchical timing wheel for timers");
+
+    // 是否每个IO线程维护自己的定时器
+    static sylar::ConfigVar<bool>::ptr g_timer_per_thread =
+        sylar::Config::Lookup("timer.per_thread", false, "per thread timer set for io threads");
+
+    // 每个fd只在第一次addEvent时注册读写边缘触发, 之后不再epoll_ctl, 就绪状态记在FdContext里
+    static sylar::ConfigVar<bool>::ptr g_persistent_epoll =
+        sylar::Config::Lookup("iomanager.persistent_epoll", false, "register fds once with EPOLLIN|EPOLLOUT|EPOLLET");
+
+    // 每个调度线程使用自己的epoll, fd绑定到第一次注册它的线程
+    static sylar::ConfigVar<bool>::ptr g_multi_reactor =
+        sylar::Config::Lookup("iomanager.multi_reactor", false, "one epoll instance per io thread");
+
+    // io_uring提交队列长度
+    static sylar::ConfigVar<uint32_t>::ptr g_uring_entries =
+        sylar::Config::Lookup("iomanager.uring_entries", (uint32_t)256, "io_uring submission queue entries");
+
+    // 一个挂起中的io_uring请求, 由等待的协程持有, user_data指向它
+    struct IOManager::UringOp {
+        // 恢复协程用的调度器
+        Scheduler* scheduler = nullptr;
+        // 等待完成的协程
+        Fiber::ptr fiber;
+        // cqe的结果
+        int res = 0;
+        // 是否因为超时被取消
+        std::atomic<bool> timedout = {false};
+    };
+
+    // 每个调度线程一个, 线程睡在自己的epoll上, 里面是只唤醒它的eventfd和嵌套的共享m_epfd
+    // 多reactor模式下工作线程注册的fd也放在这里; 单epoll模式下只用来定向唤醒这个线程
+    struct IOManager::Reactor {
+        // 线程自己的epoll句柄
+        int epfd = -1;
+        // 只唤醒这个线程的eventfd
+        int tickleFd = -1;
+        // 认领这个reactor的线程id, -1 为还没被认领
+        std::atomic<int> thread = {-1};
+        // 是否正阻塞在epoll_wait中
+        std::atomic<bool> sleeping = {false};
+        // 已写入eventfd但还没被消费
+        std::atomic<bool> tickled = {false};
+    };
+
     enum EpollCtlOp {};
 
     static std::ostream& operator<< (std::ostream& os, const EpollCtlOp& op) {
@@ -83,8 +136,8 @@ first = false; \
     }
 
     // 触发指定的IO事件, 并将对应的协程或回调函数交给调度器执行
-    void IOManager::FdContext::triggerEvent(IOManager::Event event) {
-        SYALR_ASSERT(events & event);
+    void IOManager::FdContext::triggerEvent(IOManager::Event event, int thread) {
+        SYLAR_ASSERT(events & event);
 
         // 从events中移除指定的event
         // 当某个事件被触发后, 需要从注册列表中移除它
@@ -92,82 +145,217 @@ first = false; \
         events = (Event)(events & ~event);
         EventContext& ctx = getContext(event);
         if(ctx.cb) {
-            ctx.scheduler->schedule(&ctx.cb);
+            ctx.scheduler->schedule(&ctx.cb, thread);
         } else {
-            ctx.scheduler->schedule(ctx.fiber);
+            // 共享栈协程只能回到栈所在的线程, 不按reactor指定, 由调度器按栈绑定投递
+            if(ctx.fiber->getStackThread() != -1) {
+                thread = -1;
+            }
+            ctx.scheduler->schedule(&ctx.fiber, thread);
         }
         ctx.scheduler = nullptr;
     }
 
 
     // 构造函数
-    IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
-    :Scheduler(threads, use_caller, name) {
+    // 持久模式的IOManager, fd关闭时要在它们里面删除注册
+    static RWMutex& GetPersistentMutex() {
+        static RWMutex s_mutex;
+        return s_mutex;
+    }
+
+    static std::set<IOManager*>& GetPersistentManagers() {
+        static std::set<IOManager*> s_managers;
+        return s_managers;
+    }
+
+    static std::atomic<size_t> s_persistent_count{0};
+
+    IOManager::IOManager(size_t threads, bool use_caller, const std::string& name, IoBackend backend)
+    :Scheduler(threads, use_caller, name)
+    ,TimerManager(g_timer_wheel->getValue() ? TimerManager::WHEEL : TimerManager::SET
+                ,g_timer_per_thread->getValue())
+    ,m_persistentEpoll(g_persistent_epoll->getValue())
+    ,m_multiReactor(g_multi_reactor->getValue()) {
         // 我们期望epoll的句柄上限是5000
         m_epfd = epoll_create(5000);
         SYLAR_ASSERT(m_epfd > 0);
 
-        // 返回读端和写端的两个文件描述符
-        int rt = pipe(m_tickleFds);
-        SYLAR_ASSERT(!rt);
+        // 唤醒用的eventfd, 读写都是8字节计数, 一次read就能清空
+        m_tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        SYLAR_ASSERT(m_tickleFd >= 0);
 
         // 配置epoll事件
         epoll_event event;
         memset(&event, 0, sizeof(epoll_event));
         // 监听可读事件，设置边缘触发模式
         event.events = EPOLLIN | EPOLLET;
-        // 关联读端文件描述符
-        event.data.fd = m_tickleFds[0];
+        event.data.fd = m_tickleFd;
 
-        // 将读端设置为非阻塞模式
-        rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
+        // 将eventfd注册到epoll
+        int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFd, &event);
         SYLAR_ASSERT(!rt);
 
-        // 将管道注册到epoll， 文件描述符添加到epoll中
-        rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-        SYLAR_ASSERT(!rt);
+        if(backend == IO_URING) {
+            m_uring.reset(new IoUring);
+            if(m_uring->init(g_uring_entries->getValue())) {
+                // 有完成事件时环的句柄可读, epoll_wait因此会返回
+                event.events = EPOLLIN | EPOLLET;
+                event.data.fd = m_uring->getFd();
+                rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_uring->getFd(), &event);
+                SYLAR_ASSERT(!rt);
+            } else {
+                SYLAR_LOG_ERROR(g_logger) << "io_uring_setup errno=" << errno
+                    << " errstr=" << strerror(errno) << ", fallback to epoll";
+                m_uring.reset();
+            }
+        }
 
-        // 预分配32个FdContext对象
-        contextResize(32);
+        for(size_t i = 0; i < FD_MAX_CHUNKS; ++i) {
+            m_fdChunks[i].store(nullptr, std::memory_order_relaxed);
+        }
+
+        // 工作线程加上参与调度的调用者线程, 每个一个reactor
+        // 定向唤醒只用各自的eventfd, 不用信号: 信号会落到正在运行的用户代码上, 让没有hook的阻塞调用返回EINTR
+        size_t count = m_threadCount + (m_rootThread != -1 ? 1 : 0);
+        for(size_t i = 0; i < count; ++i) {
+            std::unique_ptr<Reactor> reactor(new Reactor);
+            reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+            SYLAR_ASSERT(reactor->epfd >= 0);
+            reactor->tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            SYLAR_ASSERT(reactor->tickleFd >= 0);
+
+            event.events = EPOLLIN | EPOLLET;
+            event.data.fd = reactor->tickleFd;
+            rt = epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->tickleFd, &event);
+            SYLAR_ASSERT(!rt);
+
+            // 共享的m_epfd嵌套进每个reactor, 单epoll模式下的全部fd, 非调度线程注册的fd和io_uring都在那里
+            // 用边缘触发: 水平触发时m_epfd没取空之前每个reactor的每次epoll_wait都会返回, 所有线程一起空转
+            // (epoll句柄不能用EPOLLEXCLUSIVE), 被唤醒的线程负责取空, 没取到的线程直接回去睡
+            event.events = EPOLLIN | EPOLLET;
+            event.data.fd = m_epfd;
+            rt = epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, m_epfd, &event);
+            SYLAR_ASSERT(!rt);
+            m_reactors.push_back(std::move(reactor));
+        }
+
+        if(m_persistentEpoll) {
+            RWMutex::WriteLock lock(GetPersistentMutex());
+            GetPersistentManagers().insert(this);
+            ++s_persistent_count;
+        }
 
         start();
     }
 
     IOManager::~IOManager() {
+        if(m_persistentEpoll) {
+            RWMutex::WriteLock lock(GetPersistentMutex());
+            GetPersistentManagers().erase(this);
+            --s_persistent_count;
+        }
+        // 先停止采集, 之后的成员析构期间不会再被读取
+        unregisterMetrics();
         stop();
         close(m_epfd);
-        close(m_tickleFds[0]);
-        close(m_tickleFds[1]);
+        close(m_tickleFd);
+        m_uring.reset();
+        for(auto& i : m_reactors) {
+            if(i->epfd >= 0) {
+                close(i->epfd);
+                close(i->tickleFd);
+            }
+        }
+
+        // 逐块删除事件上下文
+        for(size_t i = 0; i < FD_MAX_CHUNKS; ++i) {
+            FdContext* chunk = m_fdChunks[i].load(std::memory_order_relaxed);
+            if(chunk) {
+                delete[] chunk;
+            }
+        }
+    }
+
+    void IOManager::collectMetrics(MetricsWriter& writer) {
+        Scheduler::collectMetrics(writer);
+        std::string labels = "scheduler=\"" + getName() + "\"";
+        writer.gauge("sylar_iomanager_pending_events", "IO events waiting to fire"
+                     ,getPendingEventCount(), labels);
+        writer.gauge("sylar_iomanager_sleeping_threads", "Threads blocked in epoll_wait"
+                     ,m_sleepingThreadCount, labels);
+    }
+
+    IOManager::FdContext* IOManager::getFdContext(int fd, bool auto_create) {
+        if(SYLAR_UNLIKELY(fd < 0)) {
+            return nullptr;
+        }
+        size_t idx = (size_t)fd >> FD_CHUNK_BITS;
+        if(SYLAR_UNLIKELY(idx >= FD_MAX_CHUNKS)) {
+            SYLAR_LOG_ERROR(g_logger) << "getFdContext fd=" << fd << " out of range";
+            return nullptr;
+        }
+
+        FdContext* chunk = m_fdChunks[idx].load(std::memory_order_acquire);
+        if(SYLAR_UNLIKELY(!chunk)) {
+            if(!auto_create) {
+                return nullptr;
+            }
+            // 多个线程可能同时分配同一块, 只有一个能装进去, 其余的释放掉自己的
+            FdContext* new_chunk = new FdContext[FD_CHUNK_SIZE];
+            for(size_t i = 0; i < FD_CHUNK_SIZE; ++i) {
+                new_chunk[i].fd = (int)((idx << FD_CHUNK_BITS) + i);
+                new_chunk[i].mutex.setSpin(m_mutexSpin);
+            }
+            if(m_fdChunks[idx].compare_exchange_strong(chunk, new_chunk
+                        ,std::memory_order_acq_rel, std::memory_order_acquire)) {
+                chunk = new_chunk;
+            } else {
+                delete[] new_chunk;
+            }
+        }
+        return &chunk[fd & (FD_CHUNK_SIZE - 1)];
+    }
 
-        // 逐个删除事件
-        for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-            if(m_fdContexts[i]) {
-                delete m_fdContexts[i];
+    IOManager::Reactor* IOManager::getReactor() {
+        int id = sylar::GetThreadId();
+        for(auto& i : m_reactors) {
+            if(i->thread == id) {
+                return i.get();
             }
         }
+        return nullptr;
+    }
+
+    bool IOManager::isWorkerThread() const {
+        // use_caller的调用线程只在stop()里参与调度, 平时注册的fd没有线程去等
+        return Scheduler::GetThis() == this && sylar::GetThreadId() != m_rootThread;
     }
 
-    void IOManager::contextResize(size_t size) {
-        m_fdContexts.resize(size);
-        for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-            if(!m_fdContexts[i]) {
-                m_fdContexts[i] = new FdContext;
+    IOManager::Reactor* IOManager::claimReactor() {
+        Reactor* reactor = getReactor();
+        if(reactor) {
+            return reactor;
+        }
+        int id = sylar::GetThreadId();
+        for(auto& i : m_reactors) {
+            int expected = -1;
+            if(i->thread.compare_exchange_strong(expected, id)) {
+                return i.get();
             }
         }
+        return nullptr;
+    }
+
+    int IOManager::getEpfd(FdContext* fd_ctx) const {
+        return fd_ctx->reactor ? fd_ctx->reactor->epfd : m_epfd;
     }
 
     int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-        FdContext* fd_ctx = nullptr;
-        RWMutexType::ReadLock lock(m_mutex);
-        // 我们必须确保容器大小和fd大小的状态,防止月结
-        if((int)m_fdContexts.size() > fd) {
-            fd_ctx = m_fdContexts[fd];
-            lock.unlock();
-        } else {
-            lock.unlock();
-            RWMutexType::WriteLock lock2(m_mutex);
-            contextResize(fd * 1.5);
-            fd_ctx = m_fdContexts[fd];
+        // 块是稳定的, 查表不需要加全局锁
+        FdContext* fd_ctx = getFdContext(fd, true);
+        if(!fd_ctx) {
+            return -1;
         }
 
         // 加锁并输出基本信息
@@ -181,23 +369,45 @@ first = false; \
 
         // Event是我们的事件等级
 
-        // 确定epoll的操作类型为添加还是修改
-        int op = fd_ctx -> events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-        // 创建epoll事件结构
-        epoll_event epevent;
-        // 设置事件类型 (边缘触发模式, 当前已注册事件, 新要添加的事件)
-        epevent.events = EPOLLET | fd_ctx -> events | event;
-        // 设置关联数据
-        epevent.data.ptr = fd_ctx;
-
-        // 将事件添加到epoll
-        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-        if(rt) {
-            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
-                << (EPOLL_EVENTS)fd_ctx->events;
-            return -1;
+        // 多reactor模式下fd绑定到第一次注册它的线程, 直到cancelAll
+        // 只有本调度器的工作线程可以认领reactor, 其他线程只用自己已经认领的, 没有就注册到共享的m_epfd
+        if(m_multiReactor && !fd_ctx->reactor && !fd_ctx->events && !fd_ctx->registered) {
+            fd_ctx->reactor = isWorkerThread() ? claimReactor() : getReactor();
+        }
+        int epfd = getEpfd(fd_ctx);
+
+        // 持久模式下已经注册过的fd不需要epoll_ctl
+        if(!m_persistentEpoll || !fd_ctx->registered) {
+            // 确定epoll的操作类型为添加还是修改
+            int op = fd_ctx -> events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            // 创建epoll事件结构
+            epoll_event epevent;
+            // 设置事件类型 (边缘触发模式, 当前已注册事件, 新要添加的事件)
+            // 持久模式一次注册读写两种事件
+            epevent.events = m_persistentEpoll ? (EPOLLET | EPOLLIN | EPOLLOUT)
+                                               : (EPOLLET | fd_ctx -> events | event);
+            // 设置关联数据
+            epevent.data.ptr = fd_ctx;
+
+            // 将事件添加到epoll
+            int rt = epoll_ctl(epfd, op, fd, &epevent);
+            if(rt && m_persistentEpoll && errno == EEXIST) {
+                // fd没经过cancelAll就被关闭又复用了, 内核里还留着旧的注册
+                op = EPOLL_CTL_MOD;
+                rt = epoll_ctl(epfd, op, fd, &epevent);
+            } else if(rt && op == EPOLL_CTL_MOD && errno == ENOENT) {
+                // 旧的fd关闭时内核已经删掉了注册, 复用后重新添加
+                op = EPOLL_CTL_ADD;
+                rt = epoll_ctl(epfd, op, fd, &epevent);
+            }
+            if(rt) {
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
+                    << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                    << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
+                    << (EPOLL_EVENTS)fd_ctx->events;
+                return -1;
+            }
+            fd_ctx->registered = m_persistentEpoll;
         }
 
         // 增加当前等待执行的事件数量
@@ -208,8 +418,8 @@ first = false; \
         FdContext::EventContext& event_ctx = fd_ctx -> getContext(event);
         SYLAR_ASSERT(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
 
-        // 设置调度器, 协程, 回调函数
-        event_ctx.scheduler = Scheduler::GetThis();
+        // 设置调度器, 协程, 回调函数; 调度器外的线程注册的回调交给本IOManager执行
+        event_ctx.scheduler = Scheduler::GetThis() ? Scheduler::GetThis() : this;
         if(cb) {
             event_ctx.cb.swap(cb);
         } else {
@@ -217,16 +427,21 @@ first = false; \
             SYLAR_ASSERT2(event_ctx.fiber->getState() == Fiber::EXEC
               ,"state=" << event_ctx.fiber->getState());
         }
+
+        // 持久模式下之前已经来过的边沿直接触发, 协程切出去之后马上会被调度回来
+        if(m_persistentEpoll && (fd_ctx->ready & event)) {
+            fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+            fd_ctx->triggerEvent(event, fd_ctx->reactor ? fd_ctx->reactor->thread.load() : -1);
+            --m_pendingEventCount;
+        }
         return 0;
     }
 
     bool IOManager::delEvent(int fd, Event event) {
-        RWMutexType::ReadLock lock(m_mutex);
-        if((int)m_fdContexts.size() <= fd) {
+        FdContext* fd_ctx = getFdContext(fd, false);
+        if(!fd_ctx) {
             return false;
         }
-        FdContext* fd_ctx = m_fdContexts[fd];
-        lock.unlock();
 
         FdContext::MutexType::Lock lock2(fd_ctx->mutex);
         if(!(fd_ctx->events & event)) {
@@ -235,17 +450,20 @@ first = false; \
 
         // 确定类型
         Event new_events = (Event)(fd_ctx -> events & ~event);
-        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-        epoll_event epevent;
-        epevnt.events = EPOLLET | new_events;
-        epevent.data.ptr = fd_ctx;
-
-        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-        if (rt) {
-            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                << rt << " (" << errno << ") (" << strerror(errno) << ")";
-            return false;
+        // 持久模式下注册保持不变, 只改本地状态
+        if(!m_persistentEpoll) {
+            int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+            epoll_event epevent;
+            epevent.events = EPOLLET | new_events;
+            epevent.data.ptr = fd_ctx;
+
+            int rt = epoll_ctl(getEpfd(fd_ctx), op, fd, &epevent);
+            if (rt) {
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << getEpfd(fd_ctx) << ", "
+                    << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                    << rt << " (" << errno << ") (" << strerror(errno) << ")";
+                return false;
+            }
         }
 
         --m_pendingEventCount;
@@ -257,12 +475,10 @@ first = false; \
     }
 
     bool IOManager::cancelEvent(int fd, Event event) {
-        RWMutexType::ReadLock lock(m_mutex);
-        if((int)m_fdContexts.size() <= fd) {
+        FdContext* fd_ctx = getFdContext(fd, false);
+        if(!fd_ctx) {
             return false;
         }
-        FdContext* fd_ctx = m_fdContexts[fd];
-        lock.unlock();
 
         FdContext::MutexType::Lock lock2(fd_ctx->mutex);
         // 检测是否已经注册
@@ -272,35 +488,37 @@ first = false; \
 
         // 更新状态, 移除指定事件
         Event new_events = (Event)(fd_ctx -> events & ~event);
-        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-        epoll_event epevent;
-        epevent.events = EPOLLET | new_events;
-        epevent.data.ptr = fd_ctx;
-
-        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-        if (rt) {
-            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                << rt << " (" << errno << ") (" << strerror(errno) << ")";
-            return false;
+        // 持久模式下注册保持不变, 只改本地状态
+        if(!m_persistentEpoll) {
+            int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+            epoll_event epevent;
+            epevent.events = EPOLLET | new_events;
+            epevent.data.ptr = fd_ctx;
+
+            int rt = epoll_ctl(getEpfd(fd_ctx), op, fd, &epevent);
+            if (rt) {
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << getEpfd(fd_ctx) << ", "
+                    << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                    << rt << " (" << errno << ") (" << strerror(errno) << ")";
+                return false;
+            }
         }
 
-        // 重置事件上下文
-        fd_ctx -> resetContext(fd_ctx -> getContext(event));
+        // 触发事件, 等待的协程被唤醒后自己处理取消
+        fd_ctx -> triggerEvent(event);
         --m_pendingEventCount;
         return true;
     }
 
     bool IOManager::cancelAll(int fd) {
-        RWMutexType::ReadLock lock(m_mutex);
-        if((int)m_fdContexts.size() <= fd) {
+        FdContext* fd_ctx = getFdContext(fd, false);
+        if(!fd_ctx) {
             return false;
         }
-        FdContext* fd_ctx = m_fdContexts[fd];
-        lock.unlock();
 
         FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-        if(!fd_ctx->events) {
+        // 持久模式下没有等待的事件也要把注册删掉, 否则fd复用后收不到通知
+        if(!fd_ctx->events && !fd_ctx->registered) {
             return false;
         }
 
@@ -312,13 +530,17 @@ first = false; \
         epevent.data.ptr = fd_ctx;
 
         // 执行epoll调用
-        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-        if (rt) {
-            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        // ENOENT: 之前的fd没经过cancelAll就关闭了, 内核里已经没有注册, 只需要清理本地状态
+        int rt = epoll_ctl(getEpfd(fd_ctx), op, fd, &epevent);
+        if (rt && errno != ENOENT) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << getEpfd(fd_ctx) << ", "
                 << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
                 << rt << " (" << errno << ") (" << strerror(errno) << ")";
             return false;
         }
+        fd_ctx->registered = false;
+        fd_ctx->ready = NONE;
+        fd_ctx->reactor = nullptr;
 
         /**
          * 我们用位运算来区分读事件和写事件
@@ -326,17 +548,207 @@ first = false; \
          * 如果类型不匹配,会发生严重错误
          */
         if(fd_ctx->events & READ) {
-            fd_ctx->resetContext(fd_ctx->read);
+            fd_ctx->triggerEvent(READ);
             --m_pendingEventCount;
         }
         if(fd_ctx->events & WRITE) {
-            fd_ctx->resetContext(fd_ctx->write);
+            fd_ctx->triggerEvent(WRITE);
             --m_pendingEventCount;
         }
         SYLAR_ASSERT(fd_ctx -> events == 0);
         return true;
     }
 
+    void IOManager::OnClose(int fd) {
+        // 没有持久模式的IOManager时不加锁
+        if(SYLAR_LIKELY(s_persistent_count == 0)) {
+            return;
+        }
+        RWMutex::ReadLock lock(GetPersistentMutex());
+        for(auto& i : GetPersistentManagers()) {
+            i->cancelAll(fd);
+        }
+    }
+
+    int IOManager::submitIo(const std::function<void(io_uring_sqe*)>& prep, uint64_t timeout_ms) {
+        SYLAR_ASSERT(m_uring);
+        std::shared_ptr<UringOp> op(new UringOp);
+        op->scheduler = Scheduler::GetThis();
+        op->fiber = Fiber::GetThis();
+
+        bool first = false;
+        {
+            Spinlock::Lock lock(m_uringSqMutex);
+            io_uring_sqe* sqe = m_uring->getSqe();
+            if(SYLAR_UNLIKELY(!sqe)) {
+                // 队列满了, 先把攒下的交给内核
+                m_uring->submit();
+                sqe = m_uring->getSqe();
+                if(!sqe) {
+                    return -EAGAIN;
+                }
+            }
+            prep(sqe);
+            sqe->user_data = (uint64_t)op.get();
+            first = m_uring->unsubmitted() == 1;
+        }
+        ++m_pendingEventCount;
+
+        Timer::ptr timer;
+        if(timeout_ms != ~0ull) {
+            std::weak_ptr<UringOp> wop(op);
+            timer = addConditionTimer(timeout_ms, [this, wop]() {
+                auto op = wop.lock();
+                if(!op) {
+                    return;
+                }
+                op->timedout = true;
+                cancelUring(op.get());
+            }, wop, false);
+        }
+
+        // 请求攒到idle里统一提交, 第一个请求叫醒一个睡眠的线程去提交
+        if(first) {
+            tickle();
+        }
+        Fiber::YieldToHold();
+
+        if(timer) {
+            timer->cancel();
+        }
+        if(op->res == -ECANCELED && op->timedout) {
+            return -ETIMEDOUT;
+        }
+        return op->res;
+    }
+
+    void IOManager::submitUring() {
+        Spinlock::Lock lock(m_uringSqMutex);
+        int rt = m_uring->submit();
+        if(SYLAR_UNLIKELY(rt < 0 && rt != -EBUSY && rt != -EAGAIN)) {
+            SYLAR_LOG_EVERY_MS(g_logger, sylar::LogLevel::ERROR, 1000) << "io_uring_enter(" << m_uring->getFd() << "):"
+                << rt << " (" << strerror(-rt) << ")";
+        }
+    }
+
+    void IOManager::reapUring() {
+        Spinlock::Lock lock(m_uringCqMutex);
+        auto cb = [this](uint64_t user_data, int res) {
+            // 取消请求自己的完成事件
+            if(!user_data) {
+                return;
+            }
+            UringOp* op = (UringOp*)user_data;
+            op->res = res;
+            // schedule之后协程随时可能恢复并释放op, 先把需要的都取出来
+            Scheduler* scheduler = op->scheduler;
+            Fiber::ptr fiber;
+            fiber.swap(op->fiber);
+            --m_pendingEventCount;
+            scheduler->schedule(fiber);
+        };
+        m_uring->reap(cb);
+        // 在途请求比完成队列长时, 多出来的完成事件在内核的溢出链表上
+        // 腾出空间后要进一次内核才会搬回来, 否则这些协程一直挂着
+        while(SYLAR_UNLIKELY(m_uring->cqOverflow())) {
+            int rt = m_uring->flushOverflow();
+            if(rt < 0) {
+                SYLAR_LOG_EVERY_MS(g_logger, sylar::LogLevel::ERROR, 1000) << "io_uring flush overflow("
+                    << m_uring->getFd() << "):" << rt << " (" << strerror(-rt) << ")";
+                break;
+            }
+            if(!m_uring->reap(cb)) {
+                break;
+            }
+        }
+    }
+
+    void IOManager::cancelUring(UringOp* op) {
+        Spinlock::Lock lock(m_uringSqMutex);
+        io_uring_sqe* sqe = m_uring->getSqe();
+        if(!sqe) {
+            m_uring->submit();
+            sqe = m_uring->getSqe();
+            if(!sqe) {
+                SYLAR_LOG_ERROR(g_logger) << "cancelUring no free sqe";
+                return;
+            }
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = (uint64_t)op;
+        sqe->user_data = 0;
+        // 取消要尽快生效, 不等idle批量提交
+        m_uring->submit();
+    }
+
+    size_t IOManager::listenReusePort(std::shared_ptr<Address> addr, std::function<void(int fd)> cb
+                                      ,int backlog) {
+        // 多reactor模式下每个调度线程一个监听socket, 否则只开一个, 由任意线程accept
+        std::vector<int> threads;
+        if(m_multiReactor) {
+            threads = m_threadIds;
+        }
+        if(threads.empty()) {
+            threads.push_back(-1);
+        }
+
+        size_t count = 0;
+        for(int thread : threads) {
+            int fd = socket(addr->getFamily(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if(fd < 0) {
+                SYLAR_LOG_ERROR(g_logger) << "listenReusePort socket errno=" << errno
+                    << " errstr=" << strerror(errno);
+                break;
+            }
+            int val = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+            if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val))
+                    || bind(fd, addr->getAddr(), addr->getAddrLen())
+                    || listen(fd, backlog)) {
+                SYLAR_LOG_ERROR(g_logger) << "listenReusePort " << *addr << " errno=" << errno
+                    << " errstr=" << strerror(errno);
+                close(fd);
+                break;
+            }
+            {
+                Mutex::Lock lock(m_listenMutex);
+                m_listenFds.push_back(fd);
+            }
+
+            // accept协程固定在目标线程上, 它的addEvent会把监听fd绑定到这个线程的reactor
+            schedule([this, fd, cb, thread]() {
+                while(true) {
+                    int client = accept(fd, nullptr, nullptr);
+                    if(client >= 0) {
+                        schedule(std::bind(cb, client), thread);
+                        continue;
+                    }
+                    if(errno == EINTR) {
+                        continue;
+                    }
+                    if(errno == EAGAIN && !addEvent(fd, READ)) {
+                        Fiber::YieldToHold();
+                        continue;
+                    }
+                    // stopListen shutdown之后accept返回EINVAL
+                    break;
+                }
+                close(fd);
+            }, thread);
+            ++count;
+        }
+        return count;
+    }
+
+    void IOManager::stopListen() {
+        Mutex::Lock lock(m_listenMutex);
+        for(int fd : m_listenFds) {
+            // 只shutdown, fd由accept协程醒来后自己关闭
+            shutdown(fd, SHUT_RDWR);
+        }
+        m_listenFds.clear();
+    }
+
     IOManager* IOManager::GetThis() {
         // GetThis返回的是Scheduler*,所以我们这里dynamic_cast了
         // 但请注意, 我们需要注意安全使用
@@ -344,18 +756,60 @@ first = false; \
     }
 
     // 唤醒空闲线程
+    // 1. 只有线程真正睡在epoll_wait里才需要写eventfd
+    // 2. 已经有一次唤醒还没被消费时直接合并, 被唤醒的线程回到run()会把任务都取走
     void IOManager::tickle() {
-        if (!hasIdleThreads()) {
-            return ;
+        // 轮流找一个睡着的reactor叫醒, 避免总是同一个线程
+        size_t count = m_reactors.size();
+        size_t start = m_tickleCursor++;
+        for(size_t i = 0; i < count; ++i) {
+            Reactor* reactor = m_reactors[(start + i) % count].get();
+            if(reactor->sleeping) {
+                tickleReactor(reactor);
+                return;
+            }
+        }
+        // 没有睡在自己reactor上的线程, 退回共享的eventfd, 它嵌套在每个reactor里
+        if (m_sleepingThreadCount == 0) {
+            return;
         }
-        int rt = write(m_tickleFds[1],"T", 1);
-        SYLAR_ASSERT(rt == 1);
+        if (m_tickled.exchange(true)) {
+            return;
+        }
+        uint64_t one = 1;
+        int rt = write(m_tickleFd, &one, sizeof(one));
+        SYLAR_ASSERT(rt == sizeof(one));
+    }
+
+    // 只叫醒目标线程: 写它自己reactor的eventfd
+    // 叫醒任意线程没有用, 目标线程本地队列里的任务别的线程取不到
+    void IOManager::tickleThread(int thread) {
+        for(auto& i : m_reactors) {
+            if(i->thread == thread) {
+                if(i->sleeping) {
+                    tickleReactor(i.get());
+                }
+                return;
+            }
+        }
+        // 目标线程还没有进过idle, 它睡眠前会检查自己的本地队列, 不需要唤醒
+    }
+
+    void IOManager::tickleReactor(Reactor* reactor) {
+        if(reactor->tickled.exchange(true)) {
+            return;
+        }
+        uint64_t one = 1;
+        int rt = write(reactor->tickleFd, &one, sizeof(one));
+        SYLAR_ASSERT(rt == sizeof(one));
     }
 
     bool IOManager::stopping(uint64_t& timeout) {
         // 获取下一个定时器的超时时间
         timeout = getNextTimer();
-        return timeout == ~0ull && m_pendingEventCount == 0 && stopping();
+        // 线程定时器模式下getNextTimer只看到本线程的, 还要确认其他线程也没有定时器
+        return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping()
+                && (!isPerThread() || !hasTimer());
     }
 
     bool IOManager::stopping() {
@@ -378,6 +832,16 @@ first = false; \
             delete[] ptr;
         });
 
+        // 线程定时器模式下, 本线程添加的定时器从此只进本线程的集合
+        registerTimerThread();
+
+        // 等在本线程自己的epoll上, 共享的m_epfd嵌套在里面
+        Reactor* reactor = claimReactor();
+        int epfd = reactor ? reactor->epfd : m_epfd;
+
+        // 本线程的运行时指标
+        ThreadMetrics& metrics = Metrics::Local();
+
         // 主事件循环
         while(true) {
             uint64_t next_timeout = 0;
@@ -385,34 +849,63 @@ first = false; \
             if(SYLAR_UNLIKELY(stopping(next_timeout))) {
                 SYLAR_LOG_INFO(g_logger) << "name=" << getName()
                                          << " idle stopping exit";
+                unregisterTimerThread();
+                // 停止时的唤醒是合并的, 退出前叫醒下一个睡眠线程
+                tickle();
                 break; // 满足停止条件，退出循环
             }
 
+            // 本轮攒下的io_uring请求一次提交
+            if(m_uring) {
+                submitUring();
+            }
+
             int rt = 0;
-            // epoll_wait调用循环，处理信号中断
-            do {
-                // 设置最大超时时间为3秒，避免无限等待
-                static const int MAX_TIMEOUT = 3000;
-
-                // 计算实际的超时时间
-                if(next_timeout != ~0ull) {
-                    // 如果有定时器，取定时器时间和最大超时时间的较小值
-                    next_timeout = (int)next_timeout > MAX_TIMEOUT
-                                    ? MAX_TIMEOUT : next_timeout;
-                } else {
-                    // 如果没有定时器，使用最大超时时间
-                    next_timeout = MAX_TIMEOUT;
-                }
+            // 先登记睡眠再检查任务, 和tickle()里先放任务再检查睡眠线程配对, 不会丢唤醒
+            ++m_sleepingThreadCount;
+            if(reactor) {
+                reactor->sleeping = true;
+            }
+            if (hasReadyTasks() || (m_stopping && stopping())) {
+                next_timeout = 0;
+            }
+            // 设置最大超时时间为3秒，避免无限等待
+            static const int MAX_TIMEOUT = 3000;
+
+            // 计算实际的超时时间
+            if(next_timeout != ~0ull) {
+                // 如果有定时器，取定时器时间和最大超时时间的较小值
+                next_timeout = (int)next_timeout > MAX_TIMEOUT
+                                ? MAX_TIMEOUT : next_timeout;
+            } else {
+                // 如果没有定时器，使用最大超时时间
+                next_timeout = MAX_TIMEOUT;
+            }
 
-                // 等待IO事件发生，最多等待next_timeout毫秒
-                rt = epoll_wait(m_epfd, events, MAX_EVNETS, (int)next_timeout);
-                // 如果被信号中断，继续等待；否则跳出循环
-                if(rt < 0 && errno == EINTR) {
-                    // 被信号中断，继续循环
-                } else {
-                    break; // 正常返回或其他错误，跳出循环
+            // 等待IO事件发生，最多等待next_timeout毫秒
+            // 睡眠期间idle协程不算在运行, 先清掉看门狗的记录, 否则空闲的线程会被当成卡顿
+            Watchdog::OnSwapOut();
+            rt = epoll_wait(epfd, events, MAX_EVNETS, (int)next_timeout);
+            Watchdog::OnSwapIn(Fiber::GetFiberId());
+            if(rt < 0) {
+                // 被信号中断当作一次唤醒, 其他错误说明epoll句柄或参数有问题, 要报出来
+                if(errno != EINTR) {
+                    SYLAR_LOG_ERROR(g_logger) << "epoll_wait(" << epfd << ") errno="
+                                              << errno << " errstr=" << strerror(errno);
                 }
-            } while(true);
+                rt = 0;
+            }
+            if(reactor) {
+                reactor->sleeping = false;
+            }
+            --m_sleepingThreadCount;
+            metrics.epoll_wakes.inc();
+            metrics.epoll_batch.record(rt > 0 ? rt : 0);
+
+            // 不管是哪个句柄唤醒的, 都顺便取一下io_uring的完成事件
+            if(m_uring) {
+                reapUring();
+            }
 
             // 处理到期的定时器
             std::vector<std::function<void()> > cbs;
@@ -430,84 +923,132 @@ first = false; \
             //}
 
             // 处理所有返回的IO事件
+            bool shared_ready = false;
             for(int i = 0; i < rt; ++i) {
                 epoll_event& event = events[i];
-
-                // 检查是否是线程唤醒事件（tickle管道的读端）
-                if(event.data.fd == m_tickleFds[0]) {
-                    uint8_t dummy[256];
-                    // 清空管道中的所有数据，消费唤醒信号
-                    while(read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
-                    continue; // 处理下一个事件
+                if(reactor) {
+                    // 本线程的唤醒
+                    if(event.data.fd == reactor->tickleFd) {
+                        uint64_t dummy;
+                        while(read(reactor->tickleFd, &dummy, sizeof(dummy)) < 0 && errno == EINTR);
+                        reactor->tickled = false;
+                        continue;
+                    }
+                    // 共享epoll里有事件, 本线程的都处理完再去取
+                    if(event.data.fd == m_epfd) {
+                        shared_ready = true;
+                        continue;
+                    }
+                    // 本线程reactor上的fd, 协程就在本线程恢复
+                    handleEvent(event, reactor->thread);
+                } else {
+                    handleEvent(event, -1);
                 }
+            }
+            if(shared_ready) {
+                // 嵌套是边缘触发的, 必须取空, 否则下一个边沿之前没有线程会再来取
+                do {
+                    rt = epoll_wait(m_epfd, events, MAX_EVNETS, 0);
+                    for(int i = 0; i < rt; ++i) {
+                        handleEvent(events[i], -1);
+                    }
+                } while(rt == (int)MAX_EVNETS);
+            }
 
-                // 获取文件描述符上下文（之前通过epevent.data.ptr设置）
-                FdContext* fd_ctx = (FdContext*)event.data.ptr;
-                // 对文件描述符上下文加锁，确保线程安全
-                FdContext::MutexType::Lock lock(fd_ctx->mutex);
+            // 协程切换：从idle协程切换回调度协程
+            Fiber::ptr cur = Fiber::GetThis(); // 获取当前协程（idle协程）
+            auto raw_ptr = cur.get(); // 获取原始指针
+            cur.reset(); // 释放智能指针，减少引用计数
 
-                // 处理错误和连接断开事件
-                if(event.events & (EPOLLERR | EPOLLHUP)) {
-                    // 将错误事件转换为读写事件，让上层应用处理
-                    event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
-                }
+            raw_ptr->swapOut(); // 切换回调度协程，让调度器继续调度其他任务
+        }
+    }
 
-                // 将epoll事件转换为IOManager的事件类型
-                int real_events = NONE;
-                if(event.events & EPOLLIN) {
-                    real_events |= READ; // epoll可读事件转换为READ事件
-                }
-                if(event.events & EPOLLOUT) {
-                    real_events |= WRITE; // epoll可写事件转换为WRITE事件
-                }
+    void IOManager::handleEvent(epoll_event& event, int thread) {
+        // 检查是否是线程唤醒事件
+        if(event.data.fd == m_tickleFd) {
+            uint64_t dummy;
+            // 一次read清空计数; 必须先读再清标记, 否则会吞掉后来的唤醒
+            while(read(m_tickleFd, &dummy, sizeof(dummy)) < 0 && errno == EINTR);
+            m_tickled = false;
+            return;
+        }
+        // io_uring的完成事件在idle里已经取过了
+        if(m_uring && event.data.fd == m_uring->getFd()) {
+            return;
+        }
 
-                // 检查触发的事件是否是我们关心的事件
-                if((fd_ctx->events & real_events) == NONE) {
-                    continue; // 不是我们关心的事件，跳过
-                }
+        // 获取文件描述符上下文（之前通过epevent.data.ptr设置）
+        FdContext* fd_ctx = (FdContext*)event.data.ptr;
+        // 对文件描述符上下文加锁，确保线程安全
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+
+        // 处理错误和连接断开事件
+        if(event.events & (EPOLLERR | EPOLLHUP)) {
+            // 将错误事件转换为读写事件，让上层应用处理
+            // 持久模式下没人等的也要记下来
+            event.events |= (EPOLLIN | EPOLLOUT)
+                            & (m_persistentEpoll ? (EPOLLIN | EPOLLOUT) : fd_ctx->events);
+        }
 
-                // 计算处理当前事件后剩余的事件
-                int left_events = (fd_ctx->events & ~real_events);
-                // 根据剩余事件决定epoll操作：有剩余事件则修改，无剩余事件则删除
-                int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-                // 设置新的epoll事件（边缘触发 + 剩余事件）
-                event.events = EPOLLET | left_events;
-
-                // 更新epoll的监听状态
-                int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-                if(rt2) {
-                    // epoll_ctl调用失败，记录错误日志
-                    SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                        << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
-                        << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
-                    continue; // 处理下一个事件
-                }
+        // 将epoll事件转换为IOManager的事件类型
+        int real_events = NONE;
+        if(event.events & EPOLLIN) {
+            real_events |= READ; // epoll可读事件转换为READ事件
+        }
+        if(event.events & EPOLLOUT) {
+            real_events |= WRITE; // epoll可写事件转换为WRITE事件
+        }
 
-                // 调试日志（已注释）
-                //SYLAR_LOG_INFO(g_logger) << " fd=" << fd_ctx->fd << " events=" << fd_ctx->events
-                //                         << " real_events=" << real_events;
+        if(m_persistentEpoll) {
+            // 持久模式: 没有等待者的就绪事件留给下一次addEvent, 不需要改注册
+            fd_ctx->ready = (Event)(fd_ctx->ready | (real_events & ~fd_ctx->events));
+            real_events &= fd_ctx->events;
+        } else {
+            // 检查触发的事件是否是我们关心的事件
+            if((fd_ctx->events & real_events) == NONE) {
+                return; // 不是我们关心的事件，跳过
+            }
 
-                // 触发相应的事件处理
-                if(real_events & READ) {
-                    fd_ctx->triggerEvent(read); // 触发读事件，唤醒等待的协程或执行回调
-                    --m_pendingEventCount; // 减少待处理事件计数
-                }
-                if(real_events & WRITE) {
-                    fd_ctx->triggerEvent(WRITE); // 触发写事件，唤醒等待的协程或执行回调
-                    --m_pendingEventCount; // 减少待处理事件计数
-                }
+            // 计算处理当前事件后剩余的事件
+            int left_events = (fd_ctx->events & ~real_events);
+            // 根据剩余事件决定epoll操作：有剩余事件则修改，无剩余事件则删除
+            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+            // 设置新的epoll事件（边缘触发 + 剩余事件）
+            event.events = EPOLLET | left_events;
+
+            // 更新epoll的监听状态
+            int epfd = getEpfd(fd_ctx);
+            int rt2 = epoll_ctl(epfd, op, fd_ctx->fd, &event);
+            if(rt2) {
+                // epoll_ctl调用失败，记录错误日志; 故障时每个事件都会失败, 限流避免刷屏
+                SYLAR_LOG_EVERY_MS(g_logger, sylar::LogLevel::ERROR, 1000) << "epoll_ctl(" << epfd << ", "
+                    << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
+                    << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
+                return;
             }
+        }
 
-            // 协程切换：从idle协程切换回调度协程
-            Fiber::ptr cur = Fiber::GetThis(); // 获取当前协程（idle协程）
-            auto raw_ptr = cur.get(); // 获取原始指针
-            cur.reset(); // 释放智能指针，减少引用计数
+        // 调试日志（已注释）
+        //SYLAR_LOG_INFO(g_logger) << " fd=" << fd_ctx->fd << " events=" << fd_ctx->events
+        //                         << " real_events=" << real_events;
 
-            raw_ptr->swapOut(); // 切换回调度协程，让调度器继续调度其他任务
+        // 触发相应的事件处理
+        if(real_events & READ) {
+            fd_ctx->triggerEvent(READ, thread); // 触发读事件，唤醒等待的协程或执行回调
+            --m_pendingEventCount; // 减少待处理事件计数
+        }
+        if(real_events & WRITE) {
+            fd_ctx->triggerEvent(WRITE, thread); // 触发写事件，唤醒等待的协程或执行回调
+            --m_pendingEventCount; // 减少待处理事件计数
         }
     }
 
     void IOManager::onTimerInsertedAtFront() {
         tickle();
     }
+
+    void IOManager::onThreadTimerChanged(int thread) {
+        tickleThread(thread);
+    }
 }
@@ -5,11 +5,18 @@
 #ifndef IOMANAGER_H
 #define IOMANAGER_H
 
+#include <sys/epoll.h>
+#include <sys/socket.h>
 #include "Schedule.h"
 #include "timer.h"
 
+struct io_uring_sqe;
+
 namespace sylar {
 
+    class IoUring;
+    class Address;
+
     // 基于Epoll的IO协程调度器
     class IOManager : public Scheduler, public TimerManager {
     public:
@@ -24,9 +31,21 @@ namespace sylar {
             // 写事件(EPOLLOUT)
             WRITE = 0x4,
         };
+
+        // IO后端
+        enum IoBackend {
+            // 只用epoll就绪通知
+            EPOLL = 0,
+            // hook的读写/accept/connect走io_uring提交, addEvent仍走epoll
+            IO_URING = 1,
+        };
     private:
-        struct FdContext {
-            typedef Mutex MutexType;
+        struct Reactor;
+
+        // 按缓存行对齐, 相邻fd的上下文不会落在同一缓存行上
+        struct alignas(SYLAR_CACHELINE_SIZE) FdContext {
+            // 临界区只有几次赋值, 先自旋再休眠
+            typedef AdaptiveMutex MutexType;
             struct EventContext {
                 // 事件调度器
                 Scheduler* scheduler = nullptr;
@@ -41,8 +60,8 @@ namespace sylar {
             // 重置事件上下文
             void resetContext(EventContext& ctx);
 
-            // 触发事件
-            void triggerEvent(Event event);
+            // 触发事件, thread 为恢复协程的线程, -1 为任意线程
+            void triggerEvent(Event event, int thread = -1);
 
             // 读事件上下文
             EventContext read;
@@ -52,6 +71,12 @@ namespace sylar {
             int fd = 0;
             // 当前的事件
             Event events = NONE;
+            // 持久模式: 已经来过边沿但还没有人等待的事件
+            Event ready = NONE;
+            // 持久模式: 是否已经注册到epoll
+            bool registered = false;
+            // 多reactor模式: 第一次注册时绑定的reactor, cancelAll之前不变
+            Reactor* reactor = nullptr;
             // 事件锁
             MutexType mutex;
         };
@@ -59,7 +84,9 @@ namespace sylar {
         // threads 线程数量
         // use_caller 是否将调用线程包含进去
         // name 调度器名称
-        IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = "");
+        // backend IO后端, io_uring不可用时退回epoll
+        IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = ""
+                  ,IoBackend backend = EPOLL);
 
         // 析构函数
         ~IOManager();
@@ -77,30 +104,113 @@ namespace sylar {
         // 取消所有事件
         bool cancelAll(int fd);
 
+        // 当前等待执行的事件数量
+        size_t getPendingEventCount() const { return m_pendingEventCount;}
+
+        // 是否使用io_uring后端
+        bool isUring() const { return m_uring != nullptr;}
+
+        // 提交一个io_uring请求并挂起当前协程, 完成后恢复
+        // prep 填写sqe(user_data由这里设置), timeout_ms 超时后取消请求
+        // 返回cqe的res, 出错为-errno, 超时为-ETIMEDOUT
+        int submitIo(const std::function<void(io_uring_sqe*)>& prep, uint64_t timeout_ms = ~0ull);
+
+        // 每个调度线程各开一个SO_REUSEPORT的监听socket, 由内核把连接分散到各线程
+        // 新连接在接受它的线程上回调cb(fd), 多reactor模式下这个fd之后的事件都在这个线程处理
+        // 返回成功监听的socket数量
+        size_t listenReusePort(std::shared_ptr<Address> addr, std::function<void(int fd)> cb
+                               ,int backlog = SOMAXCONN);
+
+        // 关闭listenReusePort打开的监听socket, 对应的accept协程随之退出
+        void stopListen();
+
         // 返回当前IOMANAGER
         static IOManager* GetThis();
+
+        // fd即将关闭, 在所有持久模式的IOManager里删除它的注册
+        // 持久模式下注册只在cancelAll时删除, 不调用的话fd复用后addEvent不会重新注册
+        static void OnClose(int fd);
     protected:
         void tickle() override;
+        void tickleThread(int thread) override;
         bool stopping() override;
         void idle() override;
         void onTimerInsertedAtFront() override;
+        void onThreadTimerChanged(int thread) override;
+        void collectMetrics(MetricsWriter& writer) override;
 
-        // 重置上下文容量大小
-        void contextResize(size_t size);
+        // 返回fd对应的上下文, auto_create 为 true 时按需分配所在的块
+        // 不加锁, 块一旦分配就不会移动或释放(直到析构)
+        FdContext* getFdContext(int fd, bool auto_create);
 
         // 是否可以停止
         bool stopping(uint64_t& timeout);
+    private:
+        struct UringOp;
+
+        // 返回当前线程已经认领的reactor, 没有返回nullptr
+        Reactor* getReactor();
+
+        // 返回当前线程的reactor, 还没有时认领一个空闲的
+        // 只在工作线程上调用(idle, 以及工作线程里的addEvent), 否则外部线程会占掉工作线程的reactor
+        Reactor* claimReactor();
+
+        // 当前线程是否是本调度器的工作线程
+        bool isWorkerThread() const;
+
+        // fd上下文注册所在的epoll句柄
+        int getEpfd(FdContext* fd_ctx) const;
+
+        // 唤醒指定reactor
+        void tickleReactor(Reactor* reactor);
+
+        // 处理epoll_wait返回的一个事件, thread 为恢复协程的线程
+        void handleEvent(epoll_event& event, int thread);
+
+        // 把攒下的sqe一次性提交给内核
+        void submitUring();
+
+        // 取走完成的cqe, 恢复对应的协程
+        void reapUring();
+
+        // 取消一个已提交的请求
+        void cancelUring(UringOp* op);
     private:
         /// epoll 文件句柄
         int m_epfd = 0;
-        /// pipe 文件句柄
-        int m_tickleFds[2];
+        /// 唤醒用的 eventfd
+        int m_tickleFd = -1;
+        /// 正阻塞在 epoll_wait 中的线程数量
+        std::atomic<size_t> m_sleepingThreadCount = {0};
+        /// 已写入eventfd但还没被消费的唤醒, 用于合并唤醒
+        std::atomic<bool> m_tickled = {false};
         /// 当前等待执行的事件数量
         std::atomic<size_t> m_pendingEventCount = {0};
-        /// IOManager的Mutex
-        RWMutexType m_mutex;
-        /// socket事件上下文的容器
-        std::vector<FdContext*> m_fdContexts;
+        /// 每块FdContext的数量(2^FD_CHUNK_BITS)
+        static const size_t FD_CHUNK_BITS = 10;
+        static const size_t FD_CHUNK_SIZE = 1 << FD_CHUNK_BITS;
+        /// 块指针的数量, 可支持 FD_MAX_CHUNKS * FD_CHUNK_SIZE 个fd
+        static const size_t FD_MAX_CHUNKS = 4096;
+        /// socket事件上下文的两级表, 第一级是块指针, 块内FdContext连续存放
+        std::atomic<FdContext*> m_fdChunks[FD_MAX_CHUNKS];
+        /// 是否持久注册fd(iomanager.persistent_epoll)
+        bool m_persistentEpoll = false;
+        /// 是否每个线程一个epoll(iomanager.multi_reactor)
+        bool m_multiReactor = false;
+        /// 每个调度线程一个reactor, 构造时分配, 线程第一次idle时认领
+        std::vector<std::unique_ptr<Reactor> > m_reactors;
+        /// 轮流唤醒reactor的游标
+        std::atomic<size_t> m_tickleCursor = {0};
+        /// listenReusePort打开的监听socket
+        std::vector<int> m_listenFds;
+        /// m_listenFds的锁
+        Mutex m_listenMutex;
+        /// io_uring环, epoll后端时为空
+        std::unique_ptr<IoUring> m_uring;
+        /// 提交队列锁, 和完成队列锁分属不同缓存行
+        CacheAligned<Spinlock> m_uringSqMutex;
+        /// 完成队列锁
+        CacheAligned<Spinlock> m_uringCqMutex;
     };
 }
 #endif //IOMANAGER_H
@@ -0,0 +1,144 @@
+//
+// Created by admin on 2025/8/25.
+//
+
+#include "iouring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace sylar {
+
+    static int sys_io_uring_setup(uint32_t entries, io_uring_params* p) {
+        return (int)syscall(__NR_io_uring_setup, entries, p);
+    }
+
+    static int sys_io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+        return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+    }
+
+    IoUring::~IoUring() {
+        if(m_sqes) {
+            munmap(m_sqes, m_sqesSize);
+        }
+        if(m_cqRing && m_cqRing != m_sqRing) {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+        if(m_sqRing) {
+            munmap(m_sqRing, m_sqRingSize);
+        }
+        if(m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    bool IoUring::init(uint32_t entries) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        m_fd = sys_io_uring_setup(entries, &p);
+        if(m_fd < 0) {
+            return false;
+        }
+        // 没有NODROP的老内核在完成队列满时直接丢弃完成事件, 等在上面的协程永远不会恢复
+        if(!(p.features & IORING_FEAT_NODROP)) {
+            return false;
+        }
+
+        m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        // 新内核上两个环共用一段映射
+        bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+        if(single_mmap) {
+            if(m_cqRingSize > m_sqRingSize) {
+                m_sqRingSize = m_cqRingSize;
+            }
+            m_cqRingSize = m_sqRingSize;
+        }
+
+        m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE
+                        ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if(m_sqRing == MAP_FAILED) {
+            m_sqRing = nullptr;
+            return false;
+        }
+        if(single_mmap) {
+            m_cqRing = m_sqRing;
+        } else {
+            m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE
+                            ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+            if(m_cqRing == MAP_FAILED) {
+                m_cqRing = nullptr;
+                return false;
+            }
+        }
+
+        m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE
+                        ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        if(sqes == MAP_FAILED) {
+            return false;
+        }
+        m_sqes = (io_uring_sqe*)sqes;
+
+        char* sq = (char*)m_sqRing;
+        m_sqHead = (uint32_t*)(sq + p.sq_off.head);
+        m_sqTail = (uint32_t*)(sq + p.sq_off.tail);
+        m_sqMask = (uint32_t*)(sq + p.sq_off.ring_mask);
+        m_sqArray = (uint32_t*)(sq + p.sq_off.array);
+        m_sqFlags = (uint32_t*)(sq + p.sq_off.flags);
+        m_sqEntries = p.sq_entries;
+        m_sqeHead = m_sqeTail = *m_sqTail;
+
+        char* cq = (char*)m_cqRing;
+        m_cqHead = (uint32_t*)(cq + p.cq_off.head);
+        m_cqTail = (uint32_t*)(cq + p.cq_off.tail);
+        m_cqMask = (uint32_t*)(cq + p.cq_off.ring_mask);
+        m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    io_uring_sqe* IoUring::getSqe() {
+        uint32_t head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if(m_sqeTail - head >= m_sqEntries) {
+            return nullptr;
+        }
+        io_uring_sqe* sqe = &m_sqes[m_sqeTail & *m_sqMask];
+        ++m_sqeTail;
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    int IoUring::submit() {
+        // sqe下标按顺序填到提交数组里, 再发布新的tail
+        uint32_t tail = *m_sqTail;
+        uint32_t mask = *m_sqMask;
+        while(m_sqeHead != m_sqeTail) {
+            m_sqArray[tail & mask] = m_sqeHead & mask;
+            ++tail;
+            ++m_sqeHead;
+        }
+        __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+
+        // 上次没被内核取走的也一起提交
+        uint32_t to_submit = tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if(to_submit == 0) {
+            return 0;
+        }
+        int rt = 0;
+        do {
+            rt = sys_io_uring_enter(m_fd, to_submit, 0, 0);
+        } while(rt < 0 && errno == EINTR);
+        return rt < 0 ? -errno : rt;
+    }
+
+    int IoUring::flushOverflow() {
+        int rt = 0;
+        do {
+            rt = sys_io_uring_enter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+        } while(rt < 0 && errno == EINTR);
+        return rt < 0 ? -errno : 0;
+    }
+}
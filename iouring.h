@@ -0,0 +1,88 @@
+//
+// Created by admin on 2025/8/25.
+//
+
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <boost/noncopyable.hpp>
+
+namespace sylar {
+
+    // io_uring 环的最小封装, 直接走系统调用, 不依赖liburing
+    // 不是线程安全的, 提交队列和完成队列需要调用方各自加锁
+    class IoUring : private boost::noncopyable {
+    public:
+        IoUring() = default;
+        ~IoUring();
+
+        // 创建环, entries 为提交队列长度(内核会向上取整到2的幂)
+        // 内核不支持, 被禁用, 或者完成队列满时会丢弃完成事件(没有IORING_FEAT_NODROP)时返回false
+        bool init(uint32_t entries);
+
+        // 环的文件句柄, 有完成事件时可读, 可以注册到epoll
+        int getFd() const { return m_fd;}
+
+        // 取一个空闲的sqe, 队列满时返回nullptr
+        io_uring_sqe* getSqe();
+
+        // 把已准备好但还没提交的sqe一次性交给内核
+        // 返回提交的数量, 失败返回-errno
+        int submit();
+
+        // 已准备但还没提交的sqe数量
+        uint32_t unsubmitted() const { return m_sqeTail - m_sqeHead;}
+
+        // 完成队列满过, 内核把多出来的完成事件挂在了溢出链表上
+        bool cqOverflow() const { return __atomic_load_n(m_sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW;}
+
+        // 让内核把溢出链表上的完成事件搬回完成队列(需要先reap腾出空间)
+        // 失败返回-errno
+        int flushOverflow();
+
+        // 取出所有已完成的cqe, 每个调用一次cb(user_data, res)
+        // 返回取出的数量
+        template<class Callback>
+        size_t reap(Callback cb) {
+            size_t n = 0;
+            uint32_t head = *m_cqHead;
+            uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+            while(head != tail) {
+                io_uring_cqe& cqe = m_cqes[head & *m_cqMask];
+                cb(cqe.user_data, cqe.res);
+                ++head;
+                ++n;
+            }
+            __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+            return n;
+        }
+    private:
+        int m_fd = -1;
+        // 提交队列
+        void* m_sqRing = nullptr;
+        size_t m_sqRingSize = 0;
+        uint32_t* m_sqHead = nullptr;
+        uint32_t* m_sqTail = nullptr;
+        uint32_t* m_sqMask = nullptr;
+        uint32_t* m_sqArray = nullptr;
+        uint32_t* m_sqFlags = nullptr;
+        uint32_t m_sqEntries = 0;
+        io_uring_sqe* m_sqes = nullptr;
+        size_t m_sqesSize = 0;
+        // 本地维护的sqe区间 [m_sqeHead, m_sqeTail) 为已准备未提交
+        uint32_t m_sqeHead = 0;
+        uint32_t m_sqeTail = 0;
+        // 完成队列
+        void* m_cqRing = nullptr;
+        size_t m_cqRingSize = 0;
+        uint32_t* m_cqHead = nullptr;
+        uint32_t* m_cqTail = nullptr;
+        uint32_t* m_cqMask = nullptr;
+        io_uring_cqe* m_cqes = nullptr;
+    };
+}
+
+#endif //IOURING_H
@@ -4,6 +4,16 @@
 #include <functional>
 #include <time.h>
 #include <string.h>
+#include <algorithm>
+#include <charconv>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "config.h"
 #include "util.h"
 #include "macro.h"
@@ -66,15 +76,30 @@ void LogEvent::format(const char* fmt, ...) {
 }
 
 void LogEvent::format(const char* fmt, va_list al) {
-    char* buf = nullptr;
-    int len = vasprintf(&buf, fmt, al);
-    if(len != -1) {
-        m_ss << std::string(buf, len);
-        free(buf);
+    // 直接打印到内容缓冲区的空闲部分, 放不下时扩容再打印一次
+    std::string& buf = m_ss.buffer();
+    size_t old = buf.size();
+    size_t avail = buf.capacity() - old;
+    if(avail < 64) {
+        avail = 64;
     }
+    buf.resize(old + avail);
+    va_list ap;
+    va_copy(ap, al);
+    int len = vsnprintf(&buf[old], avail + 1, fmt, ap);
+    va_end(ap);
+    if(len < 0) {
+        buf.resize(old);
+        return;
+    }
+    if((size_t)len > avail) {
+        buf.resize(old + len);
+        vsnprintf(&buf[old], len + 1, fmt, al);
+    }
+    buf.resize(old + len);
 }
 
-std::stringstream& LogEventWrap::getSS() {
+std::ostream& LogEventWrap::getSS() {
     return m_event->getSS();
 }
 
@@ -94,130 +119,6 @@ LogFormatter::ptr LogAppender::getFormatter() {
     return m_formatter;
 }
 
-class MessageFormatItem : public LogFormatter::FormatItem {
-public:
-    MessageFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getContent();
-    }
-};
-
-class LevelFormatItem : public LogFormatter::FormatItem {
-public:
-    LevelFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << LogLevel::ToString(level);
-    }
-};
-
-class ElapseFormatItem : public LogFormatter::FormatItem {
-public:
-    ElapseFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getElapse();
-    }
-};
-
-class NameFormatItem : public LogFormatter::FormatItem {
-public:
-    NameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getLogger()->getName();
-    }
-};
-
-class ThreadIdFormatItem : public LogFormatter::FormatItem {
-public:
-    ThreadIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getThreadId();
-    }
-};
-
-class FiberIdFormatItem : public LogFormatter::FormatItem {
-public:
-    FiberIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFiberId();
-    }
-};
-
-class ThreadNameFormatItem : public LogFormatter::FormatItem {
-public:
-    ThreadNameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getThreadName();
-    }
-};
-
-class DateTimeFormatItem : public LogFormatter::FormatItem {
-public:
-    DateTimeFormatItem(const std::string& format = "%Y-%m-%d %H:%M:%S")
-        :m_format(format) {
-        if(m_format.empty()) {
-            m_format = "%Y-%m-%d %H:%M:%S";
-        }
-    }
-
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        struct tm tm;
-        time_t time = event->getTime();
-        localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-        os << buf;
-    }
-private:
-    std::string m_format;
-};
-
-class FilenameFormatItem : public LogFormatter::FormatItem {
-public:
-    FilenameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFile();
-    }
-};
-
-class LineFormatItem : public LogFormatter::FormatItem {
-public:
-    LineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getLine();
-    }
-};
-
-class NewLineFormatItem : public LogFormatter::FormatItem {
-public:
-    NewLineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << std::endl;
-    }
-};
-
-
-class StringFormatItem : public LogFormatter::FormatItem {
-public:
-    StringFormatItem(const std::string& str)
-        :m_string(str) {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << m_string;
-    }
-private:
-    std::string m_string;
-};
-
-class TabFormatItem : public LogFormatter::FormatItem {
-public:
-    TabFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << "\t";
-    }
-private:
-    std::string m_string;
-};
-
-
 LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
             ,const char* file, int32_t line, uint32_t elapse
             ,uint32_t thread_id, uint32_t fiber_id, uint64_t time
@@ -233,6 +134,68 @@ LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
     ,m_level(level) {
 }
 
+LogEvent::ptr LogEvent::Create(std::shared_ptr<Logger> logger, LogLevel::Level level
+            ,const char* file, int32_t line, uint32_t elapse
+            ,uint32_t thread_id, uint32_t fiber_id, uint64_t time
+            ,const std::string& thread_name) {
+    // 日志是同步写完的, 通常只有第一个在用; 写日志的过程中又写日志时才会用到后面的
+    static thread_local std::vector<LogEvent::ptr> s_events;
+    for(auto& i : s_events) {
+        if(i.use_count() == 1) {
+            i->reset(logger, level, file, line, elapse, thread_id, fiber_id, time, thread_name);
+            return i;
+        }
+    }
+    LogEvent::ptr event(new LogEvent(logger, level, file, line, elapse
+                        ,thread_id, fiber_id, time, thread_name));
+    if(s_events.size() < 4) {
+        s_events.push_back(event);
+    }
+    return event;
+}
+
+void LogEvent::reset(std::shared_ptr<Logger> logger, LogLevel::Level level
+            ,const char* file, int32_t line, uint32_t elapse
+            ,uint32_t thread_id, uint32_t fiber_id, uint64_t time
+            ,const std::string& thread_name) {
+    m_file = file;
+    m_line = line;
+    m_elapse = elapse;
+    m_threadId = thread_id;
+    m_fiberId = fiber_id;
+    m_time = time;
+    m_threadName = thread_name;
+    m_logger.swap(logger);
+    m_level = level;
+    m_ss.reset();
+}
+
+LogStream::LogStream()
+    :std::ostream(nullptr) {
+    rdbuf(&m_buf);
+}
+
+void LogStream::reset() {
+    m_buf.m_str.clear();
+    clear();
+    flags(std::ios_base::skipws | std::ios_base::dec);
+    precision(6);
+    width(0);
+    fill(' ');
+}
+
+LogStream::Buf::int_type LogStream::Buf::overflow(int_type c) {
+    if(c != traits_type::eof()) {
+        m_str.push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize LogStream::Buf::xsputn(const char* s, std::streamsize n) {
+    m_str.append(s, n);
+    return n;
+}
+
 Logger::Logger(const std::string& name)
     :m_name(name)
     ,m_level(LogLevel::DEBUG) {
@@ -296,6 +259,15 @@ void Logger::addAppender(LogAppender::ptr appender) {
         appender->m_formatter = m_formatter;
     }
     m_appenders.push_back(appender);
+    updateSnapshot();
+}
+
+void Logger::updateSnapshot() {
+    if(m_appenders.empty()) {
+        m_snapshot.reset();
+    } else {
+        m_snapshot.reset(new std::vector<LogAppender::ptr>(m_appenders.begin(), m_appenders.end()));
+    }
 }
 
 void Logger::delAppender(LogAppender::ptr appender) {
@@ -307,19 +279,26 @@ void Logger::delAppender(LogAppender::ptr appender) {
             break;
         }
     }
+    updateSnapshot();
 }
 
 void Logger::clearAppenders() {
     MutexType::Lock lock(m_mutex);
     m_appenders.clear();
+    updateSnapshot();
 }
 
 void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
     if(level >= m_level) {
         auto self = shared_from_this();
-        MutexType::Lock lock(m_mutex);
-        if(!m_appenders.empty()) {
-            for(auto& i : m_appenders) {
+        // 只在取快照时加锁, 各个appender的输出不再被日志器的锁串行化
+        std::shared_ptr<const std::vector<LogAppender::ptr> > appenders;
+        {
+            MutexType::Lock lock(m_mutex);
+            appenders = m_snapshot;
+        }
+        if(appenders) {
+            for(auto& i : *appenders) {
                 i->log(self, level, event);
             }
         } else if(m_root) {
@@ -414,26 +393,663 @@ std::string StdoutLogAppender::toYamlString() {
     return ss.str();
 }
 
+RotatingFileLogAppender::RotatingFileLogAppender(const std::string& filename, uint64_t max_size
+                                                ,uint32_t interval, uint32_t max_files
+                                                ,uint64_t mmap_window)
+    :m_filename(filename)
+    ,m_maxSize(max_size)
+    ,m_interval(interval)
+    ,m_maxFiles(max_files)
+    ,m_mmapWindow(mmap_window) {
+    if(m_mmapWindow) {
+        // 映射的偏移必须按页对齐, 窗口取页大小的整数倍
+        uint64_t page = sysconf(_SC_PAGESIZE);
+        m_mmapWindow = (m_mmapWindow + page - 1) / page * page;
+    }
+    uint64_t now = time(0);
+    if(m_interval) {
+        m_nextRotate = (now / m_interval + 1) * m_interval;
+    }
+    m_lastCheck = now;
+    openFile();
+}
+
+RotatingFileLogAppender::~RotatingFileLogAppender() {
+    Mutex::Lock lock(m_fileMutex);
+    closeFile();
+}
+
+bool RotatingFileLogAppender::openFile() {
+    FSUtil::Mkdir(FSUtil::Dirname(m_filename));
+    // mmap需要可读写打开
+    m_fd = ::open(m_filename.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(m_fd < 0) {
+        std::cout << "RotatingFileLogAppender open file=" << m_filename
+                  << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    m_size = fstat(m_fd, &st) == 0 ? st.st_size : 0;
+    return true;
+}
+
+void RotatingFileLogAppender::closeFile() {
+    if(m_fd < 0) {
+        return;
+    }
+    if(m_map) {
+        munmap(m_map, m_mmapWindow);
+        m_map = nullptr;
+    }
+    if(m_mmapWindow) {
+        // 去掉最后一个窗口没写满的部分
+        if(ftruncate(m_fd, m_size)) {
+            std::cout << "RotatingFileLogAppender ftruncate file=" << m_filename
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+        }
+    }
+    ::close(m_fd);
+    m_fd = -1;
+    m_size = 0;
+}
+
+bool RotatingFileLogAppender::mapWindow() {
+    m_mapOffset = m_size / m_mmapWindow * m_mmapWindow;
+    // 先把窗口的磁盘空间分配好(同时扩展文件长度), 否则磁盘满时写映射内存会收到SIGBUS
+    int rt = posix_fallocate(m_fd, m_mapOffset, m_mmapWindow);
+    if(rt) {
+        errno = rt;
+        return false;
+    }
+    void* addr = mmap(nullptr, m_mmapWindow, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, m_mapOffset);
+    if(addr == MAP_FAILED) {
+        return false;
+    }
+    m_map = (char*)addr;
+    return true;
+}
+
+void RotatingFileLogAppender::append(const char* data, size_t len) {
+    if(m_fd < 0) {
+        return;
+    }
+    while(m_mmapWindow && len > 0) {
+        if(!m_map) {
+            // 上次映射失败, 退避期间直接用write
+            if(m_mapRetry && (uint64_t)time(0) < m_mapRetry) {
+                break;
+            }
+            if(!mapWindow()) {
+                // 映射失败(磁盘满, 文件系统不支持等)时截掉扩出来的部分, 改用write
+                // 重试间隔从1秒开始翻倍, 最长60秒, 不在每条日志上都重试
+                std::cout << "RotatingFileLogAppender mmap file=" << m_filename
+                          << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+                m_mapBackoff = m_mapBackoff ? std::min<uint32_t>(m_mapBackoff * 2, 60) : 1;
+                m_mapRetry = time(0) + m_mapBackoff;
+                if(ftruncate(m_fd, m_size)) {
+                    return;
+                }
+                break;
+            }
+            m_mapRetry = 0;
+            m_mapBackoff = 0;
+        }
+        uint64_t off = m_size - m_mapOffset;
+        size_t n = std::min<uint64_t>(len, m_mmapWindow - off);
+        memcpy(m_map + off, data, n);
+        m_size += n;
+        data += n;
+        len -= n;
+        if(m_size - m_mapOffset == m_mmapWindow) {
+            munmap(m_map, m_mmapWindow);
+            m_map = nullptr;
+        }
+    }
+    while(len > 0) {
+        ssize_t rt = ::write(m_fd, data, len);
+        if(rt < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            std::cout << "RotatingFileLogAppender write file=" << m_filename
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            return;
+        }
+        m_size += rt;
+        data += rt;
+        len -= rt;
+    }
+}
+
+void RotatingFileLogAppender::shiftFiles() {
+    if(m_maxFiles == 0) {
+        unlink(m_filename.c_str());
+        return;
+    }
+    unlink((m_filename + "." + std::to_string(m_maxFiles)).c_str());
+    for(uint32_t i = m_maxFiles - 1; i >= 1; --i) {
+        rename((m_filename + "." + std::to_string(i)).c_str()
+                ,(m_filename + "." + std::to_string(i + 1)).c_str());
+    }
+    rename(m_filename.c_str(), (m_filename + ".1").c_str());
+}
+
+bool RotatingFileLogAppender::doRotate() {
+    closeFile();
+    shiftFiles();
+    return openFile();
+}
+
+bool RotatingFileLogAppender::rotate() {
+    Mutex::Lock lock(m_fileMutex);
+    return doRotate();
+}
+
+void RotatingFileLogAppender::check(uint64_t now, size_t len) {
+    if(m_fd < 0) {
+        openFile();
+    }
+    // 文件被外部改名或删除时重新打开, 不再写进已经移走的文件
+    if(now >= m_lastCheck + 3) {
+        m_lastCheck = now;
+        struct stat path_st;
+        struct stat fd_st;
+        if(m_fd >= 0 && (stat(m_filename.c_str(), &path_st) || fstat(m_fd, &fd_st)
+                    || path_st.st_ino != fd_st.st_ino || path_st.st_dev != fd_st.st_dev)) {
+            closeFile();
+            openFile();
+        }
+    }
+
+    bool need = m_maxSize && m_size && m_size + len > m_maxSize;
+    if(m_interval && now >= m_nextRotate) {
+        m_nextRotate = (now / m_interval + 1) * m_interval;
+        need = need || m_size;
+    }
+    if(need) {
+        doRotate();
+    }
+}
+
+void RotatingFileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
+    if(level < m_level) {
+        return;
+    }
+    LogFormatter::ptr fmt;
+    {
+        MutexType::Lock lock(m_mutex);
+        fmt = m_formatter;
+    }
+    if(!fmt) {
+        return;
+    }
+    static thread_local std::string s_buf;
+    s_buf.clear();
+    fmt->format(s_buf, level, *event);
+
+    Mutex::Lock lock(m_fileMutex);
+    check(event->getTime(), s_buf.size());
+    append(s_buf.data(), s_buf.size());
+}
+
+std::string RotatingFileLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "RotatingFileLogAppender";
+    node["file"] = m_filename;
+    node["max_size"] = m_maxSize;
+    node["interval"] = m_interval;
+    node["max_files"] = m_maxFiles;
+    node["mmap_window"] = m_mmapWindow;
+    if(m_level != LogLevel::UNKNOW) {
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    if(m_hasFormatter && m_formatter) {
+        node["formatter"] = m_formatter->getPattern();
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+/**
+ * @brief 单生产者单消费者的环形队列, 生产者是所属线程, 消费者是写线程
+ */
+struct AsyncFileLogAppender::Ring {
+    Ring(uint32_t size) {
+        uint32_t cap = 1;
+        while(cap < size) {
+            cap <<= 1;
+        }
+        slots.resize(cap);
+        mask = cap - 1;
+    }
+
+    /// 日志文本, 写线程写完之后才清空, 字符串的内存会被复用
+    std::vector<std::string> slots;
+    uint64_t mask;
+    /// 消费位置, 只有写线程修改
+    alignas(64) std::atomic<uint64_t> head{0};
+    /// 生产位置, 只有所属线程修改
+    alignas(64) std::atomic<uint64_t> tail{0};
+    /// 所属线程已经退出, 写完之后可以回收
+    std::atomic<bool> closed{false};
+};
+
+/**
+ * @brief 线程局部的队列缓存, 线程退出时把自己的队列标记为关闭
+ */
+struct AsyncFileLogAppender::RingCache {
+    ~RingCache() {
+        for(auto& i : rings) {
+            i.second->closed = true;
+        }
+    }
+
+    /// appender id -> 队列
+    std::vector<std::pair<uint64_t, std::shared_ptr<Ring> > > rings;
+};
+
+static std::atomic<uint64_t> s_async_appender_id{0};
+
+AsyncFileLogAppender::Overflow AsyncFileLogAppender::OverflowFromString(const std::string& str) {
+    if(str == "drop" || str == "DROP") {
+        return DROP;
+    }
+    if(str == "sample" || str == "SAMPLE") {
+        return SAMPLE;
+    }
+    return BLOCK;
+}
+
+const char* AsyncFileLogAppender::OverflowToString(Overflow v) {
+    switch(v) {
+        case DROP:
+            return "drop";
+        case SAMPLE:
+            return "sample";
+        default:
+            return "block";
+    }
+}
+
+AsyncFileLogAppender::AsyncFileLogAppender(const std::string& filename, uint32_t queue_size
+                                        ,Overflow overflow, uint32_t sample_rate)
+    :m_filename(filename)
+    ,m_queueSize(queue_size ? queue_size : 8192)
+    ,m_overflow(overflow)
+    ,m_sampleRate(sample_rate ? sample_rate : 1)
+    ,m_id(++s_async_appender_id) {
+    reopen();
+    m_lastTime = time(0);
+    m_thread.reset(new Thread(std::bind(&AsyncFileLogAppender::run, this), "log_writer"));
+}
+
+AsyncFileLogAppender::~AsyncFileLogAppender() {
+    m_stopping = true;
+    m_sleeping = false;
+    m_sem.notify();
+    m_thread->join();
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+std::shared_ptr<AsyncFileLogAppender::Ring> AsyncFileLogAppender::getRing() {
+    static thread_local RingCache s_cache;
+    for(auto& i : s_cache.rings) {
+        if(i.first == m_id) {
+            return i.second;
+        }
+    }
+
+    // 已经析构的appender留下的队列顺便清理掉, 它们的id不会再出现
+    std::shared_ptr<Ring> ring(new Ring(m_queueSize));
+    {
+        Mutex::Lock lock(m_ringsMutex);
+        m_rings.push_back(ring);
+        ++m_ringsVersion;
+    }
+    auto& rings = s_cache.rings;
+    rings.erase(std::remove_if(rings.begin(), rings.end(),
+                [](const std::pair<uint64_t, std::shared_ptr<Ring> >& v) {
+                    return v.second.use_count() == 1;
+                }), rings.end());
+    rings.push_back(std::make_pair(m_id, ring));
+    return ring;
+}
+
+void AsyncFileLogAppender::wakeWriter() {
+    // 和写线程的 m_sleeping = true; 再检查一遍队列 配对, 保证不会漏掉唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_sleeping.load(std::memory_order_relaxed)) {
+        bool expected = true;
+        if(m_sleeping.compare_exchange_strong(expected, false)) {
+            m_sem.notify();
+        }
+    }
+}
+
+void AsyncFileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
+    if(level < m_level) {
+        return;
+    }
+    LogFormatter::ptr fmt;
+    {
+        MutexType::Lock lock(m_mutex);
+        fmt = m_formatter;
+    }
+    if(!fmt) {
+        return;
+    }
+
+    std::shared_ptr<Ring> ring = getRing();
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    if(tail - ring->head.load(std::memory_order_acquire) > ring->mask) {
+        bool wait = m_overflow == BLOCK || level >= LogLevel::ERROR
+            || (m_overflow == SAMPLE && (++m_sampleCount % m_sampleRate) == 0);
+        if(!wait) {
+            ++m_dropped;
+            wakeWriter();
+            return;
+        }
+        waitForSpace(*ring, tail);
+    }
+
+    // 格式化放在调用线程, 写线程只做拷贝; 槽位的字符串写完后只清空不释放, 可以直接复用
+    std::string& slot = ring->slots[tail & ring->mask];
+    slot.clear();
+    fmt->format(slot, level, *event);
+    ring->tail.store(tail + 1, std::memory_order_release);
+    wakeWriter();
+
+    if(level >= LogLevel::FATAL) {
+        flush();
+    }
+}
+
+void AsyncFileLogAppender::waitForSpace(Ring& ring, uint64_t tail) {
+    // 写线程一般很快就能腾出空间, 先短暂自旋
+    Backoff backoff;
+    for(int i = 0; i < 100; ++i) {
+        if(tail - ring.head.load(std::memory_order_acquire) <= ring.mask) {
+            return;
+        }
+        wakeWriter();
+        backoff.pause();
+    }
+
+    // 还是满的就在m_spaceSeq上休眠, 写线程每次取走日志后发现有等待者就唤醒
+    ++m_spaceWaiters;
+    while(true) {
+        int seq = m_spaceSeq.load(std::memory_order_acquire);
+        // 和drain()里 head.store; fence; 读m_spaceWaiters 配对, 不会漏掉唤醒
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(tail - ring.head.load(std::memory_order_acquire) <= ring.mask) {
+            break;
+        }
+        wakeWriter();
+        // 带超时兜底, 写线程卡住(比如磁盘写满)时也会定期重新检查
+        struct timespec ts = {0, 10 * 1000 * 1000};
+        syscall(SYS_futex, (int*)&m_spaceSeq, FUTEX_WAIT_PRIVATE, seq, &ts, nullptr, 0);
+    }
+    --m_spaceWaiters;
+}
+
+void AsyncFileLogAppender::flush() {
+    std::vector<std::pair<std::shared_ptr<Ring>, uint64_t> > targets;
+    {
+        Mutex::Lock lock(m_ringsMutex);
+        for(auto& i : m_rings) {
+            targets.push_back(std::make_pair(i, i->tail.load(std::memory_order_acquire)));
+        }
+    }
+    for(auto& i : targets) {
+        while(i.first->head.load(std::memory_order_acquire) < i.second) {
+            wakeWriter();
+            usleep(100);
+        }
+    }
+}
+
+size_t AsyncFileLogAppender::drain(std::vector<std::shared_ptr<Ring> >& rings) {
+    std::vector<iovec> iovs;
+    // 每个队列本次取到的位置
+    std::vector<uint64_t> ends(rings.size());
+    size_t count = 0;
+    for(size_t i = 0; i < rings.size(); ++i) {
+        Ring& r = *rings[i];
+        uint64_t head = r.head.load(std::memory_order_relaxed);
+        uint64_t tail = r.tail.load(std::memory_order_acquire);
+        for(; head < tail && iovs.size() < IOV_MAX; ++head) {
+            std::string& str = r.slots[head & r.mask];
+            if(!str.empty()) {
+                iovs.push_back({&str[0], str.size()});
+            }
+        }
+        ends[i] = head;
+        count += head - r.head.load(std::memory_order_relaxed);
+    }
+    if(count == 0) {
+        return 0;
+    }
+
+    size_t idx = 0;
+    while(m_fd >= 0 && idx < iovs.size()) {
+        ssize_t rt = ::writev(m_fd, &iovs[idx], iovs.size() - idx);
+        if(rt < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            std::cout << "AsyncFileLogAppender writev file=" << m_filename
+                      << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+            break;
+        }
+        // 跳过已经写完的部分, 继续写剩下的
+        size_t n = rt;
+        while(idx < iovs.size() && n >= iovs[idx].iov_len) {
+            n -= iovs[idx].iov_len;
+            ++idx;
+        }
+        if(n > 0) {
+            iovs[idx].iov_base = (char*)iovs[idx].iov_base + n;
+            iovs[idx].iov_len -= n;
+        }
+    }
+
+    for(size_t i = 0; i < rings.size(); ++i) {
+        Ring& r = *rings[i];
+        for(uint64_t head = r.head.load(std::memory_order_relaxed); head < ends[i]; ++head) {
+            r.slots[head & r.mask].clear();
+        }
+        r.head.store(ends[i], std::memory_order_release);
+    }
+
+    // 唤醒因为队列满休眠的生产者
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_spaceWaiters.load(std::memory_order_relaxed) > 0) {
+        ++m_spaceSeq;
+        syscall(SYS_futex, (int*)&m_spaceSeq, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+    return count;
+}
+
+void AsyncFileLogAppender::run() {
+    std::vector<std::shared_ptr<Ring> > rings;
+    uint64_t version = ~0ull;
+    while(true) {
+        if(version != m_ringsVersion) {
+            Mutex::Lock lock(m_ringsMutex);
+            // 所属线程已退出且已经写完的队列回收掉
+            m_rings.erase(std::remove_if(m_rings.begin(), m_rings.end(),
+                        [](const std::shared_ptr<Ring>& r) {
+                            return r->closed && r->head == r->tail;
+                        }), m_rings.end());
+            rings = m_rings;
+            version = m_ringsVersion;
+        }
+
+        uint64_t now = time(0);
+        if(now >= m_lastTime + 3) {
+            reopen();
+            m_lastTime = now;
+        }
+
+        if(drain(rings)) {
+            continue;
+        }
+        if(m_stopping) {
+            break;
+        }
+
+        m_sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool has_data = version != m_ringsVersion;
+        for(auto& r : rings) {
+            if(r->head.load(std::memory_order_relaxed) != r->tail.load(std::memory_order_acquire)) {
+                has_data = true;
+                break;
+            }
+            if(r->closed) {
+                // 有线程退出了, 回去回收它的队列
+                version = ~0ull;
+                has_data = true;
+            }
+        }
+        if(has_data || m_stopping) {
+            // 生产者已经抢先把m_sleeping改回false的话, 会有一次notify, 要消费掉
+            if(m_sleeping.exchange(false)) {
+                continue;
+            }
+        }
+        m_sem.wait();
+    }
+}
+
+bool AsyncFileLogAppender::reopen() {
+    FSUtil::Mkdir(FSUtil::Dirname(m_filename));
+    int fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        std::cout << "AsyncFileLogAppender open file=" << m_filename
+                  << " errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+        return false;
+    }
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+    m_fd = fd;
+    return true;
+}
+
+std::string AsyncFileLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "AsyncFileLogAppender";
+    node["file"] = m_filename;
+    node["queue_size"] = m_queueSize;
+    node["overflow"] = OverflowToString(m_overflow);
+    node["sample_rate"] = m_sampleRate;
+    if(m_level != LogLevel::UNKNOW) {
+        node["level"] = LogLevel::ToString(m_level);
+    }
+    if(m_hasFormatter && m_formatter) {
+        node["formatter"] = m_formatter->getPattern();
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
 LogFormatter::LogFormatter(const std::string& pattern)
     :m_pattern(pattern) {
     init();
 }
 
 std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-    std::stringstream ss;
-    for(auto& i : m_items) {
-        i->format(ss, logger, level, event);
-    }
-    return ss.str();
+    std::string str;
+    format(str, level, *event);
+    return str;
 }
 
 std::ostream& LogFormatter::format(std::ostream& ofs, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-    for(auto& i : m_items) {
-        i->format(ofs, logger, level, event);
+    static thread_local std::string s_buf;
+    s_buf.clear();
+    format(s_buf, level, *event);
+    ofs.write(s_buf.data(), s_buf.size());
+    if(m_flush) {
+        ofs.flush();
     }
     return ofs;
 }
 
+template<class T>
+static void AppendInt(std::string& out, T v) {
+    char buf[24];
+    auto rt = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, rt.ptr - buf);
+}
+
+void LogFormatter::format(std::string& out, LogLevel::Level level, const LogEvent& event) {
+    // 同一秒内的时间只格式化一次
+    static thread_local time_t s_time = -1;
+    static thread_local std::string s_timeFmt;
+    static thread_local char s_timeBuf[64];
+    static thread_local size_t s_timeLen = 0;
+
+    for(auto& i : m_ops) {
+        switch(i.type) {
+            case OP_STRING:
+                out.append(i.arg);
+                break;
+            case OP_MESSAGE:
+                out.append(event.getContent());
+                break;
+            case OP_LEVEL:
+                out.append(LogLevel::ToString(level));
+                break;
+            case OP_ELAPSE:
+                AppendInt(out, event.getElapse());
+                break;
+            case OP_NAME:
+                out.append(event.getLogger()->getName());
+                break;
+            case OP_THREAD_ID:
+                AppendInt(out, event.getThreadId());
+                break;
+            case OP_NEWLINE:
+                out.push_back('\n');
+                break;
+            case OP_DATETIME: {
+                time_t time = event.getTime();
+                if(time != s_time || s_timeFmt != i.arg) {
+                    struct tm tm;
+                    localtime_r(&time, &tm);
+                    s_timeLen = strftime(s_timeBuf, sizeof(s_timeBuf), i.arg.c_str(), &tm);
+                    s_time = time;
+                    s_timeFmt = i.arg;
+                }
+                out.append(s_timeBuf, s_timeLen);
+                break;
+            }
+            case OP_FILENAME:
+                out.append(event.getFile());
+                break;
+            case OP_LINE:
+                AppendInt(out, event.getLine());
+                break;
+            case OP_TAB:
+                out.push_back('\t');
+                break;
+            case OP_FIBER_ID:
+                AppendInt(out, event.getFiberId());
+                break;
+            case OP_THREAD_NAME:
+                out.append(event.getThreadName());
+                break;
+        }
+    }
+}
+
 //%xxx %xxx{xxx} %%
 void LogFormatter::init() {
     //str, format, type
@@ -449,6 +1065,7 @@ void LogFormatter::init() {
         if((i + 1) < m_pattern.size()) {
             if(m_pattern[i + 1] == '%') {
                 nstr.append(1, '%');
+                ++i;
                 continue;
             }
         }
@@ -511,41 +1128,57 @@ void LogFormatter::init() {
     if(!nstr.empty()) {
         vec.push_back(std::make_tuple(nstr, "", 0));
     }
-    static std::map<std::string, std::function<FormatItem::ptr(const std::string& str)> > s_format_items = {
-#define XX(str, C) \
-        {#str, [](const std::string& fmt) { return FormatItem::ptr(new C(fmt));}}
-
-        XX(m, MessageFormatItem),           //m:消息
-        XX(p, LevelFormatItem),             //p:日志级别
-        XX(r, ElapseFormatItem),            //r:累计毫秒数
-        XX(c, NameFormatItem),              //c:日志名称
-        XX(t, ThreadIdFormatItem),          //t:线程id
-        XX(n, NewLineFormatItem),           //n:换行
-        XX(d, DateTimeFormatItem),          //d:时间
-        XX(f, FilenameFormatItem),          //f:文件名
-        XX(l, LineFormatItem),              //l:行号
-        XX(T, TabFormatItem),               //T:Tab
-        XX(F, FiberIdFormatItem),           //F:协程id
-        XX(N, ThreadNameFormatItem),        //N:线程名称
+    static std::map<std::string, OpType> s_format_ops = {
+#define XX(str, T) \
+        {#str, T}
+
+        XX(m, OP_MESSAGE),           //m:消息
+        XX(p, OP_LEVEL),             //p:日志级别
+        XX(r, OP_ELAPSE),            //r:累计毫秒数
+        XX(c, OP_NAME),              //c:日志名称
+        XX(t, OP_THREAD_ID),         //t:线程id
+        XX(n, OP_NEWLINE),           //n:换行
+        XX(d, OP_DATETIME),          //d:时间
+        XX(f, OP_FILENAME),          //f:文件名
+        XX(l, OP_LINE),              //l:行号
+        XX(T, OP_TAB),               //T:Tab
+        XX(F, OP_FIBER_ID),          //F:协程id
+        XX(N, OP_THREAD_NAME),       //N:线程名称
 #undef XX
     };
 
+    // 编译成指令列表, 相邻的字面量合并成一条
+    auto add_string = [this](const std::string& str) {
+        if(!m_ops.empty() && m_ops.back().type == OP_STRING) {
+            m_ops.back().arg.append(str);
+        } else {
+            m_ops.push_back(Op{OP_STRING, str});
+        }
+    };
     for(auto& i : vec) {
         if(std::get<2>(i) == 0) {
-            m_items.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
+            add_string(std::get<0>(i));
         } else {
-            auto it = s_format_items.find(std::get<0>(i));
-            if(it == s_format_items.end()) {
-                m_items.push_back(FormatItem::ptr(new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
+            auto it = s_format_ops.find(std::get<0>(i));
+            if(it == s_format_ops.end()) {
+                add_string("<<error_format %" + std::get<0>(i) + ">>");
                 m_error = true;
+            } else if(it->second == OP_TAB) {
+                add_string("\t");
+            } else if(it->second == OP_NEWLINE) {
+                add_string("\n");
+                m_flush = true;
             } else {
-                m_items.push_back(it->second(std::get<1>(i)));
+                Op op{it->second, std::get<1>(i)};
+                if(op.type == OP_DATETIME && op.arg.empty()) {
+                    op.arg = "%Y-%m-%d %H:%M:%S";
+                }
+                m_ops.push_back(op);
             }
         }
 
         //std::cout << "(" << std::get<0>(i) << ") - (" << std::get<1>(i) << ") - (" << std::get<2>(i) << ")" << std::endl;
     }
-    //std::cout << m_items.size() << std::endl;
 }
 
 
@@ -573,16 +1206,32 @@ Logger::ptr LoggerManager::getLogger(const std::string& name) {
 }
 
 struct LogAppenderDefine {
-    int type = 0; //1 File, 2 Stdout
+    int type = 0; //1 File, 2 Stdout, 3 AsyncFile, 4 RotatingFile
     LogLevel::Level level = LogLevel::UNKNOW;
     std::string formatter;
     std::string file;
+    // 以下只对AsyncFile有效, 0/空 表示默认值
+    uint32_t queue_size = 0;
+    std::string overflow;
+    uint32_t sample_rate = 0;
+    // 以下只对RotatingFile有效
+    uint64_t max_size = 0;
+    uint32_t interval = 0;
+    uint32_t max_files = 10;
+    uint64_t mmap_window = 0;
 
     bool operator==(const LogAppenderDefine& oth) const {
         return type == oth.type
             && level == oth.level
             && formatter == oth.formatter
-            && file == oth.file;
+            && file == oth.file
+            && queue_size == oth.queue_size
+            && overflow == oth.overflow
+            && sample_rate == oth.sample_rate
+            && max_size == oth.max_size
+            && interval == oth.interval
+            && max_files == oth.max_files
+            && mmap_window == oth.mmap_window;
     }
 };
 
@@ -646,6 +1295,49 @@ public:
                     if(a["formatter"].IsDefined()) {
                         lad.formatter = a["formatter"].as<std::string>();
                     }
+                } else if(type == "AsyncFileLogAppender") {
+                    lad.type = 3;
+                    if(!a["file"].IsDefined()) {
+                        std::cout << "log config error: asyncfileappender file is null, " << a
+                              << std::endl;
+                        continue;
+                    }
+                    lad.file = a["file"].as<std::string>();
+                    if(a["queue_size"].IsDefined()) {
+                        lad.queue_size = a["queue_size"].as<uint32_t>();
+                    }
+                    if(a["overflow"].IsDefined()) {
+                        lad.overflow = a["overflow"].as<std::string>();
+                    }
+                    if(a["sample_rate"].IsDefined()) {
+                        lad.sample_rate = a["sample_rate"].as<uint32_t>();
+                    }
+                    if(a["formatter"].IsDefined()) {
+                        lad.formatter = a["formatter"].as<std::string>();
+                    }
+                } else if(type == "RotatingFileLogAppender") {
+                    lad.type = 4;
+                    if(!a["file"].IsDefined()) {
+                        std::cout << "log config error: rotatingfileappender file is null, " << a
+                              << std::endl;
+                        continue;
+                    }
+                    lad.file = a["file"].as<std::string>();
+                    if(a["max_size"].IsDefined()) {
+                        lad.max_size = a["max_size"].as<uint64_t>();
+                    }
+                    if(a["interval"].IsDefined()) {
+                        lad.interval = a["interval"].as<uint32_t>();
+                    }
+                    if(a["max_files"].IsDefined()) {
+                        lad.max_files = a["max_files"].as<uint32_t>();
+                    }
+                    if(a["mmap_window"].IsDefined()) {
+                        lad.mmap_window = a["mmap_window"].as<uint64_t>();
+                    }
+                    if(a["formatter"].IsDefined()) {
+                        lad.formatter = a["formatter"].as<std::string>();
+                    }
                 } else if(type == "StdoutLogAppender") {
                     lad.type = 2;
                     if(a["formatter"].IsDefined()) {
@@ -684,6 +1376,25 @@ public:
                 na["file"] = a.file;
             } else if(a.type == 2) {
                 na["type"] = "StdoutLogAppender";
+            } else if(a.type == 3) {
+                na["type"] = "AsyncFileLogAppender";
+                na["file"] = a.file;
+                if(a.queue_size) {
+                    na["queue_size"] = a.queue_size;
+                }
+                if(!a.overflow.empty()) {
+                    na["overflow"] = a.overflow;
+                }
+                if(a.sample_rate) {
+                    na["sample_rate"] = a.sample_rate;
+                }
+            } else if(a.type == 4) {
+                na["type"] = "RotatingFileLogAppender";
+                na["file"] = a.file;
+                na["max_size"] = a.max_size;
+                na["interval"] = a.interval;
+                na["max_files"] = a.max_files;
+                na["mmap_window"] = a.mmap_window;
             }
             if(a.level != LogLevel::UNKNOW) {
                 na["level"] = LogLevel::ToString(a.level);
@@ -735,6 +1446,13 @@ struct LogIniter {
                     sylar::LogAppender::ptr ap;
                     if(a.type == 1) {
                         ap.reset(new FileLogAppender(a.file));
+                    } else if(a.type == 3) {
+                        ap.reset(new AsyncFileLogAppender(a.file, a.queue_size
+                                    ,AsyncFileLogAppender::OverflowFromString(a.overflow)
+                                    ,a.sample_rate));
+                    } else if(a.type == 4) {
+                        ap.reset(new RotatingFileLogAppender(a.file, a.max_size
+                                    ,a.interval, a.max_files, a.mmap_window));
                     } else if(a.type == 2) {
                         if(!sylar::EnvMgr::GetInstance()->has("d")) {
                             ap.reset(new StdoutLogAppender);
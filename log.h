@@ -22,7 +22,7 @@
   * +-------------------------------------------------------------+
   * | LogFormatter (日志格式器)                                   |
   * +-------------------------------------------------------------+
-  * | FormatItem (格式解析基类)                                   |
+  * | Op (模板编译后的指令)                                       |
   * |   -> Message(内容), Level(级别), Elapse(耗时)              |
   * |   -> Name(日志名), ThreadId(线程ID), NewLine(换行)          |
   * |   -> DateTime(日期), Filename(文件名), Line(行号)          |
@@ -43,18 +43,33 @@
 #include <vector>
 #include <stdarg.h>
 #include <map>
+#include <atomic>
+#include <time.h>
 #include "util.h"
 #include "singleton.h"
 #include "thread.h"
 
+/**
+ * @brief 编译期保留的最低日志级别(LogLevel::Level的数值), 低于它的日志宏整体被编译器消除
+ * @details 由CMake的SYLAR_LOG_MIN_LEVEL选项设置, 默认保留全部(DEBUG)
+ */
+#ifndef SYLAR_LOG_MIN_LEVEL
+#define SYLAR_LOG_MIN_LEVEL 1
+#endif
+
+/**
+ * @brief level是否在编译期被保留, level为常量时整个条件在编译期求值
+ */
+#define SYLAR_LOG_COMPILED(level) ((int)(level) >= SYLAR_LOG_MIN_LEVEL)
+
 /**
  * @brief 使用流式方式将日志级别level的日志写入到logger
  */
 #define SYLAR_LOG_LEVEL(logger, level) \
-    if(logger->getLevel() <= level) \
-        sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level, \
+    if(SYLAR_LOG_COMPILED(level) && logger->getLevel() <= level) \
+        sylar::LogEventWrap(sylar::LogEvent::Create(logger, level, \
                         __FILE__, __LINE__, 0, sylar::GetThreadId(),\
-                sylar::GetFiberId(), time(0), sylar::Thread::GetName()))).getSS()
+                sylar::GetFiberId(), time(0), sylar::Thread::GetName())).getSS()
 
 /**
  * @brief 使用流式方式将日志级别debug的日志写入到logger
@@ -85,10 +100,10 @@
  * @brief 使用格式化方式将日志级别level的日志写入到logger
  */
 #define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...) \
-    if(logger->getLevel() <= level) \
-        sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level, \
+    if(SYLAR_LOG_COMPILED(level) && logger->getLevel() <= level) \
+        sylar::LogEventWrap(sylar::LogEvent::Create(logger, level, \
                         __FILE__, __LINE__, 0, sylar::GetThreadId(),\
-                sylar::GetFiberId(), time(0), sylar::Thread::GetName()))).getEvent()->format(fmt, __VA_ARGS__)
+                sylar::GetFiberId(), time(0), sylar::Thread::GetName())).getEvent()->format(fmt, __VA_ARGS__)
 
 /**
  * @brief 使用格式化方式将日志级别debug的日志写入到logger
@@ -115,6 +130,27 @@
  */
 #define SYLAR_LOG_FMT_FATAL(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::FATAL, fmt, __VA_ARGS__)
 
+/**
+ * @brief 每n次只写第1次, 计数只统计满足级别的调用
+ * @details 每个调用点有自己的计数器, 多线程下也只放行约1/n
+ */
+#define SYLAR_LOG_EVERY_N(logger, level, n) \
+    if(SYLAR_LOG_COMPILED(level) && logger->getLevel() <= level \
+            && []() -> sylar::LogEveryN& { static sylar::LogEveryN s_limiter; return s_limiter; }().check(n)) \
+        sylar::LogEventWrap(sylar::LogEvent::Create(logger, level, \
+                        __FILE__, __LINE__, 0, sylar::GetThreadId(),\
+                sylar::GetFiberId(), time(0), sylar::Thread::GetName())).getSS()
+
+/**
+ * @brief 每ms毫秒最多写一次, 同一调用点的其余日志被丢弃
+ */
+#define SYLAR_LOG_EVERY_MS(logger, level, ms) \
+    if(SYLAR_LOG_COMPILED(level) && logger->getLevel() <= level \
+            && []() -> sylar::LogEveryMS& { static sylar::LogEveryMS s_limiter; return s_limiter; }().check(ms)) \
+        sylar::LogEventWrap(sylar::LogEvent::Create(logger, level, \
+                        __FILE__, __LINE__, 0, sylar::GetThreadId(),\
+                sylar::GetFiberId(), time(0), sylar::Thread::GetName())).getSS()
+
 /**
  * @brief 获取主日志器
  */
@@ -130,6 +166,44 @@ namespace sylar {
 class Logger;
 class LoggerManager;
 
+/**
+ * @brief SYLAR_LOG_EVERY_N的计数器
+ */
+class LogEveryN {
+public:
+    /**
+     * @brief 第1,n+1,2n+1...次调用返回true
+     */
+    bool check(uint64_t n) {
+        return n <= 1 || m_count.fetch_add(1, std::memory_order_relaxed) % n == 0;
+    }
+private:
+    std::atomic<uint64_t> m_count{0};
+};
+
+/**
+ * @brief SYLAR_LOG_EVERY_MS的限流器
+ */
+class LogEveryMS {
+public:
+    /**
+     * @brief 距离上次放行超过ms毫秒时返回true, 并发调用时只有一个能放行
+     */
+    bool check(uint64_t ms) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        // 加1避开初始值0, 保证第一次一定放行
+        uint64_t now = ts.tv_sec * 1000ul + ts.tv_nsec / 1000000 + 1;
+        uint64_t last = m_last.load(std::memory_order_relaxed);
+        if(last && now - last < ms) {
+            return false;
+        }
+        return m_last.compare_exchange_strong(last, now, std::memory_order_relaxed);
+    }
+private:
+    std::atomic<uint64_t> m_last{0};
+};
+
 /**
  * @brief 日志级别
  */
@@ -166,12 +240,57 @@ public:
     static LogLevel::Level FromString(const std::string& str);
 };
 
+/**
+ * @brief 日志内容流
+ * @details 直接追加到内部的std::string, 清空时保留容量, 事件复用之后不再分配内存
+ */
+class LogStream : public std::ostream {
+public:
+    LogStream();
+
+    /**
+     * @brief 返回已写入的内容
+     */
+    const std::string& str() const { return m_buf.m_str;}
+
+    /**
+     * @brief 返回内部缓冲区, 可以直接追加
+     */
+    std::string& buffer() { return m_buf.m_str;}
+
+    /**
+     * @brief 清空内容并恢复默认的流状态(进制,精度等)
+     */
+    void reset();
+private:
+    /**
+     * @brief 追加到std::string的streambuf
+     */
+    class Buf : public std::streambuf {
+    public:
+        std::string m_str;
+    protected:
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(const char* s, std::streamsize n) override;
+    };
+private:
+    Buf m_buf;
+};
+
 /**
  * @brief 日志事件
  */
 class LogEvent {
 public:
     typedef std::shared_ptr<LogEvent> ptr;
+
+    /**
+     * @brief 创建日志事件, 优先复用本线程已经用完的事件, 参数同构造函数
+     */
+    static LogEvent::ptr Create(std::shared_ptr<Logger> logger, LogLevel::Level level
+            ,const char* file, int32_t line, uint32_t elapse
+            ,uint32_t thread_id, uint32_t fiber_id, uint64_t time
+            ,const std::string& thread_name);
     /**
      * @brief 构造函数
      * @param[in] logger 日志器
@@ -227,7 +346,7 @@ public:
     /**
      * @brief 返回日志内容
      */
-    std::string getContent() const { return m_ss.str();}
+    const std::string& getContent() const { return m_ss.str();}
 
     /**
      * @brief 返回日志器
@@ -242,7 +361,7 @@ public:
     /**
      * @brief 返回日志内容字符串流
      */
-    std::stringstream& getSS() { return m_ss;}
+    std::ostream& getSS() { return m_ss;}
 
     /**
      * @brief 格式化写入日志内容
@@ -253,6 +372,14 @@ public:
      * @brief 格式化写入日志内容
      */
     void format(const char* fmt, va_list al);
+private:
+    /**
+     * @brief 复用时重新设置各个字段并清空内容
+     */
+    void reset(std::shared_ptr<Logger> logger, LogLevel::Level level
+            ,const char* file, int32_t line, uint32_t elapse
+            ,uint32_t thread_id, uint32_t fiber_id, uint64_t time
+            ,const std::string& thread_name);
 private:
     /// 文件名
     const char* m_file = nullptr;
@@ -269,7 +396,7 @@ private:
     /// 线程名称
     std::string m_threadName;
     /// 日志内容流
-    std::stringstream m_ss;
+    LogStream m_ss;
     /// 日志器
     std::shared_ptr<Logger> m_logger;
     /// 日志等级
@@ -301,7 +428,7 @@ public:
     /**
      * @brief 获取日志内容流
      */
-    std::stringstream& getSS();
+    std::ostream& getSS();
 private:
     /**
      * @brief 日志事件
@@ -344,26 +471,55 @@ public:
      */
     std::string format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
     std::ostream& format(std::ostream& ofs, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
+
+    /**
+     * @brief 把格式化日志文本追加到out, 不经过ostream
+     * @param[in, out] out 输出缓冲区, 复用同一个缓冲区时不再分配内存
+     * @param[in] level 日志级别
+     * @param[in] event 日志事件
+     */
+    void format(std::string& out, LogLevel::Level level, const LogEvent& event);
 public:
 
     /**
-     * @brief 日志内容项格式化
+     * @brief 模板编译后的指令类型
      */
-    class FormatItem {
-    public:
-        typedef std::shared_ptr<FormatItem> ptr;
-        /**
-         * @brief 析构函数
-         */
-        virtual ~FormatItem() {}
-        /**
-         * @brief 格式化日志到流
-         * @param[in, out] os 日志输出流
-         * @param[in] logger 日志器
-         * @param[in] level 日志等级
-         * @param[in] event 日志事件
-         */
-        virtual void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
+    enum OpType {
+        /// 字面量
+        OP_STRING = 0,
+        /// %m 消息
+        OP_MESSAGE,
+        /// %p 日志级别
+        OP_LEVEL,
+        /// %r 累计毫秒数
+        OP_ELAPSE,
+        /// %c 日志名称
+        OP_NAME,
+        /// %t 线程id
+        OP_THREAD_ID,
+        /// %n 换行
+        OP_NEWLINE,
+        /// %d 时间
+        OP_DATETIME,
+        /// %f 文件名
+        OP_FILENAME,
+        /// %l 行号
+        OP_LINE,
+        /// %T 制表符
+        OP_TAB,
+        /// %F 协程id
+        OP_FIBER_ID,
+        /// %N 线程名称
+        OP_THREAD_NAME
+    };
+
+    /**
+     * @brief 模板编译后的一条指令
+     */
+    struct Op {
+        OpType type;
+        /// 字面量内容或者时间格式
+        std::string arg;
     };
 
     /**
@@ -383,8 +539,10 @@ public:
 private:
     /// 日志格式模板
     std::string m_pattern;
-    /// 日志格式解析后格式存储
-    std::vector<FormatItem::ptr> m_items;
+    /// 日志格式编译后的指令, 相邻的字面量已经合并
+    std::vector<Op> m_ops;
+    /// 模板里有%n, 写到ostream之后要flush, 和之前的std::endl一致
+    bool m_flush = false;
     /// 是否有错误
     bool m_error = false;
 
@@ -550,6 +708,11 @@ public:
      * @brief 将日志器的配置转成YAML String
      */
     std::string toYamlString();
+private:
+    /**
+     * @brief 日志目标变化后重建m_snapshot, 调用时需持有m_mutex
+     */
+    void updateSnapshot();
 private:
     /// 日志名称
     std::string m_name;
@@ -559,6 +722,8 @@ private:
     MutexType m_mutex;
     /// 日志目标集合
     std::list<LogAppender::ptr> m_appenders;
+    /// m_appenders的只读快照, 写日志时使用
+    std::shared_ptr<const std::vector<LogAppender::ptr> > m_snapshot;
     /// 日志格式器
     LogFormatter::ptr m_formatter;
     /// 主日志器
@@ -599,6 +764,238 @@ private:
     uint64_t m_lastTime = 0;
 };
 
+/**
+ * @brief 按大小/时间滚动的文件Appender
+ * @details 当前文件超过max_size字节, 或者跨过interval秒的边界(按UTC对齐)时滚动:
+ *          file -> file.1 -> file.2 ... 超过max_files个的最旧文件被删除
+ *          mmap_window不为0时按这个大小映射文件的写入窗口, 写日志只是memcpy,
+ *          窗口写满再映射下一段; 进程崩溃时文件末尾可能留有未写满窗口的'\0'
+ */
+class RotatingFileLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<RotatingFileLogAppender> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] filename 文件路径
+     * @param[in] max_size 单个文件的最大字节数, 0 表示不按大小滚动
+     * @param[in] interval 按时间滚动的间隔(秒), 0 表示不按时间滚动
+     * @param[in] max_files 保留的历史文件个数
+     * @param[in] mmap_window mmap写入窗口的字节数, 0 表示用write写入
+     */
+    RotatingFileLogAppender(const std::string& filename, uint64_t max_size = 0
+                            ,uint32_t interval = 0, uint32_t max_files = 10
+                            ,uint64_t mmap_window = 0);
+
+    ~RotatingFileLogAppender();
+
+    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    std::string toYamlString() override;
+
+    /**
+     * @brief 立即滚动当前文件
+     */
+    bool rotate();
+private:
+    /**
+     * @brief 打开m_filename, 追加写入
+     */
+    bool openFile();
+
+    /**
+     * @brief 关闭当前文件, mmap模式下把文件截断到实际写入的长度
+     */
+    void closeFile();
+
+    /**
+     * @brief 把文件从m_size开始的一段映射为写入窗口, 映射前先posix_fallocate分配磁盘空间
+     */
+    bool mapWindow();
+
+    /**
+     * @brief 写入当前文件
+     */
+    void append(const char* data, size_t len);
+
+    /**
+     * @brief 检查是否需要滚动, 以及文件是否被外部移走
+     */
+    void check(uint64_t now, size_t len);
+
+    /**
+     * @brief 依次改名 file.N-1 -> file.N ... file -> file.1
+     */
+    void shiftFiles();
+
+    /**
+     * @brief 滚动当前文件, 调用时需持有m_fileMutex
+     */
+    bool doRotate();
+private:
+    /// 文件路径
+    std::string m_filename;
+    /// 单个文件的最大字节数
+    uint64_t m_maxSize;
+    /// 按时间滚动的间隔
+    uint32_t m_interval;
+    /// 保留的历史文件个数
+    uint32_t m_maxFiles;
+    /// mmap写入窗口大小
+    uint64_t m_mmapWindow;
+    /// 保护以下文件状态, 写文件可能阻塞, 不用自旋锁
+    Mutex m_fileMutex;
+    /// 文件句柄
+    int m_fd = -1;
+    /// 当前文件已写入的字节数
+    uint64_t m_size = 0;
+    /// 下一次按时间滚动的时间点
+    uint64_t m_nextRotate = 0;
+    /// 上次检查文件是否被移走的时间
+    uint64_t m_lastCheck = 0;
+    /// 写入窗口
+    char* m_map = nullptr;
+    /// 写入窗口在文件里的偏移
+    uint64_t m_mapOffset = 0;
+    /// 映射失败后, 到这个时间点之前不再重试, 0 表示没有失败
+    uint64_t m_mapRetry = 0;
+    /// 当前的重试间隔(秒)
+    uint32_t m_mapBackoff = 0;
+};
+
+/**
+ * @brief 异步输出到文件的Appender
+ * @details 调用线程只做格式化, 把日志文本放进本线程独占的无锁环形队列(单生产者单消费者),
+ *          后台写线程从所有队列里批量取出, 合并成writev写入文件
+ *          FATAL级别的日志写入后会等待所有队列落盘
+ */
+class AsyncFileLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<AsyncFileLogAppender> ptr;
+
+    /**
+     * @brief 队列满时的处理策略
+     */
+    enum Overflow {
+        /// 丢弃新日志
+        DROP = 0,
+        /// 等待写线程腾出空间
+        BLOCK = 1,
+        /// 每sample_rate条等待写入一条, 其余丢弃, ERROR及以上总是等待
+        SAMPLE = 2
+    };
+
+    /**
+     * @brief 将文本转换成队列满时的处理策略, 不认识的返回BLOCK
+     */
+    static Overflow OverflowFromString(const std::string& str);
+
+    /**
+     * @brief 将队列满时的处理策略转成文本
+     */
+    static const char* OverflowToString(Overflow v);
+
+    /**
+     * @brief 构造函数
+     * @param[in] filename 文件路径
+     * @param[in] queue_size 每个线程的队列长度, 向上取整到2的幂
+     * @param[in] overflow 队列满时的处理策略
+     * @param[in] sample_rate SAMPLE策略的采样间隔
+     */
+    AsyncFileLogAppender(const std::string& filename, uint32_t queue_size = 8192
+                        ,Overflow overflow = BLOCK, uint32_t sample_rate = 100);
+
+    /**
+     * @brief 析构函数, 写完队列里剩余的日志后退出写线程
+     */
+    ~AsyncFileLogAppender();
+
+    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    std::string toYamlString() override;
+
+    /**
+     * @brief 等待调用时已经入队的日志全部写入文件
+     */
+    void flush();
+
+    /**
+     * @brief 队列满被丢弃的日志条数
+     */
+    uint64_t getDropped() const { return m_dropped;}
+private:
+    struct Ring;
+    struct RingCache;
+
+    /**
+     * @brief 返回当前线程在本appender上的队列, 第一次调用时创建
+     */
+    std::shared_ptr<Ring> getRing();
+
+    /**
+     * @brief 写线程没在等待时直接返回, 否则唤醒它
+     */
+    void wakeWriter();
+
+    /**
+     * @brief BLOCK策略下队列满时等待写线程腾出空间, 先有限次自旋, 再在futex上休眠
+     * @param[in] ring 当前线程的队列
+     * @param[in] tail 要写入的位置
+     */
+    void waitForSpace(Ring& ring, uint64_t tail);
+
+    /**
+     * @brief 写线程主循环
+     */
+    void run();
+
+    /**
+     * @brief 把rings里所有已入队的日志写出去
+     * @return 写出的条数
+     */
+    size_t drain(std::vector<std::shared_ptr<Ring> >& rings);
+
+    /**
+     * @brief 打开日志文件
+     */
+    bool reopen();
+private:
+    /// 文件路径
+    std::string m_filename;
+    /// 文件句柄
+    int m_fd = -1;
+    /// 上次重新打开时间
+    uint64_t m_lastTime = 0;
+    /// 每个队列的长度
+    uint32_t m_queueSize;
+    /// 队列满时的处理策略
+    Overflow m_overflow;
+    /// 采样间隔
+    uint32_t m_sampleRate;
+    /// 采样计数
+    std::atomic<uint32_t> m_sampleCount{0};
+    /// 丢弃条数
+    std::atomic<uint64_t> m_dropped{0};
+    /// 用来在线程局部缓存里区分appender, 不会复用
+    uint64_t m_id;
+    /// 保护m_rings
+    Mutex m_ringsMutex;
+    /// 所有线程的队列
+    std::vector<std::shared_ptr<Ring> > m_rings;
+    /// m_rings变化时加一, 写线程据此刷新自己的副本
+    std::atomic<uint64_t> m_ringsVersion{0};
+    /// 写线程是否在等待
+    std::atomic<bool> m_sleeping{false};
+    /// 是否停止
+    std::atomic<bool> m_stopping{false};
+    /// 唤醒写线程
+    Semaphore m_sem;
+    /// 因为队列满在m_spaceSeq上休眠的生产者数量
+    std::atomic<int> m_spaceWaiters{0};
+    /// 写线程取走日志后加一并唤醒, 生产者在上面futex等待
+    std::atomic<int> m_spaceSeq{0};
+    /// 写线程
+    Thread::ptr m_thread;
+};
+
 /**
  * @brief 日志器管理类
  */
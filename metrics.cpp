@@ -0,0 +1,238 @@
+//
+// Created by admin on 2025/8/31.
+//
+
+#include "metrics.h"
+#include "mutex.h"
+#include "fiber.h"
+#include <algorithm>
+#include <sstream>
+#include <time.h>
+
+namespace sylar {
+
+    namespace {
+        struct Registry {
+            // 保护threads, retired
+            Mutex threadMutex;
+            std::vector<ThreadMetrics*> threads;
+            // 已经退出的线程的汇总
+            MetricsData retired;
+            // 线程退出之后还在记录的(比如别的thread_local析构里), 只是尽量记下, 不保证准确
+            ThreadMetrics orphan;
+
+            // 保护collectors, 持锁调用采集函数, DelCollector返回后就不会再被调用
+            Mutex collectorMutex;
+            std::map<uint64_t, Metrics::Collector> collectors;
+            uint64_t nextId = 0;
+        };
+
+        // 不释放, 线程在main返回之后退出也能安全注销
+        Registry& GetRegistry() {
+            static Registry* s_registry = new Registry;
+            return *s_registry;
+        }
+
+        struct LocalHolder {
+            ThreadMetrics metrics;
+
+            LocalHolder() {
+                Registry& r = GetRegistry();
+                Mutex::Lock lock(r.threadMutex);
+                r.threads.push_back(&metrics);
+            }
+
+            ~LocalHolder();
+        };
+
+        static thread_local ThreadMetrics* t_metrics = nullptr;
+
+        LocalHolder::~LocalHolder() {
+            Registry& r = GetRegistry();
+            Mutex::Lock lock(r.threadMutex);
+            r.retired.merge(metrics);
+            r.threads.erase(std::remove(r.threads.begin(), r.threads.end(), &metrics), r.threads.end());
+            t_metrics = &r.orphan;
+        }
+    }
+
+    void HistogramData::merge(const HistogramData& rhs) {
+        count += rhs.count;
+        sum += rhs.sum;
+        for(size_t i = 0; i < BUCKETS; ++i) {
+            buckets[i] += rhs.buckets[i];
+        }
+    }
+
+    void Histogram::collect(HistogramData& data) const {
+        for(size_t i = 0; i < HistogramData::BUCKETS; ++i) {
+            uint64_t v = m_buckets[i].get();
+            data.buckets[i] += v;
+            data.count += v;
+        }
+        data.sum += m_sum.get();
+    }
+
+    void MetricsData::merge(const ThreadMetrics& m) {
+        tasks += m.tasks.get();
+        epoll_wakes += m.epoll_wakes.get();
+        timers += m.timers.get();
+        m.task_wait.collect(task_wait);
+        m.task_run.collect(task_run);
+        m.epoll_batch.collect(epoll_batch);
+        m.timer_lag.collect(timer_lag);
+    }
+
+    MetricsWriter::Family& MetricsWriter::getFamily(const std::string& name, const char* type
+                                                    ,const std::string& help) {
+        Family& family = m_families[name];
+        if(family.type.empty()) {
+            family.type = type;
+            family.help = help;
+        }
+        return family;
+    }
+
+    void MetricsWriter::gauge(const std::string& name, const std::string& help, double value
+                              ,const std::string& labels) {
+        std::stringstream ss;
+        ss << name;
+        if(!labels.empty()) {
+            ss << "{" << labels << "}";
+        }
+        ss << " " << value;
+        getFamily(name, "gauge", help).samples.push_back(ss.str());
+    }
+
+    void MetricsWriter::counter(const std::string& name, const std::string& help, uint64_t value
+                                ,const std::string& labels) {
+        std::stringstream ss;
+        ss << name;
+        if(!labels.empty()) {
+            ss << "{" << labels << "}";
+        }
+        ss << " " << value;
+        getFamily(name, "counter", help).samples.push_back(ss.str());
+    }
+
+    void MetricsWriter::histogram(const std::string& name, const std::string& help
+                                  ,const HistogramData& data, double scale
+                                  ,const std::string& labels) {
+        Family& family = getFamily(name, "histogram", help);
+        std::string prefix = labels.empty() ? "" : labels + ",";
+        uint64_t total = 0;
+        // 最后一个桶收纳所有更大的值, 作为+Inf输出
+        for(size_t i = 0; i + 1 < HistogramData::BUCKETS; ++i) {
+            total += data.buckets[i];
+            std::stringstream ss;
+            ss.precision(12);
+            // 值都是整数, 第i个桶的上界(含)为2^i-1
+            ss << name << "_bucket{" << prefix << "le=\""
+               << (double)((1ull << i) - 1) * scale << "\"} " << total;
+            family.samples.push_back(ss.str());
+        }
+        total += data.buckets[HistogramData::BUCKETS - 1];
+
+        std::stringstream ss;
+        ss << name << "_bucket{" << prefix << "le=\"+Inf\"} " << total;
+        family.samples.push_back(ss.str());
+
+        std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+        ss.str("");
+        ss << name << "_sum" << suffix << " " << (double)data.sum * scale;
+        family.samples.push_back(ss.str());
+        ss.str("");
+        ss << name << "_count" << suffix << " " << total;
+        family.samples.push_back(ss.str());
+    }
+
+    std::string MetricsWriter::toString() const {
+        std::stringstream ss;
+        for(auto& i : m_families) {
+            ss << "# HELP " << i.first << " " << i.second.help << "\n";
+            ss << "# TYPE " << i.first << " " << i.second.type << "\n";
+            for(auto& s : i.second.samples) {
+                ss << s << "\n";
+            }
+        }
+        return ss.str();
+    }
+
+    ThreadMetrics& Metrics::Local() {
+        if(__builtin_expect(t_metrics == nullptr, 0)) {
+            static thread_local LocalHolder s_holder;
+            t_metrics = &s_holder.metrics;
+        }
+        return *t_metrics;
+    }
+
+    void Metrics::Collect(MetricsData& data) {
+        Registry& r = GetRegistry();
+        Mutex::Lock lock(r.threadMutex);
+        data.tasks += r.retired.tasks;
+        data.epoll_wakes += r.retired.epoll_wakes;
+        data.timers += r.retired.timers;
+        data.task_wait.merge(r.retired.task_wait);
+        data.task_run.merge(r.retired.task_run);
+        data.epoll_batch.merge(r.retired.epoll_batch);
+        data.timer_lag.merge(r.retired.timer_lag);
+        for(auto m : r.threads) {
+            data.merge(*m);
+        }
+        data.merge(r.orphan);
+    }
+
+    uint64_t Metrics::AddCollector(Collector cb) {
+        Registry& r = GetRegistry();
+        Mutex::Lock lock(r.collectorMutex);
+        uint64_t id = ++r.nextId;
+        r.collectors[id] = std::move(cb);
+        return id;
+    }
+
+    void Metrics::DelCollector(uint64_t id) {
+        Registry& r = GetRegistry();
+        Mutex::Lock lock(r.collectorMutex);
+        r.collectors.erase(id);
+    }
+
+    std::string Metrics::ToPrometheus() {
+        MetricsData data;
+        Collect(data);
+
+        MetricsWriter writer;
+        writer.counter("sylar_tasks_total", "Tasks executed by scheduler threads", data.tasks);
+        writer.histogram("sylar_task_wait_seconds", "Time from enqueue to swapIn"
+                         ,data.task_wait, 1e-9);
+        writer.histogram("sylar_task_run_seconds", "Time a task ran before switching back to the scheduler"
+                         ,data.task_run, 1e-9);
+        writer.counter("sylar_epoll_wakeups_total", "epoll_wait returns", data.epoll_wakes);
+        writer.histogram("sylar_epoll_batch_events", "Events returned by one epoll_wait"
+                         ,data.epoll_batch);
+        writer.counter("sylar_timers_fired_total", "Expired timers", data.timers);
+        writer.histogram("sylar_timer_lag_seconds", "Delay between timer deadline and expiry"
+                         ,data.timer_lag, 1e-9);
+
+        writer.gauge("sylar_fibers", "Live fibers", Fiber::TotalFibers());
+        writer.gauge("sylar_fiber_stacks_in_use", "Fiber stacks in use", Fiber::TotalStacksInUse());
+        writer.gauge("sylar_fiber_stacks_pooled", "Fiber stacks cached in the stack pool"
+                     ,Fiber::TotalPooledStacks());
+        writer.counter("sylar_fibers_reused_total", "Fibers reused from the fiber pool"
+                       ,Fiber::TotalReusedFibers());
+
+        {
+            Registry& r = GetRegistry();
+            Mutex::Lock lock(r.collectorMutex);
+            for(auto& i : r.collectors) {
+                i.second(writer);
+            }
+        }
+        return writer.toString();
+    }
+
+    uint64_t Metrics::NowNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+}
@@ -0,0 +1,145 @@
+//
+// Created by admin on 2025/8/31.
+//
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace sylar {
+
+    // 单写者计数器, 只能由所属线程修改, 任意线程都可以读
+    // 只有一个写者, 用relaxed的load+store代替带lock前缀的fetch_add
+    class Counter {
+    public:
+        void inc(uint64_t v = 1) {
+            m_value.store(m_value.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        }
+
+        uint64_t get() const { return m_value.load(std::memory_order_relaxed);}
+    private:
+        std::atomic<uint64_t> m_value{0};
+    };
+
+    // 直方图的快照, 第0个桶为0, 第i个桶为[2^(i-1), 2^i)
+    struct HistogramData {
+        static const size_t BUCKETS = 40;
+
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t buckets[BUCKETS] = {0};
+
+        void merge(const HistogramData& rhs);
+    };
+
+    // 按2的幂分桶的单写者直方图, record是几次普通的读写
+    class Histogram {
+    public:
+        void record(uint64_t v) {
+            size_t idx = v ? 64 - __builtin_clzll(v) : 0;
+            if(idx >= HistogramData::BUCKETS) {
+                idx = HistogramData::BUCKETS - 1;
+            }
+            m_buckets[idx].inc();
+            m_sum.inc(v);
+        }
+
+        // 累加到data, count取各个桶之和, 保证和桶的计数一致
+        void collect(HistogramData& data) const;
+    private:
+        Counter m_sum;
+        Counter m_buckets[HistogramData::BUCKETS];
+    };
+
+    // 每个线程一份的调度运行时指标, 只由所属线程修改, 读取时汇总所有线程
+    struct ThreadMetrics {
+        // 执行的任务数
+        Counter tasks;
+        // epoll_wait返回的次数
+        Counter epoll_wakes;
+        // 触发的定时器数
+        Counter timers;
+        // 任务从入队到开始执行的等待时间(纳秒)
+        Histogram task_wait;
+        // 任务每次swapIn到切回的运行时间(纳秒)
+        Histogram task_run;
+        // 每次epoll_wait返回的事件数
+        Histogram epoll_batch;
+        // 定时器实际触发时间比预定时间晚了多少(纳秒)
+        Histogram timer_lag;
+    };
+
+    // 所有线程的ThreadMetrics汇总
+    struct MetricsData {
+        uint64_t tasks = 0;
+        uint64_t epoll_wakes = 0;
+        uint64_t timers = 0;
+        HistogramData task_wait;
+        HistogramData task_run;
+        HistogramData epoll_batch;
+        HistogramData timer_lag;
+
+        void merge(const ThreadMetrics& m);
+    };
+
+    // 按Prometheus文本格式输出指标, 同名的样本放在一起, 只输出一次TYPE/HELP
+    // labels 为拼好的标签, 例如 scheduler="main",thread="123"
+    class MetricsWriter {
+    public:
+        void gauge(const std::string& name, const std::string& help, double value
+                   ,const std::string& labels = "");
+
+        void counter(const std::string& name, const std::string& help, uint64_t value
+                     ,const std::string& labels = "");
+
+        // scale 为桶边界和sum的单位换算, 例如纳秒换成秒传1e-9
+        void histogram(const std::string& name, const std::string& help
+                       ,const HistogramData& data, double scale = 1
+                       ,const std::string& labels = "");
+
+        std::string toString() const;
+    private:
+        struct Family {
+            std::string type;
+            std::string help;
+            std::vector<std::string> samples;
+        };
+
+        Family& getFamily(const std::string& name, const char* type, const std::string& help);
+    private:
+        std::map<std::string, Family> m_families;
+    };
+
+    // 运行时指标
+    // 写路径只碰本线程的ThreadMetrics, 没有共享的缓存行; 读的时候加锁遍历所有线程汇总
+    class Metrics {
+    public:
+        typedef std::function<void(MetricsWriter&)> Collector;
+
+        // 当前线程的指标
+        static ThreadMetrics& Local();
+
+        // 汇总所有线程(包括已经退出的线程)
+        static void Collect(MetricsData& data);
+
+        // 注册读取时调用的采集函数(队列长度之类的瞬时值), 返回id
+        static uint64_t AddCollector(Collector cb);
+
+        // 注销采集函数, 返回之后不会再被调用
+        static void DelCollector(uint64_t id);
+
+        // 所有指标的Prometheus文本格式
+        static std::string ToPrometheus();
+
+        // 单调时钟, 纳秒
+        static uint64_t NowNs();
+    };
+}
+
+#endif //METRICS_H
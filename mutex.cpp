@@ -4,6 +4,11 @@
 
 #include "mutex.h"
 #include <stdexcept>
+#include <sstream>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 namespace sylar {
     Semaphore::Semaphore(uint32_t count) {
@@ -28,4 +33,102 @@ namespace sylar {
         }
     }
 
+    static uint64_t NowNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    static void FutexWait(std::atomic<int>* addr, int val) {
+        syscall(SYS_futex, (int*)addr, FUTEX_WAIT_PRIVATE, val, nullptr, nullptr, 0);
+    }
+
+    static void FutexWake(std::atomic<int>* addr, int count) {
+        syscall(SYS_futex, (int*)addr, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+    }
+
+    std::atomic<bool> MutexStats::s_enabled{false};
+
+    MutexStats::MutexStats() {
+        reset();
+    }
+
+    void MutexStats::record(uint64_t wait_ns, bool contended) {
+        m_acquires.fetch_add(1, std::memory_order_relaxed);
+        if(!contended) {
+            return;
+        }
+        m_contended.fetch_add(1, std::memory_order_relaxed);
+        m_waitNs.fetch_add(wait_ns, std::memory_order_relaxed);
+        size_t idx = wait_ns ? 64 - __builtin_clzll(wait_ns) : 0;
+        if(idx >= BUCKETS) {
+            idx = BUCKETS - 1;
+        }
+        m_buckets[idx].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void MutexStats::reset() {
+        m_acquires.store(0, std::memory_order_relaxed);
+        m_contended.store(0, std::memory_order_relaxed);
+        m_waitNs.store(0, std::memory_order_relaxed);
+        for(size_t i = 0; i < BUCKETS; ++i) {
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    std::string MutexStats::toString() const {
+        std::stringstream ss;
+        uint64_t contended = getContended();
+        ss << "acquires=" << getAcquires()
+           << " contended=" << contended
+           << " avg_wait_ns=" << (contended ? getWaitNs() / contended : 0);
+        for(size_t i = 0; i < BUCKETS; ++i) {
+            uint64_t v = getBucket(i);
+            if(v) {
+                ss << " <" << (1ull << i) << "ns:" << v;
+            }
+        }
+        return ss.str();
+    }
+
+    MutexStats& MutexStats::Global() {
+        static MutexStats s_stats;
+        return s_stats;
+    }
+
+    void AdaptiveMutex::lockSlow() {
+        bool profile = MutexStats::IsEnabled();
+        uint64_t start = profile ? NowNs() : 0;
+
+        // 先自旋, 锁通常很快就会释放, 省掉两次系统调用和线程切换
+        Backoff backoff;
+        for(uint32_t i = 0; i < m_spin; ++i) {
+            int state = m_state.load(std::memory_order_relaxed);
+            if(state == UNLOCKED) {
+                if(m_state.compare_exchange_weak(state, LOCKED, std::memory_order_acquire)) {
+                    if(profile) {
+                        getStats().record(NowNs() - start, true);
+                    }
+                    return;
+                }
+            } else if(state == CONTENDED) {
+                // 已经有线程在休眠了, 继续自旋没有意义
+                break;
+            }
+            backoff.pause();
+        }
+
+        // 置成CONTENDED再休眠, 持有者unlock时会唤醒一个
+        while(m_state.exchange(CONTENDED, std::memory_order_acquire) != UNLOCKED) {
+            FutexWait(&m_state, CONTENDED);
+        }
+        if(profile) {
+            getStats().record(NowNs() - start, true);
+        }
+    }
+
+    void AdaptiveMutex::unlockSlow() {
+        FutexWake(&m_state, 1);
+    }
+
 }
\ No newline at end of file
@@ -13,10 +13,52 @@
 #include <atomic>
 #include <list>
 #include <semaphore.h>
+#include <string>
 #include <boost/noncopyable.hpp>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// 缓存行大小
+#define SYLAR_CACHELINE_SIZE 64
 
 
 namespace sylar {
+    // 自旋等待时提示CPU, 降低功耗并让出超线程的执行资源
+    inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield" ::: "memory");
+#else
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+    }
+
+    // 指数退避, 每次失败后pause的次数翻倍, 到上限后不再增加
+    class Backoff {
+    public:
+        void pause() {
+            for(uint32_t i = 0; i < m_count; ++i) {
+                CpuRelax();
+            }
+            if(m_count < MAX_PAUSE) {
+                m_count <<= 1;
+            }
+        }
+    private:
+        static const uint32_t MAX_PAUSE = 64;
+        uint32_t m_count = 1;
+    };
+
+    // 按缓存行对齐的包装, 让热点锁独占一个缓存行, 不和相邻成员伪共享
+    // 继承T, 用法和T完全一样, 比如 CacheAligned<Mutex>::Lock lock(m_mutex);
+    template<class T>
+    class alignas(SYLAR_CACHELINE_SIZE) CacheAligned : public T {
+    public:
+        using T::T;
+    };
+
     //信号量
     class Semaphore : private boost::noncopyable {
     public:
@@ -67,7 +109,7 @@ namespace sylar {
     public:
         ReadScopedLockImpl(T& mutex)
             :m_mutex(mutex) {
-            m_mutex.lock();
+            m_mutex.rdlock();
             m_locked = true;
         }
 
@@ -76,8 +118,8 @@ namespace sylar {
         }
 
         void lock() {
-            if (m_locked) {
-                m_mutex.lock();
+            if (!m_locked) {
+                m_mutex.rdlock();
                 m_locked = true;
             }
         }
@@ -109,7 +151,7 @@ namespace sylar {
 
         void lock() {
             if (!m_locked) {
-                m_mutex.lock();
+                m_mutex.wrlock();
                 m_locked = true;
             }
         }
@@ -232,22 +274,121 @@ namespace sylar {
         typedef ScopedLockImpl<CASLock> Lock;
 
         CASLock() {
-            m_mutex.clear();
         }
 
         ~CASLock() {
         }
 
         void lock() {
-            while (std::atomic_flag_test_and_set_explicit(&m_mutex,
-                std::memory_order_acquire));
+            if(!m_locked.exchange(true, std::memory_order_acquire)) {
+                return;
+            }
+            // 先只读等锁释放, 不抢占缓存行, 读到释放了再去抢
+            Backoff backoff;
+            do {
+                while(m_locked.load(std::memory_order_relaxed)) {
+                    backoff.pause();
+                }
+            } while(m_locked.exchange(true, std::memory_order_acquire));
         }
 
         void unlock() {
-            std::atomic_flag_clear_explicit(&m_mutex, std::memory_order_release);
+            m_locked.store(false, std::memory_order_release);
         }
     private:
-        std::atomic_flag m_mutex = ATOMIC_FLAG_INIT;
+        std::atomic<bool> m_locked{false};
+    };
+
+    // 锁的获取统计, 用于分析锁竞争
+    // 默认关闭(mutex.profile), 关闭时每次加锁只多一次读原子变量
+    class MutexStats : private boost::noncopyable {
+    public:
+        // 等待时间按2的幂分桶, 第i个桶为[2^(i-1), 2^i)纳秒
+        static const size_t BUCKETS = 40;
+
+        MutexStats();
+
+        // 记录一次获取, wait_ns 等待的时间, 没有竞争时为0
+        void record(uint64_t wait_ns, bool contended);
+
+        uint64_t getAcquires() const { return m_acquires.load(std::memory_order_relaxed);}
+        uint64_t getContended() const { return m_contended.load(std::memory_order_relaxed);}
+        uint64_t getWaitNs() const { return m_waitNs.load(std::memory_order_relaxed);}
+        uint64_t getBucket(size_t i) const { return m_buckets[i].load(std::memory_order_relaxed);}
+
+        void reset();
+
+        // 可读的统计信息
+        std::string toString() const;
+
+        // 没有单独设置统计对象的锁记到这里
+        static MutexStats& Global();
+
+        static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed);}
+        static void SetEnabled(bool v) { s_enabled.store(v, std::memory_order_relaxed);}
+    private:
+        static std::atomic<bool> s_enabled;
+        std::atomic<uint64_t> m_acquires;
+        std::atomic<uint64_t> m_contended;
+        std::atomic<uint64_t> m_waitNs;
+        std::atomic<uint64_t> m_buckets[BUCKETS];
+    };
+
+    // 自适应互斥量: 先自旋(带pause和指数退避), 自旋一定次数拿不到再在futex上休眠
+    // 没有竞争时加锁解锁各一次原子操作, 不进内核; 适合临界区很短但偶尔有竞争的场景
+    class AdaptiveMutex : private boost::noncopyable {
+    public:
+        typedef ScopedLockImpl<AdaptiveMutex> Lock;
+
+        // spin 休眠之前最多尝试的次数
+        AdaptiveMutex(uint32_t spin = 100)
+            :m_spin(spin) {
+        }
+
+        void lock() {
+            int expected = UNLOCKED;
+            if(__builtin_expect(m_state.compare_exchange_strong(expected, LOCKED,
+                                                                std::memory_order_acquire), 1)) {
+                if(__builtin_expect(MutexStats::IsEnabled(), 0)) {
+                    getStats().record(0, false);
+                }
+                return;
+            }
+            lockSlow();
+        }
+
+        bool tryLock() {
+            int expected = UNLOCKED;
+            return m_state.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire);
+        }
+
+        void unlock() {
+            if(m_state.exchange(UNLOCKED, std::memory_order_release) == CONTENDED) {
+                unlockSlow();
+            }
+        }
+
+        // 单独统计这个锁, 为nullptr时记到MutexStats::Global()
+        void setStats(MutexStats* stats) { m_stats = stats;}
+
+        // 设置自旋次数, 只能在锁开始使用之前调用
+        void setSpin(uint32_t spin) { m_spin = spin;}
+        uint32_t getSpin() const { return m_spin;}
+    private:
+        void lockSlow();
+        void unlockSlow();
+
+        MutexStats& getStats() { return m_stats ? *m_stats : MutexStats::Global();}
+    private:
+        enum State {
+            UNLOCKED = 0,
+            LOCKED = 1,
+            // 可能有线程在futex上等待
+            CONTENDED = 2
+        };
+        std::atomic<int> m_state{UNLOCKED};
+        uint32_t m_spin;
+        MutexStats* m_stats = nullptr;
     };
 }
 
@@ -3,3 +3,850 @@
 //
 
 #include "socket.h"
+#include "iomanager.h"
+#include "fd_manager.h"
+#include "log.h"
+#include "macro.h"
+#include "hook.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <limits.h>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#include <netinet/udp.h>
+
+// 老版本的glibc头文件里没有UDP GSO/GRO的定义
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+namespace sylar {
+
+    static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+    // 在当前IOManager上等待fd的读写事件, timeout_ms 为-1 时不超时
+    // sendfile/splice 没有被hook, 遇到EAGAIN时用它挂起协程
+    static bool wait_socket(int fd, IOManager::Event event, int64_t timeout_ms) {
+        IOManager* iom = IOManager::GetThis();
+        if(!iom) {
+            errno = EAGAIN;
+            return false;
+        }
+
+        std::shared_ptr<int> cancelled(new int(0));
+        std::weak_ptr<int> wcancelled(cancelled);
+        Timer::ptr timer;
+        if(timeout_ms >= 0) {
+            timer = iom->addConditionTimer(timeout_ms, [wcancelled, fd, iom, event]() {
+                auto t = wcancelled.lock();
+                if(!t || *t) {
+                    return;
+                }
+                *t = ETIMEDOUT;
+                iom->cancelEvent(fd, event);
+            }, wcancelled, false);
+        }
+
+        if(iom->addEvent(fd, event)) {
+            if(timer) {
+                timer->cancel();
+            }
+            return false;
+        }
+        Fiber::YieldToHold();
+        if(timer) {
+            timer->cancel();
+        }
+        if(*cancelled) {
+            errno = *cancelled;
+            return false;
+        }
+        return true;
+    }
+
+    Socket::ptr Socket::CreateTCP(Address::ptr address) {
+        Socket::ptr sock(new Socket(address->getFamily(), TCP, 0));
+        return sock;
+    }
+
+    Socket::ptr Socket::CreateUDP(Address::ptr address) {
+        Socket::ptr sock(new Socket(address->getFamily(), UDP, 0));
+        sock->newSock();
+        sock->m_isConnected = true;
+        return sock;
+    }
+
+    Socket::ptr Socket::CreateTCPSocket() {
+        Socket::ptr sock(new Socket(IPv4, TCP, 0));
+        return sock;
+    }
+
+    Socket::ptr Socket::CreateUDPSocket() {
+        Socket::ptr sock(new Socket(IPv4, UDP, 0));
+        sock->newSock();
+        sock->m_isConnected = true;
+        return sock;
+    }
+
+    Socket::ptr Socket::CreateTCPSocket6() {
+        Socket::ptr sock(new Socket(IPv6, TCP, 0));
+        return sock;
+    }
+
+    Socket::ptr Socket::CreateUDPSocket6() {
+        Socket::ptr sock(new Socket(IPv6, UDP, 0));
+        sock->newSock();
+        sock->m_isConnected = true;
+        return sock;
+    }
+
+    Socket::ptr Socket::CreateUnixTCPSocket() {
+        Socket::ptr sock(new Socket(UNIX, TCP, 0));
+        return sock;
+    }
+
+    Socket::ptr Socket::CreateUnixUDPSocket() {
+        Socket::ptr sock(new Socket(UNIX, UDP, 0));
+        sock->newSock();
+        sock->m_isConnected = true;
+        return sock;
+    }
+
+    Socket::Socket(int family, int type, int protocol)
+        :m_sock(-1)
+        ,m_family(family)
+        ,m_type(type)
+        ,m_protocol(protocol)
+        ,m_isConnected(false) {
+    }
+
+    Socket::~Socket() {
+        close();
+    }
+
+    int64_t Socket::getSendTimeout() {
+        FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+        if(ctx) {
+            return ctx->getTimeout(SO_SNDTIMEO);
+        }
+        return -1;
+    }
+
+    void Socket::setSendTimeout(int64_t v) {
+        struct timeval tv{int(v / 1000), int(v % 1000 * 1000)};
+        setOption(SOL_SOCKET, SO_SNDTIMEO, tv);
+    }
+
+    int64_t Socket::getRecvTimeout() {
+        FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+        if(ctx) {
+            return ctx->getTimeout(SO_RCVTIMEO);
+        }
+        return -1;
+    }
+
+    void Socket::setRecvTimeout(int64_t v) {
+        struct timeval tv{int(v / 1000), int(v % 1000 * 1000)};
+        setOption(SOL_SOCKET, SO_RCVTIMEO, tv);
+    }
+
+    bool Socket::getOption(int level, int option, void* result, socklen_t* len) {
+        int rt = getsockopt(m_sock, level, option, result, (socklen_t*)len);
+        if(rt) {
+            SYLAR_LOG_DEBUG(g_logger) << "getOption sock=" << m_sock
+                << " level=" << level << " option=" << option
+                << " errno=" << errno << " errstr=" << strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    bool Socket::setOption(int level, int option, const void* result, socklen_t len) {
+        if(setsockopt(m_sock, level, option, result, (socklen_t)len)) {
+            SYLAR_LOG_DEBUG(g_logger) << "setOption sock=" << m_sock
+                << " level=" << level << " option=" << option
+                << " errno=" << errno << " errstr=" << strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    Socket::ptr Socket::accept() {
+        Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
+        int newsock = ::accept(m_sock, nullptr, nullptr);
+        if(newsock == -1) {
+            SYLAR_LOG_ERROR(g_logger) << "accept(" << m_sock << ") errno="
+                << errno << " errstr=" << strerror(errno);
+            return nullptr;
+        }
+        if(sock->init(newsock)) {
+            return sock;
+        }
+        return nullptr;
+    }
+
+    int Socket::acceptBatch(std::vector<Socket::ptr>& socks, size_t max) {
+        size_t count = 0;
+        while(count < max) {
+            int newsock = ::accept4(m_sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(newsock == -1) {
+                if(errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                    errno = EAGAIN;
+                    break;
+                }
+                return count ? (int)count : -1;
+            }
+            // accept4没有hook, 要自己登记到FdMgr, 之后的读写才走IOManager
+            // 同一个fd之前可能在没有hook的线程里关闭过, 留下的FdCtx是旧的, 先删掉再重新建
+            FdMgr::GetInstance()->del(newsock);
+            FdMgr::GetInstance()->get(newsock, true);
+            Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
+            if(sock->init(newsock)) {
+                socks.push_back(sock);
+            } else {
+                ::close(newsock);
+            }
+            ++count;
+        }
+        return count;
+    }
+
+    bool Socket::init(int sock) {
+        FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock);
+        if(ctx && ctx->isSocket() && !ctx->isClose()) {
+            m_sock = sock;
+            m_isConnected = true;
+            initSock();
+            getLocalAddress();
+            getRemoteAddress();
+            return true;
+        }
+        return false;
+    }
+
+    bool Socket::bind(const Address::ptr addr) {
+        if(!isValid()) {
+            newSock();
+            if(SYLAR_UNLIKELY(!isValid())) {
+                return false;
+            }
+        }
+
+        if(SYLAR_UNLIKELY(addr->getFamily() != m_family)) {
+            SYLAR_LOG_ERROR(g_logger) << "bind sock.family("
+                << m_family << ") addr.family(" << addr->getFamily()
+                << ") not equal, addr=" << addr->toString();
+            return false;
+        }
+
+        if(::bind(m_sock, addr->getAddr(), addr->getAddrLen())) {
+            SYLAR_LOG_ERROR(g_logger) << "bind error errrno=" << errno
+                << " errstr=" << strerror(errno);
+            return false;
+        }
+        getLocalAddress();
+        return true;
+    }
+
+    bool Socket::reconnect(uint64_t timeout_ms) {
+        if(!m_remoteAddress) {
+            SYLAR_LOG_ERROR(g_logger) << "reconnect m_remoteAddress is null";
+            return false;
+        }
+        m_localAddress.reset();
+        return connect(m_remoteAddress, timeout_ms);
+    }
+
+    bool Socket::connect(const Address::ptr addr, uint64_t timeout_ms) {
+        m_remoteAddress = addr;
+        if(!isValid()) {
+            newSock();
+            if(SYLAR_UNLIKELY(!isValid())) {
+                return false;
+            }
+        }
+
+        if(SYLAR_UNLIKELY(addr->getFamily() != m_family)) {
+            SYLAR_LOG_ERROR(g_logger) << "connect sock.family("
+                << m_family << ") addr.family(" << addr->getFamily()
+                << ") not equal, addr=" << addr->toString();
+            return false;
+        }
+
+        if(timeout_ms == (uint64_t)-1) {
+            if(::connect(m_sock, addr->getAddr(), addr->getAddrLen())) {
+                SYLAR_LOG_ERROR(g_logger) << "sock=" << m_sock << " connect(" << addr->toString()
+                    << ") error errno=" << errno << " errstr=" << strerror(errno);
+                close();
+                return false;
+            }
+        } else {
+            if(::connect_with_timeout(m_sock, addr->getAddr(), addr->getAddrLen(), timeout_ms)) {
+                SYLAR_LOG_ERROR(g_logger) << "sock=" << m_sock << " connect(" << addr->toString()
+                    << ") timeout=" << timeout_ms << " error errno="
+                    << errno << " errstr=" << strerror(errno);
+                close();
+                return false;
+            }
+        }
+        m_isConnected = true;
+        getRemoteAddress();
+        getLocalAddress();
+        return true;
+    }
+
+    bool Socket::listen(int backlog) {
+        if(!isValid()) {
+            SYLAR_LOG_ERROR(g_logger) << "listen error sock=-1";
+            return false;
+        }
+        if(::listen(m_sock, backlog)) {
+            SYLAR_LOG_ERROR(g_logger) << "listen error errno=" << errno
+                << " errstr=" << strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    bool Socket::close() {
+        if(!m_isConnected && m_sock == -1) {
+            return true;
+        }
+        m_isConnected = false;
+        bool rt = true;
+        if(m_sock != -1) {
+            rt = ::close(m_sock) == 0;
+            m_sock = -1;
+        }
+        return rt;
+    }
+
+    int Socket::send(const void* buffer, size_t length, int flags) {
+        if(isConnected()) {
+            return ::send(m_sock, buffer, length, flags);
+        }
+        return -1;
+    }
+
+    int Socket::send(const iovec* buffers, size_t length, int flags) {
+        if(isConnected()) {
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = (iovec*)buffers;
+            msg.msg_iovlen = length;
+            return ::sendmsg(m_sock, &msg, flags);
+        }
+        return -1;
+    }
+
+    int Socket::sendTo(const void* buffer, size_t length, const Address::ptr to, int flags) {
+        if(isConnected()) {
+            return ::sendto(m_sock, buffer, length, flags, to->getAddr(), to->getAddrLen());
+        }
+        return -1;
+    }
+
+    int Socket::sendTo(const iovec* buffers, size_t length, const Address::ptr to, int flags) {
+        if(isConnected()) {
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = (iovec*)buffers;
+            msg.msg_iovlen = length;
+            msg.msg_name = to->getAddr();
+            msg.msg_namelen = to->getAddrLen();
+            return ::sendmsg(m_sock, &msg, flags);
+        }
+        return -1;
+    }
+
+    int Socket::recv(void* buffer, size_t length, int flags) {
+        if(isConnected()) {
+            return ::recv(m_sock, buffer, length, flags);
+        }
+        return -1;
+    }
+
+    int Socket::recv(iovec* buffers, size_t length, int flags) {
+        if(isConnected()) {
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = (iovec*)buffers;
+            msg.msg_iovlen = length;
+            return ::recvmsg(m_sock, &msg, flags);
+        }
+        return -1;
+    }
+
+    int Socket::recvFrom(void* buffer, size_t length, Address::ptr from, int flags) {
+        if(isConnected()) {
+            socklen_t len = from->getAddrLen();
+            return ::recvfrom(m_sock, buffer, length, flags, from->getAddr(), &len);
+        }
+        return -1;
+    }
+
+    int Socket::recvFrom(iovec* buffers, size_t length, Address::ptr from, int flags) {
+        if(isConnected()) {
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = (iovec*)buffers;
+            msg.msg_iovlen = length;
+            msg.msg_name = from->getAddr();
+            msg.msg_namelen = from->getAddrLen();
+            return ::recvmsg(m_sock, &msg, flags);
+        }
+        return -1;
+    }
+
+    int Socket::sendBatch(Datagram* msgs, size_t count, int flags) {
+        if(!isConnected()) {
+            return -1;
+        }
+        if(count == 0) {
+            return 0;
+        }
+        std::vector<mmsghdr> hdrs(count);
+        std::vector<iovec> iovs(count);
+        memset(&hdrs[0], 0, sizeof(mmsghdr) * count);
+        for(size_t i = 0; i < count; ++i) {
+            iovs[i].iov_base = msgs[i].buffer;
+            iovs[i].iov_len = msgs[i].length;
+            msghdr& msg = hdrs[i].msg_hdr;
+            msg.msg_iov = &iovs[i];
+            msg.msg_iovlen = 1;
+            if(msgs[i].addr) {
+                msg.msg_name = msgs[i].addr->getAddr();
+                msg.msg_namelen = msgs[i].addr->getAddrLen();
+            }
+        }
+
+        // 内核一次最多处理UIO_MAXIOV个, 发不完时继续发, 已经发出一部分后的错误留给下次调用
+        size_t sent = 0;
+        while(sent < count) {
+            int rt = ::sendmmsg(m_sock, &hdrs[sent], count - sent, flags);
+            if(rt <= 0) {
+                if(sent == 0) {
+                    return -1;
+                }
+                break;
+            }
+            sent += rt;
+        }
+        return sent;
+    }
+
+    int Socket::recvBatch(Datagram* msgs, size_t count, int flags) {
+        if(!isConnected()) {
+            return -1;
+        }
+        if(count == 0) {
+            return 0;
+        }
+        // GRO的分段大小以int放在SOL_UDP/UDP_GRO的辅助数据里
+        const size_t cmsg_space = m_udpGro ? CMSG_SPACE(sizeof(int)) : 0;
+        std::vector<mmsghdr> hdrs(count);
+        std::vector<iovec> iovs(count);
+        std::vector<char> control(cmsg_space * count);
+        memset(&hdrs[0], 0, sizeof(mmsghdr) * count);
+        for(size_t i = 0; i < count; ++i) {
+            iovs[i].iov_base = msgs[i].buffer;
+            iovs[i].iov_len = msgs[i].length;
+            msghdr& msg = hdrs[i].msg_hdr;
+            msg.msg_iov = &iovs[i];
+            msg.msg_iovlen = 1;
+            if(msgs[i].addr) {
+                msg.msg_name = msgs[i].addr->getAddr();
+                msg.msg_namelen = msgs[i].addr->getAddrLen();
+            }
+            if(cmsg_space) {
+                msg.msg_control = &control[cmsg_space * i];
+                msg.msg_controllen = cmsg_space;
+            }
+        }
+
+        int rt = ::recvmmsg(m_sock, &hdrs[0], count, flags, nullptr);
+        for(int i = 0; i < rt; ++i) {
+            msghdr& msg = hdrs[i].msg_hdr;
+            msgs[i].length = hdrs[i].msg_len;
+            msgs[i].flags = msg.msg_flags;
+            msgs[i].segment = 0;
+            if(!cmsg_space) {
+                continue;
+            }
+            for(cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+                if(cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                    int seg = 0;
+                    memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+                    msgs[i].segment = seg;
+                }
+            }
+        }
+        return rt;
+    }
+
+    bool Socket::setUdpSegment(uint16_t segment_size) {
+        int val = segment_size;
+        return setOption(SOL_UDP, UDP_SEGMENT, val);
+    }
+
+    bool Socket::setUdpGro(bool v) {
+        int val = v ? 1 : 0;
+        if(!setOption(SOL_UDP, UDP_GRO, val)) {
+            return false;
+        }
+        m_udpGro = v;
+        return true;
+    }
+
+    ssize_t Socket::sendFile(int file_fd, off_t offset, size_t length) {
+        if(!isConnected()) {
+            return -1;
+        }
+        ssize_t total = 0;
+        while(length > 0) {
+            ssize_t n = ::sendfile(m_sock, file_fd, &offset, length);
+            if(n > 0) {
+                total += n;
+                length -= n;
+                continue;
+            }
+            if(n == 0) {
+                // 文件已经读完
+                break;
+            }
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno == EAGAIN && wait_socket(m_sock, IOManager::WRITE, getSendTimeout())) {
+                continue;
+            }
+            return total ? total : -1;
+        }
+        return total;
+    }
+
+    // 每个线程缓存一对管道给splice中转, 出错时管道里可能残留数据, 直接重建
+    struct SplicePipe {
+        int fds[2] = {-1, -1};
+
+        bool get() {
+            if(fds[0] != -1) {
+                return true;
+            }
+            return pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0;
+        }
+
+        void reset() {
+            if(fds[0] != -1) {
+                ::close(fds[0]);
+                ::close(fds[1]);
+            }
+            fds[0] = fds[1] = -1;
+        }
+
+        ~SplicePipe() {
+            reset();
+        }
+    };
+
+    static thread_local SplicePipe t_splice_pipe;
+
+    ssize_t Socket::spliceFrom(int fd_in, loff_t* off_in, size_t length) {
+        if(!isConnected() || !t_splice_pipe.get()) {
+            return -1;
+        }
+        // 管道默认容量64K, 一次最多中转这么多
+        static const size_t MAX_CHUNK = 64 * 1024;
+        ssize_t total = 0;
+        while(length > 0) {
+            ssize_t in_pipe = ::splice(fd_in, off_in, t_splice_pipe.fds[1], nullptr
+                    ,std::min(length, MAX_CHUNK), SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+            if(in_pipe == 0) {
+                break;
+            }
+            if(in_pipe < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                // fd_in是socket或管道时可能还没有数据
+                if(errno == EAGAIN && wait_socket(fd_in, IOManager::READ, getRecvTimeout())) {
+                    continue;
+                }
+                return total ? total : -1;
+            }
+
+            // 把管道里的数据全部送到socket
+            while(in_pipe > 0) {
+                ssize_t n = ::splice(t_splice_pipe.fds[0], nullptr, m_sock, nullptr
+                        ,in_pipe, SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+                if(n > 0) {
+                    in_pipe -= n;
+                    length -= n;
+                    total += n;
+                    continue;
+                }
+                if(n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if(n < 0 && errno == EAGAIN && wait_socket(m_sock, IOManager::WRITE, getSendTimeout())) {
+                    continue;
+                }
+                t_splice_pipe.reset();
+                return total ? total : -1;
+            }
+        }
+        return total;
+    }
+
+    bool Socket::setZeroCopy(bool v) {
+#ifdef SO_ZEROCOPY
+        int val = v ? 1 : 0;
+        if(!setOption(SOL_SOCKET, SO_ZEROCOPY, val)) {
+            return false;
+        }
+        m_zeroCopy = v;
+        return true;
+#else
+        return !v;
+#endif
+    }
+
+    ssize_t Socket::sendZeroCopy(const void* buffer, size_t length, int flags) {
+        iovec iov;
+        iov.iov_base = (void*)buffer;
+        iov.iov_len = length;
+        return sendZeroCopy(&iov, 1, flags);
+    }
+
+    ssize_t Socket::sendZeroCopy(const iovec* buffers, size_t length, int flags) {
+        if(!isConnected()) {
+            return -1;
+        }
+        if(!m_zeroCopy) {
+            return send(buffers, length, flags);
+        }
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = (iovec*)buffers;
+        msg.msg_iovlen = length;
+        // 走sendmsg的do_io路径, io_uring的send不支持MSG_ZEROCOPY
+        ssize_t rt = ::sendmsg(m_sock, &msg, flags | MSG_ZEROCOPY);
+        if(rt < 0 && errno == ENOBUFS) {
+            // 没取走的完成通知太多, 超过了optmem的限制, 取一下再试
+            reapZeroCopy();
+            rt = ::sendmsg(m_sock, &msg, flags | MSG_ZEROCOPY);
+            if(rt < 0 && errno == ENOBUFS) {
+                return ::sendmsg(m_sock, &msg, flags);
+            }
+        }
+        if(rt > 0) {
+            // 每次成功的零拷贝发送内核都会分配一个递增的序号
+            ++m_zcSeq;
+        }
+        return rt;
+    }
+
+    size_t Socket::reapZeroCopy() {
+        size_t count = 0;
+        while(m_zcDone != m_zcSeq) {
+            char control[128];
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            // 错误队列的读取不会阻塞, 直接调用原始的recvmsg
+            int rt = recvmsg_f(m_sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+            if(rt < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            for(cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+                if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                        || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                    continue;
+                }
+                sock_extended_err* serr = (sock_extended_err*)CMSG_DATA(cm);
+                if(serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                    continue;
+                }
+                // 一条通知覆盖 [ee_info, ee_data] 一段序号
+                uint32_t lo = serr->ee_info;
+                uint32_t hi = serr->ee_data;
+                count += hi - lo + 1;
+                if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    m_zcCopied += hi - lo + 1;
+                }
+                m_zcRanges[lo] = hi;
+            }
+            // 合并连续的区间, 推进已完成的序号
+            auto it = m_zcRanges.find(m_zcDone);
+            while(it != m_zcRanges.end()) {
+                m_zcDone = it->second + 1;
+                m_zcRanges.erase(it);
+                it = m_zcRanges.find(m_zcDone);
+            }
+        }
+        return count;
+    }
+
+    Address::ptr Socket::getRemoteAddress() {
+        if(m_remoteAddress) {
+            return m_remoteAddress;
+        }
+
+        Address::ptr result;
+        switch(m_family) {
+            case AF_INET:
+                result.reset(new IPv4Address());
+                break;
+            case AF_INET6:
+                result.reset(new IPv6Address());
+                break;
+            case AF_UNIX:
+                result.reset(new UnixAddress());
+                break;
+            default:
+                result.reset(new UnknownAddress(m_family));
+                break;
+        }
+        socklen_t addrlen = result->getAddrLen();
+        if(getpeername(m_sock, result->getAddr(), &addrlen)) {
+            return Address::ptr(new UnknownAddress(m_family));
+        }
+        if(m_family == AF_UNIX) {
+            UnixAddress::ptr addr = std::dynamic_pointer_cast<UnixAddress>(result);
+            addr->setAddrLen(addrlen);
+        }
+        m_remoteAddress = result;
+        return m_remoteAddress;
+    }
+
+    Address::ptr Socket::getLocalAddress() {
+        if(m_localAddress) {
+            return m_localAddress;
+        }
+
+        Address::ptr result;
+        switch(m_family) {
+            case AF_INET:
+                result.reset(new IPv4Address());
+                break;
+            case AF_INET6:
+                result.reset(new IPv6Address());
+                break;
+            case AF_UNIX:
+                result.reset(new UnixAddress());
+                break;
+            default:
+                result.reset(new UnknownAddress(m_family));
+                break;
+        }
+        socklen_t addrlen = result->getAddrLen();
+        if(getsockname(m_sock, result->getAddr(), &addrlen)) {
+            SYLAR_LOG_ERROR(g_logger) << "getsockname error sock=" << m_sock
+                << " errno=" << errno << " errstr=" << strerror(errno);
+            return Address::ptr(new UnknownAddress(m_family));
+        }
+        if(m_family == AF_UNIX) {
+            UnixAddress::ptr addr = std::dynamic_pointer_cast<UnixAddress>(result);
+            addr->setAddrLen(addrlen);
+        }
+        m_localAddress = result;
+        return m_localAddress;
+    }
+
+    bool Socket::isValid() const {
+        return m_sock != -1;
+    }
+
+    int Socket::getError() {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if(!getOption(SOL_SOCKET, SO_ERROR, &error, &len)) {
+            error = errno;
+        }
+        return error;
+    }
+
+    std::ostream& Socket::dump(std::ostream& os) const {
+        os << "[Socket sock=" << m_sock
+           << " is_connected=" << m_isConnected
+           << " family=" << m_family
+           << " type=" << m_type
+           << " protocol=" << m_protocol;
+        if(m_localAddress) {
+            os << " local_address=" << m_localAddress->toString();
+        }
+        if(m_remoteAddress) {
+            os << " remote_address=" << m_remoteAddress->toString();
+        }
+        os << "]";
+        return os;
+    }
+
+    std::string Socket::toString() const {
+        std::stringstream ss;
+        dump(ss);
+        return ss.str();
+    }
+
+    bool Socket::cancelRead() {
+        return IOManager::GetThis()->cancelEvent(m_sock, sylar::IOManager::READ);
+    }
+
+    bool Socket::cancelWrite() {
+        return IOManager::GetThis()->cancelEvent(m_sock, sylar::IOManager::WRITE);
+    }
+
+    bool Socket::cancelAccept() {
+        return IOManager::GetThis()->cancelEvent(m_sock, sylar::IOManager::READ);
+    }
+
+    bool Socket::cancelAll() {
+        return IOManager::GetThis()->cancelAll(m_sock);
+    }
+
+    void Socket::initSock() {
+        int val = 1;
+        setOption(SOL_SOCKET, SO_REUSEADDR, val);
+        if(m_type == SOCK_STREAM) {
+            setOption(IPPROTO_TCP, TCP_NODELAY, val);
+        }
+    }
+
+    void Socket::newSock() {
+        m_sock = socket(m_family, m_type, m_protocol);
+        if(SYLAR_LIKELY(m_sock != -1)) {
+            initSock();
+        } else {
+            SYLAR_LOG_ERROR(g_logger) << "socket(" << m_family
+                << ", " << m_type << ", " << m_protocol << ") errno="
+                << errno << " errstr=" << strerror(errno);
+        }
+    }
+
+    std::ostream& operator<<(std::ostream& os, const Socket& sock) {
+        return sock.dump(os);
+    }
+}
@@ -5,12 +5,271 @@
 #ifndef SOCKET_H
 #define SOCKET_H
 
+#include <memory>
+#include <map>
+#include <vector>
+#include <netinet/tcp.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <boost/noncopyable.hpp>
+#include "address.h"
 
+namespace sylar {
 
-class socket {
+    // Socket封装类
+    // 收发都走hook之后的系统调用, 在协程里是同步的写法, 底层由IOManager异步等待
+    class Socket : public std::enable_shared_from_this<Socket>, private boost::noncopyable {
+    public:
+        typedef std::shared_ptr<Socket> ptr;
+        typedef std::weak_ptr<Socket> weak_ptr;
 
-};
+        // Socket类型
+        enum Type {
+            // TCP类型
+            TCP = SOCK_STREAM,
+            // UDP类型
+            UDP = SOCK_DGRAM
+        };
 
+        // Socket协议簇
+        enum Family {
+            // IPv4 socket
+            IPv4 = AF_INET,
+            // IPv6 socket
+            IPv6 = AF_INET6,
+            // Unix socket
+            UNIX = AF_UNIX,
+        };
 
+        // 创建和地址协议簇一致的TCP/UDP Socket
+        static Socket::ptr CreateTCP(Address::ptr address);
+        static Socket::ptr CreateUDP(Address::ptr address);
+
+        // 创建IPv4的TCP/UDP Socket
+        static Socket::ptr CreateTCPSocket();
+        static Socket::ptr CreateUDPSocket();
+
+        // 创建IPv6的TCP/UDP Socket
+        static Socket::ptr CreateTCPSocket6();
+        static Socket::ptr CreateUDPSocket6();
+
+        // 创建Unix的TCP/UDP Socket
+        static Socket::ptr CreateUnixTCPSocket();
+        static Socket::ptr CreateUnixUDPSocket();
+
+        // family 协议簇, type 类型, protocol 协议
+        Socket(int family, int type, int protocol = 0);
+
+        virtual ~Socket();
+
+        // 发送超时时间(毫秒), -1 为不超时
+        int64_t getSendTimeout();
+        void setSendTimeout(int64_t v);
+
+        // 接收超时时间(毫秒), -1 为不超时
+        int64_t getRecvTimeout();
+        void setRecvTimeout(int64_t v);
+
+        // 获取sockopt, 对应getsockopt
+        bool getOption(int level, int option, void* result, socklen_t* len);
+
+        template<class T>
+        bool getOption(int level, int option, T& result) {
+            socklen_t length = sizeof(T);
+            return getOption(level, option, &result, &length);
+        }
+
+        // 设置sockopt, 对应setsockopt
+        bool setOption(int level, int option, const void* result, socklen_t len);
+
+        template<class T>
+        bool setOption(int level, int option, const T& value) {
+            return setOption(level, option, &value, sizeof(T));
+        }
+
+        // 接收连接, 成功返回新连接的socket, 失败返回nullptr
+        // 必须先 bind, listen 成功
+        virtual Socket::ptr accept();
+
+        // 用accept4一次取走最多max个已完成握手的连接放入socks, 不挂起
+        // 返回取到的个数, 已经取空时errno为EAGAIN; 一个都没取到并且出错时返回-1
+        int acceptBatch(std::vector<Socket::ptr>& socks, size_t max);
+
+        // 绑定地址
+        virtual bool bind(const Address::ptr addr);
+
+        // 连接地址, timeout_ms 超时时间(毫秒), -1 使用tcp.connect.timeout
+        virtual bool connect(const Address::ptr addr, uint64_t timeout_ms = -1);
+
+        // 用上一次connect的地址重连
+        virtual bool reconnect(uint64_t timeout_ms = -1);
+
+        // 监听socket, 必须先bind成功
+        virtual bool listen(int backlog = SOMAXCONN);
+
+        // 关闭socket, 已经关闭的返回true, ::close失败返回false
+        virtual bool close();
+
+        // 发送数据, 返回值同send: >0 发送的字节数, =0 socket被关闭, <0 出错
+        virtual int send(const void* buffer, size_t length, int flags = 0);
+
+        // 聚合发送, buffers 为iovec数组, length 为数组长度, 一次sendmsg发出
+        virtual int send(const iovec* buffers, size_t length, int flags = 0);
+
+        // 发送数据到指定地址
+        virtual int sendTo(const void* buffer, size_t length, const Address::ptr to, int flags = 0);
+        virtual int sendTo(const iovec* buffers, size_t length, const Address::ptr to, int flags = 0);
+
+        // 接收数据, 返回值同recv: >0 接收的字节数, =0 socket被关闭, <0 出错
+        virtual int recv(void* buffer, size_t length, int flags = 0);
+        virtual int recv(iovec* buffers, size_t length, int flags = 0);
+
+        // 接收数据, from 保存发送端地址
+        virtual int recvFrom(void* buffer, size_t length, Address::ptr from, int flags = 0);
+        virtual int recvFrom(iovec* buffers, size_t length, Address::ptr from, int flags = 0);
+
+        // 批量收发的一个数据报
+        struct Datagram {
+            // 数据缓冲区
+            void* buffer = nullptr;
+            // 发送时为数据长度; 接收时为缓冲区长度, 返回后为收到的长度
+            size_t length = 0;
+            // 发送时为目的地址, 为空则发往connect的地址; 接收时保存来源地址, 需预先创建, 可以为空
+            Address::ptr addr;
+            // 接收返回后的msg_flags, 比如MSG_TRUNC
+            int flags = 0;
+            // 开启GRO时合并包的分段大小, 0 表示没有合并
+            uint16_t segment = 0;
+        };
+
+        // 用一次sendmmsg发送count个数据报, 返回发出的个数, 一个都没发出去时返回-1
+        int sendBatch(Datagram* msgs, size_t count, int flags = 0);
+
+        // 用一次recvmmsg接收最多count个数据报, 至少收到一个才返回
+        // 返回收到的个数, 出错返回-1
+        int recvBatch(Datagram* msgs, size_t count, int flags = 0);
+
+        // UDP GSO: 内核按segment_size把一个大缓冲区切成多个数据报发出, 0 为关闭
+        bool setUdpSegment(uint16_t segment_size);
+
+        // UDP GRO: 内核把同一条流的多个数据报合并成一个交给recv, 分段大小见Datagram::segment
+        bool setUdpGro(bool v);
+        bool isUdpGro() const { return m_udpGro;}
+
+        // 用sendfile把文件内容直接发到socket, 数据不经过用户态
+        // file_fd 文件句柄, offset 起始偏移, length 发送长度
+        // 返回发送的字节数, 一个字节都没发出去时返回-1
+        ssize_t sendFile(int file_fd, off_t offset, size_t length);
+
+        // 经由本线程缓存的管道把fd_in的数据splice到socket, fd_in 可以是文件或管道
+        // off_in 为nullptr时使用fd_in当前的偏移
+        // 返回发送的字节数, 一个字节都没发出去时返回-1
+        ssize_t spliceFrom(int fd_in, loff_t* off_in, size_t length);
+
+        // 开启/关闭MSG_ZEROCOPY发送(SO_ZEROCOPY), 内核不支持时返回false
+        bool setZeroCopy(bool v);
+        bool isZeroCopy() const { return m_zeroCopy;}
+
+        // 零拷贝发送, 返回值同send
+        // 成功后缓冲区在isZeroCopyDone(seq)之前不能修改或释放, seq 为发送前getZeroCopySeq()的值
+        // 没有开启零拷贝时退回普通发送
+        ssize_t sendZeroCopy(const void* buffer, size_t length, int flags = 0);
+        ssize_t sendZeroCopy(const iovec* buffers, size_t length, int flags = 0);
+
+        // 非阻塞地读取错误队列里的零拷贝完成通知, 返回本次完成的发送次数
+        size_t reapZeroCopy();
+
+        // 下一次零拷贝发送的序号
+        uint32_t getZeroCopySeq() const { return m_zcSeq;}
+
+        // 序号为seq的零拷贝发送是否已完成, 缓冲区可以复用
+        bool isZeroCopyDone(uint32_t seq) const { return (int32_t)(m_zcDone - seq) > 0;}
+
+        // 还没完成的零拷贝发送次数
+        uint32_t getZeroCopyPending() const { return m_zcSeq - m_zcDone;}
+
+        // 内核退回成拷贝发送的次数(比如发往本机回环), 比例高时零拷贝没有收益
+        uint64_t getZeroCopyCopied() const { return m_zcCopied;}
+
+        // 远端地址
+        Address::ptr getRemoteAddress();
+
+        // 本地地址
+        Address::ptr getLocalAddress();
+
+        int getFamily() const { return m_family;}
+        int getType() const { return m_type;}
+        int getProtocol() const { return m_protocol;}
+
+        // 是否连接
+        bool isConnected() const { return m_isConnected;}
+
+        // 是否有效(m_sock != -1)
+        bool isValid() const;
+
+        // 返回socket错误(SO_ERROR)
+        int getError();
+
+        // 输出信息到流中
+        virtual std::ostream& dump(std::ostream& os) const;
+
+        virtual std::string toString() const;
+
+        // 返回socket句柄
+        int getSocket() const { return m_sock;}
+
+        // 取消读
+        bool cancelRead();
+
+        // 取消写
+        bool cancelWrite();
+
+        // 取消accept
+        bool cancelAccept();
+
+        // 取消所有事件
+        bool cancelAll();
+    protected:
+        // 初始化socket
+        void initSock();
+
+        // 创建socket
+        void newSock();
+
+        // 用已有的句柄初始化
+        virtual bool init(int sock);
+    protected:
+        // socket句柄
+        int m_sock;
+        // 协议簇
+        int m_family;
+        // 类型
+        int m_type;
+        // 协议
+        int m_protocol;
+        // 是否连接
+        bool m_isConnected;
+        // 是否开启了零拷贝发送
+        bool m_zeroCopy = false;
+        // 下一次零拷贝发送的序号, 和内核的计数保持一致
+        uint32_t m_zcSeq = 0;
+        // 此序号之前的零拷贝发送都已完成
+        uint32_t m_zcDone = 0;
+        // 乱序到达的完成区间 [first, second]
+        std::map<uint32_t, uint32_t> m_zcRanges;
+        // 内核退回拷贝的次数
+        uint64_t m_zcCopied = 0;
+        // 是否开启了UDP GRO
+        bool m_udpGro = false;
+        // 本地地址
+        Address::ptr m_localAddress;
+        // 远端地址
+        Address::ptr m_remoteAddress;
+    };
+
+    // 流式输出socket
+    std::ostream& operator<<(std::ostream& os, const Socket& sock);
+}
 
 #endif //SOCKET_H
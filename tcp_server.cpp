@@ -0,0 +1,435 @@
+//
+// Created by admin on 2025/9/3.
+//
+
+#include "tcp_server.h"
+#include "Config.h"
+#include "log.h"
+#include "metrics.h"
+#include "fd_manager.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace sylar {
+
+    static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+    static ConfigVar<uint32_t>::ptr g_tcp_server_accept_batch =
+        Config::Lookup<uint32_t>("tcp_server.accept_batch", 64, "connections accepted per readiness event");
+
+    static ConfigVar<uint32_t>::ptr g_tcp_server_max_connections =
+        Config::Lookup<uint32_t>("tcp_server.max_connections", 0, "max connections, 0 for unlimited");
+
+    static ConfigVar<uint64_t>::ptr g_tcp_server_write_queue_size =
+        Config::Lookup<uint64_t>("tcp_server.write_queue_size", 4 * 1024 * 1024
+                                 ,"per connection write queue limit(bytes)");
+
+    static ConfigVar<uint64_t>::ptr g_tcp_server_drain_timeout =
+        Config::Lookup<uint64_t>("tcp_server.drain_timeout", 5000
+                                 ,"time to wait for connections on stop before aborting them(ms)");
+
+    // 写协程一次sendmsg最多带的数据块数
+    static const size_t MAX_IOV = 64;
+
+    TcpConnection::TcpConnection(Socket::ptr sock, uint64_t id, size_t max_pending)
+        :m_sock(sock)
+        ,m_id(id)
+        ,m_maxPending(max_pending) {
+    }
+
+    TcpConnection::~TcpConnection() {
+        m_sock->close();
+        if(m_onClose) {
+            m_onClose();
+        }
+    }
+
+    bool TcpConnection::send(std::string data) {
+        if(data.empty()) {
+            return !m_closed;
+        }
+        size_t size = data.size();
+        FiberMutex::Lock lock(m_mutex);
+        m_notFull.wait(m_mutex, [this, size]() {
+            return m_closed || m_closing || m_pendingBytes == 0
+                   || m_pendingBytes + size <= m_maxPending;
+        });
+        if(m_closed || m_closing) {
+            return false;
+        }
+        m_pendingBytes += size;
+        m_queue.push_back(std::move(data));
+        m_notEmpty.notify();
+        return true;
+    }
+
+    bool TcpConnection::send(const void* buffer, size_t length) {
+        return send(std::string((const char*)buffer, length));
+    }
+
+    bool TcpConnection::trySend(std::string data) {
+        FiberMutex::Lock lock(m_mutex);
+        if(m_closed || m_closing) {
+            return false;
+        }
+        if(m_pendingBytes && m_pendingBytes + data.size() > m_maxPending) {
+            return false;
+        }
+        if(data.empty()) {
+            return true;
+        }
+        m_pendingBytes += data.size();
+        m_queue.push_back(std::move(data));
+        m_notEmpty.notify();
+        return true;
+    }
+
+    void TcpConnection::close() {
+        FiberMutex::Lock lock(m_mutex);
+        m_closing = true;
+        m_notEmpty.notify();
+    }
+
+    void TcpConnection::abort() {
+        {
+            FiberMutex::Lock lock(m_mutex);
+            if(m_closed) {
+                return;
+            }
+            m_closed = true;
+            size_t dropped = 0;
+            for(auto& i : m_queue) {
+                dropped += i.size();
+            }
+            m_queue.clear();
+            m_pendingBytes -= dropped;
+            m_notEmpty.notifyAll();
+            m_notFull.notifyAll();
+        }
+        // 挂起在recv/send里的协程由epoll的EPOLLHUP唤醒
+        ::shutdown(m_sock->getSocket(), SHUT_RDWR);
+    }
+
+    void TcpConnection::shutdownRead() {
+        ::shutdown(m_sock->getSocket(), SHUT_RD);
+    }
+
+    void TcpConnection::startWriter(IOManager* iom) {
+        iom->schedule(std::bind(&TcpConnection::writeLoop, shared_from_this()));
+    }
+
+    void TcpConnection::writeLoop() {
+        std::vector<std::string> batch;
+        std::vector<iovec> iovs;
+        batch.reserve(MAX_IOV);
+        iovs.reserve(MAX_IOV);
+        while(true) {
+            {
+                FiberMutex::Lock lock(m_mutex);
+                m_notEmpty.wait(m_mutex, [this]() {
+                    return m_closed || m_closing || !m_queue.empty();
+                });
+                if(m_closed) {
+                    return;
+                }
+                if(m_queue.empty()) {
+                    // close()之前放入的都已经发完
+                    m_closed = true;
+                    m_notFull.notifyAll();
+                    break;
+                }
+                while(!m_queue.empty() && batch.size() < MAX_IOV) {
+                    batch.push_back(std::move(m_queue.front()));
+                    m_queue.pop_front();
+                }
+            }
+
+            size_t bytes = 0;
+            for(auto& i : batch) {
+                iovec iov;
+                iov.iov_base = &i[0];
+                iov.iov_len = i.size();
+                iovs.push_back(iov);
+                bytes += i.size();
+            }
+
+            // 处理部分写, 直到这一批全部发出
+            bool ok = true;
+            iovec* iov = &iovs[0];
+            size_t count = iovs.size();
+            while(count) {
+                int rt = m_sock->send(iov, count, MSG_NOSIGNAL);
+                if(rt <= 0) {
+                    ok = false;
+                    break;
+                }
+                size_t left = rt;
+                while(count && left >= iov->iov_len) {
+                    left -= iov->iov_len;
+                    ++iov;
+                    --count;
+                }
+                if(count) {
+                    iov->iov_base = (char*)iov->iov_base + left;
+                    iov->iov_len -= left;
+                }
+            }
+            iovs.clear();
+            batch.clear();
+
+            {
+                FiberMutex::Lock lock(m_mutex);
+                m_pendingBytes -= bytes;
+                m_notFull.notifyAll();
+            }
+            if(!ok) {
+                SYLAR_LOG_DEBUG(g_logger) << "TcpConnection id=" << m_id << " send errno="
+                                          << errno << " errstr=" << strerror(errno);
+                abort();
+                return;
+            }
+        }
+        ::shutdown(m_sock->getSocket(), SHUT_WR);
+    }
+
+    TcpServer::TcpServer(IOManager* worker, IOManager* accept_worker)
+        :m_worker(worker)
+        ,m_acceptWorker(accept_worker)
+        ,m_maxConnections(g_tcp_server_max_connections->getValue())
+        ,m_maxPending(g_tcp_server_write_queue_size->getValue())
+        ,m_drainTimeout(g_tcp_server_drain_timeout->getValue())
+        ,m_acceptBatch(g_tcp_server_accept_batch->getValue()) {
+        if(m_acceptBatch == 0) {
+            m_acceptBatch = 1;
+        }
+    }
+
+    TcpServer::~TcpServer() {
+        if(m_metricsId) {
+            Metrics::DelCollector(m_metricsId);
+        }
+        m_socks.clear();
+    }
+
+    bool TcpServer::bind(Address::ptr addr) {
+        Socket::ptr sock = Socket::CreateTCP(addr);
+        if(!sock->bind(addr)) {
+            SYLAR_LOG_ERROR(g_logger) << "TcpServer bind fail errno=" << errno
+                                      << " errstr=" << strerror(errno)
+                                      << " addr=[" << addr->toString() << "]";
+            return false;
+        }
+        if(!sock->listen()) {
+            SYLAR_LOG_ERROR(g_logger) << "TcpServer listen fail errno=" << errno
+                                      << " errstr=" << strerror(errno)
+                                      << " addr=[" << addr->toString() << "]";
+            return false;
+        }
+        // acceptBatch直接调用accept4, 监听socket必须是非阻塞的
+        // 在没有hook的线程里bind时socket不在FdMgr里, 是阻塞的, 这里登记一次(FdCtx会设置O_NONBLOCK)
+        FdMgr::GetInstance()->del(sock->getSocket());
+        FdMgr::GetInstance()->get(sock->getSocket(), true);
+        m_socks.push_back(sock);
+        SYLAR_LOG_INFO(g_logger) << "TcpServer " << m_name << " bind success " << *sock;
+        return true;
+    }
+
+    bool TcpServer::bind(const std::vector<Address::ptr>& addrs, std::vector<Address::ptr>& fails) {
+        for(auto& addr : addrs) {
+            if(!bind(addr)) {
+                fails.push_back(addr);
+            }
+        }
+        if(!fails.empty()) {
+            m_socks.clear();
+            return false;
+        }
+        return true;
+    }
+
+    bool TcpServer::start() {
+        if(m_started) {
+            return true;
+        }
+        if(m_socks.empty()) {
+            SYLAR_LOG_ERROR(g_logger) << "TcpServer " << m_name << " start without listen socket";
+            return false;
+        }
+        m_started = true;
+        if(m_maxConnections) {
+            m_slots.reset(new FiberSemaphore(m_maxConnections));
+        }
+        m_metricsId = Metrics::AddCollector([this](MetricsWriter& writer) {
+            std::string labels = "server=\"" + m_name + "\"";
+            writer.gauge("sylar_tcp_connections", "Open TcpServer connections"
+                         ,m_connectionCount, labels);
+            writer.counter("sylar_tcp_accepted_total", "Connections accepted by TcpServer"
+                           ,m_acceptCount, labels);
+        });
+        for(auto& sock : m_socks) {
+            m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), sock));
+        }
+        return true;
+    }
+
+    void TcpServer::startAccept(Socket::ptr sock) {
+        std::vector<Socket::ptr> socks;
+        socks.reserve(m_acceptBatch);
+        while(!m_stopping) {
+            size_t want = m_acceptBatch;
+            if(m_slots) {
+                // 连接数到了上限就在这里等, 新连接留在backlog里
+                m_slots->wait();
+                if(m_stopping) {
+                    break;
+                }
+                want = 1;
+                while(want < m_acceptBatch && m_slots->tryWait()) {
+                    ++want;
+                }
+            }
+
+            int rt = sock->acceptBatch(socks, want);
+            int err = errno;
+            if(m_slots) {
+                for(size_t i = socks.size(); i < want; ++i) {
+                    m_slots->notify();
+                }
+            }
+            for(auto& s : socks) {
+                addConnection(s);
+            }
+            socks.clear();
+
+            if(rt < 0) {
+                if(err == EINVAL || err == EBADF) {
+                    // 监听socket已经被stop()关闭
+                    break;
+                }
+                SYLAR_LOG_ERROR(g_logger) << "TcpServer accept errno=" << err
+                                          << " errstr=" << strerror(err);
+                // EMFILE等资源不足, 等一会儿再取, 避免空转
+                usleep(100 * 1000);
+                continue;
+            }
+            if((size_t)rt < want && !m_stopping) {
+                // 已经取空, 等下一次可读
+                if(m_acceptWorker->addEvent(sock->getSocket(), IOManager::READ)) {
+                    SYLAR_LOG_ERROR(g_logger) << "TcpServer addEvent fail " << *sock;
+                    break;
+                }
+                Fiber::YieldToHold();
+            }
+        }
+        SYLAR_LOG_DEBUG(g_logger) << "TcpServer " << m_name << " accept stopped " << *sock;
+    }
+
+    void TcpServer::addConnection(Socket::ptr sock) {
+        TcpConnection::ptr conn(new TcpConnection(sock, ++m_nextId, m_maxPending));
+        uint64_t id = conn->getId();
+        TcpServer::ptr self = shared_from_this();
+        conn->m_onClose = [self, id]() {
+            self->onConnectionClosed(id);
+        };
+        bool stopping;
+        {
+            Mutex::Lock lock(m_mutex);
+            m_connections[id] = conn;
+            ++m_connectionCount;
+            stopping = m_stopping;
+        }
+        ++m_acceptCount;
+        if(stopping) {
+            // 和stop()并发, stop()遍历时可能没看到这个连接
+            conn->shutdownRead();
+        }
+        m_worker->schedule(std::bind(&TcpServer::runClient, self, conn));
+    }
+
+    void TcpServer::runClient(TcpConnection::ptr conn) {
+        conn->startWriter(m_worker);
+        handleClient(conn);
+        conn->close();
+    }
+
+    void TcpServer::handleClient(TcpConnection::ptr conn) {
+        if(m_handler) {
+            m_handler(conn);
+        }
+    }
+
+    void TcpServer::stop() {
+        if(!m_started || m_stopping.exchange(true)) {
+            return;
+        }
+        // accept协程由EPOLLHUP唤醒, 之后accept返回EINVAL
+        for(auto& sock : m_socks) {
+            ::shutdown(sock->getSocket(), SHUT_RDWR);
+            if(m_slots) {
+                m_slots->notify();
+            }
+        }
+
+        std::vector<TcpConnection::ptr> conns;
+        {
+            Mutex::Lock lock(m_mutex);
+            for(auto& i : m_connections) {
+                TcpConnection::ptr conn = i.second.lock();
+                if(conn) {
+                    conns.push_back(conn);
+                }
+            }
+            if(m_connectionCount && m_drainTimeout) {
+                m_drainTimer = m_worker->addTimer(m_drainTimeout
+                        ,std::bind(&TcpServer::abortAll, shared_from_this()), false);
+            }
+        }
+        SYLAR_LOG_INFO(g_logger) << "TcpServer " << m_name << " stopping, draining "
+                                 << conns.size() << " connections";
+        for(auto& conn : conns) {
+            conn->shutdownRead();
+        }
+    }
+
+    void TcpServer::abortAll() {
+        std::vector<TcpConnection::ptr> conns;
+        {
+            Mutex::Lock lock(m_mutex);
+            m_drainTimer.reset();
+            for(auto& i : m_connections) {
+                TcpConnection::ptr conn = i.second.lock();
+                if(conn) {
+                    conns.push_back(conn);
+                }
+            }
+        }
+        if(!conns.empty()) {
+            SYLAR_LOG_WARN(g_logger) << "TcpServer " << m_name << " drain timeout, abort "
+                                     << conns.size() << " connections";
+        }
+        for(auto& conn : conns) {
+            conn->abort();
+        }
+    }
+
+    void TcpServer::onConnectionClosed(uint64_t id) {
+        Timer::ptr timer;
+        {
+            Mutex::Lock lock(m_mutex);
+            m_connections.erase(id);
+            if(--m_connectionCount == 0 && m_stopping) {
+                // 全部连接都已结束, 不让定时器拖住Scheduler::stop
+                timer.swap(m_drainTimer);
+            }
+        }
+        if(m_slots) {
+            m_slots->notify();
+        }
+        if(timer) {
+            timer->cancel();
+        }
+    }
+}
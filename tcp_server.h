@@ -0,0 +1,192 @@
+//
+// Created by admin on 2025/9/3.
+//
+
+#ifndef TCP_SERVER_H
+#define TCP_SERVER_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include "address.h"
+#include "socket.h"
+#include "iomanager.h"
+#include "fiber_sync.h"
+#include "mutex.h"
+
+namespace sylar {
+
+    // TcpServer接受的一个连接
+    // 读在处理协程里直接调用recv; 写先放进有界的写队列, 由单独的写协程合并成一次sendmsg发出
+    // 写队列超过上限时send挂起调用协程, 直到写协程发出一部分(背压)
+    class TcpConnection : public std::enable_shared_from_this<TcpConnection>
+                        , private boost::noncopyable {
+    friend class TcpServer;
+    public:
+        typedef std::shared_ptr<TcpConnection> ptr;
+        typedef std::weak_ptr<TcpConnection> weak_ptr;
+
+        // max_pending 写队列的字节上限
+        TcpConnection(Socket::ptr sock, uint64_t id, size_t max_pending);
+
+        // 连接的最后一个引用释放时关闭socket
+        ~TcpConnection();
+
+        // 接收数据, 返回值同Socket::recv
+        int recv(void* buffer, size_t length) { return m_sock->recv(buffer, length);}
+
+        // 放入写队列, 队列满时挂起当前协程, 连接已关闭返回false
+        // 单条数据超过上限时, 等队列清空后照样放入
+        bool send(std::string data);
+        bool send(const void* buffer, size_t length);
+
+        // 放入写队列, 队列满或者连接已关闭返回false, 不挂起
+        bool trySend(std::string data);
+
+        // 写队列里的数据发完后关闭写端
+        void close();
+
+        // 立即断开, 丢弃没有发出的数据, 唤醒所有挂起的读写
+        void abort();
+
+        // 关闭读端, 挂起在recv里的协程读到0返回
+        void shutdownRead();
+
+        // 写队列中的字节数(包括正在发送的)
+        size_t getPendingBytes() const { return m_pendingBytes;}
+
+        bool isClosed() const { return m_closed;}
+
+        uint64_t getId() const { return m_id;}
+
+        Socket::ptr getSocket() const { return m_sock;}
+    private:
+        // 写协程, 在iom上运行
+        void startWriter(IOManager* iom);
+
+        void writeLoop();
+    private:
+        Socket::ptr m_sock;
+        uint64_t m_id;
+        size_t m_maxPending;
+        // 保护m_queue, m_closing
+        FiberMutex m_mutex;
+        FiberCondVar m_notEmpty;
+        FiberCondVar m_notFull;
+        std::deque<std::string> m_queue;
+        std::atomic<size_t> m_pendingBytes{0};
+        // 调用了close, 写完就结束
+        bool m_closing = false;
+        // 连接已经断开, 不能再写
+        std::atomic<bool> m_closed{false};
+        // 析构时通知TcpServer
+        std::function<void()> m_onClose;
+    };
+
+    // 基于IOManager的TCP服务器
+    // accept协程运行在acceptWorker上, 每次可读时用accept4一次取走最多tcp_server.accept_batch个连接
+    // 连接的处理协程和写协程运行在worker上
+    // 连接数到达上限时暂停accept, 新连接留在内核的backlog里, 有连接关闭后继续
+    // 停止: stop()之后不再接受新连接, 已有连接关闭读端, 处理协程读到0结束, 写队列发完后关闭
+    //       超过drain_timeout还没结束的连接被强制断开
+    //       stop()不等待, 也不停止worker(worker可能还在运行别的服务); 需要等连接全部结束时,
+    //       由调用者随后调用worker的Scheduler::stop(), 它会等到全部协程和drain定时器结束
+    class TcpServer : public std::enable_shared_from_this<TcpServer>, private boost::noncopyable {
+    public:
+        typedef std::shared_ptr<TcpServer> ptr;
+        // 连接的处理函数, 在worker的协程里调用, 返回后连接在写队列发完后关闭
+        typedef std::function<void(TcpConnection::ptr conn)> Handler;
+
+        // worker 处理连接的IOManager, accept_worker 运行accept协程的IOManager
+        TcpServer(IOManager* worker = IOManager::GetThis()
+                  ,IOManager* accept_worker = IOManager::GetThis());
+
+        virtual ~TcpServer();
+
+        // 绑定并监听地址, 可以调用多次监听多个地址, 必须在start()之前调用
+        bool bind(Address::ptr addr);
+
+        // 绑定多个地址, 失败的地址放入fails
+        bool bind(const std::vector<Address::ptr>& addrs, std::vector<Address::ptr>& fails);
+
+        // 开始accept
+        bool start();
+
+        // 停止accept并开始关闭已有连接, 不等待, 等待由调用者对worker调用stop()
+        void stop();
+
+        void setHandler(Handler handler) { m_handler = std::move(handler);}
+
+        // 最大连接数, 0 为不限制, 必须在start()之前设置
+        void setMaxConnections(uint32_t v) { m_maxConnections = v;}
+        uint32_t getMaxConnections() const { return m_maxConnections;}
+
+        // 每个连接写队列的字节上限
+        void setMaxPendingBytes(size_t v) { m_maxPending = v;}
+        size_t getMaxPendingBytes() const { return m_maxPending;}
+
+        // 停止时等待连接结束的时间(毫秒)
+        void setDrainTimeout(uint64_t v) { m_drainTimeout = v;}
+        uint64_t getDrainTimeout() const { return m_drainTimeout;}
+
+        const std::string& getName() const { return m_name;}
+        void setName(const std::string& v) { m_name = v;}
+
+        // 当前连接数
+        size_t getConnectionCount() const { return m_connectionCount;}
+
+        // 累计接受的连接数
+        uint64_t getAcceptCount() const { return m_acceptCount;}
+
+        bool isStop() const { return !m_started || m_stopping;}
+
+        const std::vector<Socket::ptr>& getSocks() const { return m_socks;}
+    protected:
+        // 处理一个连接, 默认调用setHandler设置的处理函数
+        virtual void handleClient(TcpConnection::ptr conn);
+
+        // 监听socket上的accept协程
+        virtual void startAccept(Socket::ptr sock);
+    private:
+        // 登记新连接并交给worker处理
+        void addConnection(Socket::ptr sock);
+
+        // 连接的处理协程
+        void runClient(TcpConnection::ptr conn);
+
+        // 连接析构时调用
+        void onConnectionClosed(uint64_t id);
+
+        // drain_timeout到了, 断开剩余的连接
+        void abortAll();
+    private:
+        std::vector<Socket::ptr> m_socks;
+        IOManager* m_worker;
+        IOManager* m_acceptWorker;
+        Handler m_handler;
+        std::string m_name = "sylar/1.0.0";
+        uint32_t m_maxConnections;
+        size_t m_maxPending;
+        uint64_t m_drainTimeout;
+        size_t m_acceptBatch;
+        // 剩余的连接名额, 只在限制连接数时创建
+        std::unique_ptr<FiberSemaphore> m_slots;
+        std::atomic<size_t> m_connectionCount{0};
+        std::atomic<uint64_t> m_acceptCount{0};
+        std::atomic<uint64_t> m_nextId{0};
+        std::atomic<bool> m_started{false};
+        std::atomic<bool> m_stopping{false};
+        uint64_t m_metricsId = 0;
+        // 保护m_connections, m_drainTimer
+        Mutex m_mutex;
+        std::unordered_map<uint64_t, TcpConnection::weak_ptr> m_connections;
+        Timer::ptr m_drainTimer;
+    };
+}
+
+#endif //TCP_SERVER_H
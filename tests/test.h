@@ -0,0 +1,20 @@
+//
+// Created by admin on 2025/9/5.
+//
+
+#ifndef SYLAR_TEST_H
+#define SYLAR_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// 测试用的断言, 不受NDEBUG影响, 失败时打印位置和表达式后abort, ctest据此判定失败
+#define CHECK(x) \
+    do { \
+        if(!(x)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); \
+            abort(); \
+        } \
+    } while(0)
+
+#endif //SYLAR_TEST_H
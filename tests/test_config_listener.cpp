@@ -0,0 +1,93 @@
+//
+// Created by admin on 2025/9/5.
+//
+
+#include "test.h"
+#include "Config.h"
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    // 多个线程并发写, 回调按发布顺序一个一个执行, 每次的old都是上一次的new
+    void test_concurrent_order() {
+        const int THREADS = 4;
+        const int LOOPS = 20000;
+        sylar::ConfigVar<int>::ptr var =
+            sylar::Config::Lookup<int>("test.listener.order", 0, "");
+        int last = 0;
+        int calls = 0;
+        bool broken = false;
+        bool inside = false;
+        var->addListener([&](const int& old_value, const int& new_value) {
+            if(inside || old_value != last) {
+                broken = true;
+            }
+            inside = true;
+            last = new_value;
+            ++calls;
+            inside = false;
+        });
+
+        std::vector<std::thread> threads;
+        for(int i = 0; i < THREADS; ++i) {
+            threads.emplace_back([=]() {
+                // 相邻两次写的值不同, 每次都是一次变更
+                for(int j = 0; j < LOOPS; ++j) {
+                    var->setValue(i * LOOPS + j + 1);
+                }
+            });
+        }
+        for(auto& t : threads) {
+            t.join();
+        }
+        CHECK(!broken);
+        CHECK(last == var->getValue());
+        CHECK(calls > 0);
+    }
+
+    // 回调里写同一个配置不会死锁, 新的变更等当前回调返回后再通知
+    void test_reentrant() {
+        sylar::ConfigVar<std::string>::ptr var =
+            sylar::Config::Lookup<std::string>("test.listener.reentrant", "a", "");
+        std::vector<std::string> seen;
+        var->addListener([&](const std::string& old_value, const std::string& new_value) {
+            seen.push_back(old_value + ">" + new_value);
+            if(new_value == "b") {
+                CHECK(var->getValue() == "b");
+                var->setValue("c");
+                CHECK(seen.size() == 1);
+            }
+        });
+        var->setValue("b");
+        CHECK(var->getValue() == "c");
+        CHECK(seen == (std::vector<std::string>{"a>b", "b>c"}));
+    }
+
+    // 回调抛出异常后, 之后的变更照常通知
+    void test_throwing_listener() {
+        sylar::ConfigVar<int>::ptr var =
+            sylar::Config::Lookup<int>("test.listener.throw", 0, "");
+        int calls = 0;
+        var->addListener([&](const int& old_value, const int& new_value) {
+            ++calls;
+            if(new_value == 1) {
+                throw std::runtime_error("listener failed");
+            }
+        });
+        var->setValue(1);
+        var->setValue(2);
+        CHECK(calls == 2);
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_ROOT()->setLevel(sylar::LogLevel::FATAL);
+    test_concurrent_order();
+    test_reentrant();
+    test_throwing_listener();
+    printf("test_config_listener ok\n");
+    return 0;
+}
@@ -0,0 +1,168 @@
+//
+// Created by admin on 2025/9/5.
+//
+
+#include "test.h"
+#include "Config.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+    sylar::ConfigVar<int>::ptr g_int =
+        sylar::Config::Lookup<int>("test.snapshot.int", 1, "");
+    sylar::ConfigVar<double>::ptr g_double =
+        sylar::Config::Lookup<double>("test.snapshot.double", 1.5, "");
+    sylar::ConfigVar<bool>::ptr g_bool =
+        sylar::Config::Lookup<bool>("test.snapshot.bool", false, "");
+    sylar::ConfigVar<std::string>::ptr g_string =
+        sylar::Config::Lookup<std::string>("test.snapshot.string", "default", "");
+    sylar::ConfigVar<std::vector<int> >::ptr g_vec =
+        sylar::Config::Lookup<std::vector<int> >("test.snapshot.vec", std::vector<int>{1, 2}, "");
+    sylar::ConfigVar<std::list<std::string> >::ptr g_list =
+        sylar::Config::Lookup<std::list<std::string> >("test.snapshot.list", std::list<std::string>(), "");
+    sylar::ConfigVar<std::set<double> >::ptr g_set =
+        sylar::Config::Lookup<std::set<double> >("test.snapshot.set", std::set<double>(), "");
+    sylar::ConfigVar<std::map<std::string, std::vector<int> > >::ptr g_map =
+        sylar::Config::Lookup<std::map<std::string, std::vector<int> > >("test.snapshot.map"
+                ,std::map<std::string, std::vector<int> >(), "");
+    sylar::ConfigVar<std::unordered_map<std::string, std::string> >::ptr g_umap =
+        sylar::Config::Lookup<std::unordered_map<std::string, std::string> >("test.snapshot.umap"
+                ,std::unordered_map<std::string, std::string>(), "");
+
+    std::string SnapshotPath() {
+        return "/tmp/test_config_snapshot." + std::to_string(getpid()) + ".bin";
+    }
+
+    void set_values() {
+        g_int->setValue(42);
+        g_double->setValue(3.25);
+        g_bool->setValue(true);
+        // 带0字节的字符串也要原样保存
+        g_string->setValue(std::string("hello\0world", 11));
+        g_vec->setValue(std::vector<int>{7, 8, 9});
+        g_list->setValue(std::list<std::string>{"a", "", std::string("b\0c", 3)});
+        g_set->setValue(std::set<double>{0.5, -1.25});
+        g_map->setValue(std::map<std::string, std::vector<int> >{{"x", {1}}, {"y", {}}});
+        g_umap->setValue(std::unordered_map<std::string, std::string>{{"k", "v"}, {"", "empty"}});
+    }
+
+    void reset_values() {
+        g_int->setValue(0);
+        g_double->setValue(0);
+        g_bool->setValue(false);
+        g_string->setValue("");
+        g_vec->setValue(std::vector<int>());
+        g_list->setValue(std::list<std::string>());
+        g_set->setValue(std::set<double>());
+        g_map->setValue(std::map<std::string, std::vector<int> >());
+        g_umap->setValue(std::unordered_map<std::string, std::string>());
+    }
+
+    void check_values() {
+        CHECK(g_int->getValue() == 42);
+        CHECK(g_double->getValue() == 3.25);
+        CHECK(g_bool->getValue() == true);
+        CHECK(g_string->getValue() == std::string("hello\0world", 11));
+        CHECK(g_vec->getValue() == (std::vector<int>{7, 8, 9}));
+        CHECK(g_list->getValue() == (std::list<std::string>{"a", "", std::string("b\0c", 3)}));
+        CHECK(g_set->getValue() == (std::set<double>{0.5, -1.25}));
+        CHECK(g_map->getValue() == (std::map<std::string, std::vector<int> >{{"x", {1}}, {"y", {}}}));
+        CHECK(g_umap->getValue()
+                == (std::unordered_map<std::string, std::string>{{"k", "v"}, {"", "empty"}}));
+    }
+
+    // 容器按二进制编码保存, 元素递归编码; 尾部多余或缺少字节都拒绝
+    void test_container_binary() {
+        set_values();
+        std::string out;
+        CHECK(g_map->toBinary(out));
+        std::string good = out;
+        g_map->setValue(std::map<std::string, std::vector<int> >());
+        CHECK(!g_map->fromBinary(good.data(), good.size() - 1, true));
+        std::string longer = good + "x";
+        CHECK(!g_map->fromBinary(longer.data(), longer.size(), true));
+        CHECK(g_map->getValue().empty());
+        CHECK(g_map->fromBinary(good.data(), good.size(), true));
+        CHECK(g_map->getValue() == (std::map<std::string, std::vector<int> >{{"x", {1}}, {"y", {}}}));
+
+        // 旧快照里的容器是YAML String, 仍然可以加载
+        std::string yaml = g_vec->toString();
+        g_vec->setValue(std::vector<int>());
+        CHECK(g_vec->fromBinary(yaml.data(), yaml.size(), false));
+        CHECK(g_vec->getValue() == (std::vector<int>{7, 8, 9}));
+    }
+
+    // 保存之后改掉, 加载回来的值和保存时一致, 并且触发变更回调
+    void test_roundtrip(const std::string& path) {
+        set_values();
+        CHECK(sylar::Config::SaveSnapshot(path));
+        reset_values();
+
+        int calls = 0;
+        uint64_t id = g_int->addListener([&](const int& old_value, const int& new_value) {
+            CHECK(old_value == 0);
+            CHECK(new_value == 42);
+            ++calls;
+        });
+        CHECK(sylar::Config::LoadSnapshot(path));
+        check_values();
+        CHECK(calls == 1);
+
+        // 内容没变的参数第二次加载直接跳过, 不再触发回调
+        CHECK(sylar::Config::LoadSnapshot(path));
+        CHECK(calls == 1);
+        g_int->delListener(id);
+
+        // 加载后又被setValue改过, 再加载要恢复
+        g_int->setValue(5);
+        CHECK(sylar::Config::LoadSnapshot(path));
+        CHECK(g_int->getValue() == 42);
+    }
+
+    // 文件不存在, 头部不对, 截断都返回false
+    void test_bad_file(const std::string& path) {
+        CHECK(!sylar::Config::LoadSnapshot(path + ".missing"));
+
+        std::string bad = path + ".bad";
+        FILE* fp = fopen(bad.c_str(), "wb");
+        CHECK(fp);
+        fwrite("not a snapshot file", 1, 19, fp);
+        fclose(fp);
+        CHECK(!sylar::Config::LoadSnapshot(bad));
+
+        // 只保留文件的前一部分
+        fp = fopen(path.c_str(), "rb");
+        CHECK(fp);
+        std::string data;
+        char buf[4096];
+        size_t n;
+        while((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+            data.append(buf, n);
+        }
+        fclose(fp);
+        CHECK(data.size() > 32);
+        fp = fopen(bad.c_str(), "wb");
+        CHECK(fp);
+        fwrite(data.data(), 1, data.size() - 3, fp);
+        fclose(fp);
+        CHECK(!sylar::Config::LoadSnapshot(bad));
+        unlink(bad.c_str());
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string path = SnapshotPath();
+    test_roundtrip(path);
+    test_container_binary();
+    test_bad_file(path);
+    unlink(path.c_str());
+    printf("test_config_snapshot ok\n");
+    return 0;
+}
@@ -0,0 +1,209 @@
+//
+// Created by admin on 2025/9/5.
+//
+
+#include "test.h"
+#include "dns.h"
+#include "iomanager.h"
+#include "Config.h"
+#include "log.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+    // 本地的假DNS服务器, 只认识下面几个名字, 其余回NXDOMAIN
+    // www.sylar.test   A 10.1.2.3
+    // slow.sylar.test  A 10.4.5.6, 100毫秒后才回复
+    class FakeDnsServer {
+    public:
+        FakeDnsServer() {
+            m_fd = socket(AF_INET, SOCK_DGRAM, 0);
+            CHECK(m_fd >= 0);
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            CHECK(bind(m_fd, (sockaddr*)&addr, sizeof(addr)) == 0);
+            socklen_t len = sizeof(addr);
+            CHECK(getsockname(m_fd, (sockaddr*)&addr, &len) == 0);
+            m_port = ntohs(addr.sin_port);
+            m_thread = std::thread(&FakeDnsServer::run, this);
+        }
+
+        ~FakeDnsServer() {
+            ::shutdown(m_fd, SHUT_RDWR);
+            close(m_fd);
+            m_thread.join();
+        }
+
+        uint16_t getPort() const { return m_port;}
+
+        int getQueries(const std::string& name) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_queries[name];
+        }
+    private:
+        void run() {
+            uint8_t buf[512];
+            while(true) {
+                sockaddr_in from;
+                socklen_t len = sizeof(from);
+                int n = recvfrom(m_fd, buf, sizeof(buf), 0, (sockaddr*)&from, &len);
+                if(n <= 12) {
+                    return;
+                }
+                // 问题里的名字
+                std::string name;
+                int p = 12;
+                while(p < n && buf[p]) {
+                    if(!name.empty()) {
+                        name += '.';
+                    }
+                    name.append((char*)buf + p + 1, buf[p]);
+                    p += buf[p] + 1;
+                }
+                p += 5;
+                if(p > n) {
+                    continue;
+                }
+                uint16_t qtype = buf[p - 4] << 8 | buf[p - 3];
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    ++m_queries[name];
+                }
+
+                const uint8_t* ip = nullptr;
+                static const uint8_t WWW[4] = {10, 1, 2, 3};
+                static const uint8_t SLOW[4] = {10, 4, 5, 6};
+                bool known = false;
+                if(name == "www.sylar.test") {
+                    known = true;
+                    ip = WWW;
+                } else if(name == "slow.sylar.test") {
+                    known = true;
+                    ip = SLOW;
+                    usleep(100 * 1000);
+                }
+                // 只有A记录, AAAA回NOERROR但没有答案
+                if(qtype != 1) {
+                    ip = nullptr;
+                }
+
+                uint8_t out[512];
+                memcpy(out, buf, p);
+                out[2] = 0x81;
+                out[3] = known ? 0x80 : 0x83;
+                out[6] = 0;
+                out[7] = ip ? 1 : 0;
+                out[8] = out[9] = out[10] = out[11] = 0;
+                int q = p;
+                if(ip) {
+                    const uint8_t ans[] = {0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4,
+                                           ip[0], ip[1], ip[2], ip[3]};
+                    memcpy(out + q, ans, sizeof(ans));
+                    q += sizeof(ans);
+                }
+                sendto(m_fd, out, q, 0, (sockaddr*)&from, len);
+            }
+        }
+    private:
+        int m_fd = -1;
+        uint16_t m_port = 0;
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::map<std::string, int> m_queries;
+    };
+
+    // 命中和否定结果都按TTL缓存, 第二次不再发查询
+    void test_cache(sylar::DnsResolver& resolver, FakeDnsServer& server) {
+        std::vector<sylar::IPAddress::ptr> result;
+        CHECK(resolver.resolve(result, "www.sylar.test"));
+        CHECK(result.size() == 1);
+        CHECK(result[0]->toString() == "10.1.2.3:0");
+        CHECK(server.getQueries("www.sylar.test") == 1);
+
+        result.clear();
+        CHECK(resolver.resolve(result, "WWW.sylar.test."));
+        CHECK(result.size() == 1);
+        CHECK(server.getQueries("www.sylar.test") == 1);
+
+        result.clear();
+        CHECK(!resolver.resolve(result, "nx.sylar.test"));
+        CHECK(!resolver.resolve(result, "nx.sylar.test"));
+        CHECK(result.empty());
+        CHECK(server.getQueries("nx.sylar.test") == 1);
+
+        resolver.clear();
+        CHECK(resolver.resolve(result, "www.sylar.test"));
+        CHECK(server.getQueries("www.sylar.test") == 2);
+    }
+
+    // 同一个域名的并发查询只发一次, 其余协程等第一个的结果
+    void test_coalesce(sylar::IOManager& iom, sylar::DnsResolver& resolver, FakeDnsServer& server) {
+        const int FIBERS = 8;
+        std::atomic<int> ok{0};
+        sylar::FiberSemaphore done;
+        for(int i = 0; i < FIBERS; ++i) {
+            iom.schedule([&]() {
+                std::vector<sylar::IPAddress::ptr> result;
+                if(resolver.resolve(result, "slow.sylar.test")
+                        && result.size() == 1
+                        && result[0]->toString() == "10.4.5.6:0") {
+                    ++ok;
+                }
+                done.notify();
+            });
+        }
+        for(int i = 0; i < FIBERS; ++i) {
+            done.wait();
+        }
+        CHECK(ok == FIBERS);
+        CHECK(server.getQueries("slow.sylar.test") == 1);
+    }
+
+    // Address::Lookup用的入口: 端口, 数字地址和服务名
+    void test_lookup(sylar::DnsResolver& resolver) {
+        std::vector<sylar::Address::ptr> result;
+        CHECK(resolver.lookup(result, "www.sylar.test.", "8080", AF_INET) == 1);
+        CHECK(result.size() == 1);
+        CHECK(result[0]->toString() == "10.1.2.3:8080");
+
+        result.clear();
+        CHECK(resolver.lookup(result, "nx.sylar.test.", "80", AF_INET) == 0);
+        // 数字地址和服务名交给getaddrinfo
+        CHECK(resolver.lookup(result, "127.0.0.1", "80", AF_INET) == -1);
+        CHECK(resolver.lookup(result, "www.sylar.test.", "http", AF_INET) == -1);
+        CHECK(result.empty());
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    FakeDnsServer server;
+    sylar::Config::Lookup<std::vector<std::string> >("dns.servers")
+        ->setValue({"127.0.0.1:" + std::to_string(server.getPort())});
+
+    sylar::DnsResolver resolver;
+    // 不在协程里不适用
+    std::vector<sylar::Address::ptr> addrs;
+    CHECK(resolver.lookup(addrs, "www.sylar.test.", "80", AF_INET) == -1);
+
+    sylar::IOManager iom(2, false, "dns");
+    sylar::Semaphore done;
+    iom.schedule([&]() {
+        test_cache(resolver, server);
+        test_coalesce(iom, resolver, server);
+        test_lookup(resolver);
+        done.notify();
+    });
+    done.wait();
+    iom.stop();
+    printf("test_dns ok\n");
+    return 0;
+}
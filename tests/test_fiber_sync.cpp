@@ -0,0 +1,250 @@
+//
+// Created by admin on 2025/9/5.
+//
+
+#include "test.h"
+#include "fiber_sync.h"
+#include "iomanager.h"
+#include "hook.h"
+#include "log.h"
+#include "metrics.h"
+#include <atomic>
+
+namespace {
+
+    // 唤醒延迟上限(微秒), 丢唤醒时要等到epoll_wait超时(3秒)
+    const uint64_t MAX_WAKE_US = 100 * 1000;
+    const int ROUNDS = 50;
+
+    // 持有方和等待方在两个IOManager的线程上, 解锁/通知一定是跨线程的
+    // 持有方拿着锁sleep, 等待方所在的线程这时已经睡在epoll_wait里, 解锁后看等待方多久恢复
+    void test_cross_thread_unlock(sylar::IOManager& waiter_iom, sylar::IOManager& holder_iom) {
+        sylar::FiberMutex mutex;
+        std::atomic<int> round{-1};
+        std::atomic<uint64_t> unlock_us{0};
+        uint64_t worst = 0;
+        uint64_t total = 0;
+        sylar::Semaphore done;
+
+        holder_iom.schedule([&]() {
+            for(int i = 0; i < ROUNDS; ++i) {
+                mutex.lock();
+                round = i;
+                usleep(2000);
+                unlock_us = sylar::Metrics::NowNs() / 1000;
+                mutex.unlock();
+                // 等等待方拿到锁再进入下一轮
+                while(round != -1) {
+                    usleep(100);
+                }
+            }
+            done.notify();
+        });
+        waiter_iom.schedule([&]() {
+            for(int i = 0; i < ROUNDS; ++i) {
+                while(round != i) {
+                    usleep(100);
+                }
+                mutex.lock();
+                uint64_t us = sylar::Metrics::NowNs() / 1000 - unlock_us;
+                mutex.unlock();
+                worst = std::max(worst, us);
+                total += us;
+                round = -1;
+            }
+            done.notify();
+        });
+        // 两边都结束后才能离开, 它们还在用这里的局部变量
+        done.wait();
+        done.wait();
+        printf("cross thread unlock: avg %lu us, worst %lu us\n", total / ROUNDS, worst);
+        CHECK(worst < MAX_WAKE_US);
+    }
+
+    void test_cross_thread_notify(sylar::IOManager& waiter_iom, sylar::IOManager& holder_iom) {
+        sylar::FiberMutex mutex;
+        sylar::FiberCondVar cond;
+        std::atomic<int> round{-1};
+        std::atomic<bool> waiting{false};
+        int ready = -1;
+        uint64_t notify_us = 0;
+        uint64_t worst = 0;
+        uint64_t total = 0;
+        sylar::Semaphore done;
+
+        waiter_iom.schedule([&]() {
+            for(int i = 0; i < ROUNDS; ++i) {
+                sylar::FiberMutex::Lock lock(mutex);
+                round = i;
+                waiting = true;
+                cond.wait(mutex, [&]() { return ready == i;});
+                uint64_t us = sylar::Metrics::NowNs() / 1000 - notify_us;
+                worst = std::max(worst, us);
+                total += us;
+            }
+            done.notify();
+        });
+        holder_iom.schedule([&]() {
+            for(int i = 0; i < ROUNDS; ++i) {
+                while(round != i || !waiting) {
+                    usleep(100);
+                }
+                waiting = false;
+                // 让等待方所在的线程睡进epoll_wait
+                usleep(2000);
+                sylar::FiberMutex::Lock lock(mutex);
+                ready = i;
+                notify_us = sylar::Metrics::NowNs() / 1000;
+                cond.notify();
+            }
+            done.notify();
+        });
+        // 两边都结束后才能离开, 它们还在用这里的局部变量
+        done.wait();
+        done.wait();
+        printf("cross thread notify: avg %lu us, worst %lu us\n", total / ROUNDS, worst);
+        CHECK(worst < MAX_WAKE_US);
+    }
+
+    // 多个线程上的协程争一把锁, 临界区里让出执行权, 任何时刻只能有一个在里面
+    void test_mutex_exclusion(sylar::IOManager& iom) {
+        const int FIBERS = 8;
+        const int LOOPS = 200;
+        sylar::FiberMutex mutex;
+        std::atomic<int> inside{0};
+        std::atomic<bool> overlap{false};
+        int counter = 0;
+        sylar::Semaphore done;
+
+        for(int i = 0; i < FIBERS; ++i) {
+            iom.schedule([&]() {
+                for(int j = 0; j < LOOPS; ++j) {
+                    sylar::FiberMutex::Lock lock(mutex);
+                    if(++inside != 1) {
+                        overlap = true;
+                    }
+                    ++counter;
+                    if(j % 16 == 0) {
+                        sylar::Fiber::YieldToReady();
+                    }
+                    --inside;
+                }
+                done.notify();
+            });
+        }
+        for(int i = 0; i < FIBERS; ++i) {
+            done.wait();
+        }
+        CHECK(!overlap);
+        CHECK(counter == FIBERS * LOOPS);
+        CHECK(mutex.tryLock());
+        mutex.unlock();
+    }
+
+    // 信号量限制同时持有的数量, 挂起的协程在notify后继续
+    void test_semaphore(sylar::IOManager& iom) {
+        const int FIBERS = 6;
+        sylar::FiberSemaphore sem(2);
+        std::atomic<int> holders{0};
+        std::atomic<int> max_holders{0};
+        sylar::Semaphore done;
+
+        for(int i = 0; i < FIBERS; ++i) {
+            iom.schedule([&]() {
+                sem.wait();
+                int n = ++holders;
+                int old = max_holders;
+                while(n > old && !max_holders.compare_exchange_weak(old, n)) {
+                }
+                usleep(2000);
+                --holders;
+                sem.notify();
+                done.notify();
+            });
+        }
+        for(int i = 0; i < FIBERS; ++i) {
+            done.wait();
+        }
+        CHECK(max_holders <= 2);
+        CHECK(max_holders >= 1);
+        CHECK(sem.tryWait());
+        CHECK(sem.tryWait());
+        CHECK(!sem.tryWait());
+        sem.notify();
+        sem.notify();
+    }
+
+    // 两个生产者两个消费者, 通道容量很小, 满和空都会挂起; 关闭后消费者取完剩余的数据再退出
+    void test_channel(sylar::IOManager& iom) {
+        const int PER_PRODUCER = 1000;
+        sylar::Channel<int> chan(4);
+        std::atomic<int> producers{2};
+        std::atomic<long> sum{0};
+        std::atomic<int> popped{0};
+        sylar::Semaphore done;
+
+        for(int p = 0; p < 2; ++p) {
+            iom.schedule([&, p]() {
+                for(int i = 1; i <= PER_PRODUCER; ++i) {
+                    CHECK(chan.push(p * PER_PRODUCER + i));
+                }
+                if(--producers == 0) {
+                    chan.close();
+                }
+                done.notify();
+            });
+        }
+        for(int c = 0; c < 2; ++c) {
+            iom.schedule([&]() {
+                int v = 0;
+                while(chan.pop(v)) {
+                    sum += v;
+                    ++popped;
+                }
+                done.notify();
+            });
+        }
+        for(int i = 0; i < 4; ++i) {
+            done.wait();
+        }
+        long n = 2 * PER_PRODUCER;
+        CHECK(popped == n);
+        CHECK(sum == n * (n + 1) / 2);
+        CHECK(chan.isClosed());
+        CHECK(!chan.push(1));
+        CHECK(!chan.tryPush(1));
+
+        // 不挂起的版本
+        sylar::Channel<int> small(2);
+        CHECK(small.getCapacity() == 2);
+        CHECK(small.tryPush(1));
+        CHECK(small.tryPush(2));
+        CHECK(!small.tryPush(3));
+        CHECK(small.size() == 2);
+        int v = 0;
+        CHECK(small.tryPop(v) && v == 1);
+        small.close();
+        // 关闭后剩下的数据照样能取出
+        CHECK(small.tryPop(v) && v == 2);
+        CHECK(!small.tryPop(v));
+    }
+}
+
+int main(int argc, char** argv) {
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    // 等待方用两个线程, 唤醒到另一个线程上没有用, 必须叫醒挂起时所在的线程
+    sylar::IOManager waiter_iom(2, false, "waiter");
+    sylar::IOManager holder_iom(1, false, "holder");
+
+    test_cross_thread_unlock(waiter_iom, holder_iom);
+    test_cross_thread_notify(waiter_iom, holder_iom);
+    test_mutex_exclusion(waiter_iom);
+    test_semaphore(waiter_iom);
+    test_channel(waiter_iom);
+
+    holder_iom.stop();
+    waiter_iom.stop();
+    printf("test_fiber_sync ok\n");
+    return 0;
+}
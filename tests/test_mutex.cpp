@@ -0,0 +1,106 @@
+//
+// Created by admin on 2025/9/5.
+//
+
+#include "test.h"
+#include "mutex.h"
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    // 多个线程争一把锁, 自旋次数很小时大部分竞争都会进futex休眠
+    void test_exclusion(uint32_t spin) {
+        const int THREADS = 4;
+        const int LOOPS = 100000;
+        sylar::AdaptiveMutex mutex;
+        mutex.setSpin(spin);
+        CHECK(mutex.getSpin() == spin);
+        long counter = 0;
+        std::atomic<int> inside{0};
+        std::atomic<bool> overlap{false};
+
+        std::vector<std::thread> threads;
+        for(int i = 0; i < THREADS; ++i) {
+            threads.emplace_back([&]() {
+                for(int j = 0; j < LOOPS; ++j) {
+                    sylar::AdaptiveMutex::Lock lock(mutex);
+                    if(++inside != 1) {
+                        overlap = true;
+                    }
+                    ++counter;
+                    --inside;
+                }
+            });
+        }
+        for(auto& t : threads) {
+            t.join();
+        }
+        CHECK(!overlap);
+        CHECK(counter == (long)THREADS * LOOPS);
+    }
+
+    void test_try_lock() {
+        sylar::AdaptiveMutex mutex;
+        CHECK(mutex.tryLock());
+        CHECK(!mutex.tryLock());
+        bool got = true;
+        std::thread t([&]() { got = mutex.tryLock();});
+        t.join();
+        CHECK(!got);
+        mutex.unlock();
+        CHECK(mutex.tryLock());
+        mutex.unlock();
+    }
+
+    // 打开统计后每次获取都记一次, 关闭后不再记录
+    void test_stats() {
+        sylar::MutexStats stats;
+        sylar::AdaptiveMutex mutex;
+        mutex.setStats(&stats);
+
+        sylar::MutexStats::SetEnabled(true);
+        for(int i = 0; i < 10; ++i) {
+            sylar::AdaptiveMutex::Lock lock(mutex);
+        }
+        CHECK(stats.getAcquires() == 10);
+        CHECK(stats.getContended() == 0);
+
+        // 持有锁时另一个线程来拿, 一定是有竞争的获取
+        mutex.lock();
+        std::thread t([&]() {
+            sylar::AdaptiveMutex::Lock lock(mutex);
+        });
+        usleep(20 * 1000);
+        mutex.unlock();
+        t.join();
+        CHECK(stats.getAcquires() == 12);
+        CHECK(stats.getContended() == 1);
+        CHECK(stats.getWaitNs() > 0);
+        uint64_t buckets = 0;
+        for(size_t i = 0; i < sylar::MutexStats::BUCKETS; ++i) {
+            buckets += stats.getBucket(i);
+        }
+        CHECK(buckets == stats.getContended());
+
+        sylar::MutexStats::SetEnabled(false);
+        {
+            sylar::AdaptiveMutex::Lock lock(mutex);
+        }
+        CHECK(stats.getAcquires() == 12);
+
+        stats.reset();
+        CHECK(stats.getAcquires() == 0);
+    }
+}
+
+int main(int argc, char** argv) {
+    test_exclusion(0);
+    test_exclusion(100);
+    test_try_lock();
+    test_stats();
+    printf("test_mutex ok\n");
+    return 0;
+}
@@ -0,0 +1,166 @@
+//
+// Created by admin on 2025/9/5.
+//
+
+#include "test.h"
+#include "tcp_server.h"
+#include "log.h"
+#include <errno.h>
+#include <atomic>
+
+namespace {
+
+    // 回显, 直到对端关闭
+    void EchoHandler(sylar::TcpConnection::ptr conn) {
+        char buf[4096];
+        while(true) {
+            int rt = conn->recv(buf, sizeof(buf));
+            if(rt <= 0 || !conn->send(buf, rt)) {
+                break;
+            }
+        }
+    }
+
+    // 发一条消息, 收到同样长度的回显返回true
+    bool EchoOnce(sylar::Socket::ptr sock, const std::string& msg) {
+        if(sock->send(msg.data(), msg.size()) != (int)msg.size()) {
+            return false;
+        }
+        std::string got(msg.size(), '\0');
+        size_t n = 0;
+        while(n < got.size()) {
+            int rt = sock->recv(&got[n], got.size() - n);
+            if(rt <= 0) {
+                return false;
+            }
+            n += rt;
+        }
+        return got == msg;
+    }
+
+    sylar::Socket::ptr Connect(sylar::Address::ptr addr) {
+        sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+        CHECK(sock->connect(addr, 2000));
+        return sock;
+    }
+
+    sylar::TcpServer::ptr StartServer(sylar::IOManager& iom, sylar::IOManager& accept_iom
+                                      ,uint32_t max_connections, sylar::Address::ptr& addr) {
+        sylar::TcpServer::ptr server(new sylar::TcpServer(&iom, &accept_iom));
+        server->setHandler(EchoHandler);
+        server->setMaxConnections(max_connections);
+        // 在没有hook的主线程里bind, 监听socket也要能被accept协程非阻塞地使用
+        CHECK(server->bind(sylar::IPv4Address::Create("127.0.0.1", 0)));
+        CHECK(server->start());
+        addr = server->getSocks()[0]->getLocalAddress();
+        return server;
+    }
+
+    // 多个连接同时回显, 写队列合并发出的数据不丢不乱
+    void test_echo(sylar::IOManager& iom, sylar::IOManager& accept_iom) {
+        const int CLIENTS = 4;
+        const int ROUNDS = 200;
+        sylar::Address::ptr addr;
+        sylar::TcpServer::ptr server = StartServer(iom, accept_iom, 0, addr);
+
+        std::atomic<int> ok{0};
+        sylar::Semaphore done;
+        for(int c = 0; c < CLIENTS; ++c) {
+            iom.schedule([&, c]() {
+                sylar::Socket::ptr sock = Connect(addr);
+                bool good = true;
+                for(int i = 0; i < ROUNDS && good; ++i) {
+                    good = EchoOnce(sock, "client " + std::to_string(c) + " round " + std::to_string(i));
+                }
+                if(good) {
+                    ++ok;
+                }
+                sock->close();
+                done.notify();
+            });
+        }
+        for(int c = 0; c < CLIENTS; ++c) {
+            done.wait();
+        }
+        CHECK(ok == CLIENTS);
+        CHECK(server->getAcceptCount() == CLIENTS);
+        server->stop();
+    }
+
+    // 连接数到上限后新连接留在backlog里, 有连接关闭后才被接受
+    void test_max_connections(sylar::IOManager& iom, sylar::IOManager& accept_iom) {
+        sylar::Address::ptr addr;
+        sylar::TcpServer::ptr server = StartServer(iom, accept_iom, 1, addr);
+
+        sylar::Semaphore done;
+        iom.schedule([&]() {
+            sylar::Socket::ptr first = Connect(addr);
+            CHECK(EchoOnce(first, "first"));
+
+            // 内核完成了握手, 但服务器还没有accept, 收不到回显
+            sylar::Socket::ptr second = Connect(addr);
+            CHECK(second->send("second", 6) == 6);
+            second->setRecvTimeout(200);
+            char buf[16];
+            CHECK(second->recv(buf, sizeof(buf)) < 0);
+            CHECK(server->getConnectionCount() == 1);
+
+            first->close();
+            second->setRecvTimeout(2000);
+            int rt = second->recv(buf, sizeof(buf));
+            CHECK(rt == 6 && memcmp(buf, "second", 6) == 0);
+            CHECK(server->getAcceptCount() == 2);
+            second->close();
+            done.notify();
+        });
+        done.wait();
+        server->stop();
+    }
+
+    // stop()关闭已有连接的读端, 处理函数读到0返回, 客户端随之读到0
+    void test_stop_drain(sylar::IOManager& iom, sylar::IOManager& accept_iom) {
+        sylar::Address::ptr addr;
+        sylar::TcpServer::ptr server = StartServer(iom, accept_iom, 0, addr);
+
+        sylar::Semaphore connected;
+        sylar::Semaphore done;
+        iom.schedule([&]() {
+            sylar::Socket::ptr sock = Connect(addr);
+            CHECK(EchoOnce(sock, "before stop"));
+            connected.notify();
+            sock->setRecvTimeout(2000);
+            char buf[16];
+            CHECK(sock->recv(buf, sizeof(buf)) == 0);
+            sock->close();
+            done.notify();
+        });
+        connected.wait();
+        server->stop();
+        CHECK(server->isStop());
+        done.wait();
+
+        // 监听socket已关闭, 新连接失败
+        sylar::Semaphore refused;
+        iom.schedule([&]() {
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+            CHECK(!sock->connect(addr, 1000));
+            refused.notify();
+        });
+        refused.wait();
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::IOManager iom(2, false, "tcp");
+    sylar::IOManager accept_iom(1, false, "accept");
+
+    test_echo(iom, accept_iom);
+    test_max_connections(iom, accept_iom);
+    test_stop_drain(iom, accept_iom);
+
+    accept_iom.stop();
+    iom.stop();
+    printf("test_tcp_server ok\n");
+    return 0;
+}
@@ -0,0 +1,56 @@
+//
+// Created by admin on 2025/9/5.
+//
+
+#include "test.h"
+#include "watchdog.h"
+#include "iomanager.h"
+#include "Config.h"
+#include "log.h"
+#include "metrics.h"
+#include <unistd.h>
+
+namespace {
+
+    // 空闲的IOManager线程睡在epoll_wait里(最长3秒), 不能被当成卡顿
+    void test_idle_no_report() {
+        uint64_t before = sylar::Watchdog::GetStallCount();
+        {
+            sylar::IOManager iom(2, false, "idle");
+            // 主线程没有hook, 这里是真的sleep, 工作线程一直空闲
+            usleep(500 * 1000);
+            iom.stop();
+        }
+        CHECK(sylar::Watchdog::GetStallCount() == before);
+    }
+
+    // 对照: 协程真正跑满超过阈值时要报告, 否则上面的检查没有意义
+    void test_busy_reported() {
+        uint64_t before = sylar::Watchdog::GetStallCount();
+        sylar::IOManager iom(1, false, "busy");
+        sylar::Semaphore done;
+        iom.schedule([&]() {
+            uint64_t start = sylar::Metrics::NowNs();
+            while(sylar::Metrics::NowNs() - start < 200 * 1000 * 1000ull) {
+            }
+            done.notify();
+        });
+        done.wait();
+        iom.stop();
+        CHECK(sylar::Watchdog::GetStallCount() > before);
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    sylar::Config::Lookup<uint32_t>("watchdog.threshold")->setValue(50);
+    sylar::Config::Lookup<uint32_t>("watchdog.interval")->setValue(10);
+    CHECK(sylar::Watchdog::Start());
+
+    test_idle_no_report();
+    test_busy_reported();
+
+    sylar::Watchdog::Stop();
+    printf("test_watchdog ok\n");
+    return 0;
+}
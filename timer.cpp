@@ -31,6 +31,10 @@
  *
  * 6. 性能优化设计
  *    - 使用有序集合 std::set 存储定时器，查找效率 O(log n)
+ *    - 可选分层时间轮后端(TimerManager::WHEEL), 插入/取消 O(1)
+ *      第0层256个1ms槽位, 往上4层每层64个槽位, 上层槽位到点后级联到下层
+ *    - 可选线程定时器(per_thread), 每个IO线程维护自己的定时器集合(后端和共享集合相同)
+ *      集合只有自己的锁, 本线程的操作不经过共享锁, 跨线程的取消/重置持有该集合的锁直接完成
  *    - 双重锁检查模式，减少写锁竞争
  *    - 批量处理到期定时器，减少系统调用
  *    - 内存预分配，避免频繁的内存重分配
@@ -38,9 +42,205 @@
 
 #include "timer.h"
 #include "util.h"
+#include "metrics.h"
 
 namespace sylar {
 
+    // 第level层的起始槽位下标
+    static uint32_t WheelOffset(int level) {
+        return level == 0 ? 0 : 256 + (level - 1) * 64;
+    }
+
+    // 第level层每个槽位对应的时间位移
+    static uint32_t WheelShift(int level) {
+        return level == 0 ? 0 : 8 + (level - 1) * 6;
+    }
+
+    // 第level层在位图中的起始字
+    static uint32_t WheelWord(int level) {
+        return level == 0 ? 0 : 3 + level;
+    }
+
+    // 在n位的位图中从from开始循环查找第一个置位, 返回相对from的距离, 没有返回-1
+    static int WheelFindNext(const uint64_t* words, uint32_t n, uint32_t from) {
+        // 先找[from, n), 再找[0, from)
+        for (int pass = 0; pass < 2; ++pass) {
+            uint32_t begin = pass == 0 ? from : 0;
+            uint32_t end = pass == 0 ? n : from;
+            for (uint32_t pos = begin; pos < end; pos = (pos / 64 + 1) * 64) {
+                uint64_t word = words[pos / 64] >> (pos % 64);
+                if (word) {
+                    uint32_t hit = pos + __builtin_ctzll(word);
+                    if (hit < end) {
+                        return (hit + n - from) % n;
+                    }
+                    break;
+                }
+            }
+        }
+        return -1;
+    }
+
+    // 定时器存储, 按后端放在有序集合或分层时间轮中
+    // 共享集合和线程定时器集合共用, 本身不加锁, 由持有者保证互斥
+    struct TimerQueue {
+        TimerQueue(TimerManager::Backend backend, uint64_t now_ms)
+            :backend(backend) {
+            if (backend == TimerManager::WHEEL) {
+                wheelSlots.resize(WHEEL_SLOTS);
+                wheelTime = now_ms;
+            }
+        }
+
+        ~TimerQueue() {
+            // 槽位链表里是shared_ptr串起来的, 逐个断开, 避免长链表递归析构
+            for (auto& head : wheelSlots) {
+                while (head) {
+                    Timer::ptr next = std::move(head -> m_wheelNext);
+                    head = std::move(next);
+                }
+            }
+        }
+
+        size_t size() const {
+            return backend == TimerManager::WHEEL ? wheelCount : timers.size();
+        }
+
+        bool empty() const { return size() == 0; }
+
+        // 插入, 返回是否可能成为最早到期的定时器
+        bool insert(const Timer::ptr& timer) {
+            if (backend == TimerManager::WHEEL) {
+                // 时间轮空的时候直接对齐到当前时间, 免得从很久之前一格一格推进
+                if (!wheelCount) {
+                    wheelTime = std::max(wheelTime, sylar::GetCurrentMS());
+                }
+                bool at_front = timer -> m_next < next;
+                wheelInsert(timer);
+                return at_front;
+            }
+            auto it = timers.insert(timer).first;
+            if (it != timers.begin()) {
+                return false;
+            }
+            next = timer -> m_next;
+            return true;
+        }
+
+        // 删除, 不存在返回false
+        bool erase(const Timer::ptr& timer) {
+            if (backend == TimerManager::WHEEL) {
+                return wheelErase(timer);
+            }
+            auto it = timers.find(timer);
+            if (it == timers.end()) {
+                return false;
+            }
+            timers.erase(it);
+            updateNext();
+            return true;
+        }
+
+        // 取出所有到期的定时器, all为true时取出全部
+        void takeExpired(uint64_t now_ms, bool all, std::vector<Timer::ptr>& expired) {
+            if (backend == TimerManager::WHEEL) {
+                wheelExpire(now_ms, expired, all);
+            } else {
+                auto it = timers.end();
+                if (!all) {
+                    Timer::ptr now_timer(new Timer(now_ms));
+                    it = timers.lower_bound(now_timer);
+                    // 跳过相同时间的定时器
+                    while (it != timers.end() && (*it) -> m_next == now_ms) {
+                        ++it;
+                    }
+                }
+                // 我们把从头开始的所有相同或过期的定时器放到expired中
+                expired.insert(expired.end(), timers.begin(), it);
+                timers.erase(timers.begin(), it);
+            }
+            updateNext();
+        }
+
+        // 重新计算next
+        void updateNext() {
+            if (backend == TimerManager::WHEEL) {
+                next = wheelCount ? wheelNextExpire() : ~0ull;
+            } else {
+                next = timers.empty() ? ~0ull : (*timers.begin()) -> m_next;
+            }
+        }
+
+        // 时间轮: 按到期时间挂到对应层级的槽位
+        void wheelInsert(const Timer::ptr& timer);
+
+        // 时间轮: 从槽位中摘除
+        bool wheelErase(const Timer::ptr& timer);
+
+        // 时间轮: 把上层槽位的定时器重新分配到下层
+        void wheelCascade(int level, uint32_t slot);
+
+        // 时间轮: 摘下整个槽位的定时器
+        void wheelTake(int level, uint32_t slot, std::vector<Timer::ptr>& timers);
+
+        // 时间轮: 推进到now_ms, 收集到期的定时器, all为true收集全部
+        void wheelExpire(uint64_t now_ms, std::vector<Timer::ptr>& expired, bool all);
+
+        // 时间轮: 最早到期时间的下界
+        uint64_t wheelNextExpire();
+
+        // 时间轮层数, 第0层256个槽位, 其余每层64个槽位, 覆盖 2^32 毫秒
+        static const int WHEEL_LEVELS = 5;
+        static const uint32_t WHEEL_ROOT_BITS = 8;
+        static const uint32_t WHEEL_ROOT_SIZE = 1 << WHEEL_ROOT_BITS;
+        static const uint32_t WHEEL_BITS = 6;
+        static const uint32_t WHEEL_SIZE = 1 << WHEEL_BITS;
+        static const uint32_t WHEEL_SLOTS = WHEEL_ROOT_SIZE + (WHEEL_LEVELS - 1) * WHEEL_SIZE;
+
+        TimerManager::Backend backend;
+        // 有序集合后端
+        std::set<Timer::ptr, Timer::Comparator> timers;
+        // 时间轮槽位链表头, 各层依次排列
+        std::vector<Timer::ptr> wheelSlots;
+        // 非空槽位位图, 第0层占4个字, 其余每层1个字
+        uint64_t wheelBitmap[WHEEL_ROOT_SIZE / 64 + WHEEL_LEVELS - 1] = {0};
+        // 下一个待处理的毫秒, 之前的槽位都已处理
+        uint64_t wheelTime = 0;
+        // 时间轮中的定时器数量
+        size_t wheelCount = 0;
+        // 最早到期时间, 有序集合是精确值, 时间轮是下界, 没有定时器为~0ull
+        // 持有者互斥修改, getNextTimer不加锁读
+        std::atomic<uint64_t> next = {~0ull};
+    };
+
+    // 线程定时器集合
+    // 所属线程和其他线程都持有mutex操作, 不经过管理器的共享锁
+    struct TimerShard {
+        typedef Mutex MutexType;
+
+        TimerShard(TimerManager* manager, TimerManager::Backend backend, uint64_t now_ms)
+            :manager(manager)
+            ,queue(backend, now_ms)
+            ,previouseTime(now_ms) {
+        }
+
+        // 所属管理器
+        TimerManager* manager = nullptr;
+        // 所属线程id
+        int thread = -1;
+        // 定时器集合
+        TimerQueue queue;
+        // 定时器数量, 给其他线程判断hasTimer
+        std::atomic<size_t> count = {0};
+        // 上次执行时间, 用于检测时钟回拨
+        uint64_t previouseTime = 0;
+        // 保护queue和其中定时器的m_cb/m_next
+        MutexType mutex;
+    };
+
+    // 当前线程注册的定时器集合, 一个线程同一时间只属于一个管理器
+    static thread_local TimerShard* t_timer_shard = nullptr;
+
     // 定时器比较大小
     bool Timer::Comparator::operator()(const Timer::ptr& lhs
         ,const Timer::ptr& rhs) const {
@@ -68,32 +268,36 @@ namespace sylar {
     }
 
     bool Timer::cancel() {
+        bool rt = false;
+        if (m_manager -> shardCancel(shared_from_this(), rt)) {
+            return rt;
+        }
         TimerManager::RWMutexType::WriteLock lock(m_manager -> m_mutex);
         if (m_cb) {
             m_cb = nullptr;
-            auto it = m_manager -> m_timers.find(shared_from_this());
-            if (it != m_manager -> m_timers.end()) {
-                m_manager -> m_timers.erase(it);
-            }
+            m_manager -> eraseTimer(shared_from_this());
+            m_manager -> updateShared();
             return true;
         }
         return false;
     }
 
     bool Timer::refresh() {
+        bool rt = false;
+        if (m_manager -> shardRefresh(shared_from_this(), rt)) {
+            return rt;
+        }
         TimerManager::RWMutexType::WriteLock lock(m_manager -> m_mutex);
         if (!m_cb) {
             return false;
         }
 
         // 如果当前定时器依旧
-        auto it = m_manager -> m_timers.find(shared_from_this());
-        if (it == m_manager -> m_timers.end()) {
+        if (!m_manager -> eraseTimer(shared_from_this())) {
             return false;
         }
-        m_manager -> m_timers.erase(it);
         m_next = sylar::GetCurrentMS() + m_ms;
-        m_manager -> m_timers.insert(shared_from_this());
+        m_manager -> insertTimer(shared_from_this());
         return true;
     }
 
@@ -105,15 +309,17 @@ namespace sylar {
         if (ms == m_ms && !from_now) {
             return false;
         }
+        bool rt = false;
+        if (m_manager -> shardReset(shared_from_this(), ms, from_now, rt)) {
+            return rt;
+        }
         TimerManager::RWMutexType::WriteLock lock(m_manager -> m_mutex);
         if (!m_cb) {
             return false;
         }
-        auto it = m_manager -> m_timers.find(shared_from_this());
-        if (it == m_manager -> m_timers.end()) {
+        if (!m_manager -> eraseTimer(shared_from_this())) {
             return false;
         }
-        m_manager -> m_timers.erase(it);
         uint64_t start = 0;
         if (from_now) {
             start = sylar::GetCurrentMS();
@@ -122,20 +328,33 @@ namespace sylar {
         }
         m_ms = ms;
         m_next = start + m_ms;
-        m_manager -> m_timers.insert(shared_from_this());
+        m_manager -> insertTimer(shared_from_this());
         return true;
     }
 
-    TimerManager::TimerManager() {
+    TimerManager::TimerManager(Backend backend, bool per_thread)
+        :m_backend(backend)
+        ,m_perThread(per_thread) {
         // m_previouseTime为上次执行时间
         m_previouseTime = sylar::GetCurrentMS();
+        m_queue.reset(new TimerQueue(m_backend, m_previouseTime));
     }
 
-    TimerManager::~TimerManager() {}
+    TimerManager::~TimerManager() {
+    }
 
     Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb
         , bool recurring) {
         Timer::ptr timer(new Timer(ms, cb, recurring, this));
+        TimerShard* shard = getShard();
+        if (shard) {
+            // 当前线程回到idle时会重新计算超时, 不需要唤醒
+            TimerShard::MutexType::Lock lock(shard -> mutex);
+            timer -> m_shard = shard;
+            shard -> queue.insert(timer);
+            shard -> count = shard -> queue.size();
+            return timer;
+        }
         RWMutexType::WriteLock lock(m_mutex);
         addTimer(timer, lock);
         return timer;
@@ -155,21 +374,34 @@ namespace sylar {
         return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
     }
 
-    uint64_t TimerManager::getNextTimer() {
-        RWMutexType::ReadLock lock(m_mutex);
-        m_tickled = false;
-        if (m_timers.empty()) {
+    // 距离next的毫秒数, 已经过了返回0
+    static uint64_t TimeoutTo(uint64_t next) {
+        if (next == ~0ull) {
             return ~0ull;
         }
-
-        // 如果当前时间已经大于到期时间了
-        // 返回0, 代表立即需要处理
-        const Timer::ptr& next = *m_timers.begin();
         uint64_t now_ms = sylar::GetCurrentMS();
-        if (now_ms >= next -> m_next) { return 0; }
+        return now_ms >= next ? 0 : next - now_ms;
+    }
 
-        // 返回距离下一个定时器触发的毫秒数
-        return next -> m_next - now_ms;
+    uint64_t TimerManager::getNextTimer() {
+        TimerShard* shard = getShard();
+        if (!shard) {
+            return getSharedNextTimer();
+        }
+
+        uint64_t next = TimeoutTo(shard -> queue.next);
+        if (m_hasShared) {
+            next = std::min(next, getSharedNextTimer());
+        }
+        return next;
+    }
+
+    uint64_t TimerManager::getSharedNextTimer() {
+        // 不加锁, 直接用缓存的最早到期时间; 时间轮的下界在定时器取消后可能偏早,
+        // 提前醒来的那次listExpiredCb会重新计算
+        // 先清m_tickled再读, 和addTimer里先插入再读m_tickled配对, 不会漏掉唤醒
+        m_tickled = false;
+        return TimeoutTo(m_queue -> next);
     }
 
 
@@ -177,55 +409,76 @@ namespace sylar {
         uint64_t now_ms = sylar::GetCurrentMS();
         // 用于存放到期的定时器
         std::vector<Timer::ptr> expired;
-        {
-            RWMutexType::ReadLock lock(m_mutex);
-            if (m_timers.empty()) {
-                return;
+        ThreadMetrics& metrics = Metrics::Local();
+
+        TimerShard* shard = getShard();
+        if (shard) {
+            TimerShard::MutexType::Lock lock(shard -> mutex);
+            bool rollover = now_ms < shard -> previouseTime
+                            && now_ms < (shard -> previouseTime - 60 * 60 * 1000);
+            shard -> previouseTime = now_ms;
+            if (!shard -> queue.empty() && (rollover || shard -> queue.next <= now_ms)) {
+                shard -> queue.takeExpired(now_ms, rollover, expired);
+                for (auto& timer : expired) {
+                    // 时钟回拨时m_next可能比now_ms大, 不算延迟
+                    metrics.timer_lag.record(now_ms > timer -> m_next
+                                             ? (now_ms - timer -> m_next) * 1000000 : 0);
+                    metrics.timers.inc();
+                    cbs.push_back(timer -> m_cb);
+                    if (timer -> m_recurring) {
+                        timer -> m_next = now_ms + timer -> m_ms;
+                        shard -> queue.insert(timer);
+                    } else {
+                        timer -> m_cb = nullptr;
+                    }
+                }
+                shard -> count = shard -> queue.size();
+                expired.clear();
             }
         }
 
-        RWMutexType::WriteLock lock(m_mutex);
-        if (m_timers.empty()) {
+        if (!m_hasShared) {
             return;
         }
 
-        // 因为我们是set集合,如果首个定时器都没有到期的话
-        // 后面也就都不用检查了, 直接返回即可
-        bool rollover = detectClockRollover(now_ms);
-        if (!rollover && (*m_timers.begin()) -> m_next > now_ms) {
+        RWMutexType::WriteLock lock(m_mutex);
+        if (m_queue -> empty()) {
             return;
         }
 
-        Timer::ptr now_timer(new Timer(now_ms));
-        auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-        // 跳过相同时间的定时器
-        while (it != m_timers.end() && (*it) -> m_next == now_ms) {
-            ++it;
+        // 最早的定时器都没有到期的话, 后面也就都不用检查了, 直接返回即可
+        bool rollover = detectClockRollover(now_ms);
+        if (!rollover && m_queue -> next > now_ms) {
+            return;
         }
+        m_queue -> takeExpired(now_ms, rollover, expired);
 
-        // 我们把从头开始的所有相同或过期的定时器放到expired中
-        expired.insert(expired.begin(), m_timers.begin(), it);
-        m_timers.erase(m_timers.begin(), it);
         // 预先分配内存
-        cbs.reserve(expired.size());
+        cbs.reserve(cbs.size() + expired.size());
 
         for(auto& timer : expired) {
+            metrics.timer_lag.record(now_ms > timer->m_next
+                                     ? (now_ms - timer->m_next) * 1000000 : 0);
+            metrics.timers.inc();
             // 将过期定时器的回调添加到cbs中
             cbs.push_back(timer->m_cb);
             // 如果是循环定时器的话
-            // 重新计算到期时间,并重新添加到m_timers中
+            // 重新计算到期时间,并重新添加到集合中
             if(timer->m_recurring) {
                 timer->m_next = now_ms + timer->m_ms;
-                m_timers.insert(timer);
+                insertTimer(timer);
             } else {
                 timer->m_cb = nullptr;
             }
         }
+        updateShared();
     }
 
     void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
-        auto it = m_timers.insert(val).first;
-        bool at_front = (it == m_timers.begin()) && !m_tickled;
+        // 共享集合原本为空时, 之前的m_tickled可能已经没人重置了
+        bool was_empty = !m_hasShared;
+        bool at_front = insertTimer(val) && (!m_tickled || was_empty);
+        updateShared();
         if(at_front) {
             m_tickled = true;
         }
@@ -251,8 +504,323 @@ namespace sylar {
 
     // 检测是否有次定时器
     bool TimerManager::hasTimer() {
+        if (m_hasShared) {
+            return true;
+        }
         RWMutexType::ReadLock lock(m_mutex);
-        return !m_timers.empty();
+        for (auto& shard : m_shards) {
+            if (shard -> count) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void TimerManager::updateShared() {
+        m_hasShared = !m_queue -> empty();
+    }
+
+    TimerShard* TimerManager::getShard() {
+        TimerShard* shard = t_timer_shard;
+        return (shard && shard -> manager == this) ? shard : nullptr;
+    }
+
+    void TimerManager::registerTimerThread() {
+        if (!m_perThread || getShard()) {
+            return;
+        }
+        std::unique_ptr<TimerShard> shard(new TimerShard(this, m_backend, sylar::GetCurrentMS()));
+        shard -> thread = sylar::GetThreadId();
+        t_timer_shard = shard.get();
+
+        RWMutexType::WriteLock lock(m_mutex);
+        m_shards.push_back(std::move(shard));
+    }
+
+    void TimerManager::unregisterTimerThread() {
+        TimerShard* shard = getShard();
+        if (!shard) {
+            return;
+        }
+        t_timer_shard = nullptr;
+
+        bool has_timer = false;
+        {
+            // 持有shard锁直到定时器移回共享集合, 其他线程看到m_shard为空后走共享路径
+            TimerShard::MutexType::Lock lock(shard -> mutex);
+            std::vector<Timer::ptr> timers;
+            shard -> queue.takeExpired(sylar::GetCurrentMS(), true, timers);
+            shard -> count = 0;
+
+            RWMutexType::WriteLock wlock(m_mutex);
+            for (auto& timer : timers) {
+                timer -> m_shard = nullptr;
+                insertTimer(timer);
+                has_timer = true;
+            }
+            updateShared();
+        }
+
+        if (has_timer) {
+            onTimerInsertedAtFront();
+        }
+    }
+
+    bool TimerManager::shardCancel(const Timer::ptr& timer, bool& rt) {
+        TimerShard* shard = timer -> m_shard;
+        if (!shard) {
+            return false;
+        }
+        TimerShard::MutexType::Lock lock(shard -> mutex);
+        if (timer -> m_shard != shard) {
+            // 所属线程已注销, 定时器移回了共享集合
+            return false;
+        }
+        // 一次性定时器执行时m_cb已清空
+        rt = false;
+        if (timer -> m_cb) {
+            timer -> m_cb = nullptr;
+            rt = shard -> queue.erase(timer);
+            shard -> count = shard -> queue.size();
+        }
+        return true;
+    }
+
+    bool TimerManager::shardRefresh(const Timer::ptr& timer, bool& rt) {
+        TimerShard* shard = timer -> m_shard;
+        if (!shard) {
+            return false;
+        }
+        TimerShard::MutexType::Lock lock(shard -> mutex);
+        if (timer -> m_shard != shard) {
+            return false;
+        }
+        rt = false;
+        if (timer -> m_cb && shard -> queue.erase(timer)) {
+            // 刷新只会让到期时间变晚, 不需要唤醒
+            timer -> m_next = sylar::GetCurrentMS() + timer -> m_ms;
+            shard -> queue.insert(timer);
+            rt = true;
+        }
+        return true;
+    }
+
+    bool TimerManager::shardReset(const Timer::ptr& timer, uint64_t ms, bool from_now, bool& rt) {
+        TimerShard* shard = timer -> m_shard;
+        if (!shard) {
+            return false;
+        }
+        bool at_front = false;
+        {
+            TimerShard::MutexType::Lock lock(shard -> mutex);
+            if (timer -> m_shard != shard) {
+                return false;
+            }
+            rt = false;
+            if (!timer -> m_cb || !shard -> queue.erase(timer)) {
+                return true;
+            }
+            uint64_t start = from_now ? sylar::GetCurrentMS() : timer -> m_next - timer -> m_ms;
+            timer -> m_ms = ms;
+            timer -> m_next = start + ms;
+            at_front = shard -> queue.insert(timer);
+            rt = true;
+        }
+        if (at_front && t_timer_shard != shard) {
+            // 可能改早了, 让所属线程重新计算超时
+            onThreadTimerChanged(shard -> thread);
+        }
+        return true;
+    }
+
+    bool TimerManager::insertTimer(const Timer::ptr& timer) {
+        return m_queue -> insert(timer);
+    }
+
+    bool TimerManager::eraseTimer(const Timer::ptr& timer) {
+        return m_queue -> erase(timer);
+    }
+
+    void TimerQueue::wheelInsert(const Timer::ptr& timer) {
+        uint64_t expire = timer -> m_next < wheelTime ? wheelTime : timer -> m_next;
+        uint64_t delta = expire - wheelTime;
+        int level = 0;
+        uint32_t slot = 0;
+        if (delta < WHEEL_ROOT_SIZE) {
+            slot = expire & (WHEEL_ROOT_SIZE - 1);
+        } else {
+            // 超出时间轮范围的先放到最外层最远的槽位, 级联时重新计算
+            if (delta >= (1ull << 32)) {
+                expire = wheelTime + (1ull << 32) - 1;
+                delta = expire - wheelTime;
+            }
+            level = 1;
+            while (level < WHEEL_LEVELS - 1 && delta >= (1ull << WheelShift(level + 1))) {
+                ++level;
+            }
+            slot = (expire >> WheelShift(level)) & (WHEEL_SIZE - 1);
+        }
+
+        Timer::ptr& head = wheelSlots[WheelOffset(level) + slot];
+        timer -> m_wheelPrev = nullptr;
+        timer -> m_wheelNext = head;
+        if (head) {
+            head -> m_wheelPrev = timer.get();
+        }
+        head = timer;
+        timer -> m_wheelLevel = level;
+        timer -> m_wheelSlot = slot;
+        wheelBitmap[WheelWord(level) + slot / 64] |= 1ull << (slot % 64);
+
+        ++wheelCount;
+        if (timer -> m_next < next) {
+            next = timer -> m_next;
+        }
+    }
+
+    bool TimerQueue::wheelErase(const Timer::ptr& timer) {
+        if (timer -> m_wheelLevel < 0) {
+            return false;
+        }
+        int level = timer -> m_wheelLevel;
+        uint32_t slot = timer -> m_wheelSlot;
+        Timer::ptr& head = wheelSlots[WheelOffset(level) + slot];
+
+        // 调用方持有timer, 断开链表时不会被析构
+        Timer::ptr after = std::move(timer -> m_wheelNext);
+        if (after) {
+            after -> m_wheelPrev = timer -> m_wheelPrev;
+        }
+        if (timer -> m_wheelPrev) {
+            timer -> m_wheelPrev -> m_wheelNext = std::move(after);
+        } else {
+            head = std::move(after);
+        }
+        if (!head) {
+            wheelBitmap[WheelWord(level) + slot / 64] &= ~(1ull << (slot % 64));
+        }
+
+        timer -> m_wheelPrev = nullptr;
+        timer -> m_wheelLevel = -1;
+        if (--wheelCount == 0) {
+            // 空了之后不会再有listExpiredCb刷新下界, 这里直接清掉
+            next = ~0ull;
+        }
+        return true;
+    }
+
+    void TimerQueue::wheelTake(int level, uint32_t slot, std::vector<Timer::ptr>& timers) {
+        Timer::ptr cur = std::move(wheelSlots[WheelOffset(level) + slot]);
+        wheelBitmap[WheelWord(level) + slot / 64] &= ~(1ull << (slot % 64));
+        while (cur) {
+            Timer::ptr next = std::move(cur -> m_wheelNext);
+            cur -> m_wheelPrev = nullptr;
+            cur -> m_wheelLevel = -1;
+            --wheelCount;
+            timers.push_back(std::move(cur));
+            cur = std::move(next);
+        }
+    }
+
+    void TimerQueue::wheelCascade(int level, uint32_t slot) {
+        if (!(wheelBitmap[WheelWord(level) + slot / 64] & (1ull << (slot % 64)))) {
+            return;
+        }
+        std::vector<Timer::ptr> timers;
+        wheelTake(level, slot, timers);
+        for (auto& timer : timers) {
+            wheelInsert(timer);
+        }
+    }
+
+    void TimerQueue::wheelExpire(uint64_t now_ms, std::vector<Timer::ptr>& expired, bool all) {
+        if (all) {
+            for (int level = 0; level < WHEEL_LEVELS; ++level) {
+                uint32_t size = level == 0 ? WHEEL_ROOT_SIZE : WHEEL_SIZE;
+                for (uint32_t slot = 0; slot < size; ++slot) {
+                    wheelTake(level, slot, expired);
+                }
+            }
+            wheelTime = now_ms + 1;
+            return;
+        }
+
+        while (wheelTime <= now_ms) {
+            uint32_t idx = wheelTime & (WHEEL_ROOT_SIZE - 1);
+            // 第0层转完一圈, 把上层对应的槽位级联下来
+            if (idx == 0) {
+                for (int level = 1; level < WHEEL_LEVELS; ++level) {
+                    uint32_t slot = (wheelTime >> WheelShift(level)) & (WHEEL_SIZE - 1);
+                    wheelCascade(level, slot);
+                    if (slot != 0) {
+                        break;
+                    }
+                }
+            }
+            wheelTake(0, idx, expired);
+            ++wheelTime;
+
+            if (!wheelCount) {
+                wheelTime = now_ms + 1;
+                break;
+            }
+
+            // 跳过第0层的空槽位, 最多跳到下一次级联或now_ms之后
+            idx = wheelTime & (WHEEL_ROOT_SIZE - 1);
+            if (idx != 0) {
+                int dist = WheelFindNext(wheelBitmap, WHEEL_ROOT_SIZE, idx);
+                uint64_t step = WHEEL_ROOT_SIZE - idx;
+                if (dist >= 0 && (uint64_t)dist < step) {
+                    step = dist;
+                }
+                step = std::min(step, now_ms + 1 - wheelTime);
+                wheelTime += step;
+            }
+        }
+
+        // 推进之后才插入的过期定时器挂在当前槽位上, 单独取出来
+        uint32_t idx = wheelTime & (WHEEL_ROOT_SIZE - 1);
+        Timer::ptr cur = wheelSlots[idx];
+        while (cur) {
+            Timer::ptr next = cur -> m_wheelNext;
+            if (cur -> m_next <= now_ms) {
+                wheelErase(cur);
+                expired.push_back(std::move(cur));
+            }
+            cur = std::move(next);
+        }
+    }
+
+    uint64_t TimerQueue::wheelNextExpire() {
+        uint64_t next = ~0ull;
+        // 第0层槽位里就是精确的到期时间(过期的挂在当前槽位)
+        uint32_t idx = wheelTime & (WHEEL_ROOT_SIZE - 1);
+        int dist = WheelFindNext(wheelBitmap, WHEEL_ROOT_SIZE, idx);
+        if (dist == 0) {
+            // 当前槽位里可能有已经过期的定时器
+            for (Timer* t = wheelSlots[idx].get(); t; t = t -> m_wheelNext.get()) {
+                next = std::min(next, t -> m_next);
+            }
+        } else if (dist > 0) {
+            next = wheelTime + dist;
+        }
+
+        // 上层槽位取其级联的时间, 槽位里的定时器都不会早于这个时间
+        for (int level = 1; level < WHEEL_LEVELS; ++level) {
+            uint32_t shift = WheelShift(level);
+            // 下一次级联发生在不早于wheelTime的第一个 2^shift 边界
+            uint64_t base = (wheelTime + (1ull << shift) - 1) >> shift;
+            int d = WheelFindNext(&wheelBitmap[WheelWord(level)], WHEEL_SIZE
+                                    , base & (WHEEL_SIZE - 1));
+            if (d < 0) {
+                continue;
+            }
+            uint64_t cascade = (base + d) << shift;
+            if (cascade < next) {
+                next = cascade;
+            }
+        }
+        return next;
     }
 
-}
\ No newline at end of file
+}
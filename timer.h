@@ -8,14 +8,19 @@
 #include <memory>
 #include <vector>
 #include <set>
+#include <atomic>
 #include "Thread.h"
 
 namespace sylar {
 
     class TimerManager;
+    struct TimerShard;
+    struct TimerQueue;
 
     class Timer : public std::enable_shared_from_this<Timer> {
         friend class TimerManager;
+        friend struct TimerShard;
+        friend struct TimerQueue;
     public:
         typedef std::shared_ptr<Timer> ptr;
 
@@ -47,6 +52,18 @@ namespace sylar {
         std::function<void()> m_cb;
         // 定时器管理类指针
         TimerManager* m_manager = nullptr;
+
+        // 时间轮槽位内的双向链表(仅时间轮后端使用)
+        Timer::ptr m_wheelNext;
+        Timer* m_wheelPrev = nullptr;
+        // 所在层级, -1 表示不在时间轮中
+        int m_wheelLevel = -1;
+        // 所在槽位
+        uint32_t m_wheelSlot = 0;
+
+        // 所属的线程定时器集合, nullptr 表示在共享集合中
+        // 持有所属集合的锁修改, 所属线程注销时清空
+        std::atomic<TimerShard*> m_shard = {nullptr};
     private:
         struct Comparator {
             // 比较定时器的智能指针的大小(当然, 按照智能指针执行的)
@@ -59,7 +76,20 @@ namespace sylar {
     public:
         typedef RWMutex RWMutexType;
 
-        TimerManager();
+        // 定时器存储后端
+        enum Backend {
+            // 有序集合, 插入/删除 O(log n)
+            SET = 0,
+            // 分层时间轮, 插入/删除 O(1), 精度1ms
+            WHEEL = 1
+        };
+
+        /**
+         * backend 定时器存储后端
+         * per_thread 是否启用线程定时器: 注册过的线程添加的定时器只放在线程自己的集合中,
+         *            不经过共享锁; 其他线程的取消/刷新/重置持有该集合自己的锁直接完成
+         */
+        TimerManager(Backend backend = SET, bool per_thread = false);
 
         virtual ~TimerManager();
 
@@ -75,23 +105,66 @@ namespace sylar {
 
         // 是否有定时器
         bool hasTimer();
+
+        // 返回定时器存储后端
+        Backend getBackend() const { return m_backend; }
+
+        // 是否启用线程定时器
+        bool isPerThread() const { return m_perThread; }
+
+        // 把当前线程注册为定时器线程, 之后当前线程的getNextTimer/listExpiredCb只看自己的集合和共享集合
+        void registerTimerThread();
+
+        // 注销当前线程, 剩余的定时器移回共享集合
+        void unregisterTimerThread();
     protected:
         // 新定时器添加到首部并执行
         virtual void onTimerInsertedAtFront() = 0;
 
+        // 其他线程把thread的定时器改早了, 需要唤醒该线程重新计算超时
+        virtual void onThreadTimerChanged(int thread) { onTimerInsertedAtFront(); }
+
         // 将定时器添加到管理器中
-        bool addTimer(Timer::ptr val ,RWMutexType::WriteLock& lock);
+        void addTimer(Timer::ptr val ,RWMutexType::WriteLock& lock);
     private:
         // 检测服务器时间是否正确
         bool detectClockRollover(uint64_t now_ms);
+
+        // 按后端插入定时器, 返回是否可能成为最早到期的定时器(需持有写锁)
+        bool insertTimer(const Timer::ptr& timer);
+
+        // 按后端删除定时器, 不存在返回false(需持有写锁)
+        bool eraseTimer(const Timer::ptr& timer);
+
+        // 当前线程在本管理器中的定时器集合, 没有注册返回nullptr
+        TimerShard* getShard();
+
+        // 共享集合的最近到期时间
+        uint64_t getSharedNextTimer();
+
+        // 线程定时器的取消/刷新/重置, 返回false表示定时器已在共享集合, 走共享路径
+        bool shardCancel(const Timer::ptr& timer, bool& rt);
+        bool shardRefresh(const Timer::ptr& timer, bool& rt);
+        bool shardReset(const Timer::ptr& timer, uint64_t ms, bool from_now, bool& rt);
+
+        // 刷新共享集合是否为空的标记(需持有写锁)
+        void updateShared();
     private:
         RWMutexType m_mutex;
-        // 定时器集合
-        std::set<Timer::ptr, Timer::Comparator> m_timers;
+        // 存储后端
+        Backend m_backend = SET;
+        // 共享的定时器集合
+        std::unique_ptr<TimerQueue> m_queue;
         // 是否触发ontimerInsertedAtFront
-        bool m_tickled = false;
+        std::atomic<bool> m_tickled = {false};
         // 上次执行时间
         uint64_t m_previouseTime = 0;
+        // 是否启用线程定时器
+        bool m_perThread = false;
+        // 已注册线程的定时器集合, 生命周期与管理器相同
+        std::vector<std::unique_ptr<TimerShard> > m_shards;
+        // 共享集合中是否有定时器, 线程定时器模式下不加锁即可跳过共享集合
+        std::atomic<bool> m_hasShared = {false};
     };
 }
 
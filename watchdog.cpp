@@ -0,0 +1,319 @@
+//
+// Created by admin on 2025/9/1.
+//
+
+#include "watchdog.h"
+#include "Thread.h"
+#include "Config.h"
+#include "log.h"
+#include "util.h"
+#include "metrics.h"
+#include <errno.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+
+namespace sylar {
+
+    static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+    static ConfigVar<bool>::ptr g_watchdog_enable =
+        Config::Lookup<bool>("watchdog.enable", false, "enable fiber stall watchdog");
+
+    static ConfigVar<uint32_t>::ptr g_watchdog_threshold =
+        Config::Lookup<uint32_t>("watchdog.threshold", 100, "report fibers running longer than this(ms)");
+
+    static ConfigVar<uint32_t>::ptr g_watchdog_interval =
+        Config::Lookup<uint32_t>("watchdog.interval", 20, "watchdog check interval(ms)");
+
+    std::atomic<bool> Watchdog::s_enabled{false};
+
+    namespace {
+        static const int MAX_FRAMES = 64;
+
+        // 取调用栈的状态
+        enum TraceState {
+            TRACE_IDLE = 0,
+            // 检测线程已经发出信号
+            TRACE_REQUESTED = 1,
+            // 信号处理函数正在填写
+            TRACE_WRITING = 2,
+            TRACE_DONE = 3
+        };
+
+        // 每个执行协程的线程一个
+        struct Slot {
+            // 正在运行的协程id, 0表示在调度协程里
+            std::atomic<uint64_t> fiber{0};
+            // 切入时间(毫秒)
+            std::atomic<uint64_t> start{0};
+            pthread_t pthread;
+            pid_t tid = 0;
+            std::atomic<int> traceState{TRACE_IDLE};
+            // 信号处理函数里取到的调用栈
+            void* frames[MAX_FRAMES];
+            int frameCount = 0;
+            // 取调用栈时正在运行的协程和切入时间
+            uint64_t traceFiber = 0;
+            uint64_t traceStart = 0;
+            // 已经报告过的切入时间, 一次卡顿只报告一次, 只由检测线程访问
+            uint64_t reported = 0;
+        };
+
+        struct Registry {
+            // 保护slots
+            Mutex mutex;
+            std::vector<Slot*> slots;
+            // 没有注册的Slot, 线程退出之后还有协程切换时用
+            Slot orphan;
+            // 保护thread的启停
+            Mutex startMutex;
+            Thread::ptr thread;
+            std::atomic<bool> running{false};
+            std::atomic<uint64_t> stalls{0};
+        };
+
+        // 不释放, 线程在main返回之后退出也能安全注销
+        Registry& GetRegistry() {
+            static Registry* s_registry = new Registry;
+            return *s_registry;
+        }
+
+        static thread_local Slot* t_slot = nullptr;
+
+        struct SlotHolder {
+            Slot slot;
+
+            SlotHolder() {
+                slot.pthread = pthread_self();
+                slot.tid = sylar::GetThreadId();
+                Registry& r = GetRegistry();
+                Mutex::Lock lock(r.mutex);
+                r.slots.push_back(&slot);
+            }
+
+            ~SlotHolder() {
+                Registry& r = GetRegistry();
+                Mutex::Lock lock(r.mutex);
+                r.slots.erase(std::remove(r.slots.begin(), r.slots.end(), &slot), r.slots.end());
+                t_slot = &r.orphan;
+            }
+        };
+
+        Slot* GetSlot() {
+            if(__builtin_expect(t_slot == nullptr, 0)) {
+                static thread_local SlotHolder s_holder;
+                t_slot = &s_holder.slot;
+            }
+            return t_slot;
+        }
+
+        uint64_t NowMs() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+            return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+        }
+
+        // 取调用栈用的信号
+        int TraceSignal() {
+            return SIGRTMIN + 2;
+        }
+
+        // 在卡住的线程上执行, 只做backtrace, 符号化交给检测线程
+        void TraceHandler(int) {
+            int saved_errno = errno;
+            Slot* slot = t_slot;
+            int expected = TRACE_REQUESTED;
+            if(slot && slot->traceState.compare_exchange_strong(expected, TRACE_WRITING
+                                                                  ,std::memory_order_acquire)) {
+                slot->traceFiber = slot->fiber.load(std::memory_order_relaxed);
+                slot->traceStart = slot->start.load(std::memory_order_relaxed);
+                slot->frameCount = backtrace(slot->frames, MAX_FRAMES);
+                slot->traceState.store(TRACE_DONE, std::memory_order_release);
+            }
+            errno = saved_errno;
+        }
+
+        // 跳过信号处理函数和信号返回的桩
+        std::string FormatFrames(void** frames, int count, int skip, const std::string& prefix) {
+            if(count <= skip) {
+                return "";
+            }
+            char** strings = backtrace_symbols(frames + skip, count - skip);
+            if(strings == nullptr) {
+                return "";
+            }
+            std::stringstream ss;
+            for(int i = 0; i < count - skip; ++i) {
+                ss << prefix << strings[i] << std::endl;
+            }
+            free(strings);
+            return ss.str();
+        }
+
+        // 让slot所在的线程取调用栈, 最多等100毫秒
+        // 取的时候已经不是fiber在start切入的那次运行了(协程已经切出去), 返回空
+        std::string CaptureTrace(Slot* slot, uint64_t fiber, uint64_t start) {
+            slot->traceState.store(TRACE_REQUESTED, std::memory_order_release);
+            if(pthread_kill(slot->pthread, TraceSignal()) == 0) {
+                for(int i = 0; i < 100; ++i) {
+                    if(slot->traceState.load(std::memory_order_acquire) == TRACE_DONE) {
+                        break;
+                    }
+                    usleep(1000);
+                }
+            }
+
+            int expected = TRACE_REQUESTED;
+            if(slot->traceState.compare_exchange_strong(expected, TRACE_IDLE)) {
+                // 信号还没有被处理(比如线程屏蔽了信号), 放弃
+                return "";
+            }
+            // 信号处理函数已经开始写, 很快就会写完
+            while(slot->traceState.load(std::memory_order_acquire) != TRACE_DONE) {
+                sched_yield();
+            }
+            std::string trace;
+            if(slot->traceFiber == fiber && slot->traceStart == start) {
+                trace = FormatFrames(slot->frames, slot->frameCount, 2, "    ");
+            }
+            slot->traceState.store(TRACE_IDLE, std::memory_order_relaxed);
+            return trace;
+        }
+
+        struct Report {
+            pid_t tid;
+            uint64_t fiber;
+            uint64_t elapsed;
+            std::string trace;
+        };
+
+        void Run() {
+            Registry& r = GetRegistry();
+            std::vector<Report> reports;
+            while(r.running) {
+                uint32_t interval = g_watchdog_interval->getValue();
+                usleep((interval ? interval : 1) * 1000);
+                uint64_t threshold = g_watchdog_threshold->getValue();
+                uint64_t now = NowMs();
+                {
+                    // 持有mutex时线程不会退出, 可以给它发信号
+                    Mutex::Lock lock(r.mutex);
+                    for(auto slot : r.slots) {
+                        uint64_t fiber = slot->fiber.load(std::memory_order_acquire);
+                        uint64_t start = slot->start.load(std::memory_order_relaxed);
+                        if(!fiber || start == slot->reported || now < start + threshold) {
+                            continue;
+                        }
+                        slot->reported = start;
+                        r.stalls.fetch_add(1, std::memory_order_relaxed);
+
+                        std::string trace = CaptureTrace(slot, fiber, start);
+                        reports.push_back(Report{slot->tid, fiber, now - start, std::move(trace)});
+                    }
+                }
+
+                // 不在锁里写日志, 写日志可能很慢
+                for(auto& i : reports) {
+                    SYLAR_LOG_WARN(g_logger) << "fiber stalled thread=" << i.tid
+                                             << " fiber_id=" << i.fiber
+                                             << " running=" << i.elapsed << "ms"
+                                             << " threshold=" << threshold << "ms"
+                                             << "\nbacktrace:\n"
+                                             << (i.trace.empty() ? "    <unavailable>\n" : i.trace);
+                }
+                reports.clear();
+            }
+        }
+    }
+
+    void Watchdog::SwapIn(uint64_t fiber_id) {
+        Slot* slot = GetSlot();
+        slot->start.store(NowMs(), std::memory_order_relaxed);
+        slot->fiber.store(fiber_id, std::memory_order_release);
+    }
+
+    void Watchdog::SwapOut() {
+        GetSlot()->fiber.store(0, std::memory_order_release);
+    }
+
+    bool Watchdog::Start() {
+        Registry& r = GetRegistry();
+        Mutex::Lock lock(r.startMutex);
+        if(r.thread) {
+            return false;
+        }
+
+        // 第一次调用backtrace会加载libgcc并分配内存, 不能发生在信号处理函数里
+        void* warmup[1];
+        backtrace(warmup, 1);
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = TraceHandler;
+        // 被打断的系统调用自动重启, 尽量不影响卡住的线程
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if(sigaction(TraceSignal(), &sa, nullptr)) {
+            SYLAR_LOG_ERROR(g_logger) << "Watchdog sigaction errno=" << errno
+                                      << " errstr=" << strerror(errno);
+            return false;
+        }
+
+        {
+            // 关闭期间没有更新过的记录不算卡顿
+            Mutex::Lock lock2(r.mutex);
+            for(auto slot : r.slots) {
+                slot->reported = slot->start.load(std::memory_order_relaxed);
+            }
+        }
+
+        r.running = true;
+        s_enabled = true;
+        r.thread.reset(new Thread(&Run, "watchdog"));
+        SYLAR_LOG_INFO(g_logger) << "watchdog started threshold="
+                                 << g_watchdog_threshold->getValue() << "ms";
+        return true;
+    }
+
+    void Watchdog::Stop() {
+        Registry& r = GetRegistry();
+        Mutex::Lock lock(r.startMutex);
+        if(!r.thread) {
+            return;
+        }
+        s_enabled = false;
+        r.running = false;
+        r.thread->join();
+        r.thread.reset();
+    }
+
+    uint64_t Watchdog::GetStallCount() {
+        return GetRegistry().stalls.load(std::memory_order_relaxed);
+    }
+
+    struct WatchdogIniter {
+        WatchdogIniter() {
+            Metrics::AddCollector([](MetricsWriter& writer) {
+                writer.counter("sylar_fiber_stalls_total", "Fibers that ran longer than watchdog.threshold"
+                               ,Watchdog::GetStallCount());
+            });
+            g_watchdog_enable->addListener([](const bool& old_value, const bool& new_value) {
+                if(new_value) {
+                    Watchdog::Start();
+                } else {
+                    Watchdog::Stop();
+                }
+            });
+        }
+    };
+
+    static WatchdogIniter s_watchdog_initer;
+}
@@ -0,0 +1,52 @@
+//
+// Created by admin on 2025/9/1.
+//
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <atomic>
+#include <stdint.h>
+
+namespace sylar {
+
+    // 协程卡顿检测
+    // 协程里跑了很重的计算或者调用了没有hook的阻塞调用(getaddrinfo, 写日志文件)时,
+    // 同一个线程上的其他协程都会被卡住, 这里用一个后台线程定期检查每个线程当前协程的运行时间,
+    // 超过watchdog.threshold(毫秒)就打印一次它的调用栈
+    // 调用栈是给卡住的线程发信号(SIGRTMIN+2), 在信号处理函数里取的, 所以打印的是它此刻正在执行的位置
+    // 信号会打断不能自动重启的阻塞调用(nanosleep, poll等返回EINTR), 每次卡顿只发一次
+    // 由watchdog.enable开启
+    class Watchdog {
+    public:
+        // Fiber::swapIn切入协程前调用, 记录协程id和切入时间
+        static void OnSwapIn(uint64_t fiber_id) {
+            if(s_enabled.load(std::memory_order_relaxed)) {
+                SwapIn(fiber_id);
+            }
+        }
+
+        // 协程切回调度协程后调用
+        static void OnSwapOut() {
+            if(s_enabled.load(std::memory_order_relaxed)) {
+                SwapOut();
+            }
+        }
+
+        // 启动检测线程, 已经启动返回false
+        static bool Start();
+
+        // 停止检测线程
+        static void Stop();
+
+        // 检测到的卡顿次数
+        static uint64_t GetStallCount();
+    private:
+        static void SwapIn(uint64_t fiber_id);
+        static void SwapOut();
+    private:
+        static std::atomic<bool> s_enabled;
+    };
+}
+
+#endif //WATCHDOG_H